@@ -20,6 +20,7 @@
 #define NDARRAY_ARRAY_H
 
 #include <array>
+#include <atomic>
 // TODO(jiawen): CUDA *should* support assert on device. This might be due to the fact that we are
 // not depending on the CUDA toolkit.
 #if defined(__CUDA__)
@@ -29,6 +30,9 @@
 #include <cassert>
 #endif
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <tuple>
@@ -67,6 +71,33 @@
 #define NDARRAY_RESTRICT
 #endif
 
+// Non-temporal (streaming) stores are implemented with SSE2 intrinsics when
+// available. Otherwise, they fall back to ordinary stores.
+#if defined(__SSE2__) && !defined(__CUDA__)
+#include <emmintrin.h>
+#define NDARRAY_HAVE_NON_TEMPORAL_STORES 1
+#endif
+
+/** Copies and fills with `store_policy::automatic` use non-temporal stores
+ * when the destination is at least this many bytes. This should be somewhat
+ * larger than the last level cache of the target. */
+#ifndef NDARRAY_NON_TEMPORAL_THRESHOLD
+#define NDARRAY_NON_TEMPORAL_THRESHOLD (64 * 1024 * 1024)
+#endif
+
+// When NDARRAY_PROFILE is defined, the bulk operations record counters and
+// timelines with the profiler in profile.h. Otherwise, NDARRAY_PROFILE_SCOPE
+// expands to nothing, and its arguments are not evaluated.
+#if defined(NDARRAY_PROFILE) && !defined(__CUDA__)
+#include "profile.h"
+#include <typeinfo>
+#define NDARRAY_PROFILE_SCOPE(name, shape_type, elements, bytes)                                   \
+  ::nda::profile::scope ndarray_profile_scope(                                                     \
+      name, typeid(shape_type), static_cast<size_t>(elements), static_cast<size_t>(bytes))
+#else
+#define NDARRAY_PROFILE_SCOPE(name, shape_type, elements, bytes)
+#endif
+
 namespace nda {
 
 using size_t = std::size_t;
@@ -1237,14 +1268,266 @@ NDARRAY_INLINE NDARRAY_HOST_DEVICE void for_each_index_in_order(
   for_each_index_in_order_impl(fn, std::tuple<>(), std::get<sizeof...(Is) - 1 - Is>(dims)...);
 }
 
-template <typename TSrc, typename TDst>
-NDARRAY_INLINE NDARRAY_HOST_DEVICE void move_assign(TSrc& src, TDst& dst) {
-  dst = std::move(src);
+// Store `value` to `dst`, bypassing the cache if possible.
+template <typename T>
+NDARRAY_INLINE NDARRAY_HOST_DEVICE void stream_store(T& dst, const T& value) {
+#ifdef NDARRAY_HAVE_NON_TEMPORAL_STORES
+  if (std::is_trivially_copyable<T>::value && sizeof(T) == sizeof(int) &&
+      reinterpret_cast<uintptr_t>(&dst) % sizeof(int) == 0) {
+    int bits;
+    std::memcpy(&bits, &value, sizeof(int));
+    _mm_stream_si32(reinterpret_cast<int*>(&dst), bits);
+    return;
+  }
+#if defined(__x86_64__)
+  if (std::is_trivially_copyable<T>::value && sizeof(T) == sizeof(long long) &&
+      reinterpret_cast<uintptr_t>(&dst) % sizeof(long long) == 0) {
+    long long bits;
+    std::memcpy(&bits, &value, sizeof(long long));
+    _mm_stream_si64(reinterpret_cast<long long*>(&dst), bits);
+    return;
+  }
+#endif
+#endif
+  dst = value;
+}
+
+// Copy `size` bytes from `src` to `dst`, bypassing the cache for the aligned
+// part of `dst`. `src` and `dst` must not overlap.
+NDARRAY_HOST_DEVICE inline void stream_copy(void* dst, const void* src, size_t size) {
+#ifdef NDARRAY_HAVE_NON_TEMPORAL_STORES
+  char* d = static_cast<char*>(dst);
+  const char* s = static_cast<const char*>(src);
+  size_t head = std::min(size, (16 - reinterpret_cast<uintptr_t>(d) % 16) % 16);
+  std::memcpy(d, s, head);
+  d += head;
+  s += head;
+  size -= head;
+  for (; size >= 64; size -= 64, d += 64, s += 64) {
+    __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s) + 0);
+    __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s) + 1);
+    __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s) + 2);
+    __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s) + 3);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(d) + 0, v0);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(d) + 1, v1);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(d) + 2, v2);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(d) + 3, v3);
+  }
+  for (; size >= 16; size -= 16, d += 16, s += 16) {
+    _mm_stream_si128(
+        reinterpret_cast<__m128i*>(d), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s)));
+  }
+  std::memcpy(d, s, size);
+#else
+  std::memcpy(dst, src, size);
+#endif
 }
 
+// Fill `extent` values starting at `dst` with `value`, bypassing the cache for
+// the aligned part of `dst`. Types that evenly divide a 16 byte vector are
+// filled with vector stores of a pattern of copies of `value`.
+#ifdef NDARRAY_HAVE_NON_TEMPORAL_STORES
+template <typename T>
+using is_stream_fill_vector = std::integral_constant<bool,
+    std::is_trivially_copyable<T>::value && sizeof(T) <= 16 && 16 % sizeof(T) == 0>;
+#else
+template <typename T>
+using is_stream_fill_vector = std::false_type;
+#endif
+
+template <typename T>
+NDARRAY_HOST_DEVICE void stream_fill(std::false_type, T* dst, index_t extent, const T& value) {
+  for (index_t i = 0; i < extent; i++) {
+    stream_store(dst[i], value);
+  }
+}
+#ifdef NDARRAY_HAVE_NON_TEMPORAL_STORES
+template <typename T>
+NDARRAY_HOST_DEVICE void stream_fill(std::true_type, T* dst, index_t extent, const T& value) {
+  if (reinterpret_cast<uintptr_t>(dst) % sizeof(T) != 0) {
+    stream_fill(std::false_type(), dst, extent, value);
+    return;
+  }
+  T* end = dst + extent;
+  for (; dst < end && reinterpret_cast<uintptr_t>(dst) % 16 != 0; dst++) {
+    *dst = value;
+  }
+  // Make a vector of copies of the value.
+  char pattern[16];
+  for (size_t i = 0; i < 16; i += sizeof(T)) {
+    std::memcpy(&pattern[i], &value, sizeof(T));
+  }
+  const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+  for (; dst + 16 / sizeof(T) <= end; dst += 16 / sizeof(T)) {
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst), v);
+  }
+  for (; dst < end; dst++) {
+    *dst = value;
+  }
+}
+#endif
+template <typename T>
+NDARRAY_HOST_DEVICE void stream_fill(T* dst, index_t extent, const T& value) {
+  stream_fill(is_stream_fill_vector<T>(), dst, extent, value);
+}
+
+// Non-temporal stores are weakly ordered. This must be called after a sequence
+// of non-temporal stores, before the data is used by another thread.
+NDARRAY_HOST_DEVICE inline void stream_fence() {
+#ifdef NDARRAY_HAVE_NON_TEMPORAL_STORES
+  _mm_sfence();
+#endif
+}
+
+// The element-wise operations of move, copy, and fill are functors, so the
+// loops below can recognize them. Functors may provide a `dense_row` function
+// to handle a whole dense row at once, which is used when `has_dense_row` is
+// true for the functor and pointer types.
+template <class Fn, class... Ptrs>
+struct has_dense_row : std::false_type {};
+
+template <class TSrc, class TDst>
+using is_trivial_assign = std::integral_constant<bool,
+    std::is_same<std::remove_const_t<TSrc>, TDst>::value && std::is_trivially_copyable<TDst>::value>;
+
+template <typename TSrc, typename TDst>
+struct move_assign {
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void operator()(TSrc& src, TDst& dst) const {
+    dst = std::move(src);
+  }
+  // Dense rows of trivially copyable values are memcpy if the source and
+  // destination do not alias, or memmove if they might.
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(
+      NoAlias, index_t extent, TSrc* src, TDst* dst) const {
+    if (NoAlias::value) {
+      std::memcpy(dst, src, sizeof(TDst) * extent);
+    } else {
+      std::memmove(dst, src, sizeof(TDst) * extent);
+    }
+  }
+};
+template <class TSrc, class TDst>
+struct has_dense_row<move_assign<TSrc, TDst>, TSrc*, TDst*> : is_trivial_assign<TSrc, TDst> {};
+
+// Value types with a faster way to convert many values than assigning them
+// one at a time can specialize this to be std::true_type, with a static member
+// `convert(extent, src, dst)`. `copy` uses it for dense rows of the values.
+template <class TSrc, class TDst>
+struct convert_row : std::false_type {};
+
+template <class TSrc, class TDst>
+using has_convert_row = convert_row<std::remove_const_t<TSrc>, TDst>;
+
 template <typename TSrc, typename TDst>
-NDARRAY_INLINE NDARRAY_HOST_DEVICE void copy_assign(const TSrc& src, TDst& dst) {
-  dst = src;
+struct copy_assign {
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void operator()(const TSrc& src, TDst& dst) const {
+    dst = src;
+  }
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(
+      NoAlias, index_t extent, TSrc* src, TDst* dst) const {
+    dense_row(has_convert_row<TSrc, TDst>(), NoAlias(), extent, src, dst);
+  }
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(
+      std::true_type, NoAlias, index_t extent, TSrc* src, TDst* dst) const {
+    has_convert_row<TSrc, TDst>::convert(extent, src, dst);
+  }
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(
+      std::false_type, NoAlias, index_t extent, TSrc* src, TDst* dst) const {
+    move_assign<TSrc, TDst>().dense_row(NoAlias(), extent, src, dst);
+  }
+};
+template <class TSrc, class TDst>
+struct has_dense_row<copy_assign<TSrc, TDst>, TSrc*, TDst*>
+    : std::integral_constant<bool,
+          is_trivial_assign<TSrc, TDst>::value || has_convert_row<TSrc, TDst>::value> {};
+
+// A copy that writes the destination with non-temporal stores.
+template <typename TSrc, typename TDst>
+struct stream_copy_assign {
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void operator()(const TSrc& src, TDst& dst) const {
+    assign(is_trivial_assign<TSrc, TDst>(), src, dst);
+  }
+  // Only copies of trivially copyable values of the same type use
+  // non-temporal stores. Conversions and other types use ordinary assignment.
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void assign(
+      std::true_type, const TSrc& src, TDst& dst) const {
+    stream_store<TDst>(dst, src);
+  }
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void assign(
+      std::false_type, const TSrc& src, TDst& dst) const {
+    dst = src;
+  }
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(
+      NoAlias, index_t extent, TSrc* src, TDst* dst) const {
+    dense_row(has_convert_row<TSrc, TDst>(), NoAlias(), extent, src, dst);
+  }
+  // Conversions use ordinary stores.
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(
+      std::true_type, NoAlias, index_t extent, TSrc* src, TDst* dst) const {
+    has_convert_row<TSrc, TDst>::convert(extent, src, dst);
+  }
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(
+      std::false_type, NoAlias, index_t extent, TSrc* src, TDst* dst) const {
+    if (NoAlias::value) {
+      stream_copy(dst, src, sizeof(TDst) * extent);
+    } else {
+      std::memmove(dst, src, sizeof(TDst) * extent);
+    }
+  }
+};
+template <class TSrc, class TDst>
+struct has_dense_row<stream_copy_assign<TSrc, TDst>, TSrc*, TDst*>
+    : std::integral_constant<bool,
+          is_trivial_assign<TSrc, TDst>::value || has_convert_row<TSrc, TDst>::value> {};
+
+template <typename T>
+struct fill_assign {
+  T value;
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void operator()(T& dst) const { dst = value; }
+};
+
+// Assigns the value with a bit pattern of all zeros.
+template <typename T>
+struct zero_assign {
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void operator()(T& dst) const {
+    std::memset(&dst, 0, sizeof(T));
+  }
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(NoAlias, index_t extent, T* dst) const {
+    std::memset(dst, 0, sizeof(T) * extent);
+  }
+};
+template <class T>
+struct has_dense_row<zero_assign<T>, T*> : std::true_type {};
+
+// A fill that writes the destination with non-temporal stores.
+template <typename T>
+struct stream_fill_assign {
+  T value;
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void operator()(T& dst) const { stream_store(dst, value); }
+  template <class NoAlias>
+  NDARRAY_INLINE NDARRAY_HOST_DEVICE void dense_row(NoAlias, index_t extent, T* dst) const {
+    stream_fill(dst, extent, value);
+  }
+};
+template <class T>
+struct has_dense_row<stream_fill_assign<T>, T*> : std::true_type {};
+
+// Returns true if the bits of `value` are all zero.
+template <class T>
+NDARRAY_HOST_DEVICE bool is_zero_bits(const T& value) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+  for (size_t i = 0; i < sizeof(T); i++) {
+    if (bytes[i] != 0) return false;
+  }
+  return true;
 }
 
 template <size_t D, class Ptr0>
@@ -1259,21 +1542,49 @@ NDARRAY_INLINE NDARRAY_HOST_DEVICE void advance(Ptr0& ptr0, Ptr1& ptr1) {
 // If we ever need other than 1- or 2-way for_each_value, add a variadic
 // version of advance.
 
+// The innermost loop of for_each_value_in_order, when all of the pointers are
+// dense. If NoAlias is true_type, the caller has checked that the pointers do
+// not alias, and the pointers are qualified with NDARRAY_RESTRICT. This allows
+// the compiler to vectorize loops that read and write through different
+// pointers.
 template <class Fn, class Ptr0, class... Ptrs>
-NDARRAY_UNIQUE NDARRAY_HOST_DEVICE void for_each_value_in_order_inner_dense(
+NDARRAY_UNIQUE NDARRAY_HOST_DEVICE void for_each_value_in_order_inner_dense(std::true_type,
     index_t extent, Fn&& fn, Ptr0 NDARRAY_RESTRICT ptr0, Ptrs NDARRAY_RESTRICT... ptrs) {
   Ptr0 end = ptr0 + extent;
   while (ptr0 < end) {
     fn(*ptr0++, *ptrs++...);
   }
 }
+template <class Fn, class Ptr0, class... Ptrs>
+NDARRAY_UNIQUE NDARRAY_HOST_DEVICE void for_each_value_in_order_inner_dense(
+    std::false_type, index_t extent, Fn&& fn, Ptr0 ptr0, Ptrs... ptrs) {
+  Ptr0 end = ptr0 + extent;
+  while (ptr0 < end) {
+    fn(*ptr0++, *ptrs++...);
+  }
+}
 
-template <size_t, class ExtentType, class Fn, class... Ptrs>
+// Use the functor's implementation of a dense row if it has one.
+template <class NoAlias, class Fn, class... Ptrs>
+NDARRAY_INLINE NDARRAY_HOST_DEVICE void for_each_value_in_order_dense_row(
+    NoAlias, std::true_type, index_t extent, Fn&& fn, Ptrs... ptrs) {
+  fn.dense_row(NoAlias(), extent, ptrs...);
+}
+template <class NoAlias, class Fn, class... Ptrs>
+NDARRAY_INLINE NDARRAY_HOST_DEVICE void for_each_value_in_order_dense_row(
+    NoAlias, std::false_type, index_t extent, Fn&& fn, Ptrs... ptrs) {
+  for_each_value_in_order_inner_dense(NoAlias(), extent, fn, ptrs...);
+}
+
+template <size_t, class NoAlias, class ExtentType, class Fn, class... Ptrs>
 NDARRAY_UNIQUE NDARRAY_HOST_DEVICE void for_each_value_in_order_impl(
     std::true_type, const ExtentType& extent, Fn&& fn, Ptrs... ptrs) {
   index_t extent_d = std::get<0>(extent);
   if (all(std::get<0>(std::get<1>(ptrs)) == 1 ...)) {
-    for_each_value_in_order_inner_dense(extent_d, fn, std::get<0>(ptrs)...);
+    using use_dense_row =
+        has_dense_row<std::decay_t<Fn>, std::decay_t<decltype(std::get<0>(ptrs))>...>;
+    for_each_value_in_order_dense_row(
+        NoAlias(), use_dense_row(), extent_d, fn, std::get<0>(ptrs)...);
   } else {
     for (index_t i = 0; i < extent_d; i++) {
       fn(*std::get<0>(ptrs)...);
@@ -1282,31 +1593,60 @@ NDARRAY_UNIQUE NDARRAY_HOST_DEVICE void for_each_value_in_order_impl(
   }
 }
 
-template <size_t D, class ExtentType, class Fn, class... Ptrs>
+template <size_t D, class NoAlias, class ExtentType, class Fn, class... Ptrs>
 NDARRAY_UNIQUE NDARRAY_HOST_DEVICE void for_each_value_in_order_impl(
     std::false_type, const ExtentType& extent, Fn&& fn, Ptrs... ptrs) {
   index_t extent_d = std::get<D>(extent);
   for (index_t i = 0; i < extent_d; i++) {
     using is_inner_loop = std::conditional_t<D == 1, std::true_type, std::false_type>;
-    for_each_value_in_order_impl<D - 1>(is_inner_loop(), extent, fn, ptrs...);
+    for_each_value_in_order_impl<D - 1, NoAlias>(is_inner_loop(), extent, fn, ptrs...);
     advance<D>(ptrs...);
   }
 }
 
-template <size_t D, class ExtentType, class Fn, class... Ptrs>
+template <size_t D, class NoAlias, class ExtentType, class Fn, class... Ptrs>
 NDARRAY_INLINE NDARRAY_HOST_DEVICE void for_each_value_in_order(
     const ExtentType& extent, Fn&& fn, Ptrs... ptrs) {
   using is_inner_loop = std::conditional_t<D == 0, std::true_type, std::false_type>;
-  for_each_value_in_order_impl<D>(is_inner_loop(), extent, fn, ptrs...);
+  for_each_value_in_order_impl<D, NoAlias>(is_inner_loop(), extent, fn, ptrs...);
 }
 
 // Scalar buffers are a special case.
-template <size_t D, class Fn, class... Ptrs>
+template <size_t D, class NoAlias, class Fn, class... Ptrs>
 NDARRAY_INLINE NDARRAY_HOST_DEVICE void for_each_value_in_order(
     const std::tuple<>& extent, Fn&& fn, Ptrs... ptrs) {
   fn(*std::get<0>(ptrs)...);
 }
 
+// Computes the range of flat offsets addressed by a loop nest with extents
+// `extent`, for a pointer with strides `stride`.
+template <class Extent, class Stride, size_t... Is>
+NDARRAY_HOST_DEVICE index_t loop_flat_min(
+    const Extent& extent, const Stride& stride, index_sequence<Is...>) {
+  return sum((std::get<Is>(extent) - 1) * std::min<index_t>(0, std::get<Is>(stride))...);
+}
+template <class Extent, class Stride, size_t... Is>
+NDARRAY_HOST_DEVICE index_t loop_flat_max(
+    const Extent& extent, const Stride& stride, index_sequence<Is...>) {
+  return sum((std::get<Is>(extent) - 1) * std::max<index_t>(0, std::get<Is>(stride))...);
+}
+
+// Returns true if the memory addressed by the pointer and stride pairs `a` and
+// `b` in a loop nest with extents `extent` may overlap. This is conservative,
+// the ranges may interleave without addressing the same elements.
+template <size_t Rank, class ExtentType, class PtrA, class PtrB>
+NDARRAY_HOST_DEVICE bool may_overlap(const ExtentType& extent, const PtrA& a, const PtrB& b) {
+  const auto is = make_index_sequence<Rank>();
+  const auto* a_begin = std::get<0>(a) + loop_flat_min(extent, std::get<1>(a), is);
+  const auto* a_end = std::get<0>(a) + loop_flat_max(extent, std::get<1>(a), is) + 1;
+  const auto* b_begin = std::get<0>(b) + loop_flat_min(extent, std::get<1>(b), is);
+  const auto* b_end = std::get<0>(b) + loop_flat_max(extent, std::get<1>(b), is) + 1;
+  // Comparing pointers to different objects with < is unspecified, so compare
+  // the addresses as integers.
+  return reinterpret_cast<uintptr_t>(a_begin) < reinterpret_cast<uintptr_t>(b_end) &&
+         reinterpret_cast<uintptr_t>(b_begin) < reinterpret_cast<uintptr_t>(a_end);
+}
+
 template <size_t Rank>
 NDARRAY_HOST_DEVICE auto make_default_dense_shape() {
   // The inner dimension is a dense_dim, unless the shape is rank 0.
@@ -1518,12 +1858,16 @@ NDARRAY_UNIQUE NDARRAY_HOST_DEVICE void for_each_value_in_order(
   // TODO: This is losing compile-time constant extents and strides info
   // (https://github.com/dsharlet/array/issues/1).
   auto base_and_stride = std::make_pair(base, shape.stride());
-  internal::for_each_value_in_order<Shape::rank() - 1>(shape.extent(), fn, base_and_stride);
+  internal::for_each_value_in_order<Shape::rank() - 1, std::true_type>(
+      shape.extent(), fn, base_and_stride);
 }
 
 /** Similar to `for_each_value_in_order`, but iterates over two arrays
  * simultaneously. `shape` defines the loop nest, while `shape_a` and `shape_b`
- * define the memory layout of `base_a` and `base_b`. */
+ * define the memory layout of `base_a` and `base_b`.
+ *
+ * If the memory ranges addressed by the two arrays do not overlap, the loops
+ * are implemented with pointers that the compiler may assume do not alias. */
 template <class Shape, class ShapeA, class PtrA, class ShapeB, class PtrB, class Fn,
     class = internal::enable_if_callable<Fn, typename std::remove_pointer<PtrA>::type&,
         typename std::remove_pointer<PtrB>::type&>>
@@ -1535,7 +1879,13 @@ NDARRAY_UNIQUE NDARRAY_HOST_DEVICE void for_each_value_in_order(const Shape& sha
   // (https://github.com/dsharlet/array/issues/1).
   auto a = std::make_pair(base_a, shape_a.stride());
   auto b = std::make_pair(base_b, shape_b.stride());
-  internal::for_each_value_in_order<Shape::rank() - 1>(shape.extent(), fn, a, b);
+  if (internal::may_overlap<Shape::rank()>(shape.extent(), a, b)) {
+    internal::for_each_value_in_order<Shape::rank() - 1, std::false_type>(
+        shape.extent(), fn, a, b);
+  } else {
+    internal::for_each_value_in_order<Shape::rank() - 1, std::true_type>(
+        shape.extent(), fn, a, b);
+  }
 }
 
 namespace internal {
@@ -1561,6 +1911,16 @@ inline bool operator<(const copy_dims& l, const copy_dims& r) {
   return l.dst.stride() < r.dst.stride();
 }
 
+// Copy dims can be fused if both the src and dst dims can be fused.
+NDARRAY_INLINE NDARRAY_HOST_DEVICE bool can_fuse(const copy_dims& inner, const copy_dims& outer) {
+  return inner.src.extent() == inner.dst.extent() && can_fuse(inner.src, outer.src) &&
+         can_fuse(inner.dst, outer.dst);
+}
+
+NDARRAY_INLINE NDARRAY_HOST_DEVICE copy_dims fuse(const copy_dims& inner, const copy_dims& outer) {
+  return {fuse(inner.src, outer.src), fuse(inner.dst, outer.dst)};
+}
+
 // We need a sort that only needs to deal with very small lists,
 // and extra complexity here is costly in code size/compile time.
 // This is a rare job for bubble sort!
@@ -1573,33 +1933,39 @@ NDARRAY_HOST_DEVICE void bubble_sort(Iterator begin, Iterator end) {
   }
 }
 
+// Sort the loops in [begin, end) by stride, and fuse loops that are
+// contiguous, using `can_fuse` and `fuse` for the type of the loops. Returns
+// the end of the fused loops.
+template <class Iterator>
+NDARRAY_HOST_DEVICE Iterator sort_and_fuse(Iterator begin, Iterator end) {
+  bubble_sort(begin, end);
+  for (Iterator i = begin; end - i > 1;) {
+    if (can_fuse(*i, *(i + 1))) {
+      *i = fuse(*i, *(i + 1));
+      for (Iterator j = i + 1; end - j > 1; ++j) {
+        *j = std::move(*(j + 1));
+      }
+      --end;
+    } else {
+      ++i;
+    }
+  }
+  return end;
+}
+
 // Sort the dims such that strides are increasing from dim 0, and contiguous
 // dimensions are fused.
 template <class Shape>
 NDARRAY_HOST_DEVICE shape_of_rank<Shape::rank()> dynamic_optimize_shape(const Shape& shape) {
   auto dims = internal::tuple_to_array<dim<>>(shape.dims());
 
-  // Sort the dims by stride.
-  bubble_sort(dims.begin(), dims.end());
-
-  // Find dimensions that are contiguous and fuse them.
-  size_t rank = dims.size();
-  for (size_t i = 0; i + 1 < rank;) {
-    if (can_fuse(dims[i], dims[i + 1])) {
-      dims[i] = fuse(dims[i], dims[i + 1]);
-      for (size_t j = i + 1; j + 1 < rank; j++) {
-        dims[j] = dims[j + 1];
-      }
-      rank--;
-    } else {
-      i++;
-    }
-  }
+  // Sort the dims by stride, and fuse dimensions that are contiguous.
+  auto end = sort_and_fuse(dims.begin(), dims.end());
 
   // Unfortunately, we can't make the rank of the resulting shape smaller. Fill
   // the end of the array with size 1 dimensions.
-  for (size_t i = rank; i < dims.size(); i++) {
-    dims[i] = dim<>(0, 1, 0);
+  for (auto i = end; i != dims.end(); ++i) {
+    *i = dim<>(0, 1, 0);
   }
 
   return shape_of_rank<Shape::rank()>(array_to_tuple(dims));
@@ -1620,29 +1986,13 @@ NDARRAY_HOST_DEVICE auto dynamic_optimize_copy_shapes(const ShapeSrc& src, const
     dims[i] = {src_dims[i], dst_dims[i]};
   }
 
-  // Sort the dims by the dst stride.
-  bubble_sort(dims.begin(), dims.end());
-
-  // Find dimensions that are contiguous and fuse them.
-  size_t new_rank = dims.size();
-  for (size_t i = 0; i + 1 < new_rank;) {
-    if (dims[i].src.extent() == dims[i].dst.extent() && can_fuse(dims[i].src, dims[i + 1].src) &&
-        can_fuse(dims[i].dst, dims[i + 1].dst)) {
-      dims[i].src = fuse(dims[i].src, dims[i + 1].src);
-      dims[i].dst = fuse(dims[i].dst, dims[i + 1].dst);
-      for (size_t j = i + 1; j + 1 < new_rank; j++) {
-        dims[j] = dims[j + 1];
-      }
-      new_rank--;
-    } else {
-      i++;
-    }
-  }
+  // Sort the dims by the dst stride, and fuse dimensions that are contiguous.
+  auto end = sort_and_fuse(dims.begin(), dims.end());
 
   // Unfortunately, we can't make the rank of the resulting shape dynamic. Fill
   // the end of the array with size 1 dimensions.
-  for (size_t i = new_rank; i < dims.size(); i++) {
-    dims[i] = {dim<>(0, 1, 0), dim<>(0, 1, 0)};
+  for (auto i = end; i != dims.end(); ++i) {
+    *i = {dim<>(0, 1, 0), dim<>(0, 1, 0)};
   }
 
   for (size_t i = 0; i < dims.size(); i++) {
@@ -1911,6 +2261,7 @@ public:
    * access patterns. */
   template <class Fn, class = internal::enable_if_callable<Fn, reference>>
   NDARRAY_HOST_DEVICE void for_each_value(Fn&& fn) const {
+    NDARRAY_PROFILE_SCOPE("for_each_value", Shape, shape_.size(), shape_.size() * sizeof(T));
     shape_traits_type::for_each_value(shape_, base_, fn);
   }
 
@@ -2092,11 +2443,13 @@ private:
   // Call the constructor on all of the elements of the array.
   void construct() {
     assert(base_ || shape_.empty());
-    for_each_value([&](T& x) { alloc_traits::construct(alloc_, &x); });
+    shape_traits_type::for_each_value(
+        shape_, base_, [&](T& x) { alloc_traits::construct(alloc_, &x); });
   }
   void construct(const T& init) {
     assert(base_ || shape_.empty());
-    for_each_value([&](T& x) { alloc_traits::construct(alloc_, &x, init); });
+    shape_traits_type::for_each_value(
+        shape_, base_, [&](T& x) { alloc_traits::construct(alloc_, &x, init); });
   }
   void copy_construct(const array& other) {
     assert(base_ || shape_.empty());
@@ -2116,7 +2469,8 @@ private:
   // Call the dstructor on every element.
   void destroy() {
     assert(base_ || shape_.empty());
-    for_each_value([&](T& x) { alloc_traits::destroy(alloc_, &x); });
+    shape_traits_type::for_each_value(
+        shape_, base_, [&](T& x) { alloc_traits::destroy(alloc_, &x); });
   }
 
   void deallocate() {
@@ -2348,10 +2702,12 @@ public:
    * which `fn` is called is undefined to enable optimized memory accesses. */
   template <class Fn, class = internal::enable_if_callable<Fn, reference>>
   void for_each_value(Fn&& fn) {
+    NDARRAY_PROFILE_SCOPE("for_each_value", Shape, shape_.size(), shape_.size() * sizeof(T));
     shape_traits_type::for_each_value(shape_, base_, fn);
   }
   template <class Fn, class = internal::enable_if_callable<Fn, const_reference>>
   void for_each_value(Fn&& fn) const {
+    NDARRAY_PROFILE_SCOPE("for_each_value", Shape, shape_.size(), shape_.size() * sizeof(T));
     shape_traits_type::for_each_value(shape_, base_, fn);
   }
 
@@ -2401,7 +2757,7 @@ public:
     pointer intersection_base =
         internal::pointer_add(new_array.base_, new_shape[intersection.min()]);
     copy_shape_traits_type::for_each_value(
-        shape_, base_, intersection, intersection_base, internal::move_assign<T, T>);
+        shape_, base_, intersection, intersection_base, internal::move_assign<T, T>());
 
     *this = std::move(new_array);
   }
@@ -2521,61 +2877,111 @@ void swap(array<T, Shape, Alloc>& a, array<T, Shape, Alloc>& b) {
   a.swap(b);
 }
 
+/** Selects how bulk operations such as `copy`, `fill`, and `generate` write
+ * their destination. */
+enum class store_policy {
+  /** Use non-temporal stores if the destination is at least
+   * `NDARRAY_NON_TEMPORAL_THRESHOLD` bytes. */
+  automatic,
+  /** Always use ordinary stores. */
+  temporal,
+  /** Always use non-temporal stores, which bypass the cache. This avoids
+   * evicting useful data from the cache, and avoids reading the destination
+   * into the cache before writing it, but makes subsequent reads of the
+   * destination slower. */
+  non_temporal,
+};
+
+namespace internal {
+
+template <class T, class Shape>
+NDARRAY_HOST_DEVICE bool use_non_temporal_stores(const array_ref<T, Shape>& dst, store_policy policy) {
+  switch (policy) {
+  case store_policy::temporal: return false;
+  case store_policy::non_temporal: return true;
+  default: return dst.size() * sizeof(T) >= NDARRAY_NON_TEMPORAL_THRESHOLD;
+  }
+}
+
+} // namespace internal
+
 /** Copy the contents of the `src` array or array_ref to the `dst` array or
  * array_ref. The elements in the shape of `dst` will be copied, and must be in
- * bounds of `src`. */
+ * bounds of `src`. `policy` selects the kind of stores used to write `dst`. */
 template <class TSrc, class TDst, class ShapeSrc, class ShapeDst,
     class = internal::enable_if_shapes_copy_compatible<ShapeDst, ShapeSrc>>
-void copy(const array_ref<TSrc, ShapeSrc>& src, const array_ref<TDst, ShapeDst>& dst) {
+void copy(const array_ref<TSrc, ShapeSrc>& src, const array_ref<TDst, ShapeDst>& dst,
+    store_policy policy = store_policy::automatic) {
   if (dst.shape().empty()) { return; }
 
   assert(src.shape().is_in_range(dst.shape().min()) && src.shape().is_in_range(dst.shape().max()));
 
-  copy_shape_traits<ShapeSrc, ShapeDst>::for_each_value(
-      src.shape(), src.base(), dst.shape(), dst.base(), internal::copy_assign<TSrc, TDst>);
+  NDARRAY_PROFILE_SCOPE(
+      "copy", ShapeDst, dst.size(), dst.size() * (sizeof(TSrc) + sizeof(TDst)));
+  if (internal::use_non_temporal_stores(dst, policy)) {
+    copy_shape_traits<ShapeSrc, ShapeDst>::for_each_value(src.shape(), src.base(), dst.shape(),
+        dst.base(), internal::stream_copy_assign<TSrc, TDst>());
+    internal::stream_fence();
+  } else {
+    copy_shape_traits<ShapeSrc, ShapeDst>::for_each_value(
+        src.shape(), src.base(), dst.shape(), dst.base(), internal::copy_assign<TSrc, TDst>());
+  }
 }
 template <class TSrc, class TDst, class ShapeSrc, class ShapeDst, class AllocDst,
     class = internal::enable_if_shapes_copy_compatible<ShapeDst, ShapeSrc>>
-void copy(const array_ref<TSrc, ShapeSrc>& src, array<TDst, ShapeDst, AllocDst>& dst) {
-  copy(src, dst.ref());
+void copy(const array_ref<TSrc, ShapeSrc>& src, array<TDst, ShapeDst, AllocDst>& dst,
+    store_policy policy = store_policy::automatic) {
+  copy(src, dst.ref(), policy);
 }
 template <class TSrc, class TDst, class ShapeSrc, class ShapeDst, class AllocSrc,
     class = internal::enable_if_shapes_copy_compatible<ShapeDst, ShapeSrc>>
-void copy(const array<TSrc, ShapeSrc, AllocSrc>& src, const array_ref<TDst, ShapeDst>& dst) {
-  copy(src.cref(), dst);
+void copy(const array<TSrc, ShapeSrc, AllocSrc>& src, const array_ref<TDst, ShapeDst>& dst,
+    store_policy policy = store_policy::automatic) {
+  copy(src.cref(), dst, policy);
 }
 template <class TSrc, class TDst, class ShapeSrc, class ShapeDst, class AllocSrc, class AllocDst,
     class = internal::enable_if_shapes_copy_compatible<ShapeDst, ShapeSrc>>
-void copy(const array<TSrc, ShapeSrc, AllocSrc>& src, array<TDst, ShapeDst, AllocDst>& dst) {
-  copy(src.cref(), dst.ref());
+void copy(const array<TSrc, ShapeSrc, AllocSrc>& src, array<TDst, ShapeDst, AllocDst>& dst,
+    store_policy policy = store_policy::automatic) {
+  copy(src.cref(), dst.ref(), policy);
+}
+// When the arrays have the same type, the overload above is ambiguous with
+// std::copy(InputIt, InputIt, OutputIt), which is found by ADL for arrays with
+// std::allocator. This overload is more specialized than std::copy.
+template <class T, class Shape, class Alloc>
+void copy(const array<T, Shape, Alloc>& src, array<T, Shape, Alloc>& dst, store_policy policy) {
+  copy(src.cref(), dst.ref(), policy);
 }
 
-/** Make a copy of the `src` array or array_ref with a new shape `shape`. */
+/** Make a copy of the `src` array or array_ref with a new shape `shape`.
+ * `policy` selects the kind of stores used to write the copy, as in `copy`. */
 template <class T, class ShapeSrc, class ShapeDst,
     class Alloc = std::allocator<typename std::remove_const<T>::type>,
     class = internal::enable_if_shapes_copy_compatible<ShapeDst, ShapeSrc>>
-auto make_copy(
-    const array_ref<T, ShapeSrc>& src, const ShapeDst& shape, const Alloc& alloc = Alloc()) {
+auto make_copy(const array_ref<T, ShapeSrc>& src, const ShapeDst& shape,
+    const Alloc& alloc = Alloc(), store_policy policy = store_policy::automatic) {
   array<typename std::allocator_traits<Alloc>::value_type, ShapeDst, Alloc> dst(shape, alloc);
-  copy(src, dst);
+  copy(src, dst, policy);
   return dst;
 }
 template <class T, class ShapeSrc, class ShapeDst, class AllocSrc, class AllocDst = AllocSrc,
     class = internal::enable_if_shapes_copy_compatible<ShapeDst, ShapeSrc>>
 auto make_copy(const array<T, ShapeSrc, AllocSrc>& src, const ShapeDst& shape,
-    const AllocDst& alloc = AllocDst()) {
-  return make_copy(src.cref(), shape, alloc);
+    const AllocDst& alloc = AllocDst(), store_policy policy = store_policy::automatic) {
+  return make_copy(src.cref(), shape, alloc, policy);
 }
 
 /** Make a copy of the `src` array or array_ref with a compact version of `src`'s
- * shape. */
+ * shape. `policy` selects the kind of stores used to write the copy. */
 template <class T, class Shape, class Alloc = std::allocator<typename std::remove_const<T>::type>>
-auto make_compact_copy(const array_ref<T, Shape>& src, const Alloc& alloc = Alloc()) {
-  return make_copy(src, make_compact(src.shape()), alloc);
+auto make_compact_copy(const array_ref<T, Shape>& src, const Alloc& alloc = Alloc(),
+    store_policy policy = store_policy::automatic) {
+  return make_copy(src, make_compact(src.shape()), alloc, policy);
 }
 template <class T, class Shape, class AllocSrc, class AllocDst = AllocSrc>
-auto make_compact_copy(const array<T, Shape, AllocSrc>& src, const AllocDst& alloc = AllocDst()) {
-  return make_compact_copy(src.cref(), alloc);
+auto make_compact_copy(const array<T, Shape, AllocSrc>& src, const AllocDst& alloc = AllocDst(),
+    store_policy policy = store_policy::automatic) {
+  return make_compact_copy(src.cref(), alloc, policy);
 }
 
 /** Move the contents from the `src` array or array_ref to the `dst` array or
@@ -2588,8 +2994,10 @@ void move(const array_ref<TSrc, ShapeSrc>& src, const array_ref<TDst, ShapeDst>&
 
   assert(src.shape().is_in_range(dst.shape().min()) && src.shape().is_in_range(dst.shape().max()));
 
+  NDARRAY_PROFILE_SCOPE(
+      "move", ShapeDst, dst.size(), dst.size() * (sizeof(TSrc) + sizeof(TDst)));
   copy_shape_traits<ShapeSrc, ShapeDst>::for_each_value(
-      src.shape(), src.base(), dst.shape(), dst.base(), internal::move_assign<TSrc, TDst>);
+      src.shape(), src.base(), dst.shape(), dst.base(), internal::move_assign<TSrc, TDst>());
 }
 template <class TSrc, class TDst, class ShapeSrc, class ShapeDst, class AllocDst,
     class = internal::enable_if_shapes_copy_compatible<ShapeDst, ShapeSrc>>
@@ -2651,27 +3059,74 @@ auto make_compact_move(array<T, Shape, Alloc>&& src, const Alloc& alloc = Alloc(
   return make_move(src, make_compact(src.shape()), alloc);
 }
 
-/** Fill the `dst` array or array_ref by copy-assigning `value`. */
+namespace internal {
+
+// Fill `dst` with `value` using temporal stores. Values of trivial types with
+// a bit pattern of all zeros are filled with memset.
+template <class T, class Shape>
+NDARRAY_HOST_DEVICE void fill_temporal(
+    std::true_type, const array_ref<T, Shape>& dst, const T& value) {
+  using traits = shape_traits<Shape>;
+  if (is_zero_bits(value)) {
+    traits::for_each_value(dst.shape(), dst.base(), zero_assign<T>());
+  } else {
+    traits::for_each_value(dst.shape(), dst.base(), fill_assign<T>{value});
+  }
+}
 template <class T, class Shape>
-NDARRAY_HOST_DEVICE void fill(const array_ref<T, Shape>& dst, const T& value) {
-  dst.for_each_value([value](T& i) { i = value; });
+NDARRAY_HOST_DEVICE void fill_temporal(
+    std::false_type, const array_ref<T, Shape>& dst, const T& value) {
+  shape_traits<Shape>::for_each_value(dst.shape(), dst.base(), fill_assign<T>{value});
+}
+
+} // namespace internal
+
+/** Fill the `dst` array or array_ref by copy-assigning `value`. `policy`
+ * selects the kind of stores used to write `dst`. */
+template <class T, class Shape>
+NDARRAY_HOST_DEVICE void fill(
+    const array_ref<T, Shape>& dst, const T& value, store_policy policy = store_policy::automatic) {
+  // This calls shape_traits directly instead of dst.for_each_value, so the
+  // profiler does not count the fill twice.
+  using traits = shape_traits<Shape>;
+  NDARRAY_PROFILE_SCOPE("fill", Shape, dst.size(), dst.size() * sizeof(T));
+  if (internal::use_non_temporal_stores(dst, policy)) {
+    traits::for_each_value(dst.shape(), dst.base(), internal::stream_fill_assign<T>{value});
+    internal::stream_fence();
+  } else {
+    internal::fill_temporal(std::is_trivial<T>(), dst, value);
+  }
 }
 template <class T, class Shape, class Alloc>
-void fill(array<T, Shape, Alloc>& dst, const T& value) {
-  fill(dst.ref(), value);
+void fill(array<T, Shape, Alloc>& dst, const T& value,
+    store_policy policy = store_policy::automatic) {
+  fill(dst.ref(), value, policy);
 }
 
 /** Fill the `dst` array or array_ref with the result of calling a generator
  * function `g`. The order in which `g` is called is the same as
- * `shape_traits<Shape>::for_each_value`. */
+ * `shape_traits<Shape>::for_each_value`. `policy` selects the kind of stores
+ * used to write `dst`. `g` is copied if it is an lvalue, or moved if it is an
+ * rvalue. */
 template <class T, class Shape, class Generator, class = internal::enable_if_callable<Generator>>
-NDARRAY_HOST_DEVICE void generate(const array_ref<T, Shape>& dst, Generator&& g) {
-  dst.for_each_value([g = std::move(g)](T& i) { i = g(); });
+NDARRAY_HOST_DEVICE void generate(const array_ref<T, Shape>& dst, Generator&& g,
+    store_policy policy = store_policy::automatic) {
+  using traits = shape_traits<Shape>;
+  NDARRAY_PROFILE_SCOPE("generate", Shape, dst.size(), dst.size() * sizeof(T));
+  if (internal::use_non_temporal_stores(dst, policy)) {
+    traits::for_each_value(dst.shape(), dst.base(),
+        [g = std::forward<Generator>(g)](T& i) { internal::stream_store<T>(i, g()); });
+    internal::stream_fence();
+  } else {
+    traits::for_each_value(
+        dst.shape(), dst.base(), [g = std::forward<Generator>(g)](T& i) { i = g(); });
+  }
 }
 template <class T, class Shape, class Alloc, class Generator,
     class = internal::enable_if_callable<Generator>>
-void generate(array<T, Shape, Alloc>& dst, Generator&& g) {
-  generate(dst.ref(), g);
+void generate(array<T, Shape, Alloc>& dst, Generator&& g,
+    store_policy policy = store_policy::automatic) {
+  generate(dst.ref(), std::forward<Generator>(g), policy);
 }
 
 /** Check if two array or array_refs have equal contents. */
@@ -2870,8 +3325,9 @@ public:
     }
   }
 
-  template <class U, size_t U_N, size_t U_A>
-  friend bool operator==(const auto_allocator& a, const auto_allocator<U, U_N, U_A>& b) {
+  template <class U, size_t U_N, size_t U_A, class U_BaseAlloc>
+  friend bool operator==(
+      const auto_allocator& a, const auto_allocator<U, U_N, U_A, U_BaseAlloc>& b) {
     if (a.allocated || b.allocated) {
       return &a.buffer[0] == &b.buffer[0];
     } else {
@@ -2879,12 +3335,164 @@ public:
     }
   }
 
-  template <class U, size_t U_N, size_t U_A>
-  friend bool operator!=(const auto_allocator& a, const auto_allocator<U, U_N, U_A>& b) {
+  template <class U, size_t U_N, size_t U_A, class U_BaseAlloc>
+  friend bool operator!=(
+      const auto_allocator& a, const auto_allocator<U, U_N, U_A, U_BaseAlloc>& b) {
     return !(a == b);
   }
 };
 
+namespace internal {
+
+// Free lists of blocks for the size classes of pool_allocator. Size class `i`
+// holds blocks of `min_block_size << i` bytes. Each thread has its own free
+// lists, so allocations do not need any synchronization.
+class pool_free_lists {
+public:
+  static constexpr size_t min_block_size = 16;
+  static constexpr size_t size_classes = 9;
+  static constexpr size_t max_block_size = min_block_size << (size_classes - 1);
+  // The maximum number of free blocks kept in each size class. Blocks freed
+  // beyond this are returned to the global heap.
+  static constexpr size_t max_free_blocks = 64;
+
+private:
+  struct block {
+    block* next;
+  };
+  block* heads_[size_classes] = {nullptr};
+  size_t counts_[size_classes] = {0};
+
+  // The state of the free lists of the calling thread. This is trivially
+  // destructible, so it can still be read after the free lists are destroyed
+  // at thread exit, by destructors of other thread_local objects that run
+  // later. Those allocations and deallocations use the global heap.
+  enum { alive, destroyed };
+  static int& thread_local_state() {
+    static thread_local int state = alive;
+    return state;
+  }
+
+  // The free lists of the calling thread, or null if they have been
+  // destroyed.
+  static pool_free_lists* thread_local_lists() {
+    if (thread_local_state() == destroyed) { return nullptr; }
+    static thread_local pool_free_lists lists;
+    return &lists;
+  }
+
+  pool_free_lists() = default;
+
+public:
+  pool_free_lists(const pool_free_lists&) = delete;
+  pool_free_lists& operator=(const pool_free_lists&) = delete;
+  ~pool_free_lists() {
+    thread_local_state() = destroyed;
+    for (size_t c = 0; c < size_classes; c++) {
+      block* head = heads_[c];
+      heads_[c] = nullptr;
+      counts_[c] = 0;
+      while (head) {
+        block* next = head->next;
+        ::operator delete(head);
+        head = next;
+      }
+    }
+  }
+
+  static size_t size_class(size_t bytes) {
+    size_t i = 0;
+    while ((min_block_size << i) < bytes) {
+      i++;
+    }
+    return i;
+  }
+
+  // Allocate a block of at least `bytes` from the free lists of the calling
+  // thread.
+  static void* allocate(size_t bytes) {
+    const size_t c = size_class(bytes);
+    pool_free_lists* lists = thread_local_lists();
+    if (lists && lists->heads_[c]) {
+      block* result = lists->heads_[c];
+      lists->heads_[c] = result->next;
+      lists->counts_[c]--;
+      return result;
+    }
+    return ::operator new(min_block_size << c);
+  }
+
+  // Return a block of at least `bytes` to the free lists of the calling thread.
+  static void deallocate(void* p, size_t bytes) noexcept {
+    const size_t c = size_class(bytes);
+    pool_free_lists* lists = thread_local_lists();
+    if (!lists || lists->counts_[c] >= max_free_blocks) {
+      ::operator delete(p);
+      return;
+    }
+    block* b = static_cast<block*>(p);
+    b->next = lists->heads_[c];
+    lists->heads_[c] = b;
+    lists->counts_[c]++;
+  }
+};
+
+} // namespace internal
+
+/** Allocator satisfying the `std::allocator` interface that keeps freed
+ * allocations of up to 4 KB in thread-local free lists, with one list per
+ * power of two size class. Allocations that can be satisfied by a free list
+ * do not use the global heap or take any locks. Larger allocations, and
+ * allocations of over-aligned types, use `std::allocator`.
+ *
+ * Memory may be deallocated on a different thread than the one that allocated
+ * it, in which case it is added to the free lists of the deallocating thread.
+ *
+ * This allocator is useful as the `BaseAlloc` of `auto_allocator`, to reduce
+ * the cost of allocations that do not fit in the automatic buffer. */
+template <class T>
+class pool_allocator {
+  static constexpr bool is_poolable = alignof(T) <= alignof(std::max_align_t);
+
+public:
+  using value_type = T;
+
+  pool_allocator() = default;
+  template <class U>
+  constexpr pool_allocator(const pool_allocator<U>&) noexcept {}
+
+  value_type* allocate(size_t n) {
+    const size_t bytes = n * sizeof(T);
+    if (is_poolable && bytes <= internal::pool_free_lists::max_block_size) {
+      void* result = internal::pool_free_lists::allocate(bytes);
+      return static_cast<value_type*>(result);
+    }
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(value_type* p, size_t n) noexcept {
+    const size_t bytes = n * sizeof(T);
+    if (is_poolable && bytes <= internal::pool_free_lists::max_block_size) {
+      internal::pool_free_lists::deallocate(p, bytes);
+    } else {
+      std::allocator<T>().deallocate(p, n);
+    }
+  }
+
+  template <class U>
+  friend bool operator==(const pool_allocator&, const pool_allocator<U>&) {
+    return true;
+  }
+  template <class U>
+  friend bool operator!=(const pool_allocator&, const pool_allocator<U>&) {
+    return false;
+  }
+};
+
+/** Allocator equivalent to `auto_allocator<T, N, Alignment>`, using a
+ * `pool_allocator` for allocations that do not fit in the automatic buffer. */
+template <class T, size_t N, size_t Alignment = alignof(T)>
+using auto_pool_allocator = auto_allocator<T, N, Alignment, pool_allocator<T>>;
+
 /** Allocator satisfying the `std::allocator` interface that is a wrapper
  * around another allocator `BaseAlloc`, and skips default construction.
  * Using this allocator can be dangerous, t is only safe to use when
@@ -2943,6 +3551,143 @@ template <class T, size_t N, size_t Alignment = sizeof(T),
     class = std::enable_if_t<std::is_trivial<T>::value>>
 using uninitialized_auto_allocator = uninitialized_allocator<auto_allocator<T, N, Alignment>>;
 
+/** Counters of the allocations made by `tracking_allocator`s with a particular
+ * tag. The counters are atomic, and can be updated and read concurrently from
+ * multiple threads without locking. */
+class allocation_stats {
+public:
+  /** The number of buckets in the histogram of allocation sizes. */
+  static constexpr size_t histogram_size = sizeof(size_t) * 8 + 1;
+
+private:
+  std::atomic<size_t> allocations_{0};
+  std::atomic<size_t> deallocations_{0};
+  std::atomic<size_t> total_bytes_{0};
+  std::atomic<size_t> current_bytes_{0};
+  std::atomic<size_t> peak_bytes_{0};
+  std::atomic<size_t> histogram_[histogram_size] = {};
+
+public:
+  allocation_stats() = default;
+  allocation_stats(const allocation_stats&) = delete;
+  allocation_stats& operator=(const allocation_stats&) = delete;
+
+  /** The histogram bucket of an allocation of `bytes` bytes. Bucket `i` counts
+   * the allocations of more than `2^(i - 1)` and at most `2^i` bytes. */
+  static size_t histogram_bucket(size_t bytes) {
+    size_t i = 0;
+    while (i < histogram_size - 1 && (size_t(1) << i) < bytes) {
+      i++;
+    }
+    return i;
+  }
+
+  void record_allocate(size_t bytes) {
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    total_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    histogram_[histogram_bucket(bytes)].fetch_add(1, std::memory_order_relaxed);
+    const size_t current = current_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_bytes_.load(std::memory_order_relaxed);
+    while (peak < current &&
+           !peak_bytes_.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+    }
+  }
+  void record_deallocate(size_t bytes) {
+    deallocations_.fetch_add(1, std::memory_order_relaxed);
+    current_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+  /** The number of allocations and deallocations. */
+  size_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+  size_t deallocations() const { return deallocations_.load(std::memory_order_relaxed); }
+  /** The sum of the sizes of all allocations, in bytes. */
+  size_t total_bytes() const { return total_bytes_.load(std::memory_order_relaxed); }
+  /** The number of bytes currently allocated. */
+  size_t current_bytes() const { return current_bytes_.load(std::memory_order_relaxed); }
+  /** The maximum number of bytes allocated at any one time. */
+  size_t peak_bytes() const { return peak_bytes_.load(std::memory_order_relaxed); }
+  /** The number of allocations in histogram bucket `i`. */
+  size_t histogram(size_t i) const { return histogram_[i].load(std::memory_order_relaxed); }
+
+  /** Reset the counters. The bytes currently allocated are still tracked, and
+   * become the new peak. */
+  void reset() {
+    allocations_.store(0, std::memory_order_relaxed);
+    deallocations_.store(0, std::memory_order_relaxed);
+    total_bytes_.store(0, std::memory_order_relaxed);
+    peak_bytes_.store(current_bytes(), std::memory_order_relaxed);
+    for (auto& i : histogram_) {
+      i.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+/** Get the counters of the allocations made by `tracking_allocator`s with tag
+ * `Tag`. */
+template <class Tag>
+allocation_stats& get_allocation_stats() {
+  static allocation_stats stats;
+  return stats;
+}
+
+/** Allocator satisfying the `std::allocator` interface that is a wrapper
+ * around another allocator `BaseAlloc`, and counts the allocations it makes in
+ * `get_allocation_stats<Tag>()`. Allocators with the same `Tag` share their
+ * counters, regardless of their value type, so a tag can be used to account
+ * for the memory used by several arrays, e.g. the temporaries of one stage of
+ * a pipeline. */
+template <class BaseAlloc, class Tag = void>
+class tracking_allocator : public BaseAlloc {
+  using base_traits = std::allocator_traits<BaseAlloc>;
+
+public:
+  using value_type = typename base_traits::value_type;
+
+  using propagate_on_container_copy_assignment =
+      typename base_traits::propagate_on_container_copy_assignment;
+  using propagate_on_container_move_assignment =
+      typename base_traits::propagate_on_container_move_assignment;
+  using propagate_on_container_swap = typename base_traits::propagate_on_container_swap;
+  static tracking_allocator select_on_container_copy_construction(const tracking_allocator& alloc) {
+    return base_traits::select_on_container_copy_construction(alloc);
+  }
+
+  template <class U>
+  struct rebind {
+    using other = tracking_allocator<typename base_traits::template rebind_alloc<U>, Tag>;
+  };
+
+  tracking_allocator() = default;
+  tracking_allocator(const BaseAlloc& base) : BaseAlloc(base) {}
+  template <class OtherBaseAlloc>
+  tracking_allocator(const tracking_allocator<OtherBaseAlloc, Tag>& other)
+      : BaseAlloc(static_cast<const OtherBaseAlloc&>(other)) {}
+
+  /** The counters shared by all allocators with this tag. */
+  static allocation_stats& stats() { return get_allocation_stats<Tag>(); }
+
+  value_type* allocate(size_t n) {
+    value_type* result = base_traits::allocate(*this, n);
+    stats().record_allocate(n * sizeof(value_type));
+    return result;
+  }
+  void deallocate(value_type* p, size_t n) noexcept {
+    stats().record_deallocate(n * sizeof(value_type));
+    base_traits::deallocate(*this, p, n);
+  }
+
+  template <class OtherBaseAlloc>
+  friend bool operator==(
+      const tracking_allocator& a, const tracking_allocator<OtherBaseAlloc, Tag>& b) {
+    return static_cast<const BaseAlloc&>(a) == static_cast<const OtherBaseAlloc&>(b);
+  }
+  template <class OtherBaseAlloc>
+  friend bool operator!=(
+      const tracking_allocator& a, const tracking_allocator<OtherBaseAlloc, Tag>& b) {
+    return static_cast<const BaseAlloc&>(a) != static_cast<const OtherBaseAlloc&>(b);
+  }
+};
+
 } // namespace nda
 
 #endif // NDARRAY_ARRAY_H
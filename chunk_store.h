@@ -0,0 +1,575 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file chunk_store.h
+ * \brief Chunked arrays stored in a directory, for arrays larger than memory.
+ *
+ * A `chunk_store` is an array divided into chunks like a `chunked_array`,
+ * where each chunk is stored in its own file in a directory. The layout is
+ * similar to Zarr:
+ * - `<path>/.ndarray` is a text file describing the shape, chunk shape, value
+ *   size and fill value of the array.
+ * - `<path>/<c0>.<c1>...` is the chunk at index `(c0, c1, ...)` in the grid of
+ *   chunks, containing the values of the chunk as a dense array, without any
+ *   header or compression. Chunks that have not been written have no file, and
+ *   their values are the fill value.
+ *
+ * Chunks are read with `pread` and written with `pwrite`, in parallel on a
+ * thread pool. Recently used chunks are kept in an LRU cache, which holds at
+ * most the given number of bytes (unless the chunks being copied exceed that).
+ * Writes to a chunk modify the cached chunk, which is written to its file once
+ * when it is evicted from the cache, or by `flush`.
+ *
+ * This requires POSIX file I/O. Errors are reported by throwing
+ * `std::system_error` or `std::runtime_error`.
+ */
+#ifndef NDARRAY_CHUNK_STORE_H
+#define NDARRAY_CHUNK_STORE_H
+
+#include "array.h"
+#include "chunked_array.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nda {
+
+namespace internal {
+
+inline std::system_error io_error(const std::string& what, const std::string& path) {
+  return std::system_error(errno, std::generic_category(), what + " " + path);
+}
+
+// Closes a file descriptor when it goes out of scope.
+class file_descriptor {
+  int fd_;
+
+public:
+  explicit file_descriptor(int fd) : fd_(fd) {}
+  ~file_descriptor() {
+    if (fd_ >= 0) { ::close(fd_); }
+  }
+  file_descriptor(const file_descriptor&) = delete;
+  file_descriptor& operator=(const file_descriptor&) = delete;
+
+  int get() const { return fd_; }
+};
+
+// Read `size` bytes of the file at `path` to `data`. Returns false if the file
+// does not exist.
+inline bool read_file(const std::string& path, void* data, size_t size) {
+  file_descriptor fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd.get() < 0) {
+    if (errno == ENOENT) { return false; }
+    throw io_error("open", path);
+  }
+  char* bytes = static_cast<char*>(data);
+  for (size_t done = 0; done < size;) {
+    ssize_t result = ::pread(fd.get(), bytes + done, size - done, done);
+    if (result < 0) {
+      if (errno == EINTR) { continue; }
+      throw io_error("pread", path);
+    } else if (result == 0) {
+      throw std::runtime_error("chunk file is too small: " + path);
+    }
+    done += result;
+  }
+  return true;
+}
+
+// Write `size` bytes of `data` to the file at `path`, replacing its contents.
+inline void write_file(const std::string& path, const void* data, size_t size) {
+  file_descriptor fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (fd.get() < 0) { throw io_error("open", path); }
+  const char* bytes = static_cast<const char*>(data);
+  for (size_t done = 0; done < size;) {
+    ssize_t result = ::pwrite(fd.get(), bytes + done, size - done, done);
+    if (result < 0) {
+      if (errno == EINTR) { continue; }
+      throw io_error("pwrite", path);
+    }
+    done += result;
+  }
+}
+
+// Call `fn(i)` for each i in [0, n) on `pool`. If any of the calls throw, one
+// of the exceptions is rethrown after all of the calls have returned.
+template <class Fn>
+void parallel_for_each_rethrow(thread_pool& pool, index_t n, Fn&& fn) {
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  pool.parallel_for(interval<>(0, n), 1, [&](const interval<>& r) {
+    for (index_t i : r) {
+      try {
+        fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) { error = std::current_exception(); }
+      }
+    }
+  });
+  if (error) { std::rethrow_exception(error); }
+}
+
+template <class Index, size_t... Is>
+std::string chunk_name(const Index& chunk, index_sequence<Is...>) {
+  std::string result;
+  for (index_t c : {std::get<Is>(chunk)...}) {
+    if (!result.empty()) { result += '.'; }
+    result += std::to_string(c);
+  }
+  return result;
+}
+
+} // namespace internal
+
+/** An array of `T` with the shape `dense_shape<Rank>`, stored as chunks in the
+ * files of a directory. `T` must be trivially copyable; the values are stored
+ * in the byte order of the machine. A chunk store is not safe to use from
+ * several threads at once, but it uses the threads of its thread pool for I/O
+ * and copies. */
+template <class T, size_t Rank>
+class chunk_store {
+  static_assert(
+      std::is_trivially_copyable<T>::value, "chunk_store values must be trivially copyable");
+
+public:
+  using value_type = T;
+  /** Shape of the store, and of each chunk. */
+  using shape_type = dense_shape<Rank>;
+  using index_type = typename shape_type::index_type;
+  using size_type = size_t;
+  /** Type of the cached chunks of the store. */
+  using chunk_type = dense_array<T, Rank>;
+
+private:
+  using dim_indices = typename shape_type::dim_indices;
+  using chunk_ptr = std::shared_ptr<chunk_type>;
+
+  struct cache_entry {
+    index_type chunk;
+    chunk_ptr values;
+    bool dirty;
+    std::list<index_t>::iterator lru;
+  };
+  // A chunk that must be written to its file.
+  struct pending_write {
+    index_type chunk;
+    chunk_ptr values;
+  };
+
+  std::string path_;
+  shape_type shape_;
+  index_type chunk_extents_;
+  shape_type grid_;
+  T fill_value_;
+  size_type cache_bytes_;
+  thread_pool* pool_;
+
+  // The cache maps flat offsets in `grid_` to chunks. `lru_` is ordered from
+  // most to least recently used.
+  std::mutex mutex_;
+  std::unordered_map<index_t, cache_entry> cache_;
+  std::list<index_t> lru_;
+  // The chunks of the batch being copied, which are not evicted until the
+  // batch is done. Otherwise, a chunk could be evicted and written while the
+  // task that uses it reads its file.
+  std::unordered_set<index_t> pinned_;
+  size_type cached_bytes_ = 0;
+  std::atomic<size_type> chunk_reads_{0};
+  std::atomic<size_type> chunk_writes_{0};
+
+  static size_type bytes_of(const chunk_type& c) { return c.size() * sizeof(T); }
+
+  std::string metadata_path() const { return path_ + "/.ndarray"; }
+  std::string chunk_path(const index_type& chunk) const {
+    return path_ + "/" + internal::chunk_name(chunk, dim_indices());
+  }
+
+  void init_grid() {
+    shape_.resolve();
+    grid_ = internal::make_chunk_grid(shape_, chunk_extents_, dim_indices());
+  }
+
+  template <size_t... Is>
+  void write_metadata(internal::index_sequence<Is...>) const {
+    std::ofstream f(metadata_path());
+    f << "ndarray_chunk_store 1\n";
+    f << "value_size " << sizeof(T) << "\n";
+    f << "rank " << Rank << "\n";
+    f << "shape";
+    for (const interval<>& d :
+        {interval<>(shape_.template dim<Is>().min(), shape_.template dim<Is>().extent())...}) {
+      f << " " << d.min() << " " << d.extent();
+    }
+    f << "\nchunks";
+    for (index_t e : {std::get<Is>(chunk_extents_)...}) {
+      f << " " << e;
+    }
+    f << "\nfill";
+    const unsigned char* fill = reinterpret_cast<const unsigned char*>(&fill_value_);
+    for (size_t i = 0; i < sizeof(T); i++) {
+      f << " " << static_cast<int>(fill[i]);
+    }
+    f << "\n";
+    if (!f) { throw internal::io_error("write", metadata_path()); }
+  }
+
+  template <size_t... Is>
+  void read_metadata(internal::index_sequence<Is...>) {
+    std::ifstream f(metadata_path());
+    if (!f) { throw internal::io_error("open", metadata_path()); }
+    std::string key;
+    int version = 0;
+    size_t value_size = 0;
+    size_t rank = 0;
+    f >> key >> version >> key >> value_size >> key >> rank;
+    if (!f || version != 1 || value_size != sizeof(T) || rank != Rank) {
+      throw std::runtime_error("chunk store has an incompatible type: " + path_);
+    }
+    index_t mins[Rank];
+    index_t extents[Rank];
+    index_t chunk_extents[Rank];
+    f >> key;
+    for (size_t d = 0; d < Rank; d++) {
+      f >> mins[d] >> extents[d];
+    }
+    f >> key;
+    for (size_t d = 0; d < Rank; d++) {
+      f >> chunk_extents[d];
+    }
+    f >> key;
+    unsigned char* fill = reinterpret_cast<unsigned char*>(&fill_value_);
+    for (size_t i = 0; i < sizeof(T); i++) {
+      int byte;
+      f >> byte;
+      fill[i] = static_cast<unsigned char>(byte);
+    }
+    if (!f) { throw std::runtime_error("chunk store metadata is invalid: " + path_); }
+    shape_ = shape_type(internal::dim_type_of<shape_type, Is>(mins[Is], extents[Is])...);
+    chunk_extents_ = index_type(chunk_extents[Is]...);
+    init_grid();
+  }
+
+  // Find a chunk in the cache, marking it the most recently used, and dirty if
+  // `dirty` is true. Returns nullptr if the chunk is not in the cache.
+  chunk_ptr lookup(index_t flat, bool dirty) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto i = cache_.find(flat);
+    if (i == cache_.end()) { return nullptr; }
+    lru_.splice(lru_.begin(), lru_, i->second.lru);
+    i->second.dirty = i->second.dirty || dirty;
+    return i->second.values;
+  }
+
+  // Remove the least recently used chunks from the cache until it fits in the
+  // budget, adding the dirty ones to `writes`. Chunks that are referenced
+  // outside of the cache or are pinned are in use, and are not evicted.
+  void evict(std::vector<pending_write>& writes) {
+    auto i = lru_.end();
+    while (cached_bytes_ > cache_bytes_ && i != lru_.begin()) {
+      --i;
+      auto entry = cache_.find(*i);
+      if (entry->second.values.use_count() > 1 || pinned_.count(*i)) { continue; }
+      cached_bytes_ -= bytes_of(*entry->second.values);
+      if (entry->second.dirty) {
+        writes.push_back({entry->second.chunk, std::move(entry->second.values)});
+      }
+      cache_.erase(entry);
+      i = lru_.erase(i);
+    }
+  }
+
+  // Add a chunk to the cache, and evict chunks to make room for it.
+  void insert(const index_type& chunk, index_t flat, const chunk_ptr& values, bool dirty) {
+    std::vector<pending_write> writes;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      lru_.push_front(flat);
+      cache_.emplace(flat, cache_entry{chunk, values, dirty, lru_.begin()});
+      cached_bytes_ += bytes_of(*values);
+      evict(writes);
+    }
+    for (size_t i = 0; i < writes.size(); i++) {
+      try {
+        write_chunk(writes[i].chunk, *writes[i].values);
+      } catch (...) {
+        // Put this chunk and the ones not written yet back in the cache, so
+        // their data is not lost.
+        for (size_t j = i; j < writes.size(); j++) {
+          reinsert_dirty(writes[j]);
+        }
+        throw;
+      }
+    }
+  }
+
+  // Return an evicted chunk that failed to be written to the cache.
+  void reinsert_dirty(const pending_write& w) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const index_t flat = grid_[w.chunk];
+    lru_.push_front(flat);
+    cache_.emplace(flat, cache_entry{w.chunk, w.values, true, lru_.begin()});
+    cached_bytes_ += bytes_of(*w.values);
+  }
+
+  // Pins the chunks of a batch in the cache while it is alive.
+  class pinned_batch {
+    chunk_store& store_;
+
+  public:
+    pinned_batch(chunk_store& store, const std::vector<index_type>& batch) : store_(store) {
+      std::lock_guard<std::mutex> lock(store_.mutex_);
+      for (const index_type& i : batch) {
+        store_.pinned_.insert(store_.grid_[i]);
+      }
+    }
+    ~pinned_batch() {
+      std::lock_guard<std::mutex> lock(store_.mutex_);
+      store_.pinned_.clear();
+    }
+  };
+
+  chunk_ptr read_chunk(const index_type& chunk) {
+    chunk_ptr result = std::make_shared<chunk_type>(chunk_shape(chunk));
+    if (internal::read_file(chunk_path(chunk), result->data(), bytes_of(*result))) {
+      chunk_reads_++;
+    } else {
+      fill(result->ref(), fill_value_);
+    }
+    return result;
+  }
+
+  void write_chunk(const index_type& chunk, const chunk_type& values) {
+    internal::write_file(chunk_path(chunk), values.data(), bytes_of(values));
+    chunk_writes_++;
+  }
+
+  // Get the chunks intersecting `crop`, grouped in batches that fit in the
+  // cache.
+  std::vector<std::vector<index_type>> chunk_batches(const shape_type& crop) const {
+    std::vector<std::vector<index_type>> batches(1);
+    size_type batch_bytes = 0;
+    shape_type chunks = internal::make_chunk_range<shape_type>(
+        chunk_index(crop.min()), chunk_index(crop.max()), dim_indices());
+    for_each_index(chunks, [&](const index_type& i) {
+      size_type bytes = chunk_shape(i).size() * sizeof(T);
+      if (!batches.back().empty() && batch_bytes + bytes > cache_bytes_) {
+        batches.emplace_back();
+        batch_bytes = 0;
+      }
+      batches.back().push_back(i);
+      batch_bytes += bytes;
+    });
+    return batches;
+  }
+
+  template <class TDst, class ShapeDst>
+  void copy_to(const array_ref<TDst, ShapeDst>& dst) {
+    assert(shape_.is_in_range(dst.shape().min()) && shape_.is_in_range(dst.shape().max()));
+    for (const std::vector<index_type>& batch : chunk_batches(dst.shape())) {
+      pinned_batch pin(*this, batch);
+      internal::parallel_for_each_rethrow(*pool_, batch.size(), [&](index_t i) {
+        const index_type& chunk = batch[i];
+        const index_t flat = grid_[chunk];
+        chunk_ptr values = lookup(flat, false);
+        if (!values) {
+          values = read_chunk(chunk);
+          insert(chunk, flat, values, false);
+        }
+        auto dst_i = internal::crop_to(dst, values->shape());
+        copy(values->cref(), dst_i);
+      });
+    }
+  }
+
+  template <class TSrc, class ShapeSrc>
+  void copy_from(const array_ref<TSrc, ShapeSrc>& src) {
+    assert(shape_.is_in_range(src.shape().min()) && shape_.is_in_range(src.shape().max()));
+    for (const std::vector<index_type>& batch : chunk_batches(src.shape())) {
+      pinned_batch pin(*this, batch);
+      internal::parallel_for_each_rethrow(*pool_, batch.size(), [&](index_t i) {
+        const index_type& chunk = batch[i];
+        const index_t flat = grid_[chunk];
+        const shape_type chunk_i = chunk_shape(chunk);
+        auto src_i = internal::crop_to(src, chunk_i);
+        chunk_ptr values = lookup(flat, true);
+        if (!values) {
+          // Chunks that are entirely overwritten don't need to be read.
+          if (src_i.size() == chunk_i.size()) {
+            values = std::make_shared<chunk_type>(chunk_i);
+          } else {
+            values = read_chunk(chunk);
+          }
+          insert(chunk, flat, values, true);
+        }
+        copy(src_i, internal::crop_to(values->ref(), src_i.shape()));
+      });
+    }
+  }
+
+public:
+  /** Create a new chunk store in the directory `path`, with shape `shape`,
+   * divided into chunks with the extents of `chunk_shape`. The directory is
+   * created if it does not exist, and should not contain another chunk store.
+   * Every value of the new store is `fill_value`. The cache holds up to
+   * `cache_bytes` bytes of chunks, and I/O is done on `pool`. */
+  chunk_store(const std::string& path, const shape_type& shape, const shape_type& chunk_shape,
+      const T& fill_value = T(), size_type cache_bytes = size_type(1) << 28,
+      thread_pool& pool = thread_pool::global())
+      : path_(path), shape_(shape), chunk_extents_(chunk_shape.extent()), fill_value_(fill_value),
+        cache_bytes_(cache_bytes), pool_(&pool) {
+    init_grid();
+    if (::mkdir(path_.c_str(), 0755) != 0 && errno != EEXIST) {
+      throw internal::io_error("mkdir", path_);
+    }
+    write_metadata(dim_indices());
+  }
+  /** Open an existing chunk store in the directory `path`. */
+  explicit chunk_store(const std::string& path, size_type cache_bytes = size_type(1) << 28,
+      thread_pool& pool = thread_pool::global())
+      : path_(path), cache_bytes_(cache_bytes), pool_(&pool) {
+    read_metadata(dim_indices());
+  }
+
+  /** Writes the modified chunks in the cache to their files. Errors are
+   * ignored, call `flush` to detect them. */
+  ~chunk_store() {
+    try {
+      flush();
+    } catch (...) {}
+  }
+
+  chunk_store(const chunk_store&) = delete;
+  chunk_store& operator=(const chunk_store&) = delete;
+
+  /** The directory containing this store. */
+  const std::string& path() const { return path_; }
+  /** The shape of this store. */
+  const shape_type& shape() const { return shape_; }
+  /** The extents of the chunks of this store. */
+  const index_type& chunk_extents() const { return chunk_extents_; }
+  /** The shape of the grid of chunks, with mins of 0. */
+  const shape_type& chunk_grid() const { return grid_; }
+  /** The value of elements in chunks that have not been written. */
+  const T& fill_value() const { return fill_value_; }
+
+  /** The index of the chunk containing the element at `indices`. */
+  index_type chunk_index(const index_type& indices) const {
+    return internal::chunk_of(indices, shape_.min(), chunk_extents_, dim_indices());
+  }
+  /** The shape of the chunk at `chunk` in the grid of chunks. */
+  shape_type chunk_shape(const index_type& chunk) const {
+    return internal::make_chunk_shape(shape_, chunk_extents_, chunk, dim_indices());
+  }
+
+  /** The maximum size of the cache in bytes. */
+  size_type cache_bytes() const { return cache_bytes_; }
+  /** The size of the chunks in the cache in bytes. */
+  size_type cached_bytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+  }
+  /** The number of chunk files read and written by this store. */
+  size_type chunk_reads() const { return chunk_reads_; }
+  size_type chunk_writes() const { return chunk_writes_; }
+
+  /** Write the chunks in the cache that have been modified to their files. */
+  void flush() {
+    std::vector<pending_write> writes;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto& i : cache_) {
+        if (i.second.dirty) {
+          writes.push_back({i.second.chunk, i.second.values});
+          i.second.dirty = false;
+        }
+      }
+    }
+    internal::parallel_for_each_rethrow(*pool_, writes.size(), [&](index_t i) {
+      try {
+        write_chunk(writes[i].chunk, *writes[i].values);
+      } catch (...) {
+        // The chunk was not written, so it is still modified.
+        lookup(grid_[writes[i].chunk], true);
+        throw;
+      }
+    });
+  }
+
+  /** Write the modified chunks in the cache to their files, and empty the
+   * cache. */
+  void clear_cache() {
+    flush();
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_.clear();
+    lru_.clear();
+    cached_bytes_ = 0;
+  }
+
+  template <class TSrc, size_t RankSrc, class TDst, class ShapeDst>
+  friend void copy(chunk_store<TSrc, RankSrc>& src, const array_ref<TDst, ShapeDst>& dst);
+  template <class TSrc, class ShapeSrc, class TDst, size_t RankDst>
+  friend void copy(const array_ref<TSrc, ShapeSrc>& src, chunk_store<TDst, RankDst>& dst);
+};
+
+/** Copy the elements in the shape of `dst` from the chunk store `src`. The
+ * shape of `dst` must be in bounds of `src`. The chunks intersecting `dst` are
+ * read in parallel, in batches that fit in the cache of `src`. */
+template <class TSrc, size_t RankSrc, class TDst, class ShapeDst>
+void copy(chunk_store<TSrc, RankSrc>& src, const array_ref<TDst, ShapeDst>& dst) {
+  if (dst.shape().empty()) { return; }
+  src.copy_to(dst);
+}
+template <class TSrc, size_t RankSrc, class TDst, class ShapeDst, class AllocDst>
+void copy(chunk_store<TSrc, RankSrc>& src, array<TDst, ShapeDst, AllocDst>& dst) {
+  copy(src, dst.ref());
+}
+
+/** Copy the elements of `src` to the chunk store `dst`. The shape of `src` must
+ * be in bounds of `dst`. The chunks intersecting `src` are modified in the
+ * cache of `dst`, and written to their files when they are evicted from the
+ * cache, or by `flush`. Chunks that are entirely overwritten are not read. */
+template <class TSrc, class ShapeSrc, class TDst, size_t RankDst>
+void copy(const array_ref<TSrc, ShapeSrc>& src, chunk_store<TDst, RankDst>& dst) {
+  if (src.shape().empty()) { return; }
+  dst.copy_from(src);
+}
+template <class TSrc, class ShapeSrc, class AllocSrc, class TDst, size_t RankDst>
+void copy(const array<TSrc, ShapeSrc, AllocSrc>& src, chunk_store<TDst, RankDst>& dst) {
+  copy(src.cref(), dst);
+}
+
+} // namespace nda
+
+#endif // NDARRAY_CHUNK_STORE_H
@@ -0,0 +1,338 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file chunked_array.h
+ * \brief Arrays divided into chunks, which are allocated when first written.
+ *
+ * A `chunked_array` divides its shape into a grid of chunks with the same
+ * extents. Each chunk is a `dense_array`, which is allocated the first time an
+ * element in it is written. Elements of chunks that have not been allocated
+ * have the fill value of the array. The memory used by a chunked array is
+ * proportional to the volume of the chunks that have been written, rather than
+ * the volume of its shape.
+ *
+ * `copy` between chunked arrays and dense arrays copies each chunk with the
+ * `copy` of array.h, so copies of dense rows are fast.
+ */
+#ifndef NDARRAY_CHUNKED_ARRAY_H
+#define NDARRAY_CHUNKED_ARRAY_H
+
+#include "array.h"
+
+#include <memory>
+#include <vector>
+
+namespace nda {
+
+namespace internal {
+
+// Find the chunk containing `indices`, for chunks of `extents` beginning at
+// `mins`.
+template <class Index, size_t... Is>
+NDARRAY_INLINE Index chunk_of(
+    const Index& indices, const Index& mins, const Index& extents, index_sequence<Is...>) {
+  return Index((std::get<Is>(indices) - std::get<Is>(mins)) / std::get<Is>(extents)...);
+}
+
+// The type of the dim I of Shape.
+template <class Shape, size_t I>
+using dim_type_of = typename std::tuple_element<I, typename Shape::dims_type>::type;
+
+// Make the shape of a grid of chunks of `extents` covering `s`.
+template <class Shape, class Index, size_t... Is>
+Shape make_chunk_grid(const Shape& s, const Index& extents, index_sequence<Is...>) {
+  assert(all(std::get<Is>(extents) > 0 ...));
+  Shape grid(dim_type_of<Shape, Is>(0, (s.template dim<Is>().extent() + std::get<Is>(extents) - 1) /
+                          std::get<Is>(extents))...);
+  grid.resolve();
+  return grid;
+}
+
+// Make the shape of the chunk at `chunk` in the grid of chunks covering `s`.
+template <class Shape, class Index, size_t... Is>
+Shape make_chunk_shape(
+    const Shape& s, const Index& extents, const Index& chunk, index_sequence<Is...>) {
+  Shape result(dim_type_of<Shape, Is>(
+      s.template dim<Is>().min() + std::get<Is>(chunk) * std::get<Is>(extents),
+      std::min(std::get<Is>(extents),
+          s.template dim<Is>().extent() - std::get<Is>(chunk) * std::get<Is>(extents)))...);
+  result.resolve();
+  return result;
+}
+
+// Make the shape of the chunk indices in the interval [min, max].
+template <class Shape, class Index, size_t... Is>
+Shape make_chunk_range(const Index& min, const Index& max, index_sequence<Is...>) {
+  return Shape(
+      dim_type_of<Shape, Is>(std::get<Is>(min), std::get<Is>(max) - std::get<Is>(min) + 1)...);
+}
+
+// Crop the array_ref `a` to the intersection of its shape and `s`.
+template <class T, class Shape, class CropShape>
+auto crop_to(const array_ref<T, Shape>& a, const CropShape& s) {
+  Shape cropped = clamp(a.shape().dims(), s.dims(), typename Shape::dim_indices());
+  return array_ref<T, Shape>(pointer_add(a.base(), a.shape()[cropped.min()]), cropped);
+}
+
+} // namespace internal
+
+/** An array of `T` with the shape `dense_shape<Rank>`, divided into chunks of
+ * a fixed extent. Each chunk is allocated the first time it is written, and
+ * elements of chunks that have not been allocated have the fill value of the
+ * array. `Alloc` is the allocator used for the elements of each chunk. */
+template <class T, size_t Rank, class Alloc = std::allocator<T>>
+class chunked_array {
+public:
+  /** Type of elements stored in this array. */
+  using value_type = T;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  /** Shape of this array, and of each chunk. */
+  using shape_type = dense_shape<Rank>;
+  using index_type = typename shape_type::index_type;
+  using size_type = size_t;
+  /** Type of the chunks of this array. */
+  using chunk_type = dense_array<T, Rank, Alloc>;
+  using chunk_ref_type = array_ref<T, shape_type>;
+  using chunk_const_ref_type = array_ref<const T, shape_type>;
+
+private:
+  using dim_indices = typename shape_type::dim_indices;
+
+  template <class... Args>
+  using enable_if_same_rank = std::enable_if_t<sizeof...(Args) == Rank>;
+
+  shape_type shape_;
+  index_type chunk_extents_;
+  // The shape of the grid of chunks, which has mins of 0, and strides such
+  // that the flat offset of a chunk index is the index of the chunk in
+  // `chunks_`.
+  shape_type grid_;
+  T fill_value_;
+  Alloc alloc_;
+  std::vector<std::unique_ptr<chunk_type>> chunks_;
+  size_type allocated_chunks_ = 0;
+
+  index_type chunk_of(const index_type& indices) const {
+    return internal::chunk_of(indices, shape_.min(), chunk_extents_, dim_indices());
+  }
+
+  chunk_type& allocate_chunk_at(size_t flat_chunk, const index_type& chunk) {
+    std::unique_ptr<chunk_type>& c = chunks_[flat_chunk];
+    if (!c) {
+      c.reset(new chunk_type(chunk_shape(chunk), fill_value_, alloc_));
+      allocated_chunks_++;
+    }
+    return *c;
+  }
+
+public:
+  /** Construct a chunked array with an empty shape. */
+  chunked_array() : fill_value_() {}
+  /** Construct a chunked array with shape `shape`, divided into chunks with
+   * extents `chunk_extents`. The chunks at the max of each dimension may be
+   * smaller. No chunks are allocated, so every element is `fill_value`. */
+  chunked_array(const shape_type& shape, const index_type& chunk_extents,
+      const T& fill_value = T(), const Alloc& alloc = Alloc())
+      : shape_(shape), chunk_extents_(chunk_extents), fill_value_(fill_value), alloc_(alloc) {
+    shape_.resolve();
+    grid_ = internal::make_chunk_grid(shape_, chunk_extents_, dim_indices());
+    chunks_.resize(grid_.flat_extent());
+  }
+
+  // Chunked arrays own their chunks, and can be moved but not copied.
+  chunked_array(const chunked_array&) = delete;
+  chunked_array& operator=(const chunked_array&) = delete;
+  chunked_array(chunked_array&&) = default;
+  chunked_array& operator=(chunked_array&&) = default;
+
+  /** Get a reference to the element at `indices`. If the chunk containing
+   * `indices` is not allocated, the result is a reference to the fill value.
+   * This never allocates a chunk. */
+  const_reference operator[](const index_type& indices) const {
+    assert(shape_.is_in_range(indices));
+    const chunk_type* c = chunks_[grid_[chunk_of(indices)]].get();
+    return c ? (*c)[indices] : fill_value_;
+  }
+  template <class... Args, class = enable_if_same_rank<Args...>>
+  const_reference operator()(Args... indices) const {
+    return operator[](std::make_tuple(indices...));
+  }
+
+  /** Get a mutable reference to the element at `indices`, allocating the chunk
+   * containing it if necessary. Use a const chunked array to read elements
+   * without allocating chunks. */
+  reference operator[](const index_type& indices) {
+    assert(shape_.is_in_range(indices));
+    index_type chunk = chunk_of(indices);
+    return allocate_chunk_at(grid_[chunk], chunk)[indices];
+  }
+  template <class... Args, class = enable_if_same_rank<Args...>>
+  reference operator()(Args... indices) {
+    return operator[](std::make_tuple(indices...));
+  }
+
+  /** Call a function with a reference to each value in the allocated chunks of
+   * this array, one chunk at a time. Elements of chunks that are not allocated
+   * are all the fill value, and are not visited. The order in which `fn` is
+   * called within a chunk is undefined. */
+  template <class Fn, class = internal::enable_if_callable<Fn, reference>>
+  void for_each_value(Fn&& fn) {
+    for (std::unique_ptr<chunk_type>& c : chunks_) {
+      if (c) { c->for_each_value(fn); }
+    }
+  }
+  template <class Fn, class = internal::enable_if_callable<Fn, const_reference>>
+  void for_each_value(Fn&& fn) const {
+    for (const std::unique_ptr<chunk_type>& c : chunks_) {
+      if (c) { c->for_each_value(fn); }
+    }
+  }
+
+  /** Call a function with an array_ref of each allocated chunk of this array. */
+  template <class Fn, class = internal::enable_if_callable<Fn, chunk_ref_type>>
+  void for_each_chunk(Fn&& fn) {
+    for (std::unique_ptr<chunk_type>& c : chunks_) {
+      if (c) { fn(c->ref()); }
+    }
+  }
+  template <class Fn, class = internal::enable_if_callable<Fn, chunk_const_ref_type>>
+  void for_each_chunk(Fn&& fn) const {
+    for (const std::unique_ptr<chunk_type>& c : chunks_) {
+      if (c) { fn(c->cref()); }
+    }
+  }
+
+  /** The shape of this array. */
+  const shape_type& shape() const { return shape_; }
+  /** The extents of the chunks of this array. */
+  const index_type& chunk_extents() const { return chunk_extents_; }
+  /** The shape of the grid of chunks of this array. Chunk indices are indices
+   * in this shape, with mins of 0. */
+  const shape_type& chunk_grid() const { return grid_; }
+  /** The value of the elements of chunks that are not allocated. */
+  const T& fill_value() const { return fill_value_; }
+  const Alloc& get_allocator() const { return alloc_; }
+
+  /** The index of the chunk containing the element at `indices`. */
+  index_type chunk_index(const index_type& indices) const { return chunk_of(indices); }
+  /** The shape of the chunk at `chunk` in the grid of chunks. */
+  shape_type chunk_shape(const index_type& chunk) const {
+    return internal::make_chunk_shape(shape_, chunk_extents_, chunk, dim_indices());
+  }
+
+  /** Get the chunk at `chunk` in the grid of chunks, or nullptr if it is not
+   * allocated. */
+  chunk_type* chunk(const index_type& chunk) { return chunks_[grid_[chunk]].get(); }
+  const chunk_type* chunk(const index_type& chunk) const { return chunks_[grid_[chunk]].get(); }
+  /** Get the chunk at `chunk` in the grid of chunks, allocating it and filling
+   * it with the fill value if it is not allocated. */
+  chunk_type& allocate_chunk(const index_type& chunk) {
+    return allocate_chunk_at(grid_[chunk], chunk);
+  }
+  /** Deallocate the chunk at `chunk` in the grid of chunks, so its elements
+   * have the fill value again. */
+  void deallocate_chunk(const index_type& chunk) {
+    std::unique_ptr<chunk_type>& c = chunks_[grid_[chunk]];
+    if (c) {
+      c.reset();
+      allocated_chunks_--;
+    }
+  }
+  /** Deallocate all of the chunks of this array. */
+  void clear() {
+    for (std::unique_ptr<chunk_type>& c : chunks_) {
+      c.reset();
+    }
+    allocated_chunks_ = 0;
+  }
+
+  /** The number of chunks that are allocated. */
+  size_type allocated_chunks() const { return allocated_chunks_; }
+  /** The number of elements in allocated chunks. */
+  size_type allocated_size() const {
+    size_type result = 0;
+    for (const std::unique_ptr<chunk_type>& c : chunks_) {
+      if (c) { result += c->size(); }
+    }
+    return result;
+  }
+};
+
+/** Copy the elements in the shape of `dst` from the chunked array `src`. The
+ * shape of `dst` must be in bounds of `src`. Each chunk of `src` intersecting
+ * `dst` is copied with `copy`, and the intersection of chunks that are not
+ * allocated are filled with the fill value of `src`. */
+template <class TSrc, size_t Rank, class AllocSrc, class TDst, class ShapeDst>
+void copy(const chunked_array<TSrc, Rank, AllocSrc>& src, const array_ref<TDst, ShapeDst>& dst,
+    store_policy policy = store_policy::automatic) {
+  using shape_type = typename chunked_array<TSrc, Rank, AllocSrc>::shape_type;
+  using index_type = typename shape_type::index_type;
+  if (dst.shape().empty()) { return; }
+  assert(src.shape().is_in_range(dst.shape().min()) && src.shape().is_in_range(dst.shape().max()));
+
+  shape_type chunks = internal::make_chunk_range<shape_type>(src.chunk_index(dst.shape().min()),
+      src.chunk_index(dst.shape().max()), typename shape_type::dim_indices());
+  for_each_index(chunks, [&](const index_type& i) {
+    auto dst_i = internal::crop_to(dst, src.chunk_shape(i));
+    if (const auto* chunk = src.chunk(i)) {
+      copy(chunk->cref(), dst_i, policy);
+    } else {
+      fill(dst_i, static_cast<TDst>(src.fill_value()), policy);
+    }
+  });
+}
+template <class TSrc, size_t Rank, class AllocSrc, class TDst, class ShapeDst, class AllocDst>
+void copy(const chunked_array<TSrc, Rank, AllocSrc>& src, array<TDst, ShapeDst, AllocDst>& dst,
+    store_policy policy = store_policy::automatic) {
+  copy(src, dst.ref(), policy);
+}
+
+/** Copy the elements of `src` to the chunked array `dst`. The shape of `src`
+ * must be in bounds of `dst`. Chunks of `dst` intersecting `src` are allocated
+ * if necessary, except chunks that are not allocated, where the elements of
+ * `src` are all the fill value of `dst`. */
+template <class TSrc, class ShapeSrc, class TDst, size_t Rank, class AllocDst>
+void copy(const array_ref<TSrc, ShapeSrc>& src, chunked_array<TDst, Rank, AllocDst>& dst,
+    store_policy policy = store_policy::automatic) {
+  using shape_type = typename chunked_array<TDst, Rank, AllocDst>::shape_type;
+  using index_type = typename shape_type::index_type;
+  if (src.shape().empty()) { return; }
+  assert(dst.shape().is_in_range(src.shape().min()) && dst.shape().is_in_range(src.shape().max()));
+
+  shape_type chunks = internal::make_chunk_range<shape_type>(dst.chunk_index(src.shape().min()),
+      dst.chunk_index(src.shape().max()), typename shape_type::dim_indices());
+  for_each_index(chunks, [&](const index_type& i) {
+    auto src_i = internal::crop_to(src, dst.chunk_shape(i));
+    auto* chunk = dst.chunk(i);
+    if (!chunk) {
+      // Don't allocate chunks that would only contain the fill value.
+      bool all_fill = true;
+      const TDst& fill_value = dst.fill_value();
+      src_i.for_each_value([&](const TSrc& x) { all_fill = all_fill && x == fill_value; });
+      if (all_fill) { return; }
+      chunk = &dst.allocate_chunk(i);
+    }
+    copy(src_i, internal::crop_to(chunk->ref(), src_i.shape()), policy);
+  });
+}
+template <class TSrc, class ShapeSrc, class AllocSrc, class TDst, size_t Rank, class AllocDst>
+void copy(const array<TSrc, ShapeSrc, AllocSrc>& src, chunked_array<TDst, Rank, AllocDst>& dst,
+    store_policy policy = store_policy::automatic) {
+  copy(src.cref(), dst, policy);
+}
+
+} // namespace nda
+
+#endif // NDARRAY_CHUNKED_ARRAY_H
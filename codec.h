@@ -0,0 +1,993 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file codec.h
+ * \brief Fast lossless compression of array data, without dependencies.
+ *
+ * `compress` encodes the values of an array with a sequence of simple stages,
+ * each of which is optional:
+ * - Delta coding replaces each value with the difference between it and the
+ *   previous value in dim 0, computed with the bits of the values as
+ *   integers. The differences are zigzag coded, so smooth data becomes mostly
+ *   small unsigned numbers.
+ * - Shuffling groups byte `b` of every value together (byte shuffle), or bit
+ *   `k` of byte `b` of every value together (bit shuffle). Small numbers
+ *   become long runs of zero bytes.
+ * - Zero run coding replaces runs of zero bytes with their length.
+ *
+ * `decompress` reverses the stages recorded in the compressed data. The
+ * compressed data is in the byte order of the machine.
+ *
+ * The values are compressed in blocks of about 32 KB, so each stage runs on
+ * data in the cache. The shuffles, delta decoding, and the search for zero
+ * runs use AVX2 when the target supports it.
+ */
+#ifndef NDARRAY_CODEC_H
+#define NDARRAY_CODEC_H
+
+#include "array.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__) && !defined(__CUDA__)
+#include <immintrin.h>
+#endif
+
+namespace nda {
+
+/** How the bytes of the values are rearranged by `compress`. */
+enum class shuffle_kind {
+  /** The bytes are not rearranged. */
+  none,
+  /** Byte `b` of every value is stored together, for each `b`. */
+  byte,
+  /** Bit `k` of byte `b` of every value is stored together, for each `b` and
+   * `k`. */
+  bit,
+};
+
+/** The stages used by `compress`. */
+struct codec {
+  /** Replace each value with its difference from the previous value in dim 0.
+   * This is ignored for values that are not 1, 2, 4, or 8 bytes. */
+  bool delta = true;
+  /** How to rearrange the bytes of the values. The bit shuffle usually
+   * compresses better than the byte shuffle, but is slower. */
+  shuffle_kind shuffle = shuffle_kind::byte;
+  /** Replace runs of zero bytes with their length. */
+  bool zero_runs = true;
+};
+
+namespace internal {
+
+template <class T>
+NDARRAY_INLINE T load_bytes(const uint8_t* src) {
+  T result;
+  std::memcpy(&result, src, sizeof(T));
+  return result;
+}
+template <class T>
+NDARRAY_INLINE void store_bytes(uint8_t* dst, T x) {
+  std::memcpy(dst, &x, sizeof(T));
+}
+
+// Temporary buffers that are not initialized, unlike std::vector.
+using byte_buffer = std::unique_ptr<uint8_t[]>;
+inline byte_buffer make_byte_buffer(size_t size) { return byte_buffer(new uint8_t[size]); }
+
+#if defined(__AVX2__) && !defined(__CUDA__)
+NDARRAY_INLINE __m256i load256(const uint8_t* src) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+}
+NDARRAY_INLINE void store256(uint8_t* dst, __m256i x) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), x);
+}
+#endif // __AVX2__
+
+// Map signed differences to unsigned integers, so differences of small
+// magnitude have zeros in their upper bits.
+template <class U>
+NDARRAY_INLINE U zigzag_encode(U x) {
+  using S = typename std::make_signed<U>::type;
+  constexpr int sign_shift = sizeof(U) * 8 - 1;
+  return static_cast<U>(static_cast<U>(x << 1) ^ static_cast<U>(static_cast<S>(x) >> sign_shift));
+}
+template <class U>
+NDARRAY_INLINE U zigzag_decode(U x) {
+  return static_cast<U>((x >> 1) ^ static_cast<U>(0 - (x & 1)));
+}
+
+// Delta code the values in [begin, end) of rows of `row` values of type U,
+// which must be unsigned, and write them to `dst[0, end - begin)`. The first
+// value of each row is the difference from zero.
+template <class U>
+void delta_encode(const U* NDARRAY_RESTRICT src, index_t begin, index_t end, index_t row,
+    U* NDARRAY_RESTRICT dst) {
+  // Loops with a constant trip count are vectorized more reliably.
+  constexpr index_t lanes = 64 / sizeof(U);
+  dst -= begin;
+  while (begin < end) {
+    const index_t row_end = std::min(end, (begin / row + 1) * row);
+    const U prev = begin % row == 0 ? 0 : src[begin - 1];
+    dst[begin] = zigzag_encode(static_cast<U>(src[begin] - prev));
+    index_t i = begin + 1;
+    for (; i + lanes <= row_end; i += lanes) {
+      for (index_t k = 0; k < lanes; k++) {
+        dst[i + k] = zigzag_encode(static_cast<U>(src[i + k] - src[i + k - 1]));
+      }
+    }
+    for (; i < row_end; i++) {
+      dst[i] = zigzag_encode(static_cast<U>(src[i] - src[i - 1]));
+    }
+    begin = row_end;
+  }
+}
+
+// Undo `delta_encode` of the values in [begin, end) of `x` in place. The
+// values before `begin` must already be decoded.
+#if defined(__AVX2__) && !defined(__CUDA__)
+template <class U>
+NDARRAY_INLINE __m256i add(__m256i a, __m256i b) {
+  switch (sizeof(U)) {
+  case 1: return _mm256_add_epi8(a, b);
+  case 2: return _mm256_add_epi16(a, b);
+  case 4: return _mm256_add_epi32(a, b);
+  default: return _mm256_add_epi64(a, b);
+  }
+}
+template <class U>
+NDARRAY_INLINE __m256i broadcast(U x) {
+  switch (sizeof(U)) {
+  case 1: return _mm256_set1_epi8(static_cast<char>(x));
+  case 2: return _mm256_set1_epi16(static_cast<short>(x));
+  case 4: return _mm256_set1_epi32(static_cast<int>(x));
+  default: return _mm256_set1_epi64x(static_cast<long long>(x));
+  }
+}
+
+// Replace the values of `x` with the prefix sum of the values plus `prev`, in
+// blocks of 32 bytes. Returns the number of values computed, and updates
+// `prev` to the last of them.
+template <class U>
+index_t prefix_sum_avx2(U* x, index_t n, U& prev) {
+  constexpr index_t lanes = 32 / sizeof(U);
+  // A shuffle that broadcasts the last value of each 128-bit half.
+  uint8_t last_bytes[32];
+  for (int i = 0; i < 32; i++) {
+    last_bytes[i] = 16 - sizeof(U) + i % sizeof(U);
+  }
+  const __m256i last = load256(last_bytes);
+  __m256i carry = broadcast(prev);
+  index_t i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    uint8_t* x_i = reinterpret_cast<uint8_t*>(x + i);
+    // Compute the prefix sum of each half by adding shifted copies.
+    __m256i v = load256(x_i);
+    if (sizeof(U) <= 1) { v = add<U>(v, _mm256_slli_si256(v, 1)); }
+    if (sizeof(U) <= 2) { v = add<U>(v, _mm256_slli_si256(v, 2)); }
+    if (sizeof(U) <= 4) { v = add<U>(v, _mm256_slli_si256(v, 4)); }
+    v = add<U>(v, _mm256_slli_si256(v, 8));
+    // Add the last value of the low half to the high half, and the last value
+    // of the previous block to everything.
+    v = add<U>(v, _mm256_shuffle_epi8(_mm256_permute2x128_si256(v, v, 0x08), last));
+    v = add<U>(v, carry);
+    store256(x_i, v);
+    carry = _mm256_shuffle_epi8(_mm256_permute2x128_si256(v, v, 0x11), last);
+  }
+  if (i > 0) { prev = x[i - 1]; }
+  return i;
+}
+#endif // __AVX2__
+
+template <class U>
+void delta_decode(U* x, index_t begin, index_t end, index_t row) {
+  constexpr index_t lanes = 64 / sizeof(U);
+  while (begin < end) {
+    const index_t row_end = std::min(end, (begin / row + 1) * row);
+    index_t i = begin;
+    for (; i + lanes <= row_end; i += lanes) {
+      for (index_t k = 0; k < lanes; k++) {
+        x[i + k] = zigzag_decode(x[i + k]);
+      }
+    }
+    for (; i < row_end; i++) {
+      x[i] = zigzag_decode(x[i]);
+    }
+    U prev = begin % row == 0 ? 0 : x[begin - 1];
+    i = begin;
+#if defined(__AVX2__) && !defined(__CUDA__)
+    i += prefix_sum_avx2(x + begin, row_end - begin, prev);
+#endif
+    for (; i < row_end; i++) {
+      prev = static_cast<U>(prev + x[i]);
+      x[i] = prev;
+    }
+    begin = row_end;
+  }
+}
+
+inline bool can_delta_code(size_t size) { return size == 1 || size == 2 || size == 4 || size == 8; }
+
+// Delta code values of `size` bytes, which must be 1, 2, 4, or 8.
+inline void delta_encode(
+    const uint8_t* src, index_t begin, index_t end, size_t size, index_t row, uint8_t* dst) {
+  switch (size) {
+  case 1: delta_encode(src, begin, end, row, dst); break;
+  case 2:
+    delta_encode(reinterpret_cast<const uint16_t*>(src), begin, end, row,
+        reinterpret_cast<uint16_t*>(dst));
+    break;
+  case 4:
+    delta_encode(reinterpret_cast<const uint32_t*>(src), begin, end, row,
+        reinterpret_cast<uint32_t*>(dst));
+    break;
+  case 8:
+    delta_encode(reinterpret_cast<const uint64_t*>(src), begin, end, row,
+        reinterpret_cast<uint64_t*>(dst));
+    break;
+  }
+}
+inline void delta_decode(uint8_t* x, index_t begin, index_t end, size_t size, index_t row) {
+  switch (size) {
+  case 1: delta_decode(x, begin, end, row); break;
+  case 2: delta_decode(reinterpret_cast<uint16_t*>(x), begin, end, row); break;
+  case 4: delta_decode(reinterpret_cast<uint32_t*>(x), begin, end, row); break;
+  case 8: delta_decode(reinterpret_cast<uint64_t*>(x), begin, end, row); break;
+  }
+}
+
+#if defined(__AVX2__) && !defined(__CUDA__)
+
+// Transpose a 4x4 matrix of 64-bit elements.
+NDARRAY_INLINE void transpose4x64(__m256i& r0, __m256i& r1, __m256i& r2, __m256i& r3) {
+  __m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+  __m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+  __m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+  __m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+  r0 = _mm256_permute2x128_si256(t0, t2, 0x20);
+  r1 = _mm256_permute2x128_si256(t1, t3, 0x20);
+  r2 = _mm256_permute2x128_si256(t0, t2, 0x31);
+  r3 = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+// Transpose an 8x8 matrix of 32-bit elements.
+NDARRAY_INLINE void transpose8x32(__m256i* r) {
+  __m256i t[8];
+  for (int i = 0; i < 8; i += 2) {
+    t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+    t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+  }
+  __m256i s[8];
+  for (int i = 0; i < 8; i += 4) {
+    s[i + 0] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+    s[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+    s[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+    s[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+  }
+  for (int i = 0; i < 4; i++) {
+    r[i] = _mm256_permute2x128_si256(s[i], s[i + 4], 0x20);
+    r[i + 4] = _mm256_permute2x128_si256(s[i], s[i + 4], 0x31);
+  }
+}
+
+// These shuffle or unshuffle blocks of 32 values, and return the number of
+// values shuffled.
+inline index_t shuffle_bytes_avx2(
+    std::integral_constant<size_t, 2>, const uint8_t* src, index_t n, uint8_t* dst,
+    index_t stride) {
+  const __m256i bytes = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, 0,
+      2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  index_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    // Each row becomes 16 values of byte 0, and 16 values of byte 1.
+    __m256i r0 = _mm256_shuffle_epi8(load256(src + i * 2), bytes);
+    __m256i r1 = _mm256_shuffle_epi8(load256(src + i * 2 + 32), bytes);
+    r0 = _mm256_permute4x64_epi64(r0, 0xd8);
+    r1 = _mm256_permute4x64_epi64(r1, 0xd8);
+    store256(dst + i, _mm256_permute2x128_si256(r0, r1, 0x20));
+    store256(dst + stride + i, _mm256_permute2x128_si256(r0, r1, 0x31));
+  }
+  return i;
+}
+inline index_t unshuffle_bytes_avx2(
+    std::integral_constant<size_t, 2>, const uint8_t* src, index_t stride, index_t n,
+    uint8_t* dst) {
+  const __m256i bytes = _mm256_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15, 0,
+      8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+  index_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i p0 = load256(src + i);
+    __m256i p1 = load256(src + stride + i);
+    __m256i r0 = _mm256_permute2x128_si256(p0, p1, 0x20);
+    __m256i r1 = _mm256_permute2x128_si256(p0, p1, 0x31);
+    r0 = _mm256_shuffle_epi8(_mm256_permute4x64_epi64(r0, 0xd8), bytes);
+    r1 = _mm256_shuffle_epi8(_mm256_permute4x64_epi64(r1, 0xd8), bytes);
+    store256(dst + i * 2, r0);
+    store256(dst + i * 2 + 32, r1);
+  }
+  return i;
+}
+
+inline index_t shuffle_bytes_avx2(
+    std::integral_constant<size_t, 4>, const uint8_t* src, index_t n, uint8_t* dst,
+    index_t stride) {
+  const __m256i bytes = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0,
+      4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+  const __m256i dwords = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  index_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    // Each row becomes 8 values of each of the 4 bytes.
+    __m256i r[4];
+    for (int k = 0; k < 4; k++) {
+      r[k] = _mm256_shuffle_epi8(load256(src + i * 4 + k * 32), bytes);
+      r[k] = _mm256_permutevar8x32_epi32(r[k], dwords);
+    }
+    transpose4x64(r[0], r[1], r[2], r[3]);
+    for (int b = 0; b < 4; b++) {
+      store256(dst + b * stride + i, r[b]);
+    }
+  }
+  return i;
+}
+inline index_t unshuffle_bytes_avx2(
+    std::integral_constant<size_t, 4>, const uint8_t* src, index_t stride, index_t n,
+    uint8_t* dst) {
+  const __m256i bytes = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0,
+      4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+  const __m256i dwords = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  index_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i r[4];
+    for (int b = 0; b < 4; b++) {
+      r[b] = load256(src + b * stride + i);
+    }
+    transpose4x64(r[0], r[1], r[2], r[3]);
+    for (int k = 0; k < 4; k++) {
+      r[k] = _mm256_permutevar8x32_epi32(r[k], dwords);
+      store256(dst + i * 4 + k * 32, _mm256_shuffle_epi8(r[k], bytes));
+    }
+  }
+  return i;
+}
+
+inline index_t shuffle_bytes_avx2(
+    std::integral_constant<size_t, 8>, const uint8_t* src, index_t n, uint8_t* dst,
+    index_t stride) {
+  const __m256i bytes = _mm256_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15, 0,
+      8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+  index_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    // Each row becomes 4 values of each of the 8 bytes.
+    __m256i r[8];
+    for (int k = 0; k < 8; k++) {
+      __m256i x = _mm256_shuffle_epi8(load256(src + i * 8 + k * 32), bytes);
+      __m256i swapped = _mm256_permute2x128_si256(x, x, 0x01);
+      __m256i lo = _mm256_unpacklo_epi16(x, swapped);
+      __m256i hi = _mm256_unpackhi_epi16(x, swapped);
+      r[k] = _mm256_permute2x128_si256(lo, hi, 0x20);
+    }
+    transpose8x32(r);
+    for (int b = 0; b < 8; b++) {
+      store256(dst + b * stride + i, r[b]);
+    }
+  }
+  return i;
+}
+inline index_t unshuffle_bytes_avx2(
+    std::integral_constant<size_t, 8>, const uint8_t* src, index_t stride, index_t n,
+    uint8_t* dst) {
+  const __m256i words = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15, 0,
+      1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+  const __m256i bytes = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, 0,
+      2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  index_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i r[8];
+    for (int b = 0; b < 8; b++) {
+      r[b] = load256(src + b * stride + i);
+    }
+    transpose8x32(r);
+    for (int k = 0; k < 8; k++) {
+      __m256i x = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(r[k], words), 0xd8);
+      store256(dst + i * 8 + k * 32, _mm256_shuffle_epi8(x, bytes));
+    }
+  }
+  return i;
+}
+#endif // __AVX2__
+
+template <size_t Size>
+void shuffle_bytes(const uint8_t* src, index_t n, uint8_t* dst, index_t stride) {
+  index_t i = 0;
+#if defined(__AVX2__) && !defined(__CUDA__)
+  i = shuffle_bytes_avx2(std::integral_constant<size_t, Size>(), src, n, dst, stride);
+#endif
+  for (; i < n; i++) {
+    for (size_t b = 0; b < Size; b++) {
+      dst[b * stride + i] = src[i * Size + b];
+    }
+  }
+}
+template <size_t Size>
+void unshuffle_bytes(const uint8_t* src, index_t stride, index_t n, uint8_t* dst) {
+  index_t i = 0;
+#if defined(__AVX2__) && !defined(__CUDA__)
+  i = unshuffle_bytes_avx2(std::integral_constant<size_t, Size>(), src, stride, n, dst);
+#endif
+  for (; i < n; i++) {
+    for (size_t b = 0; b < Size; b++) {
+      dst[i * Size + b] = src[b * stride + i];
+    }
+  }
+}
+
+// Rearrange `n` values of `size` bytes at `src`, so byte `b` of value `i` is
+// at `dst[b * stride + i]`.
+inline void shuffle_bytes(
+    const uint8_t* src, index_t n, size_t size, uint8_t* dst, index_t stride) {
+  switch (size) {
+  case 1: std::memcpy(dst, src, n); break;
+  case 2: shuffle_bytes<2>(src, n, dst, stride); break;
+  case 4: shuffle_bytes<4>(src, n, dst, stride); break;
+  case 8: shuffle_bytes<8>(src, n, dst, stride); break;
+  default:
+    for (index_t i = 0; i < n; i++) {
+      for (size_t b = 0; b < size; b++) {
+        dst[b * stride + i] = src[i * size + b];
+      }
+    }
+  }
+}
+inline void unshuffle_bytes(
+    const uint8_t* src, index_t stride, index_t n, size_t size, uint8_t* dst) {
+  switch (size) {
+  case 1: std::memcpy(dst, src, n); break;
+  case 2: unshuffle_bytes<2>(src, stride, n, dst); break;
+  case 4: unshuffle_bytes<4>(src, stride, n, dst); break;
+  case 8: unshuffle_bytes<8>(src, stride, n, dst); break;
+  default:
+    for (index_t i = 0; i < n; i++) {
+      for (size_t b = 0; b < size; b++) {
+        dst[i * size + b] = src[b * stride + i];
+      }
+    }
+  }
+}
+
+// Transpose an 8x8 matrix of bits, where byte `i` of `x` is row `i`.
+NDARRAY_INLINE uint64_t transpose_bits8x8(uint64_t x) {
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+#if defined(__AVX2__) && !defined(__CUDA__)
+// Transpose the 8x8 matrix of bits in each 64-bit element of `x`.
+NDARRAY_INLINE __m256i transpose_bits8x8(__m256i x) {
+  __m256i t;
+  t = _mm256_xor_si256(x, _mm256_srli_epi64(x, 7));
+  t = _mm256_and_si256(t, _mm256_set1_epi64x(0x00aa00aa00aa00aall));
+  x = _mm256_xor_si256(x, _mm256_xor_si256(t, _mm256_slli_epi64(t, 7)));
+  t = _mm256_xor_si256(x, _mm256_srli_epi64(x, 14));
+  t = _mm256_and_si256(t, _mm256_set1_epi64x(0x0000cccc0000ccccll));
+  x = _mm256_xor_si256(x, _mm256_xor_si256(t, _mm256_slli_epi64(t, 14)));
+  t = _mm256_xor_si256(x, _mm256_srli_epi64(x, 28));
+  t = _mm256_and_si256(t, _mm256_set1_epi64x(0x00000000f0f0f0f0ll));
+  x = _mm256_xor_si256(x, _mm256_xor_si256(t, _mm256_slli_epi64(t, 28)));
+  return x;
+}
+#endif // __AVX2__
+
+// Rearrange the bits of `n` bytes at `src`, where `n` is a multiple of 8, so
+// bit `k` of byte `i` is bit `i % 8` of `dst[k * stride + i / 8]`.
+inline void shuffle_bits(const uint8_t* src, index_t n, uint8_t* dst, index_t stride) {
+  index_t i = 0;
+#if defined(__AVX2__) && !defined(__CUDA__)
+  const __m256i bytes = _mm256_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15, 0,
+      8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+  for (; i + 256 <= n; i += 256) {
+    // After transposing the bits of each 64-bit element, byte `k` of each
+    // element belongs in row `k`. Interleave the bytes of the two elements of
+    // each 128-bit half, and transpose the resulting 8x8 matrices of 16-bit
+    // pairs of bytes.
+    __m256i r[8];
+    for (int j = 0; j < 8; j++) {
+      r[j] = _mm256_shuffle_epi8(transpose_bits8x8(load256(src + i + j * 32)), bytes);
+    }
+    __m256i t[8];
+    for (int j = 0; j < 8; j += 2) {
+      t[j] = _mm256_unpacklo_epi16(r[j], r[j + 1]);
+      t[j + 1] = _mm256_unpackhi_epi16(r[j], r[j + 1]);
+    }
+    __m256i q[8];
+    for (int j = 0; j < 8; j += 4) {
+      q[j + 0] = _mm256_unpacklo_epi32(t[j], t[j + 2]);
+      q[j + 1] = _mm256_unpackhi_epi32(t[j], t[j + 2]);
+      q[j + 2] = _mm256_unpacklo_epi32(t[j + 1], t[j + 3]);
+      q[j + 3] = _mm256_unpackhi_epi32(t[j + 1], t[j + 3]);
+    }
+    for (int k = 0; k < 8; k++) {
+      __m256i x = k % 2 == 0 ? _mm256_unpacklo_epi64(q[k / 2], q[k / 2 + 4])
+                             : _mm256_unpackhi_epi64(q[k / 2], q[k / 2 + 4]);
+      // The low half has pairs of bytes from elements 0 and 2 of each register,
+      // and the high half has pairs from elements 1 and 3.
+      x = _mm256_permute4x64_epi64(x, 0xd8);
+      store256(dst + k * stride + i / 8, _mm256_unpacklo_epi16(x, _mm256_srli_si256(x, 8)));
+    }
+  }
+#endif
+  for (; i < n; i += 8) {
+    uint64_t x = transpose_bits8x8(load_bytes<uint64_t>(src + i));
+    for (int k = 0; k < 8; k++) {
+      dst[k * stride + i / 8] = static_cast<uint8_t>(x >> (k * 8));
+    }
+  }
+}
+inline void unshuffle_bits(const uint8_t* src, index_t stride, index_t n, uint8_t* dst) {
+  index_t i = 0;
+#if defined(__AVX2__) && !defined(__CUDA__)
+  for (; i + 256 <= n; i += 256) {
+    // Transpose the bytes, so each 64-bit element contains byte `i / 8` of
+    // each of the 8 rows. The groups of 8 values in each element are
+    // `{b, b + 1 | b + 16, b + 17}` in the registers below.
+    __m256i r[8];
+    for (int k = 0; k < 8; k++) {
+      r[k] = load256(src + k * stride + i / 8);
+    }
+    __m256i r16[8];
+    for (int k = 0; k < 8; k += 2) {
+      r16[k] = _mm256_unpacklo_epi8(r[k], r[k + 1]);
+      r16[k + 1] = _mm256_unpackhi_epi8(r[k], r[k + 1]);
+    }
+    __m256i r32[8];
+    for (int k = 0; k < 8; k += 4) {
+      r32[k + 0] = _mm256_unpacklo_epi16(r16[k], r16[k + 2]);
+      r32[k + 1] = _mm256_unpackhi_epi16(r16[k], r16[k + 2]);
+      r32[k + 2] = _mm256_unpacklo_epi16(r16[k + 1], r16[k + 3]);
+      r32[k + 3] = _mm256_unpackhi_epi16(r16[k + 1], r16[k + 3]);
+    }
+    for (int q = 0; q < 4; q++) {
+      const index_t b = q * 4;
+      __m256i lo = transpose_bits8x8(_mm256_unpacklo_epi32(r32[q], r32[q + 4]));
+      __m256i hi = transpose_bits8x8(_mm256_unpackhi_epi32(r32[q], r32[q + 4]));
+      uint8_t* dst_b = dst + i + b * 8;
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_b), _mm256_castsi256_si128(lo));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_b + 16), _mm256_castsi256_si128(hi));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_b + 128), _mm256_extracti128_si256(lo, 1));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_b + 144), _mm256_extracti128_si256(hi, 1));
+    }
+  }
+#endif
+  for (; i < n; i += 8) {
+    uint64_t x = 0;
+    for (int k = 0; k < 8; k++) {
+      x |= static_cast<uint64_t>(src[k * stride + i / 8]) << (k * 8);
+    }
+    store_bytes(dst + i, transpose_bits8x8(x));
+  }
+}
+
+// Rearrange `n` values of `size` bytes at `src`, so bit `k` of byte `b` of
+// value `i` is bit `i % 8` of `dst[(b * 8 + k) * (n / 8) + i / 8]`. The last
+// `n % 8` values are stored after the rest without being rearranged. This
+// uses `n * size` bytes of `scratch`.
+inline void shuffle_bits(
+    const uint8_t* src, index_t n, size_t size, uint8_t* dst, uint8_t* scratch) {
+  const index_t n8 = n - n % 8;
+  const index_t stride = n8 / 8;
+  const uint8_t* bytes = src;
+  if (size > 1) {
+    shuffle_bytes(src, n8, size, scratch, n8);
+    bytes = scratch;
+  }
+  for (size_t b = 0; b < size; b++) {
+    shuffle_bits(bytes + b * n8, n8, dst + b * 8 * stride, stride);
+  }
+  std::memcpy(dst + n8 * size, src + n8 * size, (n - n8) * size);
+}
+inline void shuffle_bits(const uint8_t* src, index_t n, size_t size, uint8_t* dst) {
+  byte_buffer scratch = make_byte_buffer(n * size);
+  shuffle_bits(src, n, size, dst, scratch.get());
+}
+inline void unshuffle_bits(
+    const uint8_t* src, index_t n, size_t size, uint8_t* dst, uint8_t* scratch) {
+  const index_t n8 = n - n % 8;
+  const index_t stride = n8 / 8;
+  uint8_t* bytes = size > 1 ? scratch : dst;
+  for (size_t b = 0; b < size; b++) {
+    unshuffle_bits(src + b * 8 * stride, stride, n8, bytes + b * n8);
+  }
+  if (size > 1) { unshuffle_bytes(bytes, n8, n8, size, dst); }
+  std::memcpy(dst + n8 * size, src + n8 * size, (n - n8) * size);
+}
+inline void unshuffle_bits(const uint8_t* src, index_t n, size_t size, uint8_t* dst) {
+  byte_buffer scratch = make_byte_buffer(n * size);
+  unshuffle_bits(src, n, size, dst, scratch.get());
+}
+
+inline uint8_t* write_varint(uint64_t x, uint8_t* dst) {
+  while (x >= 0x80) {
+    *dst++ = static_cast<uint8_t>(x | 0x80);
+    x >>= 7;
+  }
+  *dst++ = static_cast<uint8_t>(x);
+  return dst;
+}
+inline uint64_t read_varint(const uint8_t*& src, const uint8_t* end) {
+  uint64_t x = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (src == end) { break; }
+    uint8_t byte = *src++;
+    x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) { return x; }
+  }
+  throw std::runtime_error("compressed data is invalid");
+}
+
+// Runs of zeros shorter than this are stored as literal bytes.
+constexpr size_t min_zero_run = 16;
+
+// `x` must not be zero.
+NDARRAY_INLINE int count_trailing_zeros(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(x);
+#else
+  int result = 0;
+  for (; (x & 1) == 0; x >>= 1) {
+    result++;
+  }
+  return result;
+#endif
+}
+
+// Bit `j` of the result is set if byte `j` of the first `min(n, 64)` bytes
+// at `src` is zero.
+NDARRAY_INLINE uint64_t zero_mask(const uint8_t* src, size_t n) {
+  if (n >= 64) {
+#if defined(__AVX2__) && !defined(__CUDA__)
+    const __m256i zero = _mm256_setzero_si256();
+    const uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(load256(src), zero));
+    const uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(load256(src + 32), zero));
+    return lo | static_cast<uint64_t>(hi) << 32;
+#else
+    n = 64;
+#endif
+  }
+  uint64_t mask = 0;
+  for (size_t j = 0; j < n; j++) {
+    mask |= static_cast<uint64_t>(src[j] == 0) << j;
+  }
+  return mask;
+}
+
+// The most bytes `encode_zero_runs` writes for `n` bytes. Each zero run is
+// longer than the tokens that replace it, so only the first literal token can
+// make the result bigger than `n`.
+inline size_t max_zero_runs_size(size_t n) { return n + 16; }
+
+// Write `n` bytes of `src` to `dst` as a sequence of tokens, and return the
+// number of bytes written. Each token is a varint `length * 2 + is_zero_run`,
+// followed by `length` literal bytes if the token is not a zero run.
+inline size_t encode_zero_runs(const uint8_t* src, size_t n, uint8_t* dst) {
+  static_assert(min_zero_run == 16, "the search for zero runs assumes they are 16 bytes");
+  uint8_t* const dst_begin = dst;
+  auto write_literal = [&](size_t begin, size_t end) {
+    if (begin == end) { return; }
+    dst = write_varint((end - begin) * 2, dst);
+    std::memcpy(dst, src + begin, end - begin);
+    dst += end - begin;
+  };
+  size_t literal = 0;
+  size_t i = 0;
+  while (i < n) {
+    // Find the runs of 16 zeros that begin in the next 48 bytes, which are
+    // entirely in the 64 bytes of the mask.
+    uint64_t runs = zero_mask(src + i, n - i);
+    runs &= runs >> 1;
+    runs &= runs >> 2;
+    runs &= runs >> 4;
+    runs &= runs >> 8;
+    const size_t step = std::min<size_t>(48, n - i);
+    runs &= (static_cast<uint64_t>(1) << step) - 1;
+    if (runs == 0) {
+      i += step;
+      continue;
+    }
+    const size_t begin = i + count_trailing_zeros(runs);
+    size_t end = begin + min_zero_run;
+    while (end < n) {
+      const uint64_t nonzero = ~zero_mask(src + end, n - end);
+      if (nonzero != 0) {
+        end = std::min(n, end + count_trailing_zeros(nonzero));
+        break;
+      }
+      end += 64;
+    }
+    write_literal(literal, begin);
+    dst = write_varint((end - begin) * 2 + 1, dst);
+    literal = end;
+    i = end;
+  }
+  write_literal(literal, n);
+  return dst - dst_begin;
+}
+inline void encode_zero_runs(const uint8_t* src, size_t n, std::vector<uint8_t>& dst) {
+  const size_t offset = dst.size();
+  dst.resize(offset + max_zero_runs_size(n));
+  dst.resize(offset + encode_zero_runs(src, n, dst.data() + offset));
+}
+// Decode tokens from `src` until `n` bytes have been written to `dst`, and
+// advance `src` past them.
+inline void decode_zero_runs(const uint8_t*& src, const uint8_t* end, uint8_t* dst, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    const uint64_t token = read_varint(src, end);
+    const uint64_t length = token / 2;
+    if (length > n - i) { throw std::runtime_error("compressed data is invalid"); }
+    if (token & 1) {
+      std::memset(dst + i, 0, length);
+    } else {
+      if (length > static_cast<uint64_t>(end - src)) {
+        throw std::runtime_error("compressed data is invalid");
+      }
+      std::memcpy(dst + i, src, length);
+      src += length;
+    }
+    i += length;
+  }
+}
+inline void decode_zero_runs(const uint8_t* src, size_t size, uint8_t* dst, size_t n) {
+  const uint8_t* end = src + size;
+  decode_zero_runs(src, end, dst, n);
+  if (src != end) { throw std::runtime_error("compressed data is invalid"); }
+}
+
+// Values are compressed in independent blocks of about this many bytes, so
+// each stage reads the output of the previous stage from the cache.
+constexpr size_t codec_block_bytes = 1 << 15;
+
+inline index_t codec_block_values(size_t size) {
+  return std::max<index_t>(8, codec_block_bytes / size / 8 * 8);
+}
+
+// The header of compressed data.
+struct codec_header {
+  static constexpr uint32_t magic_value = 0x3143444e; // "NDC1"
+  static constexpr size_t size = 32;
+
+  uint32_t magic = magic_value;
+  uint8_t delta = 0;
+  uint8_t shuffle = 0;
+  uint8_t zero_runs = 0;
+  uint32_t value_size = 0;
+  uint32_t block = 0;
+  uint64_t count = 0;
+  uint64_t row = 0;
+
+  void write(uint8_t* dst) const {
+    std::memset(dst, 0, size);
+    store_bytes(dst, magic);
+    dst[4] = delta;
+    dst[5] = shuffle;
+    dst[6] = zero_runs;
+    store_bytes(dst + 8, value_size);
+    store_bytes(dst + 12, block);
+    store_bytes(dst + 16, count);
+    store_bytes(dst + 24, row);
+  }
+  static codec_header read(const uint8_t* src, size_t src_size) {
+    codec_header result;
+    if (src_size < size || load_bytes<uint32_t>(src) != magic_value) {
+      throw std::runtime_error("compressed data is invalid");
+    }
+    result.delta = src[4];
+    result.shuffle = src[5];
+    result.zero_runs = src[6];
+    result.value_size = load_bytes<uint32_t>(src + 8);
+    result.block = load_bytes<uint32_t>(src + 12);
+    result.count = load_bytes<uint64_t>(src + 16);
+    result.row = load_bytes<uint64_t>(src + 24);
+    return result;
+  }
+};
+
+inline std::vector<uint8_t> compress(
+    const uint8_t* values, index_t n, size_t size, index_t row, const codec& c) {
+  codec_header header;
+  header.delta = c.delta && can_delta_code(size);
+  header.shuffle = static_cast<uint8_t>(c.shuffle);
+  header.zero_runs = c.zero_runs;
+  header.value_size = static_cast<uint32_t>(size);
+  header.block = static_cast<uint32_t>(codec_block_values(size));
+  header.count = n;
+  header.row = row;
+
+  const size_t bytes = n * size;
+  std::vector<uint8_t> result(codec_header::size);
+  header.write(result.data());
+  result.reserve(codec_header::size + bytes + bytes / 64 + 16);
+
+  const index_t block = header.block;
+  const size_t block_bytes = std::min<index_t>(n, block) * size;
+  byte_buffer deltas = make_byte_buffer(header.delta ? block_bytes : 0);
+  byte_buffer shuffled = make_byte_buffer(c.shuffle != shuffle_kind::none ? block_bytes : 0);
+  byte_buffer scratch = make_byte_buffer(c.shuffle == shuffle_kind::bit ? block_bytes : 0);
+  for (index_t i = 0; i < n; i += block) {
+    const index_t m = std::min(block, n - i);
+    const uint8_t* src = values + i * size;
+    if (header.delta) {
+      delta_encode(values, i, i + m, size, row, deltas.get());
+      src = deltas.get();
+    }
+    if (c.shuffle == shuffle_kind::byte) {
+      shuffle_bytes(src, m, size, shuffled.get(), m);
+      src = shuffled.get();
+    } else if (c.shuffle == shuffle_kind::bit) {
+      shuffle_bits(src, m, size, shuffled.get(), scratch.get());
+      src = shuffled.get();
+    }
+    if (header.zero_runs) {
+      encode_zero_runs(src, m * size, result);
+    } else {
+      result.insert(result.end(), src, src + m * size);
+    }
+  }
+  return result;
+}
+
+inline void decompress(
+    const uint8_t* data, size_t data_size, index_t n, size_t size, index_t row, uint8_t* values) {
+  const codec_header header = codec_header::read(data, data_size);
+  if (header.value_size != size || header.count != static_cast<uint64_t>(n) ||
+      header.row != static_cast<uint64_t>(row) ||
+      header.shuffle > static_cast<uint8_t>(shuffle_kind::bit) || header.block == 0) {
+    throw std::runtime_error("compressed data does not match the array");
+  }
+  const shuffle_kind shuffle = static_cast<shuffle_kind>(header.shuffle);
+  const uint8_t* src = data + codec_header::size;
+  const uint8_t* end = data + data_size;
+
+  const index_t block = header.block;
+  const size_t block_bytes = std::min<index_t>(n, block) * size;
+  byte_buffer shuffled = make_byte_buffer(shuffle != shuffle_kind::none ? block_bytes : 0);
+  byte_buffer scratch = make_byte_buffer(shuffle == shuffle_kind::bit ? block_bytes : 0);
+  for (index_t i = 0; i < n; i += block) {
+    const index_t m = std::min(block, n - i);
+    const size_t m_bytes = m * size;
+    uint8_t* dst = values + i * size;
+    // The stage before the shuffle writes to `shuffled` if there is a shuffle.
+    uint8_t* runs = shuffle != shuffle_kind::none ? shuffled.get() : dst;
+    const uint8_t* block_src = runs;
+    if (header.zero_runs) {
+      decode_zero_runs(src, end, runs, m_bytes);
+    } else {
+      if (m_bytes > static_cast<size_t>(end - src)) {
+        throw std::runtime_error("compressed data is invalid");
+      }
+      if (shuffle == shuffle_kind::none) {
+        std::memcpy(dst, src, m_bytes);
+      } else {
+        block_src = src;
+      }
+      src += m_bytes;
+    }
+    if (shuffle == shuffle_kind::byte) {
+      unshuffle_bytes(block_src, m, m, size, dst);
+    } else if (shuffle == shuffle_kind::bit) {
+      unshuffle_bits(block_src, m, size, dst, scratch.get());
+    }
+    if (header.delta) { delta_decode(values, i, i + m, size, row); }
+  }
+  if (src != end) { throw std::runtime_error("compressed data is invalid"); }
+}
+
+// Make a dense shape with the same mins and extents as `s`, where the values
+// are stored contiguously in the order of the dims.
+template <class Shape, size_t... Is>
+auto make_dense_rows(const Shape& s, index_sequence<Is...>) {
+  using result_type = dense_shape<sizeof...(Is)>;
+  result_type result(typename std::tuple_element<Is, typename result_type::dims_type>::type(
+      s.template dim<Is>().min(), s.template dim<Is>().extent())...);
+  result.resolve();
+  return result;
+}
+template <class Shape>
+auto make_dense_rows(const Shape& s) {
+  return make_dense_rows(s, typename Shape::dim_indices());
+}
+
+template <class Shape>
+index_t row_extent(const Shape& s) {
+  return std::max<index_t>(1, s.template dim<0>().extent());
+}
+
+} // namespace internal
+
+/** Compress the values of `src` with the stages of `c`. The values must be
+ * trivially copyable. Delta coding is along dim 0 of `src`. */
+template <class T, class Shape>
+std::vector<uint8_t> compress(const array_ref<T, Shape>& src, const codec& c = codec()) {
+  using value_type = typename std::remove_const<T>::type;
+  static_assert(std::is_trivially_copyable<value_type>::value,
+      "compressed values must be trivially copyable");
+  static_assert(Shape::rank() >= 1, "compressed arrays must have at least one dimension");
+  const index_t n = src.size();
+  const index_t row = internal::row_extent(src.shape());
+  if (n == 0) { return internal::compress(nullptr, 0, sizeof(value_type), row, c); }
+  auto dense_shape = internal::make_dense_rows(src.shape());
+  if (src.shape() == dense_shape) {
+    const value_type* values = &src[src.shape().min()];
+    return internal::compress(
+        reinterpret_cast<const uint8_t*>(values), n, sizeof(value_type), row, c);
+  } else {
+    auto values = make_copy(src, dense_shape);
+    return internal::compress(
+        reinterpret_cast<const uint8_t*>(values.data()), n, sizeof(value_type), row, c);
+  }
+}
+template <class T, class Shape, class Alloc>
+std::vector<uint8_t> compress(const array<T, Shape, Alloc>& src, const codec& c = codec()) {
+  return compress(src.cref(), c);
+}
+
+/** Decompress the `size` bytes at `data` produced by `compress` to `dst`. The
+ * shape of `dst` must have the same size and extent of dim 0 as the array that
+ * was compressed. Throws `std::runtime_error` if `data` is not valid. */
+template <class T, class Shape>
+void decompress(const uint8_t* data, size_t size, const array_ref<T, Shape>& dst) {
+  static_assert(
+      std::is_trivially_copyable<T>::value, "compressed values must be trivially copyable");
+  const index_t n = dst.size();
+  const index_t row = internal::row_extent(dst.shape());
+  if (n == 0) {
+    internal::decompress(data, size, 0, sizeof(T), row, nullptr);
+    return;
+  }
+  auto dense_shape = internal::make_dense_rows(dst.shape());
+  if (dst.shape() == dense_shape) {
+    T* values = &dst[dst.shape().min()];
+    internal::decompress(data, size, n, sizeof(T), row, reinterpret_cast<uint8_t*>(values));
+  } else {
+    array<T, decltype(dense_shape)> values(dense_shape);
+    internal::decompress(
+        data, size, n, sizeof(T), row, reinterpret_cast<uint8_t*>(values.data()));
+    copy(values, dst);
+  }
+}
+template <class T, class Shape, class Alloc>
+void decompress(const uint8_t* data, size_t size, array<T, Shape, Alloc>& dst) {
+  decompress(data, size, dst.ref());
+}
+template <class T, class Shape>
+void decompress(const std::vector<uint8_t>& data, const array_ref<T, Shape>& dst) {
+  decompress(data.data(), data.size(), dst);
+}
+template <class T, class Shape, class Alloc>
+void decompress(const std::vector<uint8_t>& data, array<T, Shape, Alloc>& dst) {
+  decompress(data.data(), data.size(), dst.ref());
+}
+
+} // namespace nda
+
+#endif // NDARRAY_CODEC_H
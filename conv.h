@@ -0,0 +1,498 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file conv.h
+ * \brief Convolution operators for neural network style tensors.
+ */
+#ifndef NDARRAY_CONV_H
+#define NDARRAY_CONV_H
+
+#include "array.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+namespace nda {
+
+/** Epilogue for `conv2d` that returns its argument unmodified. */
+struct no_activation {
+  template <class T>
+  T operator()(T x) const {
+    return x;
+  }
+};
+
+/** Epilogue for `conv2d` computing `max(x, 0)`. */
+struct relu {
+  template <class T>
+  T operator()(T x) const {
+    return std::max(x, static_cast<T>(0));
+  }
+};
+
+/** Epilogue for `conv2d` that clamps its argument to [`min`, `max`]. */
+template <class T>
+struct clamp_activation {
+  T min;
+  T max;
+
+  clamp_activation(T min, T max) : min(min), max(max) {}
+
+  template <class U>
+  U operator()(U x) const {
+    return std::min(std::max(x, static_cast<U>(min)), static_cast<U>(max));
+  }
+};
+
+namespace internal {
+
+// Compute one tile of `TileX` x `TileCO` outputs of a 2D convolution. When
+// `Full` is false, the tile may be smaller than this, with `nx` x `nco` outputs.
+// The accumulators are initialized with the bias, and the result of the
+// epilogue is written to the output once.
+template <index_t TileX, index_t TileCO, bool Full, class TAcc, class Input, class Filter,
+    class Bias, class Output, class Epilogue>
+void conv2d_tile(const Input& input, const Filter& filter, const Bias& bias,
+    const Output& output, const Epilogue& epilogue, index_t x0, index_t nx, index_t co0,
+    index_t nco, index_t y, index_t n) {
+  if (Full) {
+    nx = TileX;
+    nco = TileCO;
+  }
+  TAcc acc[TileX][TileCO];
+  for (index_t x = 0; x < nx; x++) {
+    for (index_t co = 0; co < nco; co++) {
+      acc[x][co] = bias(co0 + co);
+    }
+  }
+  for (index_t ci : filter.template dim<3>()) {
+    for (index_t dy : filter.template dim<2>()) {
+      for (index_t dx : filter.template dim<1>()) {
+        for (index_t x = 0; x < nx; x++) {
+          const TAcc in = input(ci, x0 + x + dx, y + dy, n);
+          for (index_t co = 0; co < nco; co++) {
+            acc[x][co] += filter(co0 + co, dx, dy, ci) * in;
+          }
+        }
+      }
+    }
+  }
+  for (index_t x = 0; x < nx; x++) {
+    for (index_t co = 0; co < nco; co++) {
+      output(co0 + co, x0 + x, y, n) = epilogue(acc[x][co]);
+    }
+  }
+}
+
+} // namespace internal
+
+/** Compute a 2D convolution (correlation) of `input` with `filter`, followed
+ * by a bias and an `epilogue` function:
+ *
+ * `output(co, x, y, n) = epilogue(bias(co) +
+ *     sum(filter(co, dx, dy, ci) * input(ci, x + dx, y + dy, n)))`
+ *
+ * where the sum is over the domain of the `dx`, `dy`, and `ci` dimensions of
+ * `filter`. The input must contain all of the indices `x + dx`, `y + dy`
+ * required to compute the output, i.e. this is a 'valid' convolution.
+ *
+ * The tensors are stored with the channels innermost, i.e. 'NHWC' order. The
+ * output is computed in tiles of several `x` and `co` indices, where the tile
+ * is accumulated in registers starting from the bias, and the epilogue is
+ * applied as the tile is written to the output. Rows of the output are computed
+ * in parallel. */
+template <class TIn, class ShapeIn, class TF, class ShapeF, class TB, class ShapeB, class TOut,
+    class ShapeOut, class Epilogue = no_activation>
+void conv2d(const array_ref<TIn, ShapeIn>& input, const array_ref<TF, ShapeF>& filter,
+    const array_ref<TB, ShapeB>& bias, const array_ref<TOut, ShapeOut>& output,
+    const Epilogue& epilogue = Epilogue()) {
+  static_assert(ShapeIn::rank() == 4 && ShapeF::rank() == 4 && ShapeOut::rank() == 4,
+      "conv2d requires rank 4 input, filter, and output.");
+  static_assert(ShapeB::rank() == 1, "conv2d requires a rank 1 bias.");
+  using acc_type = std::common_type_t<decltype(std::declval<std::remove_const_t<TIn>>() *
+                                               std::declval<std::remove_const_t<TF>>()),
+      std::remove_const_t<TB>>;
+
+  // Adjust this depending on the target architecture. For AVX2, vectors are
+  // 256-bit. We want the tiles to be as big as possible without spilling any
+  // of the accumulator registers to the stack.
+  constexpr index_t vector_size = std::max<index_t>(1, 32 / sizeof(acc_type));
+  constexpr index_t tile_x = 4;
+  constexpr index_t tile_co = vector_size * 3;
+
+  const auto& co_dim = output.template dim<0>();
+  const auto& x_dim = output.template dim<1>();
+  const auto& y_dim = output.template dim<2>();
+  assert(input.template dim<1>().min() <= x_dim.min() + filter.template dim<1>().min());
+  assert(input.template dim<1>().max() >= x_dim.max() + filter.template dim<1>().max());
+  assert(input.template dim<2>().min() <= y_dim.min() + filter.template dim<2>().min());
+  assert(input.template dim<2>().max() >= y_dim.max() + filter.template dim<2>().max());
+
+  const index_t work_per_row = x_dim.extent() * static_cast<index_t>(filter.size());
+  const index_t min_strip = std::max<index_t>(1, (1 << 16) / std::max<index_t>(1, work_per_row));
+  for (index_t n : output.template dim<3>()) {
+    parallel_for(interval<>(y_dim.min(), y_dim.extent()), min_strip, [&](const interval<>& ys) {
+      for (index_t y : ys) {
+        for (index_t x = x_dim.min(); x <= x_dim.max(); x += tile_x) {
+          const index_t nx = std::min(tile_x, x_dim.max() - x + 1);
+          for (index_t co = co_dim.min(); co <= co_dim.max(); co += tile_co) {
+            const index_t nco = std::min(tile_co, co_dim.max() - co + 1);
+            if (nx == tile_x && nco == tile_co) {
+              internal::conv2d_tile<tile_x, tile_co, true, acc_type>(
+                  input, filter, bias, output, epilogue, x, nx, co, nco, y, n);
+            } else {
+              internal::conv2d_tile<tile_x, tile_co, false, acc_type>(
+                  input, filter, bias, output, epilogue, x, nx, co, nco, y, n);
+            }
+          }
+        }
+      }
+    });
+  }
+}
+template <class TIn, class ShapeIn, class AllocIn, class TF, class ShapeF, class AllocF, class TB,
+    class ShapeB, class AllocB, class TOut, class ShapeOut, class AllocOut,
+    class Epilogue = no_activation>
+void conv2d(const array<TIn, ShapeIn, AllocIn>& input, const array<TF, ShapeF, AllocF>& filter,
+    const array<TB, ShapeB, AllocB>& bias, array<TOut, ShapeOut, AllocOut>& output,
+    const Epilogue& epilogue = Epilogue()) {
+  conv2d(input.cref(), filter.cref(), bias.cref(), output.ref(), epilogue);
+}
+
+namespace internal {
+
+// The transform matrices for Winograd convolutions F(M x M, 3 x 3), from
+// "Fast Algorithms for Convolutional Neural Networks", Lavin and Gray, 2015.
+template <index_t M>
+struct winograd_matrices;
+
+template <>
+struct winograd_matrices<2> {
+  static double bt(index_t i, index_t j) {
+    static const double m[4][4] = {
+        {1, 0, -1, 0},
+        {0, 1, 1, 0},
+        {0, -1, 1, 0},
+        {0, 1, 0, -1},
+    };
+    return m[i][j];
+  }
+  static double g(index_t i, index_t j) {
+    static const double m[4][3] = {
+        {1, 0, 0},
+        {0.5, 0.5, 0.5},
+        {0.5, -0.5, 0.5},
+        {0, 0, 1},
+    };
+    return m[i][j];
+  }
+  static double at(index_t i, index_t j) {
+    static const double m[2][4] = {
+        {1, 1, 1, 0},
+        {0, 1, -1, -1},
+    };
+    return m[i][j];
+  }
+};
+
+template <>
+struct winograd_matrices<4> {
+  static double bt(index_t i, index_t j) {
+    static const double m[6][6] = {
+        {4, 0, -5, 0, 1, 0},
+        {0, -4, -4, 1, 1, 0},
+        {0, 4, -4, -1, 1, 0},
+        {0, -2, -1, 2, 1, 0},
+        {0, 2, -1, -2, 1, 0},
+        {0, 4, 0, -5, 0, 1},
+    };
+    return m[i][j];
+  }
+  static double g(index_t i, index_t j) {
+    static const double m[6][3] = {
+        {1.0 / 4, 0, 0},
+        {-1.0 / 6, -1.0 / 6, -1.0 / 6},
+        {-1.0 / 6, 1.0 / 6, -1.0 / 6},
+        {1.0 / 24, 1.0 / 12, 1.0 / 6},
+        {1.0 / 24, -1.0 / 12, 1.0 / 6},
+        {0, 0, 1},
+    };
+    return m[i][j];
+  }
+  static double at(index_t i, index_t j) {
+    static const double m[4][6] = {
+        {1, 1, 1, 1, 1, 0},
+        {0, 1, -1, 2, -2, 0},
+        {0, 1, 1, 4, 4, 0},
+        {0, 1, -1, 8, -8, 1},
+    };
+    return m[i][j];
+  }
+};
+
+// Compute a tile of `c(co, t) = sum(a(co, ci) * b(ci, t))`, of `TileT` x
+// `TileCO` accumulators. If `Full` is true, the tile is known to be full.
+template <index_t TileT, index_t TileCO, bool Full, class A, class B, class C>
+void winograd_gemm_tile(
+    const A& a, const B& b, const C& c, index_t t0, index_t nt, index_t co0, index_t nco) {
+  using T = typename C::value_type;
+  if (Full) {
+    nt = TileT;
+    nco = TileCO;
+  }
+  T acc[TileT][TileCO];
+  for (index_t t = 0; t < nt; t++) {
+    for (index_t co = 0; co < nco; co++) {
+      acc[t][co] = 0;
+    }
+  }
+  for (index_t ci : a.template dim<1>()) {
+    for (index_t t = 0; t < nt; t++) {
+      const T b_ci_t = b(ci, t0 + t);
+      for (index_t co = 0; co < nco; co++) {
+        acc[t][co] += a(co0 + co, ci) * b_ci_t;
+      }
+    }
+  }
+  for (index_t t = 0; t < nt; t++) {
+    for (index_t co = 0; co < nco; co++) {
+      c(co0 + co, t0 + t) = acc[t][co];
+    }
+  }
+}
+
+// Compute `c(co, t) = sum(a(co, ci) * b(ci, t))` in register tiles.
+template <index_t TileT, index_t TileCO, class A, class B, class C>
+void winograd_gemm(const A& a, const B& b, const C& c) {
+  const auto& co_dim = c.template dim<0>();
+  const auto& t_dim = c.template dim<1>();
+  for (index_t t0 = t_dim.min(); t0 <= t_dim.max(); t0 += TileT) {
+    const index_t nt = std::min(TileT, t_dim.max() - t0 + 1);
+    for (index_t co0 = co_dim.min(); co0 <= co_dim.max(); co0 += TileCO) {
+      const index_t nco = std::min(TileCO, co_dim.max() - co0 + 1);
+      if (nt == TileT && nco == TileCO) {
+        winograd_gemm_tile<TileT, TileCO, true>(a, b, c, t0, nt, co0, nco);
+      } else {
+        winograd_gemm_tile<TileT, TileCO, false>(a, b, c, t0, nt, co0, nco);
+      }
+    }
+  }
+}
+
+} // namespace internal
+
+/** A 3x3 filter transformed for Winograd convolutions F(`M` x `M`, 3 x 3).
+ * Transforming the filter is relatively expensive, this object can be
+ * computed once and reused for many calls to `winograd_conv2d`. `M` may be 2
+ * or 4. */
+template <index_t M, class T = float>
+class winograd_filter {
+  static_assert(M == 2 || M == 4, "Only F(2x2, 3x3) and F(4x4, 3x3) are supported.");
+
+public:
+  /** The size of the output tiles, and the size of the transformed tiles. */
+  static constexpr index_t tile = M;
+  static constexpr index_t alpha = M + 2;
+
+private:
+  // The transformed filter, with dimensions co, ci, xi, eta.
+  dense_array<T, 4> u_;
+  interval<> co_;
+  interval<> ci_;
+  index_t dx_min_;
+  index_t dy_min_;
+
+public:
+  /** Transform the filter `filter`, with dimensions (co, dx, dy, ci). The dx and
+   * dy dimensions must have extent 3. */
+  template <class TF, class ShapeF>
+  explicit winograd_filter(const array_ref<TF, ShapeF>& filter)
+      : u_({{filter.template dim<0>().min(), filter.template dim<0>().extent()},
+            {filter.template dim<3>().min(), filter.template dim<3>().extent()}, alpha, alpha}),
+        co_(filter.template dim<0>().min(), filter.template dim<0>().extent()),
+        ci_(filter.template dim<3>().min(), filter.template dim<3>().extent()),
+        dx_min_(filter.template dim<1>().min()), dy_min_(filter.template dim<2>().min()) {
+    assert(filter.template dim<1>().extent() == 3);
+    assert(filter.template dim<2>().extent() == 3);
+    using G = internal::winograd_matrices<M>;
+    for (index_t ci : ci_) {
+      for (index_t co : co_) {
+        // u = G * g * G^T
+        double gg[alpha][3];
+        for (index_t i = 0; i < alpha; i++) {
+          for (index_t j = 0; j < 3; j++) {
+            gg[i][j] = 0;
+            for (index_t k = 0; k < 3; k++) {
+              gg[i][j] += G::g(i, k) * filter(co, dx_min_ + k, dy_min_ + j, ci);
+            }
+          }
+        }
+        for (index_t i = 0; i < alpha; i++) {
+          for (index_t j = 0; j < alpha; j++) {
+            double u = 0;
+            for (index_t k = 0; k < 3; k++) {
+              u += gg[i][k] * G::g(j, k);
+            }
+            u_(co, ci, i, j) = static_cast<T>(u);
+          }
+        }
+      }
+    }
+  }
+  template <class TF, class ShapeF, class Alloc>
+  explicit winograd_filter(const array<TF, ShapeF, Alloc>& filter)
+      : winograd_filter(filter.cref()) {}
+
+  /** The transformed filter, with dimensions co, ci, xi, eta. */
+  const dense_array<T, 4>& transformed() const { return u_; }
+
+  /** The output and input channels of the filter. */
+  const interval<>& co() const { return co_; }
+  const interval<>& ci() const { return ci_; }
+
+  /** The offset of the first tap of the filter. */
+  index_t dx_min() const { return dx_min_; }
+  index_t dy_min() const { return dy_min_; }
+};
+
+/** Compute the same result as `conv2d` for a 3x3 filter, using the Winograd
+ * algorithm F(`M` x `M`, 3 x 3) with the pre-transformed filter `filter`.
+ *
+ * Each `M` x `M` tile of the output requires `(M + 2)^2` multiplies per input
+ * and output channel, instead of `9 * M^2`, i.e. 2.25x fewer for `M = 2`, and
+ * 4x fewer for `M = 4`, at the expense of some numerical precision. The
+ * products are computed as `(M + 2)^2` matrix multiplies for a batch of tiles
+ * at a time. Partial tiles at the edges of the output are computed from
+ * zero-padded input, and only the valid outputs are written. */
+template <index_t M, class T, class TIn, class ShapeIn, class TB, class ShapeB, class TOut,
+    class ShapeOut, class Epilogue = no_activation>
+void winograd_conv2d(const array_ref<TIn, ShapeIn>& input, const winograd_filter<M, T>& filter,
+    const array_ref<TB, ShapeB>& bias, const array_ref<TOut, ShapeOut>& output,
+    const Epilogue& epilogue = Epilogue()) {
+  static_assert(ShapeIn::rank() == 4 && ShapeOut::rank() == 4,
+      "winograd_conv2d requires rank 4 input and output.");
+  using Mat = internal::winograd_matrices<M>;
+  constexpr index_t alpha = M + 2;
+  // The number of tiles to transform and multiply at once.
+  constexpr index_t batch = 16;
+
+  const auto& u = filter.transformed();
+  const interval<>& co_dim = filter.co();
+  const interval<>& ci_dim = filter.ci();
+  const auto& x_dim = output.template dim<1>();
+  const auto& y_dim = output.template dim<2>();
+  const auto& in_x = input.template dim<1>();
+  const auto& in_y = input.template dim<2>();
+  assert(output.template dim<0>().min() >= co_dim.min());
+  assert(output.template dim<0>().max() <= co_dim.max());
+
+  const index_t tiles_x = (x_dim.extent() + M - 1) / M;
+  const index_t tiles_y = (y_dim.extent() + M - 1) / M;
+
+  constexpr index_t vector_size = std::max<index_t>(1, 32 / sizeof(T));
+  for (index_t n : output.template dim<3>()) {
+    parallel_for(interval<>(0, tiles_y), [&](const interval<>& tys) {
+      // Buffers for the transformed input and products of a batch of tiles.
+      dense_array<T, 4> v({ci_dim, batch, alpha, alpha});
+      dense_array<T, 4> m({co_dim, batch, alpha, alpha});
+      for (index_t ty : tys) {
+        const index_t y0 = y_dim.min() + ty * M;
+        for (index_t tx0 = 0; tx0 < tiles_x; tx0 += batch) {
+          const index_t nt = std::min(batch, tiles_x - tx0);
+
+          // Transform the input tiles: v = B^T * d * B
+          for (index_t t = 0; t < nt; t++) {
+            const index_t x0 = x_dim.min() + (tx0 + t) * M;
+            for (index_t ci : ci_dim) {
+              T d[alpha][alpha];
+              for (index_t j = 0; j < alpha; j++) {
+                const index_t y = y0 + filter.dy_min() + j;
+                for (index_t i = 0; i < alpha; i++) {
+                  const index_t x = x0 + filter.dx_min() + i;
+                  d[i][j] = in_x.is_in_range(x) && in_y.is_in_range(y) ? input(ci, x, y, n) : 0;
+                }
+              }
+              T btd[alpha][alpha];
+              for (index_t i = 0; i < alpha; i++) {
+                for (index_t j = 0; j < alpha; j++) {
+                  T sum = 0;
+                  for (index_t k = 0; k < alpha; k++) {
+                    sum += static_cast<T>(Mat::bt(i, k)) * d[k][j];
+                  }
+                  btd[i][j] = sum;
+                }
+              }
+              for (index_t i = 0; i < alpha; i++) {
+                for (index_t j = 0; j < alpha; j++) {
+                  T sum = 0;
+                  for (index_t k = 0; k < alpha; k++) {
+                    sum += btd[i][k] * static_cast<T>(Mat::bt(j, k));
+                  }
+                  v(ci, t, i, j) = sum;
+                }
+              }
+            }
+          }
+
+          // Multiply the transformed filter and input for each of the
+          // alpha x alpha elements of the transformed tiles.
+          for (index_t i = 0; i < alpha; i++) {
+            for (index_t j = 0; j < alpha; j++) {
+              internal::winograd_gemm<4, vector_size * 3>(
+                  u(_, _, i, j), v(_, interval<>(0, nt), i, j), m(_, interval<>(0, nt), i, j));
+            }
+          }
+
+          // Transform the products back to output tiles: y = A^T * m * A
+          for (index_t t = 0; t < nt; t++) {
+            const index_t x0 = x_dim.min() + (tx0 + t) * M;
+            for (index_t co : output.template dim<0>()) {
+              T atm[M][alpha];
+              for (index_t i = 0; i < M; i++) {
+                for (index_t j = 0; j < alpha; j++) {
+                  T sum = 0;
+                  for (index_t k = 0; k < alpha; k++) {
+                    sum += static_cast<T>(Mat::at(i, k)) * m(co, t, k, j);
+                  }
+                  atm[i][j] = sum;
+                }
+              }
+              const T b = bias(co);
+              for (index_t j = 0; j < M && y0 + j <= y_dim.max(); j++) {
+                for (index_t i = 0; i < M && x0 + i <= x_dim.max(); i++) {
+                  T sum = b;
+                  for (index_t k = 0; k < alpha; k++) {
+                    sum += atm[i][k] * static_cast<T>(Mat::at(j, k));
+                  }
+                  output(co, x0 + i, y0 + j, n) = epilogue(sum);
+                }
+              }
+            }
+          }
+        }
+      }
+    });
+  }
+}
+template <index_t M, class T, class TIn, class ShapeIn, class AllocIn, class TB, class ShapeB,
+    class AllocB, class TOut, class ShapeOut, class AllocOut, class Epilogue = no_activation>
+void winograd_conv2d(const array<TIn, ShapeIn, AllocIn>& input, const winograd_filter<M, T>& filter,
+    const array<TB, ShapeB, AllocB>& bias, array<TOut, ShapeOut, AllocOut>& output,
+    const Epilogue& epilogue = Epilogue()) {
+  winograd_conv2d(input.cref(), filter, bias.cref(), output.ref(), epilogue);
+}
+
+} // namespace nda
+
+#endif // NDARRAY_CONV_H
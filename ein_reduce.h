@@ -20,6 +20,7 @@
 #define NDARRAY_EIN_REDUCE_H
 
 #include "array.h"
+#include "gemm.h"
 
 namespace nda {
 
@@ -77,6 +78,9 @@ struct ein_op : public ein_op_base<ein_op<Op, Is...>> {
 
   // The largest dimension used by this operand.
   static constexpr index_t MaxIndex = sizeof...(Is) == 0 ? -1 : variadic_max(Is...);
+  // The smallest dimension used by this operand. Operands that don't use any
+  // dimension have a MinIndex greater than every dimension.
+  static constexpr index_t MinIndex = variadic_min(Is...);
 
   // auto doesn't work here because it doesn't include the reference type of operator() when we
   // need it, but it writing it includes it when we can't, e.g. if op(...) doesn't return a
@@ -111,6 +115,7 @@ struct ein_unary_op : public ein_op_base<Derived> {
   Op op;
   ein_unary_op(const Op& op) : op(op) {}
   static constexpr index_t MaxIndex = Op::MaxIndex;
+  static constexpr index_t MinIndex = Op::MinIndex;
 };
 
 // Unary negate.
@@ -147,6 +152,7 @@ struct ein_binary_op : public ein_op_base<Derived> {
   OpB op_b;
   ein_binary_op(const OpA& a, const OpB& b) : op_a(a), op_b(b) {}
   static constexpr index_t MaxIndex = std::max(OpA::MaxIndex, OpB::MaxIndex);
+  static constexpr index_t MinIndex = std::min(OpA::MinIndex, OpB::MinIndex);
 };
 
 #define NDARRAY_MAKE_EIN_BINARY_HELPERS(name, op)                                                  \
@@ -160,7 +166,13 @@ struct ein_binary_op : public ein_op_base<Derived> {
   struct name : public ein_binary_op<OpA, OpB, name<OpA, OpB>> {                                   \
     using base = ein_binary_op<OpA, OpB, name>;                                                    \
     name(const OpA& a, const OpB& b) : base(a, b) {}                                               \
+    template <class A, class B>                                                                    \
+    using with_operands = name<A, B>;                                                              \
     using is_assign = is_assign_;                                                                  \
+    template <class A, class B>                                                                    \
+    NDARRAY_INLINE static decltype(auto) apply(A&& a, B&& b) {                                     \
+      return std::forward<A>(a) op std::forward<B>(b);                                             \
+    }                                                                                              \
     template <class Idx>                                                                           \
     NDARRAY_INLINE auto operator()(const Idx& i) const {                                           \
       return base::op_a(i) op base::op_b(i);                                                       \
@@ -173,6 +185,8 @@ struct ein_binary_op : public ein_op_base<Derived> {
   struct name : public ein_binary_op<OpA, OpB, name<OpA, OpB>> {                                   \
     using base = ein_binary_op<OpA, OpB, name>;                                                    \
     name(const OpA& a, const OpB& b) : base(a, b) {}                                               \
+    template <class A, class B>                                                                    \
+    using with_operands = name<A, B>;                                                              \
     template <class Idx>                                                                           \
     NDARRAY_INLINE auto operator()(const Idx& i) const {                                           \
       using std::min;                                                                              \
@@ -262,15 +276,19 @@ NDARRAY_INLINE auto reconcile_dim(const std::tuple<Dims...>& dims) {
   return reconcile_dim(dims, make_index_sequence<sizeof...(Dims)>());
 }
 
-// Get the shape of an ein_reduce operand, or an empty shape if not an array.
-template <class T, class Shape>
-NDARRAY_INLINE const auto& dims_of(const array_ref<T, Shape>& op) {
+// Get the shape of an ein_reduce operand, or an empty shape if it does not have one.
+template <class T>
+NDARRAY_INLINE auto dims_of(const T& op, int) -> decltype(op.shape().dims()) {
   return op.shape().dims();
 }
 template <class T>
-NDARRAY_INLINE std::tuple<> dims_of(const T& op) {
+NDARRAY_INLINE std::tuple<> dims_of(const T& op, long) {
   return std::tuple<>();
 }
+template <class T>
+NDARRAY_INLINE decltype(auto) dims_of(const T& op) {
+  return dims_of(op, 0);
+}
 
 // Helper to reinterpret a dim with a new stride.
 template <index_t NewStride, index_t Min, index_t Extent, index_t Stride>
@@ -327,6 +345,573 @@ NDARRAY_UNIQUE auto make_ein_reduce_shape(
   return make_shape(reconcile_dim(gather_dims<Is>(kind_and_ops...))...);
 }
 
+// The number of elements of the accumulators of each row or column of the
+// matrix-vector product kernels. This is two 256-bit vectors, to hide the
+// latency of the additions.
+template <class T>
+constexpr index_t gemv_lanes() {
+  return sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+}
+
+// Compute y[r * y_stride] += sum_j a[r * a_stride + j] * x[j] for r in
+// [0, Rows), where the reduction dimension j of a and x is dense. Each row
+// is accumulated in `gemv_lanes` independent lanes, so this vectorizes
+// without reassociating the sum.
+template <index_t Rows, class T>
+NDARRAY_INLINE void gemv_dot_rows(index_t n, const T* a, index_t a_stride, const T* x, T* y,
+    index_t y_stride) {
+  constexpr index_t lanes = gemv_lanes<T>();
+  T accumulators[Rows][lanes] = {{0}};
+  index_t j = 0;
+  for (; j + lanes <= n; j += lanes) {
+    for (index_t r = 0; r < Rows; r++) {
+      const T* a_rj = a + r * a_stride + j;
+      for (index_t l = 0; l < lanes; l++) {
+        accumulators[r][l] += a_rj[l] * x[j + l];
+      }
+    }
+  }
+  for (index_t r = 0; r < Rows; r++) {
+    T sum = 0;
+    for (index_t l = 0; l < lanes; l++) {
+      sum += accumulators[r][l];
+    }
+    for (index_t jr = j; jr < n; jr++) {
+      sum += a[r * a_stride + jr] * x[jr];
+    }
+    y[r * y_stride] += sum;
+  }
+}
+
+// Compute y[i] += sum_c a[c * a_stride + i] * x[c] for c in [0, Cols), where
+// the dimension i of a and y is dense.
+template <index_t Cols, class T>
+NDARRAY_INLINE void gemv_axpy_cols(index_t m, const T* a, index_t a_stride, const T* x,
+    index_t x_stride, T* NDARRAY_RESTRICT y) {
+  T x_c[Cols];
+  for (index_t c = 0; c < Cols; c++) {
+    x_c[c] = x[c * x_stride];
+  }
+  constexpr index_t lanes = gemv_lanes<T>();
+  index_t i = 0;
+  for (; i + lanes <= m; i += lanes) {
+    T y_i[lanes];
+    for (index_t l = 0; l < lanes; l++) {
+      y_i[l] = y[i + l];
+    }
+    for (index_t c = 0; c < Cols; c++) {
+      const T* a_ci = a + c * a_stride + i;
+      for (index_t l = 0; l < lanes; l++) {
+        y_i[l] += a_ci[l] * x_c[c];
+      }
+    }
+    for (index_t l = 0; l < lanes; l++) {
+      y[i + l] = y_i[l];
+    }
+  }
+  for (; i < m; i++) {
+    for (index_t c = 0; c < Cols; c++) {
+      y[i] += a[c * a_stride + i] * x_c[c];
+    }
+  }
+}
+
+// The number of rows (or columns) of the matrix processed at once by the
+// matrix-vector product kernels. Each element of x (or y) is loaded once for
+// this many rows (or columns) of the matrix.
+constexpr index_t gemv_block = 4;
+
+// Compute y(i) += a(i, j) * x(j) for i in `i_dim` and j in `j_dim`, where
+// `a_i` and `a_j` are the dims of a addressed by i and j. Returns false
+// without doing anything if neither the i nor j dimensions are dense in all
+// of the operands that use them.
+template <class T, class DimI, class DimJ, class ShapeY, class ShapeA, class DimAI, class DimAJ,
+    class ShapeX>
+bool gemv(const DimI& i_dim, const DimJ& j_dim, const array_ref<T, ShapeY>& y,
+    const array_ref<const T, ShapeA>& a, const DimAI& a_i, const DimAJ& a_j,
+    const array_ref<const T, ShapeX>& x) {
+  const auto& y_i = y.shape().template dim<0>();
+  const auto& x_j = x.shape().template dim<0>();
+  const index_t m = i_dim.extent();
+  const index_t n = j_dim.extent();
+  T* y_0 = y.base() + (i_dim.min() - y_i.min()) * y_i.stride();
+  const T* x_0 = x.base() + (j_dim.min() - x_j.min()) * x_j.stride();
+  const T* a_0 = a.base() + (i_dim.min() - a_i.min()) * a_i.stride() +
+                 (j_dim.min() - a_j.min()) * a_j.stride();
+
+  if (a_j.stride() == 1 && x_j.stride() == 1) {
+    // The rows of a are dense, compute dot products of gemv_block rows at a
+    // time with x.
+    index_t i = 0;
+    for (; i + gemv_block <= m; i += gemv_block) {
+      gemv_dot_rows<gemv_block>(
+          n, a_0 + i * a_i.stride(), a_i.stride(), x_0, y_0 + i * y_i.stride(), y_i.stride());
+    }
+    for (; i < m; i++) {
+      gemv_dot_rows<1>(
+          n, a_0 + i * a_i.stride(), a_i.stride(), x_0, y_0 + i * y_i.stride(), y_i.stride());
+    }
+    return true;
+  } else if (a_i.stride() == 1 && y_i.stride() == 1) {
+    // The columns of a are dense, add gemv_block columns at a time to y.
+    index_t j = 0;
+    for (; j + gemv_block <= n; j += gemv_block) {
+      gemv_axpy_cols<gemv_block>(
+          m, a_0 + j * a_j.stride(), a_j.stride(), x_0 + j * x_j.stride(), x_j.stride(), y_0);
+    }
+    for (; j < n; j++) {
+      gemv_axpy_cols<1>(
+          m, a_0 + j * a_j.stride(), a_j.stride(), x_0 + j * x_j.stride(), x_j.stride(), y_0);
+    }
+    return true;
+  }
+  return false;
+}
+
+// A sub-expression that has been evaluated outside of the loops it doesn't
+// depend on.
+template <class T>
+struct ein_value {
+  T value;
+  ein_value(T value) : value(std::move(value)) {}
+
+  static constexpr index_t MaxIndex = -1;
+  static constexpr index_t MinIndex = std::numeric_limits<index_t>::max();
+
+  template <class Idx>
+  NDARRAY_INLINE const T& operator()(const Idx&) const {
+    return value;
+  }
+};
+
+// An array operand, lowered to a pointer to the element at the current index
+// of the loops. The pointer is advanced by the loops, instead of computing the
+// flat offset of each index.
+template <class T, class Shape, size_t... Is>
+struct ein_pointer_op {
+  T* ptr;
+  // Only the strides of the shape are used.
+  Shape shape;
+  ein_pointer_op(T* ptr, const Shape& shape) : ptr(ptr), shape(shape) {}
+
+  static constexpr index_t MaxIndex = sizeof...(Is) == 0 ? -1 : variadic_max(Is...);
+  static constexpr index_t MinIndex = variadic_min(Is...);
+
+  template <class Idx>
+  NDARRAY_INLINE T& operator()(const Idx&) const {
+    return *ptr;
+  }
+
+  template <index_t D, size_t... Ks>
+  NDARRAY_INLINE index_t stride(index_sequence<Ks...>) const {
+    return sum((Is == D ? shape.template dim<Ks>().stride() : 0)...);
+  }
+  // The stride of the pointer in dimension D of the loops, which is the sum of
+  // the strides of the dimensions of the array addressed by D.
+  template <index_t D>
+  NDARRAY_INLINE index_t stride() const {
+    return stride<D>(make_index_sequence<sizeof...(Is)>());
+  }
+  template <index_t D>
+  NDARRAY_INLINE void advance() {
+    ptr += stride<D>();
+  }
+};
+
+// The pointer and the strides in each dimension of the loops of the array
+// operand `op`, as used by `may_overlap`.
+template <class T, class Shape, size_t... Is, size_t... Ds>
+NDARRAY_INLINE auto loop_strides(
+    const ein_pointer_op<T, Shape, Is...>& op, index_sequence<Ds...>) {
+  return std::make_pair(op.ptr, std::make_tuple(op.template stride<Ds>()...));
+}
+
+// Rebuild the operation `expr` with each of its operands `op` replaced by
+// `fn(op)`. Leaves are returned unchanged.
+template <class Op, size_t... Is, class Fn>
+NDARRAY_INLINE ein_op<Op, Is...> map_operands(const ein_op<Op, Is...>& expr, const Fn&) {
+  return expr;
+}
+template <class T, class Shape, size_t... Is, class Fn>
+NDARRAY_INLINE ein_pointer_op<T, Shape, Is...> map_operands(
+    const ein_pointer_op<T, Shape, Is...>& expr, const Fn&) {
+  return expr;
+}
+template <class Op, class Fn>
+NDARRAY_INLINE auto map_operands(const ein_negate_op<Op>& expr, const Fn& fn) {
+  return make_ein_op_negate(fn(expr.op));
+}
+template <class Type, class Op, class Fn>
+NDARRAY_INLINE auto map_operands(const ein_cast_op<Type, Op>& expr, const Fn& fn) {
+  auto op = fn(expr.op);
+  return ein_cast_op<Type, decltype(op)>(op);
+}
+template <class OpA, class OpB, class Derived, class Fn>
+NDARRAY_INLINE auto map_operands(const ein_binary_op<OpA, OpB, Derived>& expr, const Fn& fn) {
+  auto a = fn(expr.op_a);
+  auto b = fn(expr.op_b);
+  return typename Derived::template with_operands<decltype(a), decltype(b)>(a, b);
+}
+
+// Advance the pointers of the array operands of `expr` to the next index of
+// dimension D of the loops.
+template <index_t D, class Op, size_t... Is>
+NDARRAY_INLINE void advance_operands(ein_op<Op, Is...>&) {}
+template <index_t D, class T>
+NDARRAY_INLINE void advance_operands(ein_value<T>&) {}
+template <index_t D, class T, class Shape, size_t... Is>
+NDARRAY_INLINE void advance_operands(ein_pointer_op<T, Shape, Is...>& op) {
+  op.template advance<D>();
+}
+template <index_t D, class Op, class Derived>
+NDARRAY_INLINE void advance_operands(ein_unary_op<Op, Derived>& op) {
+  advance_operands<D>(op.op);
+}
+template <index_t D, class OpA, class OpB, class Derived>
+NDARRAY_INLINE void advance_operands(ein_binary_op<OpA, OpB, Derived>& op) {
+  advance_operands<D>(op.op_a);
+  advance_operands<D>(op.op_b);
+}
+
+// Replace the array operands of `expr` with pointers to their element at
+// `idx`. Other operands are evaluated at each index as before.
+template <class T, class Shape, size_t... Is, class Idx>
+NDARRAY_INLINE ein_pointer_op<T, Shape, Is...> lower_operands(
+    const ein_op<array_ref<T, Shape>, Is...>& expr, const Idx& idx) {
+  return ein_pointer_op<T, Shape, Is...>(&expr.op(std::get<Is>(idx)...), expr.op.shape());
+}
+template <class Expr, class Idx>
+NDARRAY_INLINE auto lower_operands(const Expr& expr, const Idx& idx) {
+  return map_operands(expr, [&](const auto& op) { return lower_operands(op, idx); });
+}
+
+// Replace the sub-expressions of `expr` that only depend on dimensions D and
+// above with their value at `idx`.
+template <index_t D, class Expr, class Idx>
+NDARRAY_INLINE auto hoist(const Expr& expr, const Idx& idx);
+
+template <index_t D, class Expr, class Idx>
+NDARRAY_INLINE auto hoist_impl(std::true_type, const Expr& expr, const Idx& idx) {
+  return ein_value<typename std::decay<decltype(expr(idx))>::type>(expr(idx));
+}
+template <index_t D, class Expr, class Idx>
+NDARRAY_INLINE auto hoist_impl(std::false_type, const Expr& expr, const Idx& idx) {
+  return map_operands(expr, [&](const auto& op) { return hoist<D>(op, idx); });
+}
+
+template <index_t D, class Expr, class Idx>
+NDARRAY_INLINE auto hoist(const Expr& expr, const Idx& idx) {
+  return hoist_impl<D>(std::integral_constant<bool, (Expr::MinIndex >= D)>(), expr, idx);
+}
+
+// The left-hand side of an assignment is not hoisted, only the right-hand side.
+template <index_t D, class Expr, class Idx>
+NDARRAY_INLINE auto hoist_assign(const Expr& expr, const Idx& idx) {
+  auto b = hoist<D>(expr.op_b, idx);
+  return typename Expr::template with_operands<decltype(expr.op_a), decltype(b)>(expr.op_a, b);
+}
+
+// Returns true if the operands of `rhs` may address the memory written by
+// `result` in the loops of `shape`. Operands that are not arrays are assumed
+// to alias the result.
+template <class Shape, class Result, class Op, size_t... Is>
+NDARRAY_INLINE bool may_alias(const Shape&, const Result&, const ein_op<Op, Is...>&) {
+  return true;
+}
+template <class Shape, class Result, class T>
+NDARRAY_INLINE bool may_alias(const Shape&, const Result&, const ein_value<T>&) {
+  return false;
+}
+template <class Shape, class TR, class ShapeR, size_t... IRs, class T, class ShapeT, size_t... Is>
+NDARRAY_INLINE bool may_alias(const Shape& shape, const ein_pointer_op<TR, ShapeR, IRs...>& result,
+    const ein_pointer_op<T, ShapeT, Is...>& op) {
+  const auto ds = make_index_sequence<Shape::rank()>();
+  return may_overlap<Shape::rank()>(
+      shape.extent(), loop_strides(result, ds), loop_strides(op, ds));
+}
+template <class Shape, class Result, class Op, class Derived>
+NDARRAY_INLINE bool may_alias(
+    const Shape& shape, const Result& result, const ein_unary_op<Op, Derived>& op) {
+  return may_alias(shape, result, op.op);
+}
+template <class Shape, class Result, class OpA, class OpB, class Derived>
+NDARRAY_INLINE bool may_alias(
+    const Shape& shape, const Result& result, const ein_binary_op<OpA, OpB, Derived>& op) {
+  return may_alias(shape, result, op.op_a) || may_alias(shape, result, op.op_b);
+}
+
+// Evaluate `expr` for each index of dimensions D, D - 1, ..., 0 of `shape`,
+// where `idx` holds the indices of the dimensions above D. Before each loop
+// over the inner dimensions, the sub-expressions that don't depend on them are
+// evaluated once, so the innermost loop only evaluates what depends on
+// dimension 0. `expr` is passed by value, because the loops advance its
+// pointers.
+//
+// If NoAlias is true_type, the caller has checked that the result is an array
+// that the other operands do not alias, and the innermost loop writes the
+// result through a pointer qualified with NDARRAY_RESTRICT. This allows the
+// compiler to keep the result in a register across a reduction, or to
+// vectorize the loop.
+template <class NoAlias, class Shape, class Idx, class Expr>
+NDARRAY_INLINE void evaluate_ein_loops(
+    NoAlias, std::integral_constant<index_t, -1>, const Shape&, Idx& idx, const Expr& expr) {
+  expr(idx);
+}
+template <class Shape, class Idx, class Expr>
+NDARRAY_INLINE void evaluate_ein_loops(
+    std::false_type, std::integral_constant<index_t, 0>, const Shape& shape, Idx& idx, Expr expr) {
+  for (index_t i : shape.template dim<0>()) {
+    std::get<0>(idx) = i;
+    expr(idx);
+    advance_operands<0>(expr);
+  }
+}
+
+// The result is written directly through the restrict pointer, rather than
+// through the pointer of the result operand, which the compiler does not know
+// is restricted.
+template <class Dim, class Idx, class Expr, class T>
+NDARRAY_UNIQUE void evaluate_ein_inner_no_alias(
+    const Dim& dim, Idx idx, const Expr& expr, T* NDARRAY_RESTRICT result) {
+  const index_t result_stride = expr.op_a.template stride<0>();
+  auto rhs = expr.op_b;
+  for (index_t i : dim) {
+    std::get<0>(idx) = i;
+    Expr::apply(*result, rhs(idx));
+    result += result_stride;
+    advance_operands<0>(rhs);
+  }
+}
+template <class Shape, class Idx, class Expr>
+NDARRAY_INLINE void evaluate_ein_loops(std::true_type, std::integral_constant<index_t, 0>,
+    const Shape& shape, Idx& idx, const Expr& expr) {
+  evaluate_ein_inner_no_alias(shape.template dim<0>(), idx, expr, expr.op_a.ptr);
+}
+
+template <class NoAlias, index_t D, class Shape, class Idx, class Expr>
+NDARRAY_INLINE void evaluate_ein_loops(
+    NoAlias, std::integral_constant<index_t, D>, const Shape& shape, Idx& idx, Expr expr) {
+  for (index_t i : shape.template dim<D>()) {
+    std::get<D>(idx) = i;
+    evaluate_ein_loops(NoAlias(), std::integral_constant<index_t, D - 1>(), shape, idx,
+        hoist_assign<D>(expr, idx));
+    advance_operands<D>(expr);
+  }
+}
+
+// Sub-expressions that don't depend on any dimension are evaluated once,
+// before the loops.
+template <class Shape, class Idx, class Expr>
+NDARRAY_INLINE void evaluate_ein_loops(const Shape& shape, Idx& idx, const Expr& expr) {
+  constexpr index_t Rank = Shape::rank();
+  evaluate_ein_loops(std::false_type(), std::integral_constant<index_t, Rank - 1>(), shape, idx,
+      hoist_assign<Rank>(expr, idx));
+}
+template <class Shape, class Idx, class T, class ShapeT, size_t... Is, class OpB,
+    template <class, class> class Assign>
+NDARRAY_INLINE void evaluate_ein_loops(const Shape& shape, Idx& idx,
+    const Assign<ein_pointer_op<T, ShapeT, Is...>, OpB>& expr) {
+  constexpr index_t Rank = Shape::rank();
+  auto hoisted = hoist_assign<Rank>(expr, idx);
+  if (may_alias(shape, expr.op_a, hoisted.op_b)) {
+    evaluate_ein_loops(
+        std::false_type(), std::integral_constant<index_t, Rank - 1>(), shape, idx, hoisted);
+  } else {
+    evaluate_ein_loops(
+        std::true_type(), std::integral_constant<index_t, Rank - 1>(), shape, idx, hoisted);
+  }
+}
+
+template <class Shape, class Expr>
+NDARRAY_INLINE void evaluate_ein_loops(const Shape& shape, const Expr& expr) {
+  if (shape.empty()) return;
+  auto idx = shape.min();
+  evaluate_ein_loops(shape, idx, lower_operands(expr, idx));
+}
+
+// Evaluate an Einstein reduction `expr` over the indices of `reduction_shape`.
+template <class Shape, class Expr>
+NDARRAY_INLINE void evaluate_ein_reduce(const Shape& reduction_shape, const Expr& expr) {
+  evaluate_ein_loops(reduction_shape, expr);
+}
+
+// Matrix-vector products y(i) += A(i, j) * x(j) or y(i) += A(j, i) * x(j) of
+// arithmetic types are dispatched to gemv, if the strides permit.
+template <size_t I, size_t J, size_t A0, size_t A1, class TY, class TA, class TX>
+using enable_if_gemv =
+    std::enable_if_t<I != J && ((A0 == I && A1 == J) || (A0 == J && A1 == I)) &&
+                     std::is_arithmetic<TY>::value &&
+                     std::is_same<TY, std::remove_const_t<TA>>::value &&
+                     std::is_same<TY, std::remove_const_t<TX>>::value>;
+
+// Returns true if the ranges of addresses of the arrays `a` and `b` overlap.
+template <class TA, class ShapeA, class TB, class ShapeB>
+NDARRAY_INLINE bool may_overlap(const array_ref<TA, ShapeA>& a, const array_ref<TB, ShapeB>& b) {
+  if (a.shape().empty() || b.shape().empty()) return false;
+  // Comparing pointers to different objects with < is unspecified, so compare
+  // the addresses as integers.
+  const uintptr_t a_begin = reinterpret_cast<uintptr_t>(a.base() + a.shape().flat_min());
+  const uintptr_t a_end = reinterpret_cast<uintptr_t>(a.base() + a.shape().flat_max() + 1);
+  const uintptr_t b_begin = reinterpret_cast<uintptr_t>(b.base() + b.shape().flat_min());
+  const uintptr_t b_end = reinterpret_cast<uintptr_t>(b.base() + b.shape().flat_max() + 1);
+  return a_begin < b_end && b_begin < a_end;
+}
+
+// The kernels of gemv write y through a restrict pointer, and read x in blocks
+// before updating y, so operands that overlap y are evaluated by the loops.
+template <class Shape, size_t I, size_t J, size_t A0, size_t A1, class TY, class ShapeY,
+    class TA, class ShapeA, class TX, class ShapeX, class Expr>
+NDARRAY_INLINE void evaluate_ein_gemv(const Shape& reduction_shape,
+    const array_ref<TY, ShapeY>& y, const array_ref<TA, ShapeA>& a,
+    const array_ref<TX, ShapeX>& x, const Expr& expr) {
+  const auto& a_dims = a.shape();
+  // The dims of a addressed by i and j.
+  const auto& a_i = a_dims.template dim<A0 == I ? 0 : 1>();
+  const auto& a_j = a_dims.template dim<A0 == I ? 1 : 0>();
+  if (may_overlap(y, a) || may_overlap(y, x) ||
+      !gemv(reduction_shape.template dim<I>(), reduction_shape.template dim<J>(), y,
+          array_ref<const TY, ShapeA>(a.base(), a.shape()), a_i, a_j,
+          array_ref<const TY, ShapeX>(x.base(), x.shape()))) {
+    evaluate_ein_loops(reduction_shape, expr);
+  }
+}
+
+template <class Shape, class TY, class ShapeY, size_t I, class TA, class ShapeA, size_t A0,
+    size_t A1, class TX, class ShapeX, size_t J, class = enable_if_gemv<I, J, A0, A1, TY, TA, TX>>
+NDARRAY_INLINE void evaluate_ein_reduce(const Shape& reduction_shape,
+    const ein_op_add_assign<ein_op<array_ref<TY, ShapeY>, I>,
+        ein_op_mul<ein_op<array_ref<TA, ShapeA>, A0, A1>, ein_op<array_ref<TX, ShapeX>, J>>>&
+        expr) {
+  evaluate_ein_gemv<Shape, I, J, A0, A1>(
+      reduction_shape, expr.op_a.op, expr.op_b.op_a.op, expr.op_b.op_b.op, expr);
+}
+template <class Shape, class TY, class ShapeY, size_t I, class TA, class ShapeA, size_t A0,
+    size_t A1, class TX, class ShapeX, size_t J, class = enable_if_gemv<I, J, A0, A1, TY, TA, TX>>
+NDARRAY_INLINE void evaluate_ein_reduce(const Shape& reduction_shape,
+    const ein_op_add_assign<ein_op<array_ref<TY, ShapeY>, I>,
+        ein_op_mul<ein_op<array_ref<TX, ShapeX>, J>, ein_op<array_ref<TA, ShapeA>, A0, A1>>>&
+        expr) {
+  evaluate_ein_gemv<Shape, I, J, A0, A1>(
+      reduction_shape, expr.op_a.op, expr.op_b.op_b.op, expr.op_b.op_a.op, expr);
+}
+
+// Describes an operand of a matrix product that can be computed by gemm,
+// which is either a rank 2 array with value type T, or a rank 2 array cast to
+// T.
+template <class Op, class T>
+struct gemm_operand {
+  static constexpr bool value = false;
+  static constexpr size_t i0 = -1;
+  static constexpr size_t i1 = -1;
+};
+template <class TA, class ShapeA, size_t I0, size_t I1, class T>
+struct gemm_operand<ein_op<array_ref<TA, ShapeA>, I0, I1>, T> {
+  static constexpr bool value = std::is_same<typename std::remove_const<TA>::type, T>::value;
+  static constexpr size_t i0 = I0;
+  static constexpr size_t i1 = I1;
+  static const array_ref<TA, ShapeA>& array(const ein_op<array_ref<TA, ShapeA>, I0, I1>& op) {
+    return op.op;
+  }
+};
+template <class TA, class ShapeA, size_t I0, size_t I1, class T>
+struct gemm_operand<ein_cast_op<T, ein_op<array_ref<TA, ShapeA>, I0, I1>>, T> {
+  static constexpr bool value = std::is_convertible<TA, T>::value;
+  static constexpr size_t i0 = I0;
+  static constexpr size_t i1 = I1;
+  static const array_ref<TA, ShapeA>& array(
+      const ein_cast_op<T, ein_op<array_ref<TA, ShapeA>, I0, I1>>& op) {
+    return op.op.op;
+  }
+};
+
+// Returns true if OpA addresses the dimensions {I, K}, and OpB addresses
+// {K, J} for some K, where T is arithmetic and the operands have type T or
+// are cast to T.
+template <size_t I, size_t J, class T, class OpA, class OpB>
+constexpr bool is_gemm() {
+  using A = gemm_operand<OpA, T>;
+  using B = gemm_operand<OpB, T>;
+  return std::is_arithmetic<T>::value && A::value && B::value && I != J &&
+         (A::i0 == I) != (A::i1 == I) && A::i0 != J && A::i1 != J &&
+         (B::i0 == J) != (B::i1 == J) && B::i0 != I && B::i1 != I &&
+         (A::i0 == I ? A::i1 : A::i0) == (B::i0 == J ? B::i1 : B::i0);
+}
+
+// Matrix products of a large enough size are computed by gemm. Smaller
+// products are evaluated directly, to avoid the overhead of packing.
+constexpr index_t gemm_min_work = 32 * 32 * 32;
+
+template <size_t I, size_t J, class Shape, class TC, class ShapeC, class OpA, class OpB,
+    class Expr>
+NDARRAY_INLINE void evaluate_ein_gemm(const Shape& reduction_shape,
+    const array_ref<TC, ShapeC>& c, const OpA& op_a, const OpB& op_b, const Expr& expr) {
+  using T = typename std::remove_const<TC>::type;
+  using A = gemm_operand<OpA, T>;
+  using B = gemm_operand<OpB, T>;
+  constexpr size_t K = A::i0 == I ? A::i1 : A::i0;
+  const auto& i_dim = reduction_shape.template dim<I>();
+  const auto& j_dim = reduction_shape.template dim<J>();
+  const auto& k_dim = reduction_shape.template dim<K>();
+  const auto& a = A::array(op_a);
+  const auto& b = B::array(op_b);
+  // gemm writes c while reading blocks of a and b that it has packed, so
+  // operands that overlap c are evaluated by the loops.
+  if (i_dim.extent() * j_dim.extent() * k_dim.extent() < gemm_min_work ||
+      may_overlap(c, a) || may_overlap(c, b)) {
+    evaluate_ein_loops(reduction_shape, expr);
+    return;
+  }
+  gemm<false>(i_dim, j_dim, k_dim, a, a.shape().template dim<A::i0 == I ? 0 : 1>(),
+      a.shape().template dim<A::i0 == I ? 1 : 0>(), b,
+      b.shape().template dim<B::i0 == J ? 1 : 0>(), b.shape().template dim<B::i0 == J ? 0 : 1>(),
+      c, c.shape().template dim<0>(), c.shape().template dim<1>());
+}
+
+// Compute a matrix product with gemm, where the first operand of the product
+// is A (std::true_type) or B (std::false_type).
+template <size_t I, size_t J, class Shape, class C, class Product, class Expr>
+NDARRAY_INLINE void evaluate_ein_gemm(std::true_type, const Shape& reduction_shape, const C& c,
+    const Product& product, const Expr& expr) {
+  evaluate_ein_gemm<I, J>(reduction_shape, c, product.op_a, product.op_b, expr);
+}
+template <size_t I, size_t J, class Shape, class C, class Product, class Expr>
+NDARRAY_INLINE void evaluate_ein_gemm(std::false_type, const Shape& reduction_shape, const C& c,
+    const Product& product, const Expr& expr) {
+  evaluate_ein_gemm<I, J>(reduction_shape, c, product.op_b, product.op_a, expr);
+}
+
+// Matrix products C(i, j) += A(i, k) * B(k, j) of arithmetic types, with any
+// order of the dimensions of A and B, or the operands of the product, are
+// dispatched to gemm. The operands may be cast to the value type of C.
+template <class Shape, class TC, class ShapeC, size_t I, size_t J, class OpA, class OpB,
+    class = std::enable_if_t<is_gemm<I, J, typename std::remove_const<TC>::type, OpA, OpB>() ||
+                             is_gemm<I, J, typename std::remove_const<TC>::type, OpB, OpA>()>>
+NDARRAY_INLINE void evaluate_ein_reduce(const Shape& reduction_shape,
+    const ein_op_add_assign<ein_op<array_ref<TC, ShapeC>, I, J>, ein_op_mul<OpA, OpB>>& expr) {
+  using T = typename std::remove_const<TC>::type;
+  evaluate_ein_gemm<I, J>(std::integral_constant<bool, is_gemm<I, J, T, OpA, OpB>()>(),
+      reduction_shape, expr.op_a.op, expr.op_b, expr);
+}
+
+// The number of bytes of the arrays addressed by the operands of `op`, which
+// is reported to the profiler. Operands that are not arrays are not counted.
+template <class Op, size_t... Is>
+size_t ein_footprint_bytes(const ein_op<Op, Is...>&) {
+  return 0;
+}
+template <class T, class Shape, size_t... Is>
+size_t ein_footprint_bytes(const ein_op<array_ref<T, Shape>, Is...>& op) {
+  return op.op.size() * sizeof(T);
+}
+template <class Op, class Derived>
+size_t ein_footprint_bytes(const ein_unary_op<Op, Derived>& op) {
+  return ein_footprint_bytes(op.op);
+}
+template <class OpA, class OpB, class Derived>
+size_t ein_footprint_bytes(const ein_binary_op<OpA, OpB, Derived>& op) {
+  return ein_footprint_bytes(op.op_a) + ein_footprint_bytes(op.op_b);
+}
+
 } // namespace internal
 
 /** Operand for an Einstein summation, which is an array or other
@@ -395,6 +980,18 @@ auto ein(T (&x)[N]) {
  * operations, but it may be inefficient for contractions. Contractions
  * may need to be reassociated manually for efficient computation.
  *
+ * Sub-expressions of the right-hand side that don't depend on the inner loops
+ * are evaluated outside of those loops, e.g. `A(i, k)` in
+ * `ein<i, j>(C) += ein<i, k>(A) * ein<k, j>(B)` with `j` innermost is loaded
+ * once per `(i, k)`. Callable operands may be called fewer times than the
+ * number of elements of the reduction. Operands may alias the result. The
+ * result is then updated in the order of the loops, and an operand that reads
+ * an element of the result after it is written reads the updated value. This
+ * is the same as using the original values only in elementwise operations,
+ * where each index of the reduction is an index of the result, and the
+ * aliasing operand is addressed by the same indices as the result, e.g.
+ * `ein<i, j>(A) *= ein<i, j>(A)`.
+ *
  * This function does not optimize the loop ordering within each operation.
  * The goal of this function is to provide a low-overhead and expressive
  * reduction that can be composed with other explicit loop transformations
@@ -402,6 +999,32 @@ auto ein(T (&x)[N]) {
  * implemented by splitting loops appropriately and by controlling the
  * order of the loops with the reduction indices.
  *
+ * The exception is the matrix-vector product `ein<i>(y) += ein<i, j>(A) * ein<j>(x)`,
+ * including the forms with the operands of the product swapped or with `A`
+ * addressed by `ein<j, i>`. When `y`, `A` and `x` are arrays of the same
+ * arithmetic type, and either the rows of `A` and `x` or the columns of `A`
+ * and `y` are dense, this is computed by a vectorized kernel that processes
+ * several rows or columns of `A` at once. The order of the summation differs
+ * from the order of the loops in this case. If `y` overlaps `A` or `x`, the
+ * loops are used instead.
+ *
+ * Similarly, large enough matrix products `ein<i, j>(C) += ein<i, k>(A) * ein<k, j>(B)`,
+ * with any order of the dimensions of the operands, or of the operands of the
+ * product, are computed with `gemm` when `C` has an arithmetic value type, and
+ * `A` and `B` are arrays of the same type as `C` or are cast to it, e.g.
+ * `cast<int>(ein<i, k>(A))` for `int8_t` operands. If `C` overlaps `A` or
+ * `B`, the loops are used instead.
+ *
+ * When sparse.h is included, sparse matrices (`sparse_matrix` or
+ * `sparse_matrix_ref`) can be operands, where elements that are not stored
+ * are zero. The matrix-vector and matrix products above, where `A` is a
+ * sparse matrix and the other operands are arrays, are computed with `spmv`
+ * or `spmm` when the result has the same bounds as the corresponding
+ * dimension of `A`. This only visits the nonzeros of `A`, and the result must
+ * not alias the other array operand. Other expressions
+ * with sparse operands visit every element of the reduction, and each element
+ * of a sparse operand is found by a binary search.
+ *
  * Examples:
  * - `ein_reduce(ein<>(tr_A) += ein<i, i>(A))`, the trace of `A`.
  * - `ein_reduce(ein<>(dot) += (ein<i>(x) + ein<i>(y)) * ein<i>(z))`,
@@ -435,8 +1058,14 @@ NDARRAY_UNIQUE auto ein_reduce(const Expr& expr) {
   // to make useful optimizations without making some assumptions about the
   // dimensions of the shape.
 
-  // Perform the reduction.
-  for_each_index_in_order(reduction_shape, expr);
+  // Perform the reduction. The profiler counts the iterations of the
+  // reduction loop as elements, and the size of the result and array operands
+  // as bytes.
+  NDARRAY_PROFILE_SCOPE("ein_reduce", decltype(reduction_shape), reduction_shape.size(),
+      internal::ein_footprint_bytes(expr));
+  // This call is unqualified so overloads for other operand types, such as
+  // the sparse matrices of sparse.h, are found by ADL.
+  evaluate_ein_reduce(reduction_shape, expr);
 
   // Assume the expr is an assignment, and return the left-hand side.
   return expr.op_a.op;
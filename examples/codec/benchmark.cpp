@@ -0,0 +1,90 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "benchmark.h"
+#include "codec.h"
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using namespace nda;
+
+struct named_codec {
+  const char* name;
+  codec c;
+};
+
+const named_codec codecs[] = {
+    {"zero_runs", {false, shuffle_kind::none, true}},
+    {"byte_shuffle", {false, shuffle_kind::byte, true}},
+    {"bit_shuffle", {false, shuffle_kind::bit, true}},
+    {"delta+byte_shuffle", {true, shuffle_kind::byte, true}},
+    {"delta+bit_shuffle", {true, shuffle_kind::bit, true}},
+};
+
+// Measure the throughput of compressing and decompressing `values` with each
+// codec, relative to the uncompressed size of the values.
+template <class T, class Shape>
+void benchmark_codecs(const char* data_name, const array<T, Shape>& values) {
+  const double bytes = values.size() * sizeof(T);
+  array<T, Shape> decompressed(values.shape());
+  for (const named_codec& i : codecs) {
+    std::vector<uint8_t> data;
+    double compress_time = benchmark([&]() { data = compress(values, i.c); });
+    double decompress_time = benchmark([&]() { decompress(data, decompressed); });
+    if (decompressed != values) {
+      std::cout << data_name << " " << i.name << " did not round trip!" << std::endl;
+      exit(-1);
+    }
+    std::cout << std::setw(8) << data_name << std::setw(20) << i.name << " ratio: " << std::setw(6)
+              << std::setprecision(3) << bytes / data.size()
+              << " compress: " << std::setw(6) << bytes / compress_time * 1e-9 << " GB/s"
+              << " decompress: " << std::setw(6) << bytes / decompress_time * 1e-9 << " GB/s"
+              << std::endl;
+  }
+}
+
+int main(int, const char**) {
+  const index_t W = 1024;
+  const index_t H = 1024;
+  const index_t C = 4;
+
+  // A smooth volume of integers, like a depth map or a medical image.
+  dense_array<int16_t, 3> smooth({W, H, C});
+  for_all_indices(smooth.shape(), [&](index_t x, index_t y, index_t c) {
+    smooth(x, y, c) =
+        static_cast<int16_t>(1000 * std::sin(x * 0.01) * std::cos(y * 0.02) + c * 100);
+  });
+  benchmark_codecs("smooth", smooth);
+
+  // Mostly zero floats, like an occupancy grid.
+  std::mt19937 rng;
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  dense_array<float, 3> sparse({W, H, C}, 0.0f);
+  for (int i = 0; i < 10000; i++) {
+    index_t x = rng() % W;
+    index_t y = rng() % H;
+    index_t c = rng() % C;
+    sparse(x, y, c) = uniform(rng);
+  }
+  benchmark_codecs("sparse", sparse);
+
+  // Random floats, which do not compress.
+  dense_array<float, 3> noise({W, H, C});
+  generate(noise, [&]() { return uniform(rng); });
+  benchmark_codecs("noise", noise);
+  return 0;
+}
@@ -14,6 +14,7 @@
 
 #include "array.h"
 #include "benchmark.h"
+#include "conv.h"
 
 #include <iostream>
 #include <random>
@@ -127,12 +128,37 @@ int main(int, const char**) {
       benchmark([&]() { conv2d_tiled(input.cref(), filter.cref(), bias.cref(), tiled_output.ref()); });
   std::cout << "tiled time: " << tiled_time * 1e3 << " ms" << std::endl;
 
+  // The library implementation, with the bias and ReLU fused into the
+  // computation of each tile.
+  auto fused_output = make_array<float>(tensor_shape<CO, W, H, N>());
+  double fused_time =
+      benchmark([&]() { conv2d(input.cref(), filter.cref(), bias.cref(), fused_output.ref(), relu()); });
+  std::cout << "fused time: " << fused_time * 1e3 << " ms" << std::endl;
+
+  // The Winograd F(4x4, 3x3) implementation. The filter is transformed once,
+  // outside of the benchmark.
+  winograd_filter<4> winograd_filter(filter);
+  auto winograd_output = make_array<float>(tensor_shape<CO, W, H, N>());
+  double winograd_time = benchmark([&]() {
+    winograd_conv2d(input.cref(), winograd_filter, bias.cref(), winograd_output.ref(), relu());
+  });
+  std::cout << "winograd time: " << winograd_time * 1e3 << " ms" << std::endl;
+
   const float epsilon = 1e-4f;
   for_each_index(naive_output.shape(), [&](const index_of_rank<4>& i) {
     if (std::abs(naive_output[i] - tiled_output[i]) > epsilon) {
       std::cout << "naive_output(i) = " << naive_output[i]
                 << " != tiled_output(i) = " << tiled_output[i] << std::endl;
     }
+    if (std::abs(naive_output[i] - fused_output[i]) > epsilon) {
+      std::cout << "naive_output(i) = " << naive_output[i]
+                << " != fused_output(i) = " << fused_output[i] << std::endl;
+    }
+    // The Winograd transforms lose some precision.
+    if (std::abs(naive_output[i] - winograd_output[i]) > epsilon * std::abs(naive_output[i]) * 10) {
+      std::cout << "naive_output(i) = " << naive_output[i]
+                << " != winograd_output(i) = " << winograd_output[i] << std::endl;
+    }
   });
 
   return 0;
@@ -95,7 +95,8 @@ namespace internal {
 
 // An array of kernels is not just a 2D array, because each kernel may
 // have different bounds.
-using kernel_allocator = auto_allocator<float, 16>;
+// Wide kernels don't fit in the automatic buffer, use a pool for those.
+using kernel_allocator = auto_pool_allocator<float, 16>;
 using kernel_array = dense_array<dense_array<float, 1, kernel_allocator>, 1>;
 
 // Build kernels for each index in a dim 'out' to sample from a dim 'in'.
@@ -194,6 +195,8 @@ auto make_temp_image(X x, Y y, C c) {
 template <class TIn, class TOut, class ShapeIn, class ShapeOut>
 void resample(array_ref<TIn, ShapeIn> in, array_ref<TOut, ShapeOut> out, rational<index_t> rate_x,
     rational<index_t> rate_y, continuous_kernel kernel) {
+  NDARRAY_PROFILE_SCOPE("resample", ShapeOut, out.size(),
+      in.size() * sizeof(TIn) + out.size() * sizeof(TOut));
   // Make the kernels we need at each output x and y coordinate in the output.
   internal::kernel_array kernels_x = internal::build_kernels(
       {in.x().min(), in.x().extent()}, {out.x().min(), out.x().extent()}, rate_x, kernel);
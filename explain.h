@@ -0,0 +1,361 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file explain.h
+ * \brief Diagnostics describing the loop nests used to traverse arrays.
+ *
+ * `for_each_value`, `copy` and related algorithms reorder and fuse the
+ * dimensions of the shapes they traverse at runtime. The functions in this
+ * file describe the resulting loop nest: which dimensions were fused, the
+ * order of the loops, the strides of each loop in bytes, whether compile-time
+ * constant strides were preserved, and an estimate of how much of each cache
+ * line loaded by the innermost loop is used. These descriptions are intended
+ * to help find pathological memory layouts.
+ *
+ * The descriptions assume the default `shape_traits` and `copy_shape_traits`.
+ */
+#ifndef NDARRAY_EXPLAIN_H
+#define NDARRAY_EXPLAIN_H
+
+#include "ein_reduce.h"
+
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace nda {
+
+/** One loop of a loop nest described by `explain`. */
+struct explained_loop {
+  /** The dimensions of the original shape implemented by this loop. If there is
+   * more than one, the dimensions were fused into one loop. */
+  std::vector<size_t> dims;
+  /** The number of iterations of this loop. */
+  index_t extent;
+  /** The stride of this loop in bytes, for each operand. */
+  std::vector<index_t> stride_bytes;
+};
+
+/** An operand of a loop nest described by `explain`. */
+struct explained_operand {
+  std::string name;
+  /** The size in bytes of the elements of this operand. */
+  size_t elem_size;
+  /** The number of dimensions of this operand with a compile-time constant
+   * stride, before and after optimizing the loop nest. */
+  size_t static_strides_before;
+  size_t static_strides_after;
+  /** The estimated fraction of the bytes of each cache line loaded by the
+   * innermost loop that are used. */
+  double cache_line_utilization;
+};
+
+/** A description of a loop nest. */
+struct loop_nest_explanation {
+  std::vector<explained_operand> operands;
+  /** The loops of the loop nest, from innermost to outermost. */
+  std::vector<explained_loop> loops;
+
+  /** Get a human readable description of the loop nest. */
+  std::string to_string() const {
+    std::stringstream ss;
+    ss << *this;
+    return ss.str();
+  }
+
+  friend std::ostream& operator<<(std::ostream& s, const loop_nest_explanation& e) {
+    for (const explained_operand& op : e.operands) {
+      s << op.name << ": " << op.elem_size << " byte elements, " << op.static_strides_before
+        << " -> " << op.static_strides_after << " compile-time strides, "
+        << static_cast<int>(op.cache_line_utilization * 100.0 + 0.5)
+        << "% cache line utilization" << std::endl;
+    }
+    for (size_t i = e.loops.size(); i > 0; i--) {
+      const explained_loop& loop = e.loops[i - 1];
+      s << std::string(2 * (e.loops.size() - i), ' ') << "loop dims {";
+      for (size_t j = 0; j < loop.dims.size(); j++) {
+        s << (j > 0 ? ", " : "") << loop.dims[j];
+      }
+      s << "} extent " << loop.extent << ", stride";
+      for (size_t j = 0; j < loop.stride_bytes.size(); j++) {
+        s << " " << e.operands[j].name << "=" << loop.stride_bytes[j] << "B";
+      }
+      s << std::endl;
+    }
+    return s;
+  }
+};
+
+namespace internal {
+
+// The cache line size assumed when estimating cache line utilization.
+constexpr index_t explain_cache_line_size = 64;
+
+// Estimate the fraction of each cache line loaded by a loop of `extent`
+// iterations with a stride of `stride_bytes` that is used.
+inline double estimate_cache_line_utilization(
+    index_t extent, index_t stride_bytes, index_t elem_size) {
+  const index_t line = explain_cache_line_size;
+  stride_bytes = std::abs(stride_bytes);
+  if (stride_bytes == 0) {
+    // The same element is reused by every iteration.
+    return 1.0;
+  } else if (extent <= 1) {
+    return std::min<double>(1.0, static_cast<double>(elem_size) / line);
+  } else if (stride_bytes <= elem_size) {
+    // A contiguous row, which may only partially use the last line.
+    const index_t row_bytes = extent * elem_size;
+    const index_t lines = (row_bytes + line - 1) / line;
+    return static_cast<double>(row_bytes) / (lines * line);
+  } else if (stride_bytes < line) {
+    return static_cast<double>(elem_size) / stride_bytes;
+  } else {
+    return std::min<double>(1.0, static_cast<double>(elem_size) / line);
+  }
+}
+
+template <class Dim>
+constexpr index_t is_static_stride() {
+  return Dim::Stride != dynamic ? 1 : 0;
+}
+
+template <class... Dims>
+constexpr size_t count_static_strides(const std::tuple<Dims...>*) {
+  return static_cast<size_t>(sum(is_static_stride<Dims>()...));
+}
+
+template <class Shape>
+constexpr size_t count_static_strides() {
+  return count_static_strides(static_cast<const typename Shape::dims_type*>(nullptr));
+}
+
+// A loop of the loop nest being optimized, with the dims the optimizer uses
+// for it (`dim<>` for a shape, or `copy_dims` for a copy), and the original
+// dimensions it implements.
+template <class Dims>
+struct explain_loop {
+  Dims dims;
+  std::vector<size_t> original;
+};
+
+template <class Dims>
+bool operator<(const explain_loop<Dims>& l, const explain_loop<Dims>& r) {
+  return l.dims < r.dims;
+}
+template <class Dims>
+bool can_fuse(const explain_loop<Dims>& inner, const explain_loop<Dims>& outer) {
+  return can_fuse(inner.dims, outer.dims);
+}
+template <class Dims>
+explain_loop<Dims> fuse(const explain_loop<Dims>& inner, const explain_loop<Dims>& outer) {
+  explain_loop<Dims> result = {fuse(inner.dims, outer.dims), inner.original};
+  result.original.insert(result.original.end(), outer.original.begin(), outer.original.end());
+  return result;
+}
+
+// Sort and fuse the loops with the same step as dynamic_optimize_shape and
+// dynamic_optimize_copy_shapes.
+template <class Dims>
+std::vector<explain_loop<Dims>> explain_optimize(std::vector<explain_loop<Dims>> loops) {
+  loops.erase(sort_and_fuse(loops.begin(), loops.end()), loops.end());
+  return loops;
+}
+
+// The dim of each operand of a loop.
+inline std::array<dim<>, 1> operand_dims(const dim<>& d) { return {{d}}; }
+inline std::array<dim<>, 2> operand_dims(const copy_dims& d) { return {{d.src, d.dst}}; }
+
+// Make an explanation of a loop nest, estimating the cache line utilization of
+// each operand from the innermost loop.
+inline loop_nest_explanation make_explanation(
+    std::vector<explained_loop> loops, std::vector<explained_operand> operands) {
+  for (size_t k = 0; k < operands.size(); k++) {
+    operands[k].cache_line_utilization =
+        loops.empty() ? 1.0
+                      : estimate_cache_line_utilization(loops.front().extent,
+                            loops.front().stride_bytes[k], operands[k].elem_size);
+  }
+  loop_nest_explanation result;
+  result.operands = std::move(operands);
+  result.loops = std::move(loops);
+  return result;
+}
+
+template <class Dims>
+loop_nest_explanation make_explanation(
+    const std::vector<explain_loop<Dims>>& loops, std::vector<explained_operand> operands) {
+  std::vector<explained_loop> result;
+  for (const explain_loop<Dims>& i : loops) {
+    const auto dims = operand_dims(i.dims);
+    explained_loop loop;
+    loop.dims = i.original;
+    loop.extent = dims.back().extent();
+    for (size_t k = 0; k < dims.size(); k++) {
+      loop.stride_bytes.push_back(dims[k].stride() * static_cast<index_t>(operands[k].elem_size));
+    }
+    result.push_back(std::move(loop));
+  }
+  return make_explanation(std::move(result), std::move(operands));
+}
+
+template <class Opt>
+constexpr size_t count_static_strides_after() {
+  return count_static_strides<typename std::decay<Opt>::type>();
+}
+
+} // namespace internal
+
+/** Describe the loop nest used by `for_each_value` to traverse a shape `shape`
+ * of elements of `elem_size` bytes. */
+template <class... Dims>
+loop_nest_explanation explain(const shape<Dims...>& shape, size_t elem_size = 1) {
+  using Shape = nda::shape<Dims...>;
+  auto dims = internal::tuple_to_array<dim<>>(shape.dims());
+  std::vector<internal::explain_loop<dim<>>> loops;
+  for (size_t i = 0; i < dims.size(); i++) {
+    loops.push_back({dims[i], {i}});
+  }
+  // Rank 1 shapes are not optimized.
+  if (Shape::rank() > 1) { loops = internal::explain_optimize(loops); }
+
+  using Opt = decltype(internal::optimize_shape(shape));
+  explained_operand op = {"array", elem_size, internal::count_static_strides<Shape>(),
+      internal::count_static_strides_after<Opt>(), 1.0};
+  return internal::make_explanation(loops, {op});
+}
+
+/** Describe the loop nest used by `for_each_value` to traverse the array or
+ * array_ref `a`. */
+template <class T, class Shape>
+loop_nest_explanation explain(const array_ref<T, Shape>& a) {
+  return explain(a.shape(), sizeof(T));
+}
+template <class T, class Shape, class Alloc>
+loop_nest_explanation explain(const array<T, Shape, Alloc>& a) {
+  return explain(a.shape(), sizeof(T));
+}
+
+/** Describe the loop nest used by `copy` or `move` to copy the array or
+ * array_ref `src` to `dst`. */
+template <class TSrc, class ShapeSrc, class TDst, class ShapeDst,
+    class = internal::enable_if_shapes_copy_compatible<ShapeDst, ShapeSrc>>
+loop_nest_explanation explain_copy(
+    const array_ref<TSrc, ShapeSrc>& src, const array_ref<TDst, ShapeDst>& dst) {
+  auto src_dims = internal::tuple_to_array<dim<>>(src.shape().dims());
+  auto dst_dims = internal::tuple_to_array<dim<>>(dst.shape().dims());
+  std::vector<internal::explain_loop<internal::copy_dims>> loops;
+  for (size_t i = 0; i < src_dims.size(); i++) {
+    loops.push_back({{src_dims[i], dst_dims[i]}, {i}});
+  }
+  if (ShapeDst::rank() > 1) { loops = internal::explain_optimize(loops); }
+
+  using Opt = decltype(internal::optimize_copy_shapes(src.shape(), dst.shape()));
+  explained_operand src_op = {"src", sizeof(TSrc), internal::count_static_strides<ShapeSrc>(),
+      internal::count_static_strides_after<typename Opt::first_type>(), 1.0};
+  explained_operand dst_op = {"dst", sizeof(TDst), internal::count_static_strides<ShapeDst>(),
+      internal::count_static_strides_after<typename Opt::second_type>(), 1.0};
+  return internal::make_explanation(loops, {src_op, dst_op});
+}
+template <class TSrc, class ShapeSrc, class AllocSrc, class TDst, class ShapeDst, class AllocDst>
+loop_nest_explanation explain_copy(
+    const array<TSrc, ShapeSrc, AllocSrc>& src, const array<TDst, ShapeDst, AllocDst>& dst) {
+  return explain_copy(src.cref(), dst.cref());
+}
+
+namespace internal {
+
+// Add the array operands of an Einstein reduction expression to `operands`,
+// and the stride in bytes of each loop of the reduction to `strides`.
+template <class T, class Shape, size_t... Is, size_t... Ds>
+void explain_ein_array_operand(const ein_op<array_ref<T, Shape>, Is...>& op,
+    std::vector<explained_operand>& operands, std::vector<std::vector<index_t>>& strides,
+    size_t loops, index_sequence<Ds...>) {
+  // These arrays have an extra element to avoid zero-size arrays.
+  const index_t op_strides[] = {op.op.shape().template dim<Ds>().stride()..., 0};
+  const size_t op_loops[] = {Is..., 0};
+  std::vector<index_t> loop_strides(loops, 0);
+  for (size_t d = 0; d < sizeof...(Is); d++) {
+    loop_strides[op_loops[d]] += op_strides[d] * static_cast<index_t>(sizeof(T));
+  }
+  // The operands of ein_reduce are not optimized, so their compile-time
+  // strides are preserved.
+  const size_t static_strides = count_static_strides<Shape>();
+  operands.push_back({"operand " + std::to_string(operands.size()), sizeof(T), static_strides,
+      static_strides, 1.0});
+  strides.push_back(std::move(loop_strides));
+}
+
+template <class T, class Shape, size_t... Is>
+void explain_ein_operands(const ein_op<array_ref<T, Shape>, Is...>& op,
+    std::vector<explained_operand>& operands, std::vector<std::vector<index_t>>& strides,
+    size_t loops) {
+  explain_ein_array_operand(op, operands, strides, loops, make_index_sequence<sizeof...(Is)>());
+}
+// Operands that are not arrays do not access memory.
+template <class Op, size_t... Is>
+void explain_ein_operands(const ein_op<Op, Is...>& op, std::vector<explained_operand>& operands,
+    std::vector<std::vector<index_t>>& strides, size_t loops) {}
+// Unary and binary operations are identified by their members, because
+// overloads taking their base classes would be worse matches than the leaf
+// overloads above.
+template <class Op>
+auto explain_ein_operands(const Op& op, std::vector<explained_operand>& operands,
+    std::vector<std::vector<index_t>>& strides, size_t loops)
+    -> decltype(typename std::decay<decltype(op.op)>::type::is_ein_op(), void()) {
+  explain_ein_operands(op.op, operands, strides, loops);
+}
+template <class Op>
+auto explain_ein_operands(const Op& op, std::vector<explained_operand>& operands,
+    std::vector<std::vector<index_t>>& strides, size_t loops) -> decltype(op.op_b, void()) {
+  explain_ein_operands(op.op_a, operands, strides, loops);
+  explain_ein_operands(op.op_b, operands, strides, loops);
+}
+
+} // namespace internal
+
+/** Describe the loop nest used by `ein_reduce(expr)`. The loops of an Einstein
+ * reduction are not reordered or fused: loop `i` iterates over the index `i`
+ * of the expression. Operand 0 is the result of the reduction, and the other
+ * operands are the array operands of the expression, from left to right.
+ * Matrix-vector and matrix products that `ein_reduce` computes with
+ * optimized kernels are described as the loop nest they replace. */
+template <class Expr, class = internal::enable_if_ein_assign<Expr>>
+loop_nest_explanation explain_ein_reduce(const Expr& expr) {
+  constexpr index_t LoopRank = Expr::MaxIndex + 1;
+  auto reduction_shape = internal::make_ein_reduce_shape(internal::make_index_sequence<LoopRank>(),
+      internal::is_result_shape(), expr.op_a, internal::is_operand_shape(), expr.op_b);
+  auto extents = internal::tuple_to_array<index_t>(reduction_shape.extent());
+
+  std::vector<explained_operand> operands;
+  std::vector<std::vector<index_t>> strides;
+  internal::explain_ein_operands(expr.op_a, operands, strides, LoopRank);
+  internal::explain_ein_operands(expr.op_b, operands, strides, LoopRank);
+
+  std::vector<explained_loop> loops;
+  for (index_t i = 0; i < LoopRank; i++) {
+    explained_loop loop;
+    loop.dims.push_back(i);
+    loop.extent = extents[i];
+    for (const auto& op_strides : strides) {
+      loop.stride_bytes.push_back(op_strides[i]);
+    }
+    loops.push_back(std::move(loop));
+  }
+  return internal::make_explanation(std::move(loops), std::move(operands));
+}
+
+} // namespace nda
+
+#endif // NDARRAY_EXPLAIN_H
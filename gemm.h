@@ -0,0 +1,337 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file gemm.h
+ * \brief Matrix multiplication with packed operands, including mixed
+ * precision products.
+ *
+ * The operands are copied in blocks to buffers laid out for a register-tiled
+ * micro-kernel, converting them to the accumulator type on the way. This
+ * means the micro-kernel only depends on the accumulator type, and operands
+ * of narrower types (e.g. 8-bit integers) are converted once per block,
+ * instead of once per multiplication.
+ */
+#ifndef NDARRAY_GEMM_H
+#define NDARRAY_GEMM_H
+
+#include "array.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if (defined(__AVX2__) || defined(__AVX512BW__)) && !defined(__CUDA__)
+#include <immintrin.h>
+#endif
+
+// The loop over the rows of the register tile in the micro-kernel must be
+// unrolled for the accumulators to be kept in registers.
+#if defined(__GNUC__) || defined(__clang__)
+#define NDARRAY_GEMM_UNROLL _Pragma("GCC unroll 16")
+#else
+#define NDARRAY_GEMM_UNROLL
+#endif
+
+// The size of the vector registers of the target, in bytes.
+#if defined(__AVX512F__)
+#define NDARRAY_GEMM_VECTOR_BYTES 64
+#else
+#define NDARRAY_GEMM_VECTOR_BYTES 32
+#endif
+
+namespace nda {
+
+namespace internal {
+
+template <class T>
+using is_int8 = std::integral_constant<bool,
+    std::is_same<T, int8_t>::value || std::is_same<T, uint8_t>::value>;
+
+// Describes how the operands of a product of elements of type TA and TB are
+// packed for accumulation in type T. By default, the operands are converted
+// to T when they are packed.
+template <class TA, class TB, class T, class = void>
+struct gemm_packing {
+  using type = T;
+  // The number of consecutive elements of the reduction dimension that are
+  // interleaved in the packed operands.
+  static constexpr index_t k_group = 1;
+};
+
+// 8-bit integers accumulated in 32-bit integers are packed to 16-bit integers,
+// interleaved in pairs of the reduction dimension. This allows the micro-kernel
+// to multiply and add pairs of them to the accumulators in one instruction
+// (pmaddwd or vpdpwssd).
+template <class TA, class TB>
+struct gemm_packing<TA, TB, int32_t, std::enable_if_t<is_int8<TA>::value && is_int8<TB>::value>> {
+  using type = int16_t;
+  static constexpr index_t k_group = 2;
+};
+
+// The register tile computed by the micro-kernel is gemm_mr x gemm_nr<T>(),
+// which is 12 vector registers of accumulators.
+constexpr index_t gemm_mr = 6;
+template <class T>
+constexpr index_t gemm_nr() {
+  return sizeof(T) < 2 * NDARRAY_GEMM_VECTOR_BYTES ? 2 * NDARRAY_GEMM_VECTOR_BYTES / sizeof(T)
+                                                    : 1;
+}
+
+// The blocks of the operands that are packed at once. The packed block of a
+// (gemm_mc x gemm_kc) should fit in the L2 cache, and a micro-panel of the
+// packed block of b (gemm_kc x gemm_nr) should fit in the L1 cache.
+constexpr index_t gemm_kc = 256;
+constexpr index_t gemm_mc = 16 * gemm_mr;
+constexpr index_t gemm_nc = 2048;
+
+// Pack the block of `m` x `k` elements of `a`, addressed by a(i, k) =
+// a[i * a_si + k * a_sk], to panels of MR rows. Within each panel, groups of
+// KGroup elements of the reduction dimension are contiguous, followed by the
+// MR rows, followed by the groups. Rows and reduction elements beyond the
+// block are zero.
+template <index_t MR, index_t KGroup, class TA, class TP>
+void gemm_pack(index_t m, index_t k, const TA* a, index_t a_si, index_t a_sk, TP* packed) {
+  const index_t k_groups = (k + KGroup - 1) / KGroup;
+  for (index_t i0 = 0; i0 < m; i0 += MR) {
+    for (index_t kg = 0; kg < k_groups; kg++) {
+      for (index_t r = 0; r < MR; r++) {
+        for (index_t g = 0; g < KGroup; g++) {
+          const index_t i = i0 + r;
+          const index_t kk = kg * KGroup + g;
+          *packed++ = i < m && kk < k ? static_cast<TP>(a[i * a_si + kk * a_sk]) : TP(0);
+        }
+      }
+    }
+  }
+}
+
+// Compute acc(r, l) += sum_k pa(r, k) * pb(k, l), for packed micro-panels pa
+// and pb of `k_groups` groups of the reduction dimension.
+template <index_t MR, index_t NR, index_t KGroup, class T, class TP>
+NDARRAY_INLINE void gemm_micro_kernel(
+    index_t k_groups, const TP* pa, const TP* pb, T (&acc)[MR][NR]) {
+  for (index_t kg = 0; kg < k_groups; kg++) {
+    for (index_t g = 0; g < KGroup; g++) {
+      T b_l[NR];
+      for (index_t l = 0; l < NR; l++) {
+        b_l[l] = pb[l * KGroup + g];
+      }
+      NDARRAY_GEMM_UNROLL
+      for (index_t r = 0; r < MR; r++) {
+        const T a_r = pa[r * KGroup + g];
+        for (index_t l = 0; l < NR; l++) {
+          acc[r][l] += a_r * b_l[l];
+        }
+      }
+    }
+    pa += MR * KGroup;
+    pb += NR * KGroup;
+  }
+}
+
+#if (defined(__AVX2__) || defined(__AVX512BW__)) && !defined(__CUDA__)
+// The micro-kernel for pairs of 16-bit integers accumulated in 32-bit
+// integers. Each 32-bit lane of the vectors of b holds a pair of elements of
+// the reduction dimension. The pair of elements of a is broadcast to all
+// lanes, and multiplied and added to the accumulators with pmaddwd.
+template <index_t MR, index_t NR, index_t KGroup>
+NDARRAY_INLINE void gemm_micro_kernel(
+    index_t k_groups, const int16_t* pa, const int16_t* pb, int32_t (&acc)[MR][NR]) {
+  static_assert(KGroup == 2, "16-bit integers must be packed in pairs.");
+#if defined(__AVX512BW__)
+  using vector = __m512i;
+#define NDARRAY_GEMM_LOAD(p) _mm512_loadu_si512(p)
+#define NDARRAY_GEMM_STORE(p, x) _mm512_storeu_si512(p, x)
+#define NDARRAY_GEMM_BROADCAST(x) _mm512_set1_epi32(x)
+#if defined(__AVX512VNNI__)
+#define NDARRAY_GEMM_MADD(acc, a, b) _mm512_dpwssd_epi32(acc, a, b)
+#else
+#define NDARRAY_GEMM_MADD(acc, a, b) _mm512_add_epi32(acc, _mm512_madd_epi16(a, b))
+#endif
+#else
+  using vector = __m256i;
+#define NDARRAY_GEMM_LOAD(p) _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+#define NDARRAY_GEMM_STORE(p, x) _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x)
+#define NDARRAY_GEMM_BROADCAST(x) _mm256_set1_epi32(x)
+#define NDARRAY_GEMM_MADD(acc, a, b) _mm256_add_epi32(acc, _mm256_madd_epi16(a, b))
+#endif
+  constexpr index_t lanes = sizeof(vector) / sizeof(int32_t);
+  static_assert(NR % lanes == 0, "NR must be a multiple of the vector size.");
+  constexpr index_t vectors = NR / lanes;
+
+  vector acc_v[MR][vectors];
+  for (index_t r = 0; r < MR; r++) {
+    for (index_t v = 0; v < vectors; v++) {
+      acc_v[r][v] = NDARRAY_GEMM_LOAD(&acc[r][v * lanes]);
+    }
+  }
+  for (index_t kg = 0; kg < k_groups; kg++) {
+    vector b_v[vectors];
+    for (index_t v = 0; v < vectors; v++) {
+      b_v[v] = NDARRAY_GEMM_LOAD(pb + v * lanes * 2);
+    }
+    NDARRAY_GEMM_UNROLL
+    for (index_t r = 0; r < MR; r++) {
+      int32_t a_pair;
+      std::memcpy(&a_pair, pa + r * 2, sizeof(a_pair));
+      const vector a_r = NDARRAY_GEMM_BROADCAST(a_pair);
+      for (index_t v = 0; v < vectors; v++) {
+        acc_v[r][v] = NDARRAY_GEMM_MADD(acc_v[r][v], a_r, b_v[v]);
+      }
+    }
+    pa += MR * 2;
+    pb += NR * 2;
+  }
+  for (index_t r = 0; r < MR; r++) {
+    for (index_t v = 0; v < vectors; v++) {
+      NDARRAY_GEMM_STORE(&acc[r][v * lanes], acc_v[r][v]);
+    }
+  }
+#undef NDARRAY_GEMM_LOAD
+#undef NDARRAY_GEMM_STORE
+#undef NDARRAY_GEMM_BROADCAST
+#undef NDARRAY_GEMM_MADD
+}
+#endif
+
+// Compute c(i, j) += sum_k a(i, k) * b(k, j) (or -= if `Subtract`) for the
+// `m` x `n` matrix c, with a reduction of extent `k`. The operands are
+// addressed by x(i, j) = x[i * x_si + j * x_sj]. The products are
+// accumulated in the value type T of c. If `lower` is true, only the
+// elements of c with j <= i are written.
+template <bool Subtract, class TA, class TB, class T>
+void gemm_packed(index_t m, index_t n, index_t k, const TA* a, index_t a_si, index_t a_sk,
+    const TB* b, index_t b_sk, index_t b_sj, T* c, index_t c_si, index_t c_sj,
+    bool lower = false) {
+  using packing = gemm_packing<TA, TB, T>;
+  using TP = typename packing::type;
+  constexpr index_t k_group = packing::k_group;
+  constexpr index_t mr = gemm_mr;
+  constexpr index_t nr = gemm_nr<T>();
+  static_assert(gemm_kc % k_group == 0, "gemm_kc must be a multiple of k_group.");
+  static_assert(gemm_mc % mr == 0, "gemm_mc must be a multiple of gemm_mr.");
+  static_assert(gemm_nc % nr == 0, "gemm_nc must be a multiple of gemm_nr.");
+  if (m <= 0 || n <= 0 || k <= 0) return;
+
+  const index_t kc_max = std::min(gemm_kc, (k + k_group - 1) / k_group * k_group);
+  const index_t nc_max = std::min(gemm_nc, (n + nr - 1) / nr * nr);
+  std::vector<TP> packed_a(gemm_mc * kc_max);
+  std::vector<TP> packed_b(nc_max * kc_max);
+
+  for (index_t jc = 0; jc < n; jc += gemm_nc) {
+    const index_t nc = std::min(gemm_nc, n - jc);
+    for (index_t pc = 0; pc < k; pc += gemm_kc) {
+      const index_t kc = std::min(gemm_kc, k - pc);
+      const index_t k_groups = (kc + k_group - 1) / k_group;
+      // b is packed as the transpose of a, to panels of nr columns.
+      gemm_pack<nr, k_group>(nc, kc, b + pc * b_sk + jc * b_sj, b_sj, b_sk, packed_b.data());
+      for (index_t ic = 0; ic < m; ic += gemm_mc) {
+        const index_t mc = std::min(gemm_mc, m - ic);
+        if (lower && jc > ic + mc - 1) continue;
+        gemm_pack<mr, k_group>(mc, kc, a + ic * a_si + pc * a_sk, a_si, a_sk, packed_a.data());
+        for (index_t jr = 0; jr < nc; jr += nr) {
+          const TP* pb = packed_b.data() + jr * k_groups * k_group;
+          for (index_t ir = 0; ir < mc; ir += mr) {
+            const index_t i0 = ic + ir;
+            const index_t j0 = jc + jr;
+            if (lower && j0 > i0 + mr - 1) continue;
+            const TP* pa = packed_a.data() + ir * k_groups * k_group;
+
+            T acc[mr][nr] = {{0}};
+            gemm_micro_kernel<mr, nr, k_group>(k_groups, pa, pb, acc);
+
+            const index_t rows = std::min(mr, m - i0);
+            const index_t cols = std::min(nr, n - j0);
+            for (index_t r = 0; r < rows; r++) {
+              T* c_r = c + (i0 + r) * c_si + j0 * c_sj;
+              const index_t row_cols = lower ? std::min(cols, i0 + r - j0 + 1) : cols;
+              for (index_t l = 0; l < row_cols; l++) {
+                if (Subtract) {
+                  c_r[l * c_sj] -= acc[r][l];
+                } else {
+                  c_r[l * c_sj] += acc[r][l];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// Compute c(i, j) += a(i, k) * b(k, j) (or -= if `Subtract`) for i, j, k in
+// `i_dim`, `j_dim`, `k_dim`. `a_i`, `a_k` are the dims of a addressed by i
+// and k, and similarly for b and c.
+template <bool Subtract, class DimI, class DimJ, class DimK, class TA, class ShapeA, class DimAI,
+    class DimAK, class TB, class ShapeB, class DimBK, class DimBJ, class TC, class ShapeC,
+    class DimCI, class DimCJ>
+void gemm(const DimI& i_dim, const DimJ& j_dim, const DimK& k_dim, const array_ref<TA, ShapeA>& a,
+    const DimAI& a_i, const DimAK& a_k, const array_ref<TB, ShapeB>& b, const DimBK& b_k,
+    const DimBJ& b_j, const array_ref<TC, ShapeC>& c, const DimCI& c_i, const DimCJ& c_j,
+    bool lower = false) {
+  using T = typename std::remove_const<TC>::type;
+  const auto* a_0 = a.base() + (i_dim.min() - a_i.min()) * a_i.stride() +
+                    (k_dim.min() - a_k.min()) * a_k.stride();
+  const auto* b_0 = b.base() + (k_dim.min() - b_k.min()) * b_k.stride() +
+                    (j_dim.min() - b_j.min()) * b_j.stride();
+  T* c_0 = c.base() + (i_dim.min() - c_i.min()) * c_i.stride() +
+           (j_dim.min() - c_j.min()) * c_j.stride();
+  gemm_packed<Subtract, typename std::remove_const<TA>::type,
+      typename std::remove_const<TB>::type>(
+      i_dim.extent(), j_dim.extent(), k_dim.extent(), a_0, a_i.stride(), a_k.stride(), b_0,
+      b_k.stride(), b_j.stride(), c_0, c_i.stride(), c_j.stride(), lower);
+}
+
+} // namespace internal
+
+/** Compute the matrix product `c += a * b`, where `a`, `b` and `c` are rank 2
+ * arrays with dimensions (i, k), (k, j), and (i, j), respectively. The
+ * dimensions of `c` determine the bounds of the product. The k dimensions of
+ * `a` and `b` must have the same bounds.
+ *
+ * The products are accumulated in the value type of `c`. `a` and `b` may
+ * have different value types, which are converted to the value type of `c`
+ * (e.g. to compute `int8_t` x `int8_t` products accumulated in `int32_t`).
+ * The conversion is done once for each element of blocks of `a` and `b`. If
+ * `a` and `b` are 8-bit integers and `c` is `int32_t`, pairs of products are
+ * computed with a single instruction when AVX2 or AVX-512 is available.
+ *
+ * `c` must not alias `a` or `b`. */
+template <class TA, class ShapeA, class TB, class ShapeB, class TC, class ShapeC>
+void gemm(const array_ref<TA, ShapeA>& a, const array_ref<TB, ShapeB>& b,
+    const array_ref<TC, ShapeC>& c) {
+  static_assert(ShapeA::rank() == 2 && ShapeB::rank() == 2 && ShapeC::rank() == 2,
+      "gemm requires rank 2 arrays.");
+  const auto& c_i = c.shape().template dim<0>();
+  const auto& c_j = c.shape().template dim<1>();
+  const auto& a_i = a.shape().template dim<0>();
+  const auto& a_k = a.shape().template dim<1>();
+  const auto& b_k = b.shape().template dim<0>();
+  const auto& b_j = b.shape().template dim<1>();
+  assert(a_i.is_in_range(c_i));
+  assert(b_j.is_in_range(c_j));
+  assert(a_k.min() == b_k.min() && a_k.extent() == b_k.extent());
+  internal::gemm<false>(c_i, c_j, a_k, a, a_i, a_k, b, b_k, b_j, c, c_i, c_j);
+}
+template <class TA, class ShapeA, class AllocA, class TB, class ShapeB, class AllocB, class TC,
+    class ShapeC, class AllocC>
+void gemm(const array<TA, ShapeA, AllocA>& a, const array<TB, ShapeB, AllocB>& b,
+    array<TC, ShapeC, AllocC>& c) {
+  gemm(a.cref(), b.cref(), c.ref());
+}
+
+} // namespace nda
+
+#endif // NDARRAY_GEMM_H
@@ -0,0 +1,305 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file half.h
+ * \brief 16-bit floating point value types.
+ *
+ * `half` is an IEEE 754 binary16 value, and `bfloat16` is the upper 16 bits
+ * of a `float`. Both are stored in 16 bits, and convert implicitly to and from
+ * `float`, where all arithmetic is done. They can be used as the value type of
+ * arrays, and with `copy` and `ein_reduce`. To avoid accumulating rounding
+ * errors, reductions should usually accumulate in `float`.
+ *
+ * `copy` between dense rows of these types and `float` converts many values at
+ * once, using the F16C or AVX-512 conversion instructions when the target
+ * supports them.
+ */
+#ifndef NDARRAY_HALF_H
+#define NDARRAY_HALF_H
+
+#include "array.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__F16C__) || defined(__AVX2__) || defined(__AVX512F__)) && !defined(__CUDA__)
+#include <immintrin.h>
+#endif
+
+namespace nda {
+
+namespace internal {
+
+NDARRAY_INLINE NDARRAY_HOST_DEVICE uint32_t float_to_bits(float x) {
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  return bits;
+}
+
+NDARRAY_INLINE NDARRAY_HOST_DEVICE float bits_to_float(uint32_t bits) {
+  float x;
+  std::memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+// Convert a float to binary16, rounding to the nearest even value.
+inline uint16_t float_to_half_bits_portable(float x) {
+  uint32_t bits = float_to_bits(x);
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  bits &= 0x7fffffff;
+  if (bits >= 0x47800000) {
+    // The result is infinity or NaN. NaNs are made quiet.
+    return sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00);
+  } else if (bits < 0x38800000) {
+    // The result is subnormal or zero. Adding 0.5 aligns the bits of the
+    // result at the bottom of the mantissa, rounding them with the floating
+    // point addition.
+    return sign | (float_to_bits(bits_to_float(bits) + 0.5f) - 0x3f000000);
+  } else {
+    // Adjust the exponent bias, and round the mantissa to nearest even.
+    const uint32_t odd = (bits >> 13) & 1;
+    bits += 0xc8000fff + odd;
+    return sign | (bits >> 13);
+  }
+}
+
+inline float half_bits_to_float_portable(uint16_t h) {
+  const uint32_t exponent_mask = 0x7c00 << 13;
+  uint32_t bits = (h & 0x7fff) << 13;
+  const uint32_t exponent = bits & exponent_mask;
+  bits += (127 - 15) << 23;
+  if (exponent == exponent_mask) {
+    // Infinity or NaN.
+    bits += (128 - 16) << 23;
+  } else if (exponent == 0) {
+    // Zero or subnormal, which are normalized by the subtraction.
+    bits += 1 << 23;
+    bits = float_to_bits(bits_to_float(bits) - bits_to_float(113 << 23));
+  }
+  return bits_to_float(bits | (static_cast<uint32_t>(h & 0x8000) << 16));
+}
+
+inline uint16_t float_to_half_bits(float x) {
+#if defined(__F16C__) && !defined(__CUDA__)
+  return _cvtss_sh(x, _MM_FROUND_TO_NEAREST_INT);
+#else
+  return float_to_half_bits_portable(x);
+#endif
+}
+
+inline float half_bits_to_float(uint16_t h) {
+#if defined(__F16C__) && !defined(__CUDA__)
+  return _cvtsh_ss(h);
+#else
+  return half_bits_to_float_portable(h);
+#endif
+}
+
+// Convert a float to bfloat16, rounding to the nearest even value. This is
+// written without branches, so loops of it can be vectorized.
+NDARRAY_INLINE NDARRAY_HOST_DEVICE uint16_t float_to_bfloat16_bits(float x) {
+  const uint32_t bits = float_to_bits(x);
+  const uint32_t rounded = (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+  const uint32_t quiet_nan = (bits >> 16) | 0x40;
+  return (bits & 0x7fffffff) > 0x7f800000 ? quiet_nan : rounded;
+}
+
+NDARRAY_INLINE NDARRAY_HOST_DEVICE float bfloat16_bits_to_float(uint16_t b) {
+  return bits_to_float(static_cast<uint32_t>(b) << 16);
+}
+
+} // namespace internal
+
+/** An IEEE 754 binary16 floating point value, with 11 bits of precision and a
+ * range of about 6e-8 to 65504. Conversions from `float` round to the nearest
+ * even value. */
+class half {
+  uint16_t bits_;
+
+public:
+  /** Default construction leaves the value uninitialized, like `float`. Value
+   * initialization, e.g. `half()`, makes a zero. */
+  half() = default;
+  half(float x) : bits_(internal::float_to_half_bits(x)) {}
+
+  /** Make a half from its bit pattern. */
+  static half from_bits(uint16_t bits) {
+    half result;
+    result.bits_ = bits;
+    return result;
+  }
+  /** The bit pattern of this value. */
+  uint16_t bits() const { return bits_; }
+
+  operator float() const { return internal::half_bits_to_float(bits_); }
+
+  /** Arithmetic is done in `float`, and the result rounded to `half`. */
+  half& operator+=(float r) { return *this = *this + r; }
+  half& operator-=(float r) { return *this = *this - r; }
+  half& operator*=(float r) { return *this = *this * r; }
+  half& operator/=(float r) { return *this = *this / r; }
+};
+
+/** A bfloat16 floating point value, which is the upper 16 bits of a `float`.
+ * This has the range of `float`, with 8 bits of precision. Conversions from
+ * `float` round to the nearest even value. */
+class bfloat16 {
+  uint16_t bits_;
+
+public:
+  /** Default construction leaves the value uninitialized, like `float`. Value
+   * initialization, e.g. `bfloat16()`, makes a zero. */
+  bfloat16() = default;
+  bfloat16(float x) : bits_(internal::float_to_bfloat16_bits(x)) {}
+
+  /** Make a bfloat16 from its bit pattern. */
+  static bfloat16 from_bits(uint16_t bits) {
+    bfloat16 result;
+    result.bits_ = bits;
+    return result;
+  }
+  /** The bit pattern of this value. */
+  uint16_t bits() const { return bits_; }
+
+  operator float() const { return internal::bfloat16_bits_to_float(bits_); }
+
+  /** Arithmetic is done in `float`, and the result rounded to `bfloat16`. */
+  bfloat16& operator+=(float r) { return *this = *this + r; }
+  bfloat16& operator-=(float r) { return *this = *this - r; }
+  bfloat16& operator*=(float r) { return *this = *this * r; }
+  bfloat16& operator/=(float r) { return *this = *this / r; }
+};
+
+namespace internal {
+
+// The bulk conversions below load and store the 16-bit values as integers.
+static_assert(sizeof(half) == 2 && sizeof(bfloat16) == 2, "16-bit floats must be 16 bits");
+
+#if defined(__AVX512F__) && !defined(__CUDA__)
+// The unmasked forms of some AVX-512 intrinsics cause spurious
+// -Wmaybe-uninitialized warnings with some versions of GCC, so we use the
+// zero-masked forms with all lanes enabled.
+constexpr __mmask16 all_lanes = 0xffff;
+#endif
+
+inline void convert_float_to_half(index_t n, const float* src, half* dst) {
+  index_t i = 0;
+#if defined(__AVX512F__) && !defined(__CUDA__)
+  for (; i + 16 <= n; i += 16) {
+    __m256i h = _mm512_maskz_cvtps_ph(
+        all_lanes, _mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), h);
+  }
+#endif
+#if defined(__F16C__) && !defined(__CUDA__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = half(src[i]);
+  }
+}
+
+inline void convert_half_to_float(index_t n, const half* src, float* dst) {
+  index_t i = 0;
+#if defined(__AVX512F__) && !defined(__CUDA__)
+  for (; i + 16 <= n; i += 16) {
+    __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm512_storeu_ps(dst + i, _mm512_maskz_cvtph_ps(all_lanes, h));
+  }
+#endif
+#if defined(__F16C__) && !defined(__CUDA__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = src[i];
+  }
+}
+
+// vcvtneps2bf16 flushes subnormal values to zero, unlike the portable
+// conversion. Subnormal values are already flushed when compiling with
+// -ffast-math, which this is intended for.
+inline void convert_float_to_bfloat16(index_t n, const float* src, bfloat16* dst) {
+  index_t i = 0;
+#if defined(__AVX512BF16__) && !defined(__CUDA__)
+  for (; i + 16 <= n; i += 16) {
+    __m256bh b = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), (__m256i)b);
+  }
+#endif
+  // Loads and stores of the bits of the values allow this loop to be
+  // vectorized.
+  const float* NDARRAY_RESTRICT s = src;
+  uint16_t* NDARRAY_RESTRICT d = reinterpret_cast<uint16_t*>(dst);
+  for (; i < n; i++) {
+    d[i] = float_to_bfloat16_bits(s[i]);
+  }
+}
+
+inline void convert_bfloat16_to_float(index_t n, const bfloat16* src, float* dst) {
+  index_t i = 0;
+#if defined(__AVX512F__) && !defined(__CUDA__)
+  for (; i + 16 <= n; i += 16) {
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    __m512i x = _mm512_maskz_cvtepu16_epi32(all_lanes, b);
+    x = _mm512_maskz_slli_epi32(all_lanes, x, 16);
+    _mm512_storeu_ps(dst + i, _mm512_castsi512_ps(x));
+  }
+#elif defined(__AVX2__) && !defined(__CUDA__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m256i x = _mm256_slli_epi32(_mm256_cvtepu16_epi32(b), 16);
+    _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(x));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = src[i];
+  }
+}
+
+template <>
+struct convert_row<float, half> : std::true_type {
+  static void convert(index_t extent, const float* src, half* dst) {
+    convert_float_to_half(extent, src, dst);
+  }
+};
+template <>
+struct convert_row<half, float> : std::true_type {
+  static void convert(index_t extent, const half* src, float* dst) {
+    convert_half_to_float(extent, src, dst);
+  }
+};
+template <>
+struct convert_row<float, bfloat16> : std::true_type {
+  static void convert(index_t extent, const float* src, bfloat16* dst) {
+    convert_float_to_bfloat16(extent, src, dst);
+  }
+};
+template <>
+struct convert_row<bfloat16, float> : std::true_type {
+  static void convert(index_t extent, const bfloat16* src, float* dst) {
+    convert_bfloat16_to_float(extent, src, dst);
+  }
+};
+
+} // namespace internal
+
+} // namespace nda
+
+#endif // NDARRAY_HALF_H
@@ -118,6 +118,297 @@ using planar_image_ref = array_ref<T, planar_image_shape>;
 template <class T>
 using const_planar_image_ref = planar_image_ref<const T>;
 
+/** A 'tiled' image shape stores the pixels of an image with dimensions x, y, c
+ * in tiles of `TileW` x `TileH` pixels. Within a tile, pixels are stored in
+ * chunky order (c is dense, then x, then y), and the tiles are stored in row
+ * major order. Neighborhoods in y are much closer together in memory than in a
+ * chunky or planar image, so vertical filters and small 2D crops of large
+ * images touch fewer cache lines and pages.
+ *
+ * The mapping of indices to flat offsets of this shape is not affine, so this
+ * shape is not a `shape<>`. It can be indexed, iterated, copied to and from
+ * other image shapes, and cropped with `crop`, but it cannot be sliced or
+ * cropped with intervals. */
+template <index_t TileW, index_t TileH, index_t Channels = dynamic>
+class tiled_image_shape {
+  static_assert(TileW > 0 && TileH > 0, "Tile extents must be positive.");
+
+public:
+  /** The dims of this shape. The strides of the dims are the strides of the
+   * pixels within a tile. */
+  using x_dim_type = nda::dim<dynamic, dynamic, Channels>;
+  using y_dim_type = nda::dim<dynamic, dynamic, internal::static_mul(TileW, Channels)>;
+  using c_dim_type = dense_dim<0, Channels>;
+  using dims_type = std::tuple<x_dim_type, y_dim_type, c_dim_type>;
+
+  /** The type of the affine shape of (part of) one tile of this shape. */
+  using tile_shape_type = shape<x_dim_type, y_dim_type, c_dim_type>;
+
+  static constexpr size_t rank() { return 3; }
+  static constexpr bool is_scalar() { return false; }
+
+  using index_type = index_of_rank<3>;
+  using size_type = size_t;
+  using dim_indices = decltype(internal::make_index_sequence<3>());
+
+  static constexpr index_t tile_width = TileW;
+  static constexpr index_t tile_height = TileH;
+
+private:
+  dims_type dims_;
+  // The index of the first pixel of the first tile, and the number of tiles in
+  // each dimension. These are not modified by cropping.
+  index_t x0_;
+  index_t y0_;
+  index_t tiles_x_;
+  index_t tiles_y_;
+
+  static index_t tile_count(index_t extent, index_t tile_extent) {
+    return extent > 0 ? (extent + tile_extent - 1) / tile_extent : 0;
+  }
+
+public:
+  /** Construct a tiled image shape covering the pixels `x` x `y` with
+   * channels `c`. The tiles begin at the min of `x` and `y`. */
+  tiled_image_shape(const nda::dim<>& x, const nda::dim<>& y, const c_dim_type& c = c_dim_type())
+      : dims_(x_dim_type(x.min(), x.extent(), c.extent()),
+            y_dim_type(y.min(), y.extent(), TileW * c.extent()), c),
+        x0_(x.min()), y0_(y.min()), tiles_x_(tile_count(x.extent(), TileW)),
+        tiles_y_(tile_count(y.extent(), TileH)) {}
+  tiled_image_shape() : tiled_image_shape(nda::dim<>(), nda::dim<>()) {}
+
+  /** The strides of this shape are always known, this function only updates
+   * the strides of the dims to be consistent with the number of channels. */
+  void resolve() {
+    x().set_stride(c().extent());
+    y().set_stride(TileW * c().extent());
+  }
+  bool is_resolved() const { return true; }
+
+  /** Returns `true` if the indices `args` are in range of this shape. */
+  bool is_in_range(const index_type& indices) const {
+    return internal::is_in_range(dims_, indices, dim_indices());
+  }
+  bool is_in_range(index_t x, index_t y, index_t c) const {
+    return is_in_range(std::make_tuple(x, y, c));
+  }
+
+  /** The number of flat elements in one tile. */
+  index_t tile_size() const { return TileW * TileH * c().extent(); }
+
+  /** Compute the flat offset of the indices. */
+  index_t operator()(index_t x, index_t y, index_t c) const {
+    const index_t xr = x - x0_;
+    const index_t yr = y - y0_;
+    const index_t tx = xr / TileW;
+    const index_t ty = yr / TileH;
+    return (ty * tiles_x_ + tx) * tile_size() + (yr - ty * TileH) * this->y().stride() +
+           (xr - tx * TileW) * this->x().stride() + (c - this->c().min());
+  }
+  index_t operator[](const index_type& indices) const {
+    return (*this)(std::get<0>(indices), std::get<1>(indices), std::get<2>(indices));
+  }
+
+  /** Get a specific dim `D` of this shape. */
+  template <size_t D>
+  auto& dim() {
+    return std::get<D>(dims_);
+  }
+  template <size_t D>
+  const auto& dim() const {
+    return std::get<D>(dims_);
+  }
+  dims_type& dims() { return dims_; }
+  const dims_type& dims() const { return dims_; }
+
+  x_dim_type& x() { return std::get<0>(dims_); }
+  const x_dim_type& x() const { return std::get<0>(dims_); }
+  y_dim_type& y() { return std::get<1>(dims_); }
+  const y_dim_type& y() const { return std::get<1>(dims_); }
+  c_dim_type& c() { return std::get<2>(dims_); }
+  const c_dim_type& c() const { return std::get<2>(dims_); }
+
+  index_t width() const { return x().extent(); }
+  index_t height() const { return y().extent(); }
+  index_t channels() const { return c().extent(); }
+
+  index_type min() const { return internal::mins(dims_, dim_indices()); }
+  index_type max() const { return internal::maxs(dims_, dim_indices()); }
+  index_type extent() const { return internal::extents(dims_, dim_indices()); }
+
+  /** The flat offsets of this shape always cover all of the tiles, even if the
+   * shape has been cropped. */
+  index_t flat_min() const { return 0; }
+  index_t flat_max() const { return tiles_x_ * tiles_y_ * tile_size() - 1; }
+  size_type flat_extent() const {
+    index_t e = flat_max() - flat_min() + 1;
+    return e < 0 ? 0 : static_cast<size_type>(e);
+  }
+
+  size_type size() const {
+    index_t s = internal::product(extent(), dim_indices());
+    return s < 0 ? 0 : static_cast<size_type>(s);
+  }
+  bool empty() const { return size() == 0; }
+  bool is_compact() const { return flat_extent() <= size(); }
+  bool is_one_to_one() const { return true; }
+  template <typename OtherShape>
+  bool is_subset_of(const OtherShape& other, index_t offset) const {
+    return flat_min() >= other.flat_min() + offset && flat_max() <= other.flat_max() + offset;
+  }
+
+  /** Shift the indices of this shape by `dx`, `dy`, without changing the flat
+   * offsets of any pixel. */
+  void translate(index_t dx, index_t dy) {
+    x().set_min(x().min() + dx);
+    y().set_min(y().min() + dy);
+    x0_ += dx;
+    y0_ += dy;
+  }
+
+  /** Call `fn(tile, offset)` for each tile intersecting the pixels `x` x `y` of
+   * this shape, in memory order. `tile` is the affine shape of the
+   * intersection, and `offset` is the flat offset of the min of `tile`. */
+  template <class Fn>
+  void for_each_tile(const interval<>& x, const interval<>& y, Fn&& fn) const {
+    if (x.extent() <= 0 || y.extent() <= 0) return;
+    const index_t tx_min = (x.min() - x0_) / TileW;
+    const index_t tx_max = (x.max() - x0_) / TileW;
+    const index_t ty_min = (y.min() - y0_) / TileH;
+    const index_t ty_max = (y.max() - y0_) / TileH;
+    for (index_t ty = ty_min; ty <= ty_max; ty++) {
+      const index_t tile_y = y0_ + ty * TileH;
+      const index_t y_min = std::max(tile_y, y.min());
+      const index_t y_max = std::min(tile_y + TileH - 1, y.max());
+      for (index_t tx = tx_min; tx <= tx_max; tx++) {
+        const index_t tile_x = x0_ + tx * TileW;
+        const index_t x_min = std::max(tile_x, x.min());
+        const index_t x_max = std::min(tile_x + TileW - 1, x.max());
+        tile_shape_type tile(x_dim_type(x_min, x_max - x_min + 1, this->x().stride()),
+            y_dim_type(y_min, y_max - y_min + 1, this->y().stride()), c());
+        fn(tile, (*this)(x_min, y_min, c().min()));
+      }
+    }
+  }
+  template <class Fn>
+  void for_each_tile(Fn&& fn) const {
+    for_each_tile(interval<>(x().min(), x().extent()), interval<>(y().min(), y().extent()), fn);
+  }
+
+  bool operator==(const tiled_image_shape& other) const {
+    return dims_ == other.dims_ && x0_ == other.x0_ && y0_ == other.y0_ &&
+           tiles_x_ == other.tiles_x_ && tiles_y_ == other.tiles_y_;
+  }
+  bool operator!=(const tiled_image_shape& other) const { return !operator==(other); }
+};
+
+template <class T, index_t TileW, index_t TileH, index_t Channels = dynamic,
+    class Alloc = std::allocator<T>>
+using tiled_image = array<T, tiled_image_shape<TileW, TileH, Channels>, Alloc>;
+template <class T, index_t TileW, index_t TileH, index_t Channels = dynamic>
+using tiled_image_ref = array_ref<T, tiled_image_shape<TileW, TileH, Channels>>;
+template <class T, index_t TileW, index_t TileH, index_t Channels = dynamic>
+using const_tiled_image_ref = tiled_image_ref<const T, TileW, TileH, Channels>;
+
+template <index_t TileW, index_t TileH, index_t Channels>
+class shape_traits<tiled_image_shape<TileW, TileH, Channels>> {
+public:
+  typedef tiled_image_shape<TileW, TileH, Channels> shape_type;
+  typedef typename shape_type::tile_shape_type tile_shape_type;
+
+  // Both of these visit the image one tile at a time, to follow the layout
+  // of the image in memory.
+  template <class Fn>
+  static void for_each_index(const shape_type& s, Fn&& fn) {
+    s.for_each_tile([&](const tile_shape_type& tile, index_t) { for_each_image_index(tile, fn); });
+  }
+
+  template <class Ptr, class Fn>
+  static void for_each_value(const shape_type& s, Ptr base, Fn&& fn) {
+    s.for_each_tile([&](const tile_shape_type& tile, index_t offset) {
+      shape_traits<tile_shape_type>::for_each_value(tile, internal::pointer_add(base, offset), fn);
+    });
+  }
+};
+
+namespace internal {
+
+// Crop an image shape `s` to the pixels of `tile`, in the channels `c`.
+// Returns the cropped shape, and the offset of its min in `s`.
+template <class Shape, class TileShape, class CDim>
+auto crop_to_tile(const Shape& s, const TileShape& tile, const CDim& c) {
+  auto cropped = s(interval<>(tile.x().min(), tile.x().extent()),
+      interval<>(tile.y().min(), tile.y().extent()), interval<>(c.min(), c.extent()));
+  return std::make_pair(cropped, s(tile.x().min(), tile.y().min(), c.min()));
+}
+
+} // namespace internal
+
+/** Copies to and from tiled images are performed one tile at a time. Each tile
+ * is an affine shape, which is copied with the usual `copy_shape_traits`. */
+template <index_t TileW, index_t TileH, index_t Channels, class ShapeDst>
+class copy_shape_traits<tiled_image_shape<TileW, TileH, Channels>, ShapeDst> {
+public:
+  using src_shape_type = tiled_image_shape<TileW, TileH, Channels>;
+  using dst_shape_type = ShapeDst;
+
+  template <class Fn, class TSrc, class TDst>
+  static void for_each_value(
+      const src_shape_type& shape_src, TSrc src, const ShapeDst& shape_dst, TDst dst, Fn&& fn) {
+    // The destination may only use some of the channels of the source.
+    const auto& c = shape_dst.c();
+    shape_src.for_each_tile(interval<>(shape_dst.x().min(), shape_dst.x().extent()),
+        interval<>(shape_dst.y().min(), shape_dst.y().extent()),
+        [&](const typename src_shape_type::tile_shape_type& tile, index_t offset) {
+          auto src_tile = internal::crop_to_tile(tile, tile, c);
+          auto dst_tile = internal::crop_to_tile(shape_dst, tile, c);
+          copy_shape_traits<decltype(src_tile.first), decltype(dst_tile.first)>::for_each_value(
+              src_tile.first, internal::pointer_add(src, offset + src_tile.second),
+              dst_tile.first, internal::pointer_add(dst, dst_tile.second), fn);
+        });
+  }
+};
+
+template <class ShapeSrc, index_t TileW, index_t TileH, index_t Channels>
+class copy_shape_traits<ShapeSrc, tiled_image_shape<TileW, TileH, Channels>> {
+public:
+  using src_shape_type = ShapeSrc;
+  using dst_shape_type = tiled_image_shape<TileW, TileH, Channels>;
+
+  template <class Fn, class TSrc, class TDst>
+  static void for_each_value(
+      const ShapeSrc& shape_src, TSrc src, const dst_shape_type& shape_dst, TDst dst, Fn&& fn) {
+    shape_dst.for_each_tile([&](const typename dst_shape_type::tile_shape_type& tile,
+                                index_t offset) {
+      auto src_tile = internal::crop_to_tile(shape_src, tile, tile.c());
+      copy_shape_traits<decltype(src_tile.first), typename dst_shape_type::tile_shape_type>::
+          for_each_value(src_tile.first, internal::pointer_add(src, src_tile.second), tile,
+              internal::pointer_add(dst, offset), fn);
+    });
+  }
+};
+
+template <index_t SrcTileW, index_t SrcTileH, index_t SrcChannels, index_t DstTileW,
+    index_t DstTileH, index_t DstChannels>
+class copy_shape_traits<tiled_image_shape<SrcTileW, SrcTileH, SrcChannels>,
+    tiled_image_shape<DstTileW, DstTileH, DstChannels>> {
+public:
+  using src_shape_type = tiled_image_shape<SrcTileW, SrcTileH, SrcChannels>;
+  using dst_shape_type = tiled_image_shape<DstTileW, DstTileH, DstChannels>;
+
+  // Visit the tiles of the destination, and copy each of them from the
+  // tiles of the source that intersect it.
+  template <class Fn, class TSrc, class TDst>
+  static void for_each_value(const src_shape_type& shape_src, TSrc src,
+      const dst_shape_type& shape_dst, TDst dst, Fn&& fn) {
+    using dst_tile_shape_type = typename dst_shape_type::tile_shape_type;
+    shape_dst.for_each_tile([&](const dst_tile_shape_type& tile, index_t offset) {
+      copy_shape_traits<src_shape_type, dst_tile_shape_type>::for_each_value(
+          shape_src, src, tile, internal::pointer_add(dst, offset), fn);
+    });
+  }
+};
+
 enum class crop_origin {
   /** The result of the crop has min 0, 0. */
   zero,
@@ -145,6 +436,19 @@ Shape crop_image_shape(Shape s, index_t x0, index_t y0, index_t x1, index_t y1,
   }
   return s;
 }
+template <index_t TileW, index_t TileH, index_t Channels>
+tiled_image_shape<TileW, TileH, Channels> crop_image_shape(
+    tiled_image_shape<TileW, TileH, Channels> s, index_t x0, index_t y0, index_t x1, index_t y1,
+    crop_origin origin = crop_origin::crop) {
+  // The tiles of the result must remain where they are in memory, so we crop
+  // to the same indices, and then translate the result to the new origin.
+  s.x().set_extent(x1 - x0);
+  s.y().set_extent(y1 - y0);
+  s.x().set_min(x0);
+  s.y().set_min(y0);
+  if (origin == crop_origin::zero) { s.translate(-x0, -y0); }
+  return s;
+}
 
 /** Crop the `im` image or image ref to the interval [`x0`, `x1`) x [`y0`, `y1`). The
  * result is a ref of the input image. The origin of the result is determined by
@@ -159,9 +463,11 @@ array_ref<T, Shape> crop(const array_ref<T, Shape>& im, index_t x0, index_t y0,
   Shape cropped_shape = crop_image_shape(im.shape(), x0, y0, x1, y1, origin);
   index_t c0 = im.c().min();
   T* base = im.base() != nullptr ? &im(x0, y0, c0) : nullptr;
-  if (origin == crop_origin::crop) {
-    base = internal::pointer_add(base, -cropped_shape(x0, y0, c0));
-  }
+  // Find the base such that the min of the cropped shape is the same element
+  // as the min of the crop in the original image.
+  const index_t new_x0 = origin == crop_origin::crop ? x0 : 0;
+  const index_t new_y0 = origin == crop_origin::crop ? y0 : 0;
+  base = internal::pointer_add(base, -cropped_shape(new_x0, new_y0, c0));
   return array_ref<T, Shape>(base, cropped_shape);
 }
 template <class T, class Shape>
@@ -19,6 +19,9 @@
 #define NDARRAY_MATRIX_H
 
 #include "array.h"
+#include "gemm.h"
+
+#include <cmath>
 
 namespace nda {
 
@@ -51,11 +54,11 @@ template <class T, index_t Length = dynamic>
 using const_vector_ref = vector_ref<const T, Length>;
 
 /** A matrix with static dimensions `Rows` and `Cols`, with an
- * `auto_allocator`. */
+ * `auto_pool_allocator`. */
 template <class T, index_t Rows, index_t Cols>
-using small_matrix = array<T, matrix_shape<Rows, Cols>, auto_allocator<T, Rows * Cols>>;
+using small_matrix = array<T, matrix_shape<Rows, Cols>, auto_pool_allocator<T, Rows * Cols>>;
 template <class T, index_t Length>
-using small_vector = array<T, vector_shape<Length>, auto_allocator<T, Length>>;
+using small_vector = array<T, vector_shape<Length>, auto_pool_allocator<T, Length>>;
 
 /** Calls `fn` for each index in a matrix shape `s`. */
 template <class Shape, class Fn>
@@ -84,6 +87,614 @@ public:
   }
 };
 
+/** A batch of `Rows x Cols` matrices, stored with the batch dimension
+ * innermost. Each element `(i, j)` of the matrices of a batch is a dense
+ * vector over the batch, so kernels can process one matrix per SIMD lane. */
+template <index_t Rows, index_t Cols>
+using batched_matrix_shape = shape<dim<0, Rows>, dim<0, Cols>, dense_dim<>>;
+
+template <class T, index_t Rows, index_t Cols, class Alloc = std::allocator<T>>
+using batched_matrix = array<T, batched_matrix_shape<Rows, Cols>, Alloc>;
+template <class T, index_t Rows, index_t Cols>
+using batched_matrix_ref = array_ref<T, batched_matrix_shape<Rows, Cols>>;
+
+/** A batch of vectors of length `Length`, stored with the batch dimension
+ * innermost. */
+template <index_t Length>
+using batched_vector_shape = shape<dim<0, Length>, dense_dim<>>;
+
+template <class T, index_t Length, class Alloc = std::allocator<T>>
+using batched_vector = array<T, batched_vector_shape<Length>, Alloc>;
+template <class T, index_t Length>
+using batched_vector_ref = array_ref<T, batched_vector_shape<Length>>;
+
+/** Make a shape for a batch of `batch` matrices or vectors. */
+template <index_t Rows, index_t Cols>
+batched_matrix_shape<Rows, Cols> make_batched_matrix_shape(index_t batch) {
+  return {{}, {}, batch};
+}
+template <index_t Length>
+batched_vector_shape<Length> make_batched_vector_shape(index_t batch) {
+  return {{}, batch};
+}
+
+namespace internal {
+
+// The number of matrices of a batch processed at once by the batched kernels.
+// The kernels copy this many matrices to local buffers, and compute on the
+// buffers with one matrix per lane. This lets the compiler vectorize across
+// the matrices, without needing to prove the arrays do not alias.
+constexpr index_t batch_lanes = 16;
+
+// One value for each of `batch_lanes` matrices. The operators on this type
+// are loops of a constant number of iterations, which the compiler unrolls
+// and vectorizes.
+template <class T>
+struct lane_vector {
+  T x[batch_lanes];
+
+  lane_vector() = default;
+  NDARRAY_INLINE lane_vector(T value) {
+    for (index_t l = 0; l < batch_lanes; l++) {
+      x[l] = value;
+    }
+  }
+
+  NDARRAY_INLINE lane_vector operator-() const {
+    lane_vector result;
+    for (index_t l = 0; l < batch_lanes; l++) {
+      result.x[l] = -x[l];
+    }
+    return result;
+  }
+
+#define NDARRAY_LANE_VECTOR_OP(op)                                                                 \
+  NDARRAY_INLINE lane_vector& operator op##=(const lane_vector& r) {                               \
+    for (index_t l = 0; l < batch_lanes; l++) {                                                    \
+      x[l] op## = r.x[l];                                                                          \
+    }                                                                                              \
+    return *this;                                                                                  \
+  }                                                                                                \
+  NDARRAY_INLINE lane_vector operator op(const lane_vector& r) const {                             \
+    lane_vector result = *this;                                                                    \
+    result op## = r;                                                                               \
+    return result;                                                                                 \
+  }
+
+  NDARRAY_LANE_VECTOR_OP(+)
+  NDARRAY_LANE_VECTOR_OP(-)
+  NDARRAY_LANE_VECTOR_OP(*)
+  NDARRAY_LANE_VECTOR_OP(/)
+
+#undef NDARRAY_LANE_VECTOR_OP
+};
+
+// `batch_lanes` matrices of `Rows x Cols` elements.
+template <class T, index_t Rows, index_t Cols>
+struct matrix_lanes {
+  lane_vector<T> v[Rows][Cols];
+
+  NDARRAY_INLINE lane_vector<T>& operator()(index_t i, index_t j) { return v[i][j]; }
+  NDARRAY_INLINE const lane_vector<T>& operator()(index_t i, index_t j) const { return v[i][j]; }
+};
+
+// Pointer to element (i, j) of matrix b of a batch. Vectors are treated as
+// matrices with one column.
+template <class T, index_t Rows, index_t Cols>
+NDARRAY_INLINE T* batch_element(
+    const batched_matrix_ref<T, Rows, Cols>& a, index_t i, index_t j, index_t b) {
+  return &a(i, j, b);
+}
+template <class T, index_t Length>
+NDARRAY_INLINE T* batch_element(
+    const batched_vector_ref<T, Length>& a, index_t i, index_t j, index_t b) {
+  return &a(i, b);
+}
+
+// Copy `n` matrices starting at batch index `b` of `a` to `lanes`. The unused
+// lanes are filled with copies of the first matrix, so computing on them does
+// not produce special values.
+template <class T, index_t Rows, index_t Cols, class U, class Shape>
+NDARRAY_INLINE void load_lanes(
+    const array_ref<U, Shape>& a, index_t b, index_t n, matrix_lanes<T, Rows, Cols>& lanes) {
+  for (index_t i = 0; i < Rows; i++) {
+    for (index_t j = 0; j < Cols; j++) {
+      const U* src = batch_element(a, i, j, b);
+      T* dst = lanes(i, j).x;
+      if (n == batch_lanes) {
+        for (index_t l = 0; l < batch_lanes; l++) {
+          dst[l] = src[l];
+        }
+      } else {
+        for (index_t l = 0; l < batch_lanes; l++) {
+          dst[l] = src[l < n ? l : 0];
+        }
+      }
+    }
+  }
+}
+
+template <class T, index_t Rows, index_t Cols, class U, class Shape>
+NDARRAY_INLINE void store_lanes(
+    const matrix_lanes<T, Rows, Cols>& lanes, const array_ref<U, Shape>& a, index_t b, index_t n) {
+  for (index_t i = 0; i < Rows; i++) {
+    for (index_t j = 0; j < Cols; j++) {
+      const T* src = lanes(i, j).x;
+      U* dst = batch_element(a, i, j, b);
+      if (n == batch_lanes) {
+        for (index_t l = 0; l < batch_lanes; l++) {
+          dst[l] = src[l];
+        }
+      } else {
+        for (index_t l = 0; l < n; l++) {
+          dst[l] = src[l];
+        }
+      }
+    }
+  }
+}
+
+// The batch dimension of a batched matrix or vector.
+template <class T, class Shape>
+const auto& batch_dim(const array_ref<T, Shape>& a) {
+  return a.shape().template dim<Shape::rank() - 1>();
+}
+
+// Call `fn(b, n)` for each group of `n <= batch_lanes` matrices starting at
+// batch index `b` of the batch dimension `batch`.
+template <class Dim, class Fn>
+void for_each_batch_lanes(const Dim& batch, const Fn& fn) {
+  for (index_t b = batch.min(); b <= batch.max(); b += batch_lanes) {
+    fn(b, std::min(batch_lanes, batch.max() + 1 - b));
+  }
+}
+
+// Compute the adjugate `b` of `a`, and return the determinant of `a`.
+template <class T>
+NDARRAY_INLINE lane_vector<T> adjugate(
+    const matrix_lanes<T, 1, 1>& a, matrix_lanes<T, 1, 1>& b) {
+  b(0, 0) = 1;
+  return a(0, 0);
+}
+template <class T>
+NDARRAY_INLINE lane_vector<T> adjugate(
+    const matrix_lanes<T, 2, 2>& a, matrix_lanes<T, 2, 2>& b) {
+  b(0, 0) = a(1, 1);
+  b(0, 1) = -a(0, 1);
+  b(1, 0) = -a(1, 0);
+  b(1, 1) = a(0, 0);
+  return a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0);
+}
+template <class T>
+NDARRAY_INLINE lane_vector<T> adjugate(
+    const matrix_lanes<T, 3, 3>& a, matrix_lanes<T, 3, 3>& b) {
+  b(0, 0) = a(1, 1) * a(2, 2) - a(1, 2) * a(2, 1);
+  b(0, 1) = a(0, 2) * a(2, 1) - a(0, 1) * a(2, 2);
+  b(0, 2) = a(0, 1) * a(1, 2) - a(0, 2) * a(1, 1);
+  b(1, 0) = a(1, 2) * a(2, 0) - a(1, 0) * a(2, 2);
+  b(1, 1) = a(0, 0) * a(2, 2) - a(0, 2) * a(2, 0);
+  b(1, 2) = a(0, 2) * a(1, 0) - a(0, 0) * a(1, 2);
+  b(2, 0) = a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0);
+  b(2, 1) = a(0, 1) * a(2, 0) - a(0, 0) * a(2, 1);
+  b(2, 2) = a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0);
+  return a(0, 0) * b(0, 0) + a(0, 1) * b(1, 0) + a(0, 2) * b(2, 0);
+}
+template <class T>
+NDARRAY_INLINE lane_vector<T> adjugate(
+    const matrix_lanes<T, 4, 4>& a, matrix_lanes<T, 4, 4>& b) {
+  // Expand in terms of the 2x2 minors of the first two and last two rows.
+  const lane_vector<T> s0 = a(0, 0) * a(1, 1) - a(1, 0) * a(0, 1);
+  const lane_vector<T> s1 = a(0, 0) * a(1, 2) - a(1, 0) * a(0, 2);
+  const lane_vector<T> s2 = a(0, 0) * a(1, 3) - a(1, 0) * a(0, 3);
+  const lane_vector<T> s3 = a(0, 1) * a(1, 2) - a(1, 1) * a(0, 2);
+  const lane_vector<T> s4 = a(0, 1) * a(1, 3) - a(1, 1) * a(0, 3);
+  const lane_vector<T> s5 = a(0, 2) * a(1, 3) - a(1, 2) * a(0, 3);
+  const lane_vector<T> c5 = a(2, 2) * a(3, 3) - a(3, 2) * a(2, 3);
+  const lane_vector<T> c4 = a(2, 1) * a(3, 3) - a(3, 1) * a(2, 3);
+  const lane_vector<T> c3 = a(2, 1) * a(3, 2) - a(3, 1) * a(2, 2);
+  const lane_vector<T> c2 = a(2, 0) * a(3, 3) - a(3, 0) * a(2, 3);
+  const lane_vector<T> c1 = a(2, 0) * a(3, 2) - a(3, 0) * a(2, 2);
+  const lane_vector<T> c0 = a(2, 0) * a(3, 1) - a(3, 0) * a(2, 1);
+  b(0, 0) = a(1, 1) * c5 - a(1, 2) * c4 + a(1, 3) * c3;
+  b(0, 1) = -a(0, 1) * c5 + a(0, 2) * c4 - a(0, 3) * c3;
+  b(0, 2) = a(3, 1) * s5 - a(3, 2) * s4 + a(3, 3) * s3;
+  b(0, 3) = -a(2, 1) * s5 + a(2, 2) * s4 - a(2, 3) * s3;
+  b(1, 0) = -a(1, 0) * c5 + a(1, 2) * c2 - a(1, 3) * c1;
+  b(1, 1) = a(0, 0) * c5 - a(0, 2) * c2 + a(0, 3) * c1;
+  b(1, 2) = -a(3, 0) * s5 + a(3, 2) * s2 - a(3, 3) * s1;
+  b(1, 3) = a(2, 0) * s5 - a(2, 2) * s2 + a(2, 3) * s1;
+  b(2, 0) = a(1, 0) * c4 - a(1, 1) * c2 + a(1, 3) * c0;
+  b(2, 1) = -a(0, 0) * c4 + a(0, 1) * c2 - a(0, 3) * c0;
+  b(2, 2) = a(3, 0) * s4 - a(3, 1) * s2 + a(3, 3) * s0;
+  b(2, 3) = -a(2, 0) * s4 + a(2, 1) * s2 - a(2, 3) * s0;
+  b(3, 0) = -a(1, 0) * c3 + a(1, 1) * c1 - a(1, 2) * c0;
+  b(3, 1) = a(0, 0) * c3 - a(0, 1) * c1 + a(0, 2) * c0;
+  b(3, 2) = -a(3, 0) * s3 + a(3, 1) * s1 - a(3, 2) * s0;
+  b(3, 3) = a(2, 0) * s3 - a(2, 1) * s1 + a(2, 2) * s0;
+  return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+}
+
+} // namespace internal
+
+/** Compute the matrix products `c = a * b` of each matrix of a batch. The
+ * batch of `c` must be in bounds of the batches of `a` and `b`. */
+template <class TA, class TB, class TC, index_t Rows, index_t K, index_t Cols>
+void batched_multiply(const batched_matrix_ref<TA, Rows, K>& a,
+    const batched_matrix_ref<TB, K, Cols>& b, const batched_matrix_ref<TC, Rows, Cols>& c) {
+  using T = typename std::remove_const<TC>::type;
+  internal::for_each_batch_lanes(internal::batch_dim(c), [&](index_t batch, index_t n) {
+    internal::matrix_lanes<T, Rows, K> a_lanes;
+    internal::matrix_lanes<T, K, Cols> b_lanes;
+    internal::matrix_lanes<T, Rows, Cols> c_lanes;
+    internal::load_lanes(a, batch, n, a_lanes);
+    internal::load_lanes(b, batch, n, b_lanes);
+    for (index_t i = 0; i < Rows; i++) {
+      for (index_t j = 0; j < Cols; j++) {
+        c_lanes(i, j) = a_lanes(i, 0) * b_lanes(0, j);
+        for (index_t k = 1; k < K; k++) {
+          c_lanes(i, j) += a_lanes(i, k) * b_lanes(k, j);
+        }
+      }
+    }
+    internal::store_lanes(c_lanes, c, batch, n);
+  });
+}
+template <class TA, class TB, class TC, index_t Rows, index_t K, index_t Cols, class AllocA,
+    class AllocB, class AllocC>
+void batched_multiply(const batched_matrix<TA, Rows, K, AllocA>& a,
+    const batched_matrix<TB, K, Cols, AllocB>& b, batched_matrix<TC, Rows, Cols, AllocC>& c) {
+  batched_multiply(a.cref(), b.cref(), c.ref());
+}
+
+/** Apply the transformation matrix of each element of a batch `m` to the
+ * vector of the same element of `x`, producing `y`. If `x` has one fewer
+ * element than the number of columns of `m`, `x` is treated as a point in
+ * homogeneous coordinates with an implicit last element of 1, i.e. the last
+ * column of `m` is a translation. The batch of `y` must be in bounds of the
+ * batches of `m` and `x`. */
+template <class TM, class TX, class TY, index_t Rows, index_t Cols, index_t Length>
+void batched_transform(const batched_matrix_ref<TM, Rows, Cols>& m,
+    const batched_vector_ref<TX, Length>& x, const batched_vector_ref<TY, Rows>& y) {
+  static_assert(Length == Cols || Length + 1 == Cols,
+      "the length of x must be the number of columns of m, or one less.");
+  using T = typename std::remove_const<TY>::type;
+  internal::for_each_batch_lanes(internal::batch_dim(y), [&](index_t batch, index_t n) {
+    internal::matrix_lanes<T, Rows, Cols> m_lanes;
+    internal::matrix_lanes<T, Length, 1> x_lanes;
+    internal::matrix_lanes<T, Rows, 1> y_lanes;
+    internal::load_lanes(m, batch, n, m_lanes);
+    internal::load_lanes(x, batch, n, x_lanes);
+    for (index_t i = 0; i < Rows; i++) {
+      y_lanes(i, 0) = Length < Cols ? m_lanes(i, Cols - 1) : internal::lane_vector<T>(0);
+      for (index_t j = 0; j < Length; j++) {
+        y_lanes(i, 0) += m_lanes(i, j) * x_lanes(j, 0);
+      }
+    }
+    internal::store_lanes(y_lanes, y, batch, n);
+  });
+}
+template <class TM, class TX, class TY, index_t Rows, index_t Cols, index_t Length, class AllocM,
+    class AllocX, class AllocY>
+void batched_transform(const batched_matrix<TM, Rows, Cols, AllocM>& m,
+    const batched_vector<TX, Length, AllocX>& x, batched_vector<TY, Rows, AllocY>& y) {
+  batched_transform(m.cref(), x.cref(), y.ref());
+}
+
+/** Compute the determinant of each `N x N` matrix of a batch `a`. `N` must be
+ * at most 4. `det` is a rank 1 array or array_ref, and its elements must be in
+ * bounds of the batch of `a`. */
+template <class TA, class TD, index_t N, class ShapeD>
+void batched_determinant(const batched_matrix_ref<TA, N, N>& a, const array_ref<TD, ShapeD>& det) {
+  static_assert(N >= 1 && N <= 4, "batched_determinant only supports matrices up to 4x4.");
+  static_assert(ShapeD::rank() == 1, "det must be rank 1.");
+  using T = typename std::remove_const<TD>::type;
+  internal::for_each_batch_lanes(det.shape().template dim<0>(), [&](index_t batch, index_t n) {
+    internal::matrix_lanes<T, N, N> a_lanes;
+    internal::matrix_lanes<T, N, N> adj_lanes;
+    internal::load_lanes(a, batch, n, a_lanes);
+    const internal::lane_vector<T> det_lanes = internal::adjugate(a_lanes, adj_lanes);
+    for (index_t l = 0; l < n; l++) {
+      det(batch + l) = det_lanes.x[l];
+    }
+  });
+}
+template <class TA, class TD, index_t N, class ShapeD, class AllocA, class AllocD>
+void batched_determinant(
+    const batched_matrix<TA, N, N, AllocA>& a, array<TD, ShapeD, AllocD>& det) {
+  batched_determinant(a.cref(), det.ref());
+}
+
+/** Compute the inverse of each `N x N` matrix of a batch `a`. `N` must be at
+ * most 4. The inverse of a singular matrix is computed by dividing by a zero
+ * determinant. The batch of `inv` must be in bounds of the batch of `a`. */
+template <class TA, class TI, index_t N>
+void batched_inverse(
+    const batched_matrix_ref<TA, N, N>& a, const batched_matrix_ref<TI, N, N>& inv) {
+  static_assert(N >= 1 && N <= 4, "batched_inverse only supports matrices up to 4x4.");
+  using T = typename std::remove_const<TI>::type;
+  internal::for_each_batch_lanes(internal::batch_dim(inv), [&](index_t batch, index_t n) {
+    internal::matrix_lanes<T, N, N> a_lanes;
+    internal::matrix_lanes<T, N, N> inv_lanes;
+    internal::load_lanes(a, batch, n, a_lanes);
+    const internal::lane_vector<T> inv_det =
+        internal::lane_vector<T>(1) / internal::adjugate(a_lanes, inv_lanes);
+    for (index_t i = 0; i < N; i++) {
+      for (index_t j = 0; j < N; j++) {
+        inv_lanes(i, j) *= inv_det;
+      }
+    }
+    internal::store_lanes(inv_lanes, inv, batch, n);
+  });
+}
+template <class TA, class TI, index_t N, class AllocA, class AllocI>
+void batched_inverse(
+    const batched_matrix<TA, N, N, AllocA>& a, batched_matrix<TI, N, N, AllocI>& inv) {
+  batched_inverse(a.cref(), inv.ref());
+}
+
+namespace internal {
+
+// Compute c -= a * b with gemm. The dimension of the reduction must have the
+// same bounds in a and b. If `lower` is true, only the elements on or below
+// the diagonal of c are written.
+template <class TA, class ShapeA, class TB, class ShapeB, class TC, class ShapeC>
+void multiply_subtract(const array_ref<TA, ShapeA>& a, const array_ref<TB, ShapeB>& b,
+    const array_ref<TC, ShapeC>& c, bool lower = false) {
+  const auto& c_i = c.shape().template dim<0>();
+  const auto& c_j = c.shape().template dim<1>();
+  const auto& a_k = a.shape().template dim<1>();
+  gemm</*Subtract=*/true>(c_i, c_j, a_k, a, a.shape().template dim<0>(), a_k, b,
+      b.shape().template dim<0>(), b.shape().template dim<1>(), c, c_i, c_j, lower);
+}
+
+// The number of rows of each block of the triangular solves.
+constexpr index_t solve_block_size = 32;
+
+// Solve l * x = b for x, where l is lower triangular, and overwrite b with x.
+// The bounds of both dimensions of l must be the same as the rows of b. If
+// `unit_diagonal` is true, the diagonal of l is assumed to be 1.
+template <class TL, class ShapeL, class T, class ShapeB>
+void solve_lower(
+    const array_ref<TL, ShapeL>& l, const array_ref<T, ShapeB>& b, bool unit_diagonal) {
+  const index_t end = b.i().max() + 1;
+  for (index_t k0 = b.i().min(); k0 < end; k0 += solve_block_size) {
+    const index_t k1 = std::min(k0 + solve_block_size, end);
+    // Forward substitution of the diagonal block.
+    for (index_t k = k0; k < k1; k++) {
+      for (index_t s = k0; s < k; s++) {
+        const T l_ks = l(k, s);
+        for (index_t x : b.j()) {
+          b(k, x) -= l_ks * b(s, x);
+        }
+      }
+      if (!unit_diagonal) {
+        const T inv_l_kk = 1 / l(k, k);
+        for (index_t x : b.j()) {
+          b(k, x) *= inv_l_kk;
+        }
+      }
+    }
+    // Update the rows below the block.
+    if (k1 < end) {
+      multiply_subtract(l(r(k1, end), r(k0, k1)), b(r(k0, k1), _), b(r(k1, end), _));
+    }
+  }
+}
+
+// Solve u * x = b for x, where u is upper triangular, and overwrite b with x.
+// The bounds of both dimensions of u must be the same as the rows of b.
+template <class TU, class ShapeU, class T, class ShapeB>
+void solve_upper(const array_ref<TU, ShapeU>& u, const array_ref<T, ShapeB>& b) {
+  const index_t begin = b.i().min();
+  for (index_t k1 = b.i().max() + 1; k1 > begin; k1 -= solve_block_size) {
+    const index_t k0 = std::max(k1 - solve_block_size, begin);
+    // Backward substitution of the diagonal block.
+    for (index_t k = k1 - 1; k >= k0; k--) {
+      for (index_t s = k + 1; s < k1; s++) {
+        const T u_ks = u(k, s);
+        for (index_t x : b.j()) {
+          b(k, x) -= u_ks * b(s, x);
+        }
+      }
+      const T inv_u_kk = 1 / u(k, k);
+      for (index_t x : b.j()) {
+        b(k, x) *= inv_u_kk;
+      }
+    }
+    // Update the rows above the block.
+    if (k0 > begin) {
+      multiply_subtract(u(r(begin, k0), r(k0, k1)), b(r(k0, k1), _), b(r(begin, k0), _));
+    }
+  }
+}
+
+// Make a reference to the same elements as `a`, with a min of 0 in each
+// dimension.
+template <class T>
+matrix_ref<T> with_zero_min(const matrix_ref<T>& a) {
+  return matrix_ref<T>(a.base(),
+      matrix_shape<>(nda::dim<>(0, a.rows(), a.i().stride()), dense_dim<>(0, a.columns())));
+}
+
+} // namespace internal
+
+/** Compute the LU factorization with partial pivoting `P * a = L * U` of an
+ * `M x N` matrix `a`, in place. After this returns, the elements of `a` below
+ * the diagonal are the elements of the unit lower triangular matrix `L`, and
+ * the elements on or above the diagonal are `U`.
+ *
+ * The factorization is right-looking and blocked by `block_size` columns. The
+ * updates of the trailing matrix are matrix multiplications computed with
+ * `gemm`.
+ *
+ * `pivots` must have extent `min(M, N)`. Row `k` of `a` was exchanged with row
+ * `pivots(k)`, in order of increasing `k`. Both are relative to the min of
+ * the respective array.
+ *
+ * Returns false if `U` is singular. In this case, the factorization is still
+ * completed, but `U` cannot be used to solve a system of equations. */
+template <class T>
+bool lu_factor(
+    const matrix_ref<T>& a, const vector_ref<index_t>& pivots, index_t block_size = 64) {
+  assert(block_size > 0);
+  const matrix_ref<T> lu = internal::with_zero_min(a);
+  const index_t m = lu.rows();
+  const index_t n = lu.columns();
+  const index_t k_end = std::min(m, n);
+  assert(pivots.i().extent() == k_end);
+  const index_t pivots_min = pivots.i().min();
+
+  bool nonsingular = true;
+  for (index_t k0 = 0; k0 < k_end; k0 += block_size) {
+    const index_t k1 = std::min(k0 + block_size, k_end);
+
+    // Factor the panel of columns [k0, k1), one column at a time.
+    for (index_t k = k0; k < k1; k++) {
+      index_t pivot = k;
+      for (index_t i = k + 1; i < m; i++) {
+        if (std::abs(lu(i, k)) > std::abs(lu(pivot, k))) pivot = i;
+      }
+      pivots(pivots_min + k) = pivot;
+      if (pivot != k) {
+        for (index_t j = 0; j < n; j++) {
+          std::swap(lu(k, j), lu(pivot, j));
+        }
+      }
+      if (lu(k, k) == 0) {
+        nonsingular = false;
+        continue;
+      }
+      const T inv_pivot = 1 / lu(k, k);
+      for (index_t i = k + 1; i < m; i++) {
+        const T l_ik = lu(i, k) *= inv_pivot;
+        for (index_t j = k + 1; j < k1; j++) {
+          lu(i, j) -= l_ik * lu(k, j);
+        }
+      }
+    }
+    if (k1 >= n) continue;
+
+    // Compute the block row of U to the right of the panel, and update the
+    // trailing matrix.
+    const matrix_ref<T> u_12 = lu(r(k0, k1), r(k1, n));
+    internal::solve_lower(lu(r(k0, k1), r(k0, k1)), u_12, /*unit_diagonal=*/true);
+    if (k1 < m) {
+      internal::multiply_subtract(lu(r(k1, m), r(k0, k1)), u_12, lu(r(k1, m), r(k1, n)));
+    }
+  }
+  return nonsingular;
+}
+template <class T, class Alloc, class AllocP>
+bool lu_factor(matrix<T, dynamic, dynamic, Alloc>& a, vector<index_t, dynamic, AllocP>& pivots,
+    index_t block_size = 64) {
+  return lu_factor(a.ref(), pivots.ref(), block_size);
+}
+
+/** Solve `a * x = b` for `x`, overwriting `b` with `x`, where `lu` and
+ * `pivots` are the LU factorization of the `N x N` matrix `a` computed by
+ * `lu_factor`. `b` must have `N` rows. */
+template <class T>
+void lu_solve(const const_matrix_ref<T>& lu, const const_vector_ref<index_t>& pivots,
+    const matrix_ref<T>& b) {
+  assert(lu.rows() == lu.columns());
+  assert(b.rows() == lu.rows());
+  const const_matrix_ref<T> lu0 = internal::with_zero_min(lu);
+  const matrix_ref<T> b0 = internal::with_zero_min(b);
+  for (index_t k = 0; k < pivots.i().extent(); k++) {
+    const index_t pivot = pivots(pivots.i().min() + k);
+    if (pivot != k) {
+      for (index_t j : b0.j()) {
+        std::swap(b0(k, j), b0(pivot, j));
+      }
+    }
+  }
+  internal::solve_lower(lu0, b0, /*unit_diagonal=*/true);
+  internal::solve_upper(lu0, b0);
+}
+template <class T, class AllocLU, class AllocP, class AllocB>
+void lu_solve(const matrix<T, dynamic, dynamic, AllocLU>& lu,
+    const vector<index_t, dynamic, AllocP>& pivots, matrix<T, dynamic, dynamic, AllocB>& b) {
+  lu_solve(lu.cref(), pivots.cref(), b.ref());
+}
+
+/** Compute the Cholesky factorization `a = L * L^T` of a symmetric positive
+ * definite `N x N` matrix `a`, in place. Only the elements on or below the
+ * diagonal of `a` are read, and they are overwritten by the lower triangular
+ * matrix `L`. The elements above the diagonal are not modified.
+ *
+ * The factorization is right-looking and blocked by `block_size` columns. The
+ * updates of the trailing matrix are matrix multiplications computed with
+ * `gemm`.
+ *
+ * Returns false if `a` is not positive definite. In this case, `a` is left
+ * partially factored. */
+template <class T>
+bool cholesky_factor(const matrix_ref<T>& a, index_t block_size = 64) {
+  assert(block_size > 0);
+  assert(a.rows() == a.columns());
+  const matrix_ref<T> l = internal::with_zero_min(a);
+  const index_t n = l.rows();
+
+  for (index_t k0 = 0; k0 < n; k0 += block_size) {
+    const index_t k1 = std::min(k0 + block_size, n);
+
+    // Factor the diagonal block.
+    for (index_t k = k0; k < k1; k++) {
+      T d = l(k, k);
+      for (index_t s = k0; s < k; s++) {
+        d -= l(k, s) * l(k, s);
+      }
+      if (!(d > 0)) return false;
+      d = std::sqrt(d);
+      l(k, k) = d;
+      const T inv_d = 1 / d;
+      for (index_t i = k + 1; i < k1; i++) {
+        T l_ik = l(i, k);
+        for (index_t s = k0; s < k; s++) {
+          l_ik -= l(i, s) * l(k, s);
+        }
+        l(i, k) = l_ik * inv_d;
+      }
+    }
+    if (k1 >= n) break;
+
+    // Solve l_21 * l_11^T = a_21 for the block column below the diagonal
+    // block. This is done by solving l_11 * l_21^T = a_21^T, with a transposed
+    // copy of a_21, which is also used for the update of the trailing matrix.
+    const matrix_ref<T> l_21 = l(r(k1, n), r(k0, k1));
+    matrix<T> l_21t({{k0, k1 - k0}, {k1, n - k1}});
+    copy(transpose<1, 0>(l_21), l_21t.ref());
+    internal::solve_lower(l(r(k0, k1), r(k0, k1)), l_21t.ref(), /*unit_diagonal=*/false);
+    copy(transpose<1, 0>(l_21t.ref()), l_21);
+
+    // Update the lower triangle of the trailing matrix.
+    internal::multiply_subtract(l_21, l_21t.cref(), l(r(k1, n), r(k1, n)), /*lower=*/true);
+  }
+  return true;
+}
+template <class T, class Alloc>
+bool cholesky_factor(matrix<T, dynamic, dynamic, Alloc>& a, index_t block_size = 64) {
+  return cholesky_factor(a.ref(), block_size);
+}
+
+/** Solve `a * x = b` for `x`, overwriting `b` with `x`, where `l` is the
+ * Cholesky factorization of the `N x N` matrix `a` computed by
+ * `cholesky_factor`. `b` must have `N` rows. */
+template <class T>
+void cholesky_solve(const const_matrix_ref<T>& l, const matrix_ref<T>& b) {
+  assert(l.rows() == l.columns());
+  assert(b.rows() == l.rows());
+  const const_matrix_ref<T> l0 = internal::with_zero_min(l);
+  const matrix_ref<T> b0 = internal::with_zero_min(b);
+  internal::solve_lower(l0, b0, /*unit_diagonal=*/false);
+  internal::solve_upper(transpose<1, 0>(l0), b0);
+}
+template <class T, class AllocL, class AllocB>
+void cholesky_solve(
+    const matrix<T, dynamic, dynamic, AllocL>& l, matrix<T, dynamic, dynamic, AllocB>& b) {
+  cholesky_solve(l.cref(), b.ref());
+}
+
 } // namespace nda
 
 #endif // NDARRAY_MATRIX_H
\ No newline at end of file
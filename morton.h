@@ -0,0 +1,442 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file morton.h
+ * \brief Shapes using Morton (Z-order) indexing.
+ */
+#ifndef NDARRAY_MORTON_H
+#define NDARRAY_MORTON_H
+
+#include "array.h"
+
+#include <cstdint>
+
+namespace nda {
+
+namespace internal {
+
+// Spread the low bits of `x` out such that there are `Rank - 1` zero bits
+// between each of them.
+template <size_t Rank>
+NDARRAY_INLINE uint32_t morton_dilate(uint32_t x);
+template <size_t Rank>
+NDARRAY_INLINE uint32_t morton_compact(uint32_t x);
+
+template <>
+NDARRAY_INLINE uint32_t morton_dilate<1>(uint32_t x) {
+  return x;
+}
+template <>
+NDARRAY_INLINE uint32_t morton_compact<1>(uint32_t x) {
+  return x;
+}
+
+template <>
+NDARRAY_INLINE uint32_t morton_dilate<2>(uint32_t x) {
+  x &= 0x0000ffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+template <>
+NDARRAY_INLINE uint32_t morton_compact<2>(uint32_t x) {
+  x &= 0x55555555;
+  x = (x | (x >> 1)) & 0x33333333;
+  x = (x | (x >> 2)) & 0x0f0f0f0f;
+  x = (x | (x >> 4)) & 0x00ff00ff;
+  x = (x | (x >> 8)) & 0x0000ffff;
+  return x;
+}
+
+template <>
+NDARRAY_INLINE uint32_t morton_dilate<3>(uint32_t x) {
+  x &= 0x000003ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+template <>
+NDARRAY_INLINE uint32_t morton_compact<3>(uint32_t x) {
+  x &= 0x09249249;
+  x = (x | (x >> 2)) & 0x030c30c3;
+  x = (x | (x >> 4)) & 0x0300f00f;
+  x = (x | (x >> 8)) & 0x030000ff;
+  x = (x | (x >> 16)) & 0x000003ff;
+  return x;
+}
+
+} // namespace internal
+
+/** A shape mapping indices to flat offsets with Morton (Z-order) indexing.
+ * The shape is divided into blocks of `2^BlockBits` indices in each dimension.
+ * The blocks are stored one after another, with dim 0 being the innermost
+ * dimension, and the indices within a block are stored in Morton order, i.e.
+ * the flat offset of an index in a block is the bits of the indices of each
+ * dimension interleaved.
+ *
+ * Neighbors in every dimension are close together in memory, regardless of the
+ * order in which they are visited. This is useful for algorithms that access
+ * neighborhoods in all dimensions, where any choice of affine strides leads to
+ * large strides in at least one dimension.
+ *
+ * This shape is not a `shape<>`, the dims of this shape are `interval<>`s
+ * without strides. Arrays of this shape can be indexed, iterated in Z-order
+ * with `for_each_value` and `for_each_index`, and copied to and from other
+ * shapes of the same rank, but they cannot be sliced or cropped. Only ranks 2
+ * and 3 are supported. */
+template <size_t Rank, index_t BlockBits = 4>
+class morton_shape {
+  static_assert(Rank == 2 || Rank == 3, "morton_shape only supports rank 2 and 3.");
+  static_assert(BlockBits >= 0 && BlockBits * Rank <= 30, "BlockBits is too large.");
+
+public:
+  using dims_type = internal::tuple_of_n<interval<>, Rank>;
+  using index_type = index_of_rank<Rank>;
+  using size_type = size_t;
+  using dim_indices = decltype(internal::make_index_sequence<Rank>());
+
+  static constexpr size_t rank() { return Rank; }
+  static constexpr bool is_scalar() { return false; }
+
+  /** The number of indices in each dimension of one block. */
+  static constexpr index_t block_extent = static_cast<index_t>(1) << BlockBits;
+  /** The number of flat elements in one block. */
+  static constexpr index_t block_size = static_cast<index_t>(1) << (BlockBits * Rank);
+
+private:
+  dims_type dims_;
+  // The number of blocks in each dimension.
+  std::array<index_t, Rank> blocks_;
+
+  static index_t block_count(index_t extent) {
+    return extent > 0 ? (extent + block_extent - 1) >> BlockBits : 0;
+  }
+
+  template <class Dim>
+  static interval<> to_interval(const Dim& d) {
+    return interval<>(d.min(), d.extent());
+  }
+  template <class Dims, size_t... Is>
+  static dims_type to_intervals(const Dims& dims, internal::index_sequence<Is...>) {
+    return dims_type(to_interval(std::get<Is>(dims))...);
+  }
+
+  void init_blocks() {
+    const std::array<index_t, Rank> e = extents();
+    for (size_t d = 0; d < Rank; d++) {
+      blocks_[d] = block_count(e[d]);
+    }
+  }
+
+  std::array<index_t, Rank> mins() const {
+    return internal::tuple_to_array<index_t>(min());
+  }
+  std::array<index_t, Rank> extents() const {
+    return internal::tuple_to_array<index_t>(extent());
+  }
+
+  // Offset of the block containing the indices relative to the min `i`.
+  index_t block_offset(const std::array<index_t, Rank>& i) const {
+    index_t block = 0;
+    for (size_t d = Rank; d > 0; d--) {
+      block = block * blocks_[d - 1] + (i[d - 1] >> BlockBits);
+    }
+    return block * block_size;
+  }
+  // Offset of the indices relative to the min `i` within its block.
+  static index_t offset_in_block(const std::array<index_t, Rank>& i) {
+    uint32_t result = 0;
+    for (size_t d = 0; d < Rank; d++) {
+      result |= internal::morton_dilate<Rank>(static_cast<uint32_t>(i[d] & (block_extent - 1)))
+                << d;
+    }
+    return result;
+  }
+  // The inverse of `offset_in_block`.
+  static void decode_in_block(uint32_t offset, std::array<index_t, Rank>& i) {
+    for (size_t d = 0; d < Rank; d++) {
+      i[d] = internal::morton_compact<Rank>(offset >> d);
+    }
+  }
+
+public:
+  /** Construct a shape with the given dims. Only the min and extent of the
+   * dims are used. */
+  template <size_t R = Rank, class = std::enable_if_t<R == 2>>
+  morton_shape(const nda::dim<>& i, const nda::dim<>& j)
+      : dims_(to_interval(i), to_interval(j)) {
+    init_blocks();
+  }
+  template <size_t R = Rank, class = std::enable_if_t<R == 3>>
+  morton_shape(const nda::dim<>& i, const nda::dim<>& j, const nda::dim<>& k)
+      : dims_(to_interval(i), to_interval(j), to_interval(k)) {
+    init_blocks();
+  }
+  /** Construct a shape from a tuple of `Rank` dims or intervals, such as the
+   * dims of another shape. */
+  template <class... Dims, class = std::enable_if_t<sizeof...(Dims) == Rank>>
+  explicit morton_shape(const std::tuple<Dims...>& dims)
+      : dims_(to_intervals(dims, dim_indices())) {
+    init_blocks();
+  }
+  morton_shape() {
+    dims_ = to_intervals(internal::tuple_of_n<nda::dim<>, Rank>(), dim_indices());
+    init_blocks();
+  }
+
+  /** This shape is always resolved. */
+  void resolve() {}
+  bool is_resolved() const { return true; }
+
+  /** Returns `true` if the indices `indices` are in range of this shape. */
+  bool is_in_range(const index_type& indices) const {
+    return internal::is_in_range(dims_, indices, dim_indices());
+  }
+  template <class... Args, class = std::enable_if_t<sizeof...(Args) == Rank>>
+  bool is_in_range(Args... indices) const {
+    return is_in_range(std::make_tuple(indices...));
+  }
+
+  /** Compute the flat offset of the indices `indices`. */
+  index_t operator[](const index_type& indices) const {
+    std::array<index_t, Rank> i = internal::tuple_to_array<index_t>(indices);
+    std::array<index_t, Rank> m = mins();
+    for (size_t d = 0; d < Rank; d++) {
+      i[d] -= m[d];
+    }
+    return block_offset(i) + offset_in_block(i);
+  }
+  template <class... Args, class = std::enable_if_t<sizeof...(Args) == Rank>>
+  index_t operator()(Args... indices) const {
+    return operator[](std::make_tuple(static_cast<index_t>(indices)...));
+  }
+
+  /** Get a specific dim `D` of this shape. */
+  template <size_t D>
+  interval<>& dim() {
+    return std::get<D>(dims_);
+  }
+  template <size_t D>
+  const interval<>& dim() const {
+    return std::get<D>(dims_);
+  }
+  dims_type& dims() { return dims_; }
+  const dims_type& dims() const { return dims_; }
+
+  /** Conventional names for the dims of this shape. */
+  interval<>& i() { return dim<0>(); }
+  const interval<>& i() const { return dim<0>(); }
+  interval<>& j() { return dim<1>(); }
+  const interval<>& j() const { return dim<1>(); }
+  template <size_t R = Rank, class = std::enable_if_t<(R > 2)>>
+  interval<>& k() {
+    return dim<2>();
+  }
+  template <size_t R = Rank, class = std::enable_if_t<(R > 2)>>
+  const interval<>& k() const {
+    return dim<2>();
+  }
+  interval<>& x() { return i(); }
+  const interval<>& x() const { return i(); }
+  interval<>& y() { return j(); }
+  const interval<>& y() const { return j(); }
+  template <size_t R = Rank, class = std::enable_if_t<(R > 2)>>
+  interval<>& z() {
+    return dim<2>();
+  }
+  template <size_t R = Rank, class = std::enable_if_t<(R > 2)>>
+  const interval<>& z() const {
+    return dim<2>();
+  }
+
+  index_t width() const { return x().extent(); }
+  index_t height() const { return y().extent(); }
+
+  index_type min() const { return internal::mins(dims_, dim_indices()); }
+  index_type max() const { return internal::maxs(dims_, dim_indices()); }
+  index_type extent() const { return internal::extents(dims_, dim_indices()); }
+
+  /** The flat offsets of this shape cover all of the blocks, including the
+   * indices of partial blocks that are out of range of the shape. */
+  index_t flat_min() const { return 0; }
+  index_t flat_max() const {
+    index_t blocks = 1;
+    for (index_t b : blocks_) {
+      blocks *= b;
+    }
+    return blocks * block_size - 1;
+  }
+  size_type flat_extent() const {
+    index_t e = flat_max() - flat_min() + 1;
+    return e < 0 ? 0 : static_cast<size_type>(e);
+  }
+
+  size_type size() const {
+    index_t s = internal::product(extent(), dim_indices());
+    return s < 0 ? 0 : static_cast<size_type>(s);
+  }
+  bool empty() const { return size() == 0; }
+  bool is_compact() const { return flat_extent() <= size(); }
+  bool is_one_to_one() const { return true; }
+  template <typename OtherShape>
+  bool is_subset_of(const OtherShape& other, index_t offset) const {
+    return flat_min() >= other.flat_min() + offset && flat_max() <= other.flat_max() + offset;
+  }
+
+  /** Call `fn(indices, offset)` for each index in this shape, in Z-order,
+   * where `offset` is the flat offset of `indices`. Blocks entirely in range
+   * of the shape are visited without checking the bounds of each index. */
+  template <class Fn>
+  void for_each_index_and_offset(Fn&& fn) const {
+    const std::array<index_t, Rank> m = mins();
+    const std::array<index_t, Rank> e = extents();
+    std::array<index_t, Rank> b = {};
+    index_t block_base = 0;
+    if (empty()) return;
+    while (true) {
+      // Check if this block is entirely in range.
+      bool full = true;
+      for (size_t d = 0; d < Rank; d++) {
+        full = full && (b[d] + 1) * block_extent <= e[d];
+      }
+      std::array<index_t, Rank> local;
+      index_type indices;
+      for (index_t offset = 0; offset < block_size; offset++) {
+        decode_in_block(static_cast<uint32_t>(offset), local);
+        bool in_range = true;
+        for (size_t d = 0; d < Rank; d++) {
+          local[d] += b[d] * block_extent;
+          in_range = in_range && (full || local[d] < e[d]);
+          local[d] += m[d];
+        }
+        if (!in_range) continue;
+        indices = internal::array_to_tuple(local);
+        fn(indices, block_base + offset);
+      }
+
+      // Move to the next block.
+      block_base += block_size;
+      size_t d = 0;
+      for (; d < Rank; d++) {
+        if (++b[d] < blocks_[d]) break;
+        b[d] = 0;
+      }
+      if (d == Rank) break;
+    }
+  }
+
+  bool operator==(const morton_shape& other) const { return dims_ == other.dims_; }
+  bool operator!=(const morton_shape& other) const { return dims_ != other.dims_; }
+};
+
+template <class T, size_t Rank, index_t BlockBits = 4, class Alloc = std::allocator<T>>
+using morton_array = array<T, morton_shape<Rank, BlockBits>, Alloc>;
+template <class T, size_t Rank, index_t BlockBits = 4>
+using morton_array_ref = array_ref<T, morton_shape<Rank, BlockBits>>;
+template <class T, size_t Rank, index_t BlockBits = 4>
+using const_morton_array_ref = morton_array_ref<const T, Rank, BlockBits>;
+
+template <size_t Rank, index_t BlockBits>
+class shape_traits<morton_shape<Rank, BlockBits>> {
+public:
+  typedef morton_shape<Rank, BlockBits> shape_type;
+
+  // Both of these visit the indices in Z-order, which is also the order of the
+  // indices in memory.
+  template <class Fn>
+  static void for_each_index(const shape_type& s, Fn&& fn) {
+    s.for_each_index_and_offset(
+        [&](const typename shape_type::index_type& i, index_t) { fn(i); });
+  }
+
+  template <class Ptr, class Fn>
+  static void for_each_value(const shape_type& s, Ptr base, Fn&& fn) {
+    if (s.is_compact()) {
+      // All of the blocks are full, the values are all of the flat offsets.
+      Ptr end = base + s.flat_extent();
+      for (; base < end; ++base) {
+        fn(*base);
+      }
+    } else {
+      s.for_each_index_and_offset(
+          [&](const typename shape_type::index_type&, index_t offset) { fn(base[offset]); });
+    }
+  }
+};
+
+/** Copies to and from Morton shapes visit the indices in Z-order of the Morton
+ * shape. */
+template <size_t Rank, index_t BlockBits, class ShapeDst>
+class copy_shape_traits<morton_shape<Rank, BlockBits>, ShapeDst> {
+public:
+  using src_shape_type = morton_shape<Rank, BlockBits>;
+  using dst_shape_type = ShapeDst;
+
+  template <class Fn, class TSrc, class TDst>
+  static void for_each_value(
+      const src_shape_type& shape_src, TSrc src, const ShapeDst& shape_dst, TDst dst, Fn&& fn) {
+    shape_src.for_each_index_and_offset(
+        [&](const typename src_shape_type::index_type& i, index_t offset) {
+          if (shape_dst.is_in_range(i)) { fn(src[offset], dst[shape_dst[i]]); }
+        });
+  }
+};
+
+template <class ShapeSrc, size_t Rank, index_t BlockBits>
+class copy_shape_traits<ShapeSrc, morton_shape<Rank, BlockBits>> {
+public:
+  using src_shape_type = ShapeSrc;
+  using dst_shape_type = morton_shape<Rank, BlockBits>;
+
+  template <class Fn, class TSrc, class TDst>
+  static void for_each_value(
+      const ShapeSrc& shape_src, TSrc src, const dst_shape_type& shape_dst, TDst dst, Fn&& fn) {
+    shape_dst.for_each_index_and_offset(
+        [&](const typename dst_shape_type::index_type& i, index_t offset) {
+          fn(src[shape_src[i]], dst[offset]);
+        });
+  }
+};
+
+template <size_t Rank, index_t SrcBlockBits, index_t DstBlockBits>
+class copy_shape_traits<morton_shape<Rank, SrcBlockBits>, morton_shape<Rank, DstBlockBits>> {
+public:
+  using src_shape_type = morton_shape<Rank, SrcBlockBits>;
+  using dst_shape_type = morton_shape<Rank, DstBlockBits>;
+
+  template <class Fn, class TSrc, class TDst>
+  static void for_each_value(const src_shape_type& shape_src, TSrc src,
+      const dst_shape_type& shape_dst, TDst dst, Fn&& fn) {
+    if (SrcBlockBits == DstBlockBits && shape_src.dims() == shape_dst.dims()) {
+      // The shapes are identical, we can copy the flat offsets directly.
+      shape_dst.for_each_index_and_offset(
+          [&](const typename dst_shape_type::index_type&, index_t offset) {
+            fn(src[offset], dst[offset]);
+          });
+    } else {
+      shape_dst.for_each_index_and_offset(
+          [&](const typename dst_shape_type::index_type& i, index_t offset) {
+            fn(src[shape_src[i]], dst[offset]);
+          });
+    }
+  }
+};
+
+} // namespace nda
+
+#endif // NDARRAY_MORTON_H
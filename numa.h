@@ -0,0 +1,262 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file numa.h
+ * \brief NUMA aware allocation and parallel first-touch initialization of
+ * arrays.
+ *
+ * On Linux, physical pages are placed on a NUMA node when they are first
+ * written (first-touch), unless a memory policy is set with `mbind`. Arrays
+ * constructed with `std::allocator` are initialized by the calling thread, so
+ * all of their pages are placed on one node. The tools in this file allow
+ * allocating arrays without touching their pages, and initializing them in
+ * parallel with the same partitioning used by `parallel_for`, so each page is
+ * placed near the thread that will later process it.
+ */
+#ifndef NDARRAY_NUMA_H
+#define NDARRAY_NUMA_H
+
+#include "array.h"
+#include "parallel.h"
+
+#include <cstdint>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define NDARRAY_HAVE_NUMA 1
+#endif
+
+namespace nda {
+
+/** Describes how pages allocated by `numa_allocator` are placed on NUMA
+ * nodes. */
+enum class numa_policy {
+  /** Pages are placed on the node of the thread that first writes them. */
+  first_touch,
+  /** Pages are interleaved across all of the allowed nodes. This is useful for
+   * data that is accessed by all threads, without a particular partitioning. */
+  interleave,
+};
+
+namespace internal {
+
+#ifdef NDARRAY_HAVE_NUMA
+// Constants from <numaif.h>, which is not always installed.
+constexpr int numa_mpol_interleave = 3;
+constexpr int numa_mpol_f_mems_allowed = 1 << 2;
+constexpr unsigned long numa_max_nodes = 64;
+
+// Get the mask of nodes this process may allocate memory on. Returns 0 if
+// NUMA is not supported by the kernel.
+inline unsigned long numa_allowed_nodes() {
+  unsigned long mask = 0;
+  if (syscall(SYS_get_mempolicy, nullptr, &mask, numa_max_nodes, nullptr,
+          numa_mpol_f_mems_allowed) != 0) {
+    return 0;
+  }
+  return mask;
+}
+
+inline size_t page_size() {
+  static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+// Round `bytes` up to a multiple of the page size.
+inline size_t round_up_to_pages(size_t bytes) {
+  return (bytes + page_size() - 1) / page_size() * page_size();
+}
+#endif
+
+} // namespace internal
+
+/** The number of NUMA nodes this process may allocate memory on. This is 1 on
+ * systems without NUMA support. */
+inline int numa_node_count() {
+#ifdef NDARRAY_HAVE_NUMA
+  unsigned long mask = internal::numa_allowed_nodes();
+  int count = 0;
+  for (; mask; mask &= mask - 1) {
+    count++;
+  }
+  return std::max(count, 1);
+#else
+  return 1;
+#endif
+}
+
+/** Allocator satisfying the `std::allocator` interface that allocates whole
+ * pages directly from the operating system, without writing to them. The
+ * placement of the pages on NUMA nodes is determined by `policy`.
+ *
+ * Default construction of trivially default constructible values is skipped,
+ * so an `array` using this allocator does not touch its pages when it is
+ * constructed without an initial value. Use `parallel_fill` or
+ * `parallel_generate` to initialize such arrays with first-touch placement.
+ *
+ * On systems other than Linux, this allocator is equivalent to
+ * `std::allocator`. */
+template <class T>
+class numa_allocator {
+  numa_policy policy_;
+
+public:
+  using value_type = T;
+
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  numa_allocator(numa_policy policy = numa_policy::first_touch) : policy_(policy) {}
+  template <class U>
+  numa_allocator(const numa_allocator<U>& other) noexcept : policy_(other.policy()) {}
+
+  numa_policy policy() const { return policy_; }
+
+  value_type* allocate(size_t n) {
+#ifdef NDARRAY_HAVE_NUMA
+    const size_t bytes = internal::round_up_to_pages(n * sizeof(T));
+    void* result =
+        mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (result == MAP_FAILED) { throw std::bad_alloc(); }
+    if (policy_ == numa_policy::interleave) {
+      unsigned long nodes = internal::numa_allowed_nodes();
+      if (nodes) {
+        // If this fails, the pages are placed by the default policy, which is
+        // still correct.
+        syscall(SYS_mbind, result, bytes, internal::numa_mpol_interleave, &nodes,
+            internal::numa_max_nodes, 0);
+      }
+    }
+    return static_cast<value_type*>(result);
+#else
+    return std::allocator<T>().allocate(n);
+#endif
+  }
+  void deallocate(value_type* p, size_t n) noexcept {
+#ifdef NDARRAY_HAVE_NUMA
+    munmap(p, internal::round_up_to_pages(n * sizeof(T)));
+#else
+    std::allocator<T>().deallocate(p, n);
+#endif
+  }
+
+  template <class... Args>
+  NDARRAY_INLINE void construct(value_type* ptr, Args&&... args) {
+    // Skip default construction if it has no effect, so the pages are not
+    // touched.
+    if (sizeof...(Args) > 0 || !std::is_trivially_default_constructible<T>::value) {
+      new (ptr) T(std::forward<Args>(args)...);
+    }
+  }
+
+  // Memory allocated by any numa_allocator can be deallocated by any other.
+  template <class U>
+  friend bool operator==(const numa_allocator& a, const numa_allocator<U>& b) {
+    return true;
+  }
+  template <class U>
+  friend bool operator!=(const numa_allocator& a, const numa_allocator<U>& b) {
+    return false;
+  }
+};
+
+namespace internal {
+
+// Crop the outermost dimension of `a` to `strip`.
+template <class T, class Shape, size_t... Is>
+auto crop_outer_dim(
+    const array_ref<T, Shape>& a, const interval<>& strip, index_sequence<Is...>) {
+  return a[std::make_tuple(
+      interval<>(a.shape().template dim<Is>().min(), a.shape().template dim<Is>().extent())...,
+      strip)];
+}
+
+// Call `fn` with strips of `a` along its outermost dimension, in parallel on
+// the threads of `pool`.
+template <class T, class Shape, class Fn>
+void for_each_outer_strip(
+    const array_ref<T, Shape>& a, index_t min_strip, thread_pool& pool, const Fn& fn) {
+  static_assert(Shape::rank() > 0, "parallel initialization requires a rank > 0 array.");
+  const auto& outer = a.shape().template dim<Shape::rank() - 1>();
+  const interval<> range(outer.min(), outer.extent());
+  pool.parallel_for(range, min_strip, [&](const interval<>& strip) {
+    fn(crop_outer_dim(a, strip, make_index_sequence<Shape::rank() - 1>()));
+  });
+}
+
+} // namespace internal
+
+/** Fill the `dst` array or array_ref with `value`, in parallel over strips of
+ * the outermost dimension of `dst`. The strips are the same as those of
+ * `pool.parallel_for` over the outermost dimension with the same `min_strip`,
+ * and are filled by the same threads. If `dst` was allocated by a
+ * `numa_allocator` with `numa_policy::first_touch`, and has not been written
+ * yet, the pages of each strip are placed on the node of the thread that fills
+ * it. The operating system may move threads between nodes, unless the workers
+ * of `pool` are pinned with `thread_pool::set_worker_affinity`, and the
+ * calling thread is pinned too. */
+template <class T, class Shape>
+void parallel_fill(const array_ref<T, Shape>& dst, const T& value, index_t min_strip = 1,
+    thread_pool& pool = thread_pool::global()) {
+  internal::for_each_outer_strip(
+      dst, min_strip, pool, [&](const auto& strip) { fill(strip, value); });
+}
+template <class T, class Shape, class Alloc>
+void parallel_fill(array<T, Shape, Alloc>& dst, const T& value, index_t min_strip = 1,
+    thread_pool& pool = thread_pool::global()) {
+  parallel_fill(dst.ref(), value, min_strip, pool);
+}
+
+/** Fill the `dst` array or array_ref with the result of calling a generator
+ * function `g`, in parallel over strips of the outermost dimension of `dst`,
+ * as `parallel_fill` does. Each strip calls its own copy of `g`, concurrently
+ * with the other strips. */
+template <class T, class Shape, class Generator, class = internal::enable_if_callable<Generator>>
+void parallel_generate(const array_ref<T, Shape>& dst, Generator&& g, index_t min_strip = 1,
+    thread_pool& pool = thread_pool::global()) {
+  internal::for_each_outer_strip(dst, min_strip, pool, [&](const auto& strip) {
+    generate(strip, std::decay_t<Generator>(g));
+  });
+}
+template <class T, class Shape, class Alloc, class Generator,
+    class = internal::enable_if_callable<Generator>>
+void parallel_generate(array<T, Shape, Alloc>& dst, Generator&& g, index_t min_strip = 1,
+    thread_pool& pool = thread_pool::global()) {
+  parallel_generate(dst.ref(), std::forward<Generator>(g), min_strip, pool);
+}
+
+/** An array using `numa_allocator`. */
+template <class T, class Shape>
+using numa_array = array<T, Shape, numa_allocator<T>>;
+
+/** Make a new array with shape `shape` allocated by a `numa_allocator` with
+ * policy `policy`, and initialize it to `value` with `parallel_fill`. The
+ * elements are initialized with first-touch placement only if `T` is trivially
+ * default constructible, otherwise the array's constructor touches them
+ * first. */
+template <class T, class Shape>
+numa_array<T, Shape> make_numa_array(const Shape& shape, const T& value = T(),
+    numa_policy policy = numa_policy::first_touch, index_t min_strip = 1) {
+  numa_array<T, Shape> result(shape, numa_allocator<T>(policy));
+  parallel_fill(result, value, min_strip);
+  return result;
+}
+
+} // namespace nda
+
+#endif // NDARRAY_NUMA_H
@@ -0,0 +1,207 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file parallel.h
+ * \brief A minimal thread pool and helpers for parallel loops.
+ */
+#ifndef NDARRAY_PARALLEL_H
+#define NDARRAY_PARALLEL_H
+
+#include "array.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace nda {
+
+/** A pool of persistent worker threads. Tasks are run in the order they are
+ * enqueued. Tasks can be enqueued for any worker, or for a particular worker. */
+class thread_pool {
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> tasks_;
+  // The tasks for each worker, which are run before the tasks for any worker.
+  std::vector<std::deque<std::function<void()>>> worker_tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+
+  // True on the threads of any thread pool.
+  static bool& is_worker() {
+    static thread_local bool worker = false;
+    return worker;
+  }
+
+  void worker_main(size_t worker) {
+    is_worker() = true;
+    std::deque<std::function<void()>>& own_tasks = worker_tasks_[worker];
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return stop_ || !own_tasks.empty() || !tasks_.empty(); });
+        std::deque<std::function<void()>>& queue = own_tasks.empty() ? tasks_ : own_tasks;
+        if (queue.empty()) return;
+        task = std::move(queue.front());
+        queue.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  /** Make a thread pool with `threads` worker threads. */
+  explicit thread_pool(int threads) : worker_tasks_(std::max(threads, 0)) {
+    for (int i = 0; i < threads; i++) {
+      workers_.emplace_back([this, i]() { worker_main(i); });
+    }
+  }
+  /** Make a thread pool with one fewer worker than the number of hardware
+   * threads, the calling thread is expected to participate in the work. */
+  thread_pool() : thread_pool(std::max<int>(1, std::thread::hardware_concurrency()) - 1) {}
+  ~thread_pool() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread& i : workers_) {
+      i.join();
+    }
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  /** The number of worker threads in this pool. */
+  int thread_count() const { return static_cast<int>(workers_.size()); }
+
+  /** Returns true if the calling thread is a worker of a thread pool. */
+  static bool on_worker_thread() { return is_worker(); }
+
+  /** Run `task` on one of the worker threads of this pool. */
+  void enqueue(std::function<void()> task) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
+  /** Run `task` on the worker thread `worker` of this pool, which must be in
+   * [0, `thread_count()`). */
+  void enqueue(int worker, std::function<void()> task) {
+    assert(0 <= worker && worker < thread_count());
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      worker_tasks_[worker].push_back(std::move(task));
+    }
+    // The waiting worker might not be the one notified by notify_one.
+    cv_.notify_all();
+  }
+
+  /** Restrict the worker thread `worker` of this pool to run on the CPUs in
+   * `cpus`. Returns false if this is not supported, or fails. Because
+   * `parallel_for` runs each strip on the same worker, this keeps each strip
+   * on the same CPUs across calls. */
+  bool set_worker_affinity(int worker, const std::vector<int>& cpus) {
+    assert(0 <= worker && worker < thread_count());
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i : cpus) {
+      CPU_SET(i, &set);
+    }
+    return pthread_setaffinity_np(workers_[worker].native_handle(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  /** Call `fn(strip)` for disjoint strips `strip` of `range`, with at least
+   * `min_strip` indices in each strip (except possibly the last), using the
+   * worker threads of this pool and the calling thread. This function returns
+   * when all of the calls to `fn` have returned. `fn` must not throw.
+   *
+   * The strips depend only on `range`, `min_strip` and the number of workers.
+   * The first strip runs on the calling thread, and strip `i` runs on worker
+   * `i - 1`, so calls with the same range and `min_strip` process each strip
+   * on the same thread.
+   *
+   * Calls from a worker thread of a pool run `fn(range)` on the calling
+   * thread, which avoids deadlocks due to nested parallelism. */
+  template <class Fn>
+  void parallel_for(const interval<>& range, index_t min_strip, Fn&& fn) {
+    min_strip = std::max<index_t>(min_strip, 1);
+    const index_t max_strips = (range.extent() + min_strip - 1) / min_strip;
+    const index_t strips = std::min<index_t>(thread_count() + 1, max_strips);
+    if (strips <= 1 || on_worker_thread()) {
+      if (range.extent() > 0) fn(range);
+      return;
+    }
+
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    index_t remaining = strips - 1;
+    auto strip = [&](index_t i) {
+      index_t begin = range.min() + range.extent() * i / strips;
+      index_t end = range.min() + range.extent() * (i + 1) / strips;
+      return interval<>(begin, end - begin);
+    };
+    for (index_t i = 1; i < strips; i++) {
+      enqueue(static_cast<int>(i - 1), [&, i]() {
+        fn(strip(i));
+        std::unique_lock<std::mutex> lock(done_mutex);
+        if (--remaining == 0) done_cv.notify_one();
+      });
+    }
+    fn(strip(0));
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait(lock, [&]() { return remaining == 0; });
+  }
+  template <class Fn>
+  void parallel_for(const interval<>& range, Fn&& fn) {
+    parallel_for(range, 1, fn);
+  }
+
+  /** A thread pool shared by the whole program, created on first use. */
+  static thread_pool& global() {
+    static thread_pool pool;
+    return pool;
+  }
+};
+
+/** Call `fn(strip)` for disjoint strips of `range`, in parallel on the global
+ * thread pool. See `thread_pool::parallel_for`. */
+template <class Fn>
+void parallel_for(const interval<>& range, index_t min_strip, Fn&& fn) {
+  thread_pool::global().parallel_for(range, min_strip, fn);
+}
+template <class Fn>
+void parallel_for(const interval<>& range, Fn&& fn) {
+  thread_pool::global().parallel_for(range, fn);
+}
+
+} // namespace nda
+
+#endif // NDARRAY_PARALLEL_H
@@ -0,0 +1,269 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file prefetch.h
+ * \brief Iterate over tiles of arrays that are slow to read, loading the next
+ * tiles on a background thread.
+ *
+ * Reading a file-backed array, such as a `chunk_store`, one strip at a time
+ * stalls the computation on each strip while it is read. `prefetch_strips`
+ * and `prefetch` return a range of tiles, where each tile is copied to a
+ * buffer on a background thread while the caller processes the previous
+ * tiles:
+ *
+ *     for (const auto& strip : prefetch_strips<1>(store, split(store.shape().y(), 64))) {
+ *       // strip is a const_array_ref to the rows of the strip.
+ *     }
+ *
+ * Each tile is loaded with `copy(src, tile)`, so the source can be an array,
+ * `chunked_array`, `chunk_store`, or anything else with such a `copy`.
+ */
+#ifndef NDARRAY_PREFETCH_H
+#define NDARRAY_PREFETCH_H
+
+#include "array.h"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nda {
+
+namespace internal {
+
+// Make a dense shape with the mins and extents of `s`, replacing dim `Dim`
+// with `strip`.
+template <size_t Dim, class Shape, size_t... Is>
+dense_shape<sizeof...(Is)> make_strip_shape(
+    const Shape& s, const interval<>& strip, index_sequence<Is...>) {
+  using result_type = dense_shape<sizeof...(Is)>;
+  result_type result(typename std::tuple_element<Is, typename result_type::dims_type>::type(
+      Is == Dim ? strip.min() : s.template dim<Is>().min(),
+      Is == Dim ? strip.extent() : s.template dim<Is>().extent())...);
+  result.resolve();
+  return result;
+}
+
+// Make a dense shape with the mins and extents of `s`, ignoring its strides.
+template <class Shape, size_t... Is>
+Shape make_dense_tile(const Shape& s, index_sequence<Is...>) {
+  Shape result(typename std::tuple_element<Is, typename Shape::dims_type>::type(
+      s.template dim<Is>().min(), s.template dim<Is>().extent())...);
+  result.resolve();
+  return result;
+}
+
+} // namespace internal
+
+/** A range of tiles of type `const_array_ref<T, dense_shape<Rank>>`, which are
+ * loaded by a background thread ahead of the caller.
+ *
+ * The tiles are loaded in order into a ring of `depth` buffers, each large
+ * enough for the largest tile. A tile is valid until the iterator pointing to
+ * it is incremented, which returns its buffer to the background thread to
+ * load a later tile. With the default depth of 2, the next tile is loaded
+ * while the caller processes the current one.
+ *
+ * The background thread starts when `begin` is called, and this range can be
+ * iterated once. The loader is called on the background thread, and the
+ * source it reads must not be used by other threads until the range is
+ * destroyed. */
+template <class T, size_t Rank>
+class prefetched_tiles {
+public:
+  using value_type = T;
+  using shape_type = dense_shape<Rank>;
+  using tile_ref = const_array_ref<T, shape_type>;
+  using buffer_ref = array_ref<T, shape_type>;
+  /** The type of the function that loads a tile into a buffer. */
+  using loader_type = std::function<void(const buffer_ref&)>;
+
+private:
+  std::vector<shape_type> tiles_;
+  loader_type load_;
+  index_t depth_;
+  std::vector<std::unique_ptr<T[]>> buffers_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The number of tiles that have been loaded, and that have been released by
+  // the caller.
+  size_t loaded_ = 0;
+  size_t released_ = 0;
+  bool stop_ = false;
+  std::exception_ptr error_;
+  std::thread thread_;
+
+  buffer_ref buffer(size_t i) const {
+    return buffer_ref(buffers_[i % buffers_.size()].get(), tiles_[i]);
+  }
+
+  void loader_main() {
+    for (size_t i = 0; i < tiles_.size(); i++) {
+      {
+        // Wait for the buffer of tile i to be released.
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return stop_ || i < released_ + buffers_.size(); });
+        if (stop_) return;
+      }
+      std::exception_ptr error;
+      try {
+        load_(buffer(i));
+      } catch (...) { error = std::current_exception(); }
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (error) {
+          error_ = error;
+        } else {
+          loaded_ = i + 1;
+        }
+      }
+      cv_.notify_all();
+      if (error) return;
+    }
+  }
+
+  void start() {
+    assert(!thread_.joinable());
+    size_t max_size = 0;
+    for (const shape_type& i : tiles_) {
+      max_size = std::max<size_t>(max_size, i.flat_extent());
+    }
+    const size_t buffers = std::min(tiles_.size(), static_cast<size_t>(depth_));
+    for (size_t i = 0; i < buffers; i++) {
+      buffers_.emplace_back(new T[max_size]);
+    }
+    thread_ = std::thread([this]() { loader_main(); });
+  }
+
+  tile_ref wait(size_t i) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return i < loaded_ || error_; });
+    if (i >= loaded_) { std::rethrow_exception(error_); }
+    return buffer(i);
+  }
+
+  void release(size_t i) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      released_ = std::max(released_, i + 1);
+    }
+    cv_.notify_all();
+  }
+
+public:
+  /** Make a range of `tiles`, where each tile is loaded by calling
+   * `load(tile)`, using `depth` buffers. The strides of `tiles` are ignored,
+   * each buffer is a dense array. */
+  prefetched_tiles(std::vector<shape_type> tiles, loader_type load, index_t depth = 2)
+      : tiles_(std::move(tiles)), load_(std::move(load)), depth_(depth) {
+    assert(depth_ >= 1);
+    for (shape_type& i : tiles_) {
+      i = internal::make_dense_tile(i, typename shape_type::dim_indices());
+    }
+  }
+  /** Ranges can be moved before iteration begins. */
+  prefetched_tiles(prefetched_tiles&& other)
+      : tiles_(std::move(other.tiles_)), load_(std::move(other.load_)), depth_(other.depth_) {
+    assert(!other.thread_.joinable());
+  }
+  prefetched_tiles(const prefetched_tiles&) = delete;
+  prefetched_tiles& operator=(const prefetched_tiles&) = delete;
+  prefetched_tiles& operator=(prefetched_tiles&&) = delete;
+
+  /** Stop loading tiles, and wait for the tile being loaded, if any. */
+  ~prefetched_tiles() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) { thread_.join(); }
+  }
+
+  /** An input iterator over the tiles. Dereferencing the iterator waits for
+   * the tile to be loaded, and rethrows any exception thrown while loading
+   * it. */
+  class iterator {
+    prefetched_tiles* self_;
+    size_t i_;
+
+  public:
+    iterator(prefetched_tiles* self, size_t i) : self_(self), i_(i) {}
+
+    tile_ref operator*() const { return self_->wait(i_); }
+    iterator& operator++() {
+      self_->release(i_);
+      i_++;
+      return *this;
+    }
+
+    bool operator==(const iterator& r) const { return i_ == r.i_; }
+    bool operator!=(const iterator& r) const { return i_ != r.i_; }
+  };
+
+  /** Start loading the tiles, and return an iterator to the first tile. */
+  iterator begin() {
+    start();
+    return iterator(this, 0);
+  }
+  iterator end() { return iterator(this, tiles_.size()); }
+
+  /** The shapes of the tiles. */
+  const std::vector<shape_type>& tiles() const { return tiles_; }
+  size_t size() const { return tiles_.size(); }
+  index_t depth() const { return depth_; }
+};
+
+/** Make a range of the `tiles` of `src`, which are `dense_shape`s, where each
+ * tile is copied from `src` with `copy` on a background thread, using `depth`
+ * buffers. `src` must remain valid, and must not be used by other threads,
+ * until the range is destroyed. */
+template <class Source, class TileShape>
+auto prefetch(Source& src, std::vector<TileShape> tiles, index_t depth = 2) {
+  using T = typename std::remove_const<typename Source::value_type>::type;
+  using result_type = prefetched_tiles<T, TileShape::rank()>;
+  return result_type(std::move(tiles),
+      [&src](const typename result_type::buffer_ref& tile) { copy(src, tile); }, depth);
+}
+template <class T, class Shape, class TileShape>
+auto prefetch(const array_ref<T, Shape>& src, std::vector<TileShape> tiles, index_t depth = 2) {
+  using U = typename std::remove_const<T>::type;
+  using result_type = prefetched_tiles<U, TileShape::rank()>;
+  return result_type(std::move(tiles),
+      [src](const typename result_type::buffer_ref& tile) { copy(src, tile); }, depth);
+}
+
+/** Make a range of strips of `src`, where each strip is all of `src` except
+ * dim `Dim`, which is an interval of `strips`, such as `split(src.y(), 64)`.
+ * See `prefetch`. */
+template <size_t Dim, class Source, class Strips>
+auto prefetch_strips(Source&& src, const Strips& strips, index_t depth = 2) {
+  const auto& shape = src.shape();
+  using Shape = typename std::decay<decltype(shape)>::type;
+  std::vector<dense_shape<Shape::rank()>> tiles;
+  for (const auto& i : strips) {
+    tiles.push_back(internal::make_strip_shape<Dim>(
+        shape, interval<>(i.min(), i.extent()), typename Shape::dim_indices()));
+  }
+  return prefetch(std::forward<Source>(src), std::move(tiles), depth);
+}
+
+} // namespace nda
+
+#endif // NDARRAY_PREFETCH_H
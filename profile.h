@@ -0,0 +1,292 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file profile.h
+ * \brief Instrumentation of the bulk operations of this library.
+ *
+ * When `NDARRAY_PROFILE` is defined before including array.h, the bulk
+ * operations (`copy`, `move`, `fill`, `generate`, `for_each_value`,
+ * `ein_reduce`, ...) record the number of calls, elements, bytes and time
+ * spent in each operation, aggregated per operation and shape type. The
+ * profiler can also record a timeline of each call, which can be written in
+ * the Chrome `trace_event` JSON format and viewed with chrome://tracing or
+ * Perfetto.
+ *
+ * When `NDARRAY_PROFILE` is not defined, the instrumentation compiles to
+ * nothing.
+ *
+ * All translation units of a program must agree on whether `NDARRAY_PROFILE`
+ * is defined.
+ */
+#ifndef NDARRAY_PROFILE_H
+#define NDARRAY_PROFILE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <typeinfo>
+#include <vector>
+
+#if defined(__GNUC__) || defined(__clang__)
+#include <cxxabi.h>
+#endif
+
+namespace nda {
+namespace profile {
+
+/** Aggregated statistics of an operation. */
+struct counters {
+  /** The number of calls to the operation. */
+  size_t calls = 0;
+  /** The total number of elements processed by the calls. */
+  size_t elements = 0;
+  /** The total number of bytes read or written by the calls. */
+  size_t bytes = 0;
+  /** The total time spent in the calls, in seconds. */
+  double seconds = 0.0;
+};
+
+/** The key of the aggregated statistics: the name of the operation, and the
+ * name of the shape type it was called with. */
+using counters_key = std::pair<std::string, std::string>;
+
+/** One call to an operation, in a timeline. */
+struct trace_event {
+  const char* name;
+  const std::type_info* shape;
+  // The begin time and duration of the call, in microseconds since the
+  // profiler was created.
+  double begin_us;
+  double duration_us;
+  size_t thread;
+  size_t elements;
+  size_t bytes;
+};
+
+/** Get a readable name of a type. */
+inline std::string type_name(const std::type_info& type) {
+#if defined(__GNUC__) || defined(__clang__)
+  int status = 0;
+  char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+  if (status == 0 && demangled) {
+    std::string result = demangled;
+    std::free(demangled);
+    return result;
+  }
+#endif
+  return type.name();
+}
+
+/** Collects the counters and timeline of all instrumented operations. Each
+ * thread records its calls in its own buffer, so threads do not contend for a
+ * lock. The buffers are merged when the counters or timeline are read. */
+class profiler {
+  using clock = std::chrono::steady_clock;
+  // Keyed by the address of the operation name and the shape type, which is
+  // cheaper than keying by strings.
+  using counters_map = std::map<std::pair<const char*, const std::type_info*>, counters>;
+
+  // The calls recorded by one thread. The mutex is only contended while the
+  // buffer is being read or reset.
+  struct thread_buffer {
+    std::mutex mutex;
+    size_t thread;
+    counters_map counters;
+    std::vector<trace_event> events;
+  };
+
+  // The buffer of the calling thread, and the profiler it belongs to.
+  struct thread_cache {
+    size_t profiler_id = 0;
+    thread_buffer* buffer = nullptr;
+  };
+
+  const size_t id_ = next_id();
+  clock::time_point start_ = clock::now();
+  std::atomic<bool> tracing_{false};
+  // Protects buffers_. The buffers outlive their threads, so the calls of
+  // threads that have exited are still reported.
+  std::mutex mutex_;
+  std::map<std::thread::id, std::unique_ptr<thread_buffer>> buffers_;
+
+  static size_t next_id() {
+    static std::atomic<size_t> id{0};
+    return ++id;
+  }
+
+  thread_buffer& this_thread_buffer() {
+    static thread_local thread_cache cache;
+    if (cache.profiler_id != id_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::unique_ptr<thread_buffer>& buffer = buffers_[std::this_thread::get_id()];
+      if (!buffer) {
+        buffer.reset(new thread_buffer());
+        buffer->thread = buffers_.size() - 1;
+      }
+      cache.profiler_id = id_;
+      cache.buffer = buffer.get();
+    }
+    return *cache.buffer;
+  }
+
+  static void write_json_string(std::ostream& os, const std::string& s) {
+    os << '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') os << '\\';
+      os << c;
+    }
+    os << '"';
+  }
+
+public:
+  profiler() = default;
+  profiler(const profiler&) = delete;
+  profiler& operator=(const profiler&) = delete;
+
+  /** The profiler used by the instrumented operations. */
+  static profiler& global() {
+    static profiler p;
+    return p;
+  }
+
+  /** The current time, in microseconds since the profiler was created. */
+  double now_us() const {
+    return std::chrono::duration<double, std::micro>(clock::now() - start_).count();
+  }
+
+  /** Enable or disable recording of a timeline of each call. This is disabled
+   * by default, because the timeline grows with each call. */
+  void set_tracing(bool enabled) { tracing_ = enabled; }
+
+  /** Record a call to `name` with shape type `shape`. */
+  void record(const char* name, const std::type_info& shape, double begin_us, double end_us,
+      size_t elements, size_t bytes) {
+    thread_buffer& buffer = this_thread_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    counters& c = buffer.counters[std::make_pair(name, &shape)];
+    c.calls++;
+    c.elements += elements;
+    c.bytes += bytes;
+    c.seconds += (end_us - begin_us) * 1e-6;
+    if (tracing_) {
+      buffer.events.push_back(
+          {name, &shape, begin_us, end_us - begin_us, buffer.thread, elements, bytes});
+    }
+  }
+
+  /** Discard all of the recorded counters and events. */
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& i : buffers_) {
+      std::lock_guard<std::mutex> buffer_lock(i.second->mutex);
+      i.second->counters.clear();
+      i.second->events.clear();
+    }
+  }
+
+  /** Get the counters of each operation and shape type. */
+  std::map<counters_key, counters> get_counters() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<counters_key, counters> result;
+    for (auto& b : buffers_) {
+      std::lock_guard<std::mutex> buffer_lock(b.second->mutex);
+      for (const auto& i : b.second->counters) {
+        counters& c = result[counters_key(i.first.first, type_name(*i.first.second))];
+        c.calls += i.second.calls;
+        c.elements += i.second.elements;
+        c.bytes += i.second.bytes;
+        c.seconds += i.second.seconds;
+      }
+    }
+    return result;
+  }
+
+  /** Get the timeline of recorded calls of all threads, in order of their
+   * begin time. */
+  std::vector<trace_event> get_events() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<trace_event> result;
+    for (auto& b : buffers_) {
+      std::lock_guard<std::mutex> buffer_lock(b.second->mutex);
+      result.insert(result.end(), b.second->events.begin(), b.second->events.end());
+    }
+    std::stable_sort(result.begin(), result.end(),
+        [](const trace_event& l, const trace_event& r) { return l.begin_us < r.begin_us; });
+    return result;
+  }
+
+  /** Write a table of the counters to `os`. */
+  void write_report(std::ostream& os) {
+    for (const auto& i : get_counters()) {
+      const counters& c = i.second;
+      os << i.first.first << " [" << i.first.second << "]: " << c.calls << " calls, "
+         << c.elements << " elements, " << c.bytes << " bytes, " << c.seconds * 1e3 << " ms"
+         << std::endl;
+    }
+  }
+
+  /** Write the timeline of recorded calls to `os`, in the Chrome
+   * `trace_event` JSON format. */
+  void write_chrome_trace(std::ostream& os) {
+    const std::vector<trace_event> events = get_events();
+    os << "{\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); i++) {
+      const trace_event& e = events[i];
+      if (i > 0) os << ",";
+      os << "\n{\"name\":";
+      write_json_string(os, e.name);
+      os << ",\"cat\":\"ndarray\",\"ph\":\"X\",\"ts\":" << e.begin_us
+         << ",\"dur\":" << e.duration_us << ",\"pid\":0,\"tid\":" << e.thread
+         << ",\"args\":{\"shape\":";
+      write_json_string(os, type_name(*e.shape));
+      os << ",\"elements\":" << e.elements << ",\"bytes\":" << e.bytes << "}}";
+    }
+    os << "\n]}" << std::endl;
+  }
+};
+
+/** Records the time between construction and destruction of this object as a
+ * call to an operation `name` with a shape of type `Shape`. */
+class scope {
+  const char* name_;
+  const std::type_info& shape_;
+  size_t elements_;
+  size_t bytes_;
+  double begin_us_;
+
+public:
+  scope(const char* name, const std::type_info& shape, size_t elements, size_t bytes)
+      : name_(name), shape_(shape), elements_(elements), bytes_(bytes),
+        begin_us_(profiler::global().now_us()) {}
+  ~scope() {
+    profiler& p = profiler::global();
+    p.record(name_, shape_, begin_us_, p.now_us(), elements_, bytes_);
+  }
+
+  scope(const scope&) = delete;
+  scope& operator=(const scope&) = delete;
+};
+
+} // namespace profile
+} // namespace nda
+
+#endif // NDARRAY_PROFILE_H
@@ -0,0 +1,646 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file sparse.h
+ * \brief Sparse matrices in compressed sparse row (CSR) or column (CSC)
+ * format, and products of them with dense matrices and vectors.
+ *
+ * A sparse matrix stores the nonzero elements of each row (CSR) or column
+ * (CSC), in order of their column or row index. The rows or columns are the
+ * 'outer' dimension of the matrix, and the indices stored with the nonzeros
+ * are of the 'inner' dimension. Transposing a sparse matrix swaps the format,
+ * without moving any data.
+ *
+ * Sparse matrices can be used as operands of `ein_reduce`. Matrix-vector and
+ * matrix-matrix products of a sparse matrix and dense arrays are computed
+ * with `spmv` and `spmm`, which only visit the nonzeros of the sparse matrix.
+ * See `ein_reduce()` for more details.
+ */
+#ifndef NDARRAY_SPARSE_H
+#define NDARRAY_SPARSE_H
+
+#include "array.h"
+#include "ein_reduce.h"
+#include "gemm.h"
+#include "matrix.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace nda {
+
+/** The storage format of a sparse matrix. */
+enum class sparse_format {
+  /** Compressed sparse rows: the nonzeros are stored row by row. */
+  csr,
+  /** Compressed sparse columns: the nonzeros are stored column by column. */
+  csc,
+};
+
+namespace internal {
+
+constexpr sparse_format transposed_format(sparse_format format) {
+  return format == sparse_format::csr ? sparse_format::csc : sparse_format::csr;
+}
+
+// The work done in parallel by the sparse kernels is divided into strips of
+// nonzeros. Each outer index (row or column) is processed by the strip
+// containing its first nonzero, so the strips have about the same number of
+// nonzeros, even if the nonzeros are not evenly distributed.
+inline interval<> outer_strip(
+    const index_t* offsets, index_t outer_extent, const interval<>& nonzeros) {
+  const index_t* begin = std::lower_bound(offsets, offsets + outer_extent, nonzeros.min());
+  const index_t* end = std::lower_bound(begin, offsets + outer_extent, nonzeros.max() + 1);
+  return interval<>(begin - offsets, end - begin);
+}
+
+// The minimum number of multiply-adds done by each strip of the kernels.
+constexpr index_t sparse_min_work = 1 << 14;
+
+} // namespace internal
+
+/** A reference to a sparse matrix with value type `T`, stored in `Format`.
+ * This does not own the storage of the matrix. The nonzeros of outer index
+ * `o` are `values()[p]` for `p` in `[offsets()[o], offsets()[o + 1])`, with
+ * inner index `indices()[p]`. The inner indices of each outer index are
+ * sorted, and include the min of the inner dimension. */
+template <class T, sparse_format Format>
+class sparse_matrix_ref {
+public:
+  /** Type of the values of this matrix. */
+  using value_type = T;
+  /** Type of the bounds of this matrix. The strides of the dims are not
+   * used. */
+  using shape_type = nda::shape<dim<>, dim<>>;
+
+private:
+  shape_type shape_;
+  const index_t* offsets_;
+  const index_t* indices_;
+  T* values_;
+
+public:
+  /** Make a reference to a sparse matrix with bounds `shape`, and storage
+   * `offsets`, `indices`, and `values`. `offsets` must have one more element
+   * than the outer dimension of `shape`, and start with 0. */
+  sparse_matrix_ref(
+      const shape_type& shape, const index_t* offsets, const index_t* indices, T* values)
+      : shape_(shape), offsets_(offsets), indices_(indices), values_(values) {
+    assert(offsets_[0] == 0);
+  }
+
+  /** Allow conversion from sparse_matrix_ref<U> to sparse_matrix_ref<const U>. */
+  operator sparse_matrix_ref<const T, Format>() const {
+    return sparse_matrix_ref<const T, Format>(shape_, offsets_, indices_, values_);
+  }
+
+  /** The storage format of this matrix. */
+  static constexpr sparse_format format() { return Format; }
+
+  /** The bounds of this matrix. */
+  const shape_type& shape() const { return shape_; }
+  const dim<>& i() const { return shape_.i(); }
+  const dim<>& j() const { return shape_.j(); }
+  index_t rows() const { return shape_.rows(); }
+  index_t columns() const { return shape_.columns(); }
+
+  /** The dimension indexed by the offsets (rows for CSR, columns for CSC),
+   * and the dimension of the stored indices. */
+  const dim<>& outer() const { return Format == sparse_format::csr ? i() : j(); }
+  const dim<>& inner() const { return Format == sparse_format::csr ? j() : i(); }
+
+  /** The number of stored elements of this matrix. */
+  index_t nonzeros() const { return offsets_[outer().extent()]; }
+
+  const index_t* offsets() const { return offsets_; }
+  const index_t* indices() const { return indices_; }
+  T* values() const { return values_; }
+
+  /** Get the element at row `i` and column `j`, which is zero if it is not
+   * stored. This is a binary search of the inner indices. */
+  std::remove_const_t<T> operator()(index_t i, index_t j) const {
+    assert(shape_.is_in_range(i, j));
+    const index_t o = (Format == sparse_format::csr ? i : j) - outer().min();
+    const index_t n = Format == sparse_format::csr ? j : i;
+    const index_t* begin = indices_ + offsets_[o];
+    const index_t* end = indices_ + offsets_[o + 1];
+    const index_t* at = std::lower_bound(begin, end, n);
+    return at != end && *at == n ? values_[at - indices_] : std::remove_const_t<T>();
+  }
+
+  /** Call `fn(i, j, value)` for each stored element, in the order of
+   * storage. */
+  template <class Fn>
+  void for_each_nonzero(Fn&& fn) const {
+    for (index_t o = 0; o < outer().extent(); o++) {
+      const index_t o_at = outer().min() + o;
+      for (index_t p = offsets_[o]; p < offsets_[o + 1]; p++) {
+        if (Format == sparse_format::csr) {
+          fn(o_at, indices_[p], values_[p]);
+        } else {
+          fn(indices_[p], o_at, values_[p]);
+        }
+      }
+    }
+  }
+};
+
+template <class T>
+using csr_matrix_ref = sparse_matrix_ref<T, sparse_format::csr>;
+template <class T>
+using csc_matrix_ref = sparse_matrix_ref<T, sparse_format::csc>;
+
+/** Transpose the sparse matrix `a`. The result refers to the same storage as
+ * `a`, in the other format. */
+template <class T, sparse_format Format>
+sparse_matrix_ref<T, internal::transposed_format(Format)> transpose(
+    const sparse_matrix_ref<T, Format>& a) {
+  return sparse_matrix_ref<T, internal::transposed_format(Format)>(
+      typename sparse_matrix_ref<T, Format>::shape_type(a.j(), a.i()), a.offsets(), a.indices(),
+      a.values());
+}
+
+/** A sparse matrix with value type `T`, stored in `Format`. The storage is
+ * allocated with `std::vector`. */
+template <class T, sparse_format Format>
+class sparse_matrix {
+public:
+  using value_type = T;
+  using shape_type = typename sparse_matrix_ref<T, Format>::shape_type;
+
+private:
+  shape_type shape_;
+  std::vector<index_t> offsets_;
+  std::vector<index_t> indices_;
+  std::vector<T> values_;
+
+  // Get the element of the dense matrix `a` at outer index `o` and inner
+  // index `n`.
+  template <class U, class Shape>
+  static const U& dense_at(const array_ref<U, Shape>& a, index_t o, index_t n) {
+    return Format == sparse_format::csr ? a(o, n) : a(n, o);
+  }
+
+public:
+  /** Make an empty sparse matrix. */
+  sparse_matrix() : offsets_(1, 0) {}
+
+  /** Make a sparse matrix with bounds `shape` from its storage. See
+   * `sparse_matrix_ref` for a description of the storage. */
+  sparse_matrix(const shape_type& shape, std::vector<index_t> offsets,
+      std::vector<index_t> indices, std::vector<T> values)
+      : shape_(shape), offsets_(std::move(offsets)), indices_(std::move(indices)),
+        values_(std::move(values)) {
+    assert(static_cast<index_t>(offsets_.size()) == cref().outer().extent() + 1);
+    assert(indices_.size() == values_.size());
+    assert(offsets_.back() == static_cast<index_t>(values_.size()));
+  }
+
+  /** Make a sparse matrix from the elements of the rank 2 array or array_ref
+   * `dense` that are not equal to zero. */
+  template <class U, class Shape>
+  explicit sparse_matrix(const array_ref<U, Shape>& dense)
+      : shape_(nda::dim<>(dense.i().min(), dense.i().extent()),
+            nda::dim<>(dense.j().min(), dense.j().extent())) {
+    static_assert(Shape::rank() == 2, "Sparse matrices can only be made from rank 2 arrays.");
+    const dim<>& outer = Format == sparse_format::csr ? shape_.i() : shape_.j();
+    const dim<>& inner = Format == sparse_format::csr ? shape_.j() : shape_.i();
+    offsets_.reserve(outer.extent() + 1);
+    offsets_.push_back(0);
+    for (index_t o : outer) {
+      for (index_t n : inner) {
+        const T value = dense_at(dense, o, n);
+        if (value != T()) {
+          indices_.push_back(n);
+          values_.push_back(value);
+        }
+      }
+      offsets_.push_back(static_cast<index_t>(values_.size()));
+    }
+  }
+  template <class U, class Shape, class Alloc>
+  explicit sparse_matrix(const array<U, Shape, Alloc>& dense) : sparse_matrix(dense.cref()) {}
+
+  /** Make a sparse matrix with the same elements as the sparse matrix
+   * `other`, which is stored in the other format. */
+  template <class U>
+  explicit sparse_matrix(const sparse_matrix_ref<U, internal::transposed_format(Format)>& other)
+      : shape_(other.shape()), offsets_(other.inner().extent() + 1, 0),
+        indices_(other.nonzeros()), values_(other.nonzeros()) {
+    // This is a counting sort of the nonzeros by their inner index in
+    // `other`.
+    const index_t n_min = other.inner().min();
+    for (index_t p = 0; p < other.nonzeros(); p++) {
+      offsets_[other.indices()[p] - n_min + 1]++;
+    }
+    for (size_t o = 1; o < offsets_.size(); o++) {
+      offsets_[o] += offsets_[o - 1];
+    }
+    std::vector<index_t> next(offsets_.begin(), offsets_.end() - 1);
+    for (index_t o = 0; o < other.outer().extent(); o++) {
+      for (index_t p = other.offsets()[o]; p < other.offsets()[o + 1]; p++) {
+        const index_t at = next[other.indices()[p] - n_min]++;
+        indices_[at] = other.outer().min() + o;
+        values_[at] = other.values()[p];
+      }
+    }
+  }
+  template <class U>
+  explicit sparse_matrix(const sparse_matrix<U, internal::transposed_format(Format)>& other)
+      : sparse_matrix(other.cref()) {}
+
+  /** Make a sparse_matrix_ref referring to the storage of this matrix. */
+  sparse_matrix_ref<T, Format> ref() {
+    return sparse_matrix_ref<T, Format>(shape_, offsets_.data(), indices_.data(), values_.data());
+  }
+  sparse_matrix_ref<const T, Format> cref() const {
+    return sparse_matrix_ref<const T, Format>(
+        shape_, offsets_.data(), indices_.data(), values_.data());
+  }
+  sparse_matrix_ref<const T, Format> ref() const { return cref(); }
+  operator sparse_matrix_ref<T, Format>() { return ref(); }
+  operator sparse_matrix_ref<const T, Format>() const { return cref(); }
+
+  static constexpr sparse_format format() { return Format; }
+
+  const shape_type& shape() const { return shape_; }
+  const dim<>& i() const { return shape_.i(); }
+  const dim<>& j() const { return shape_.j(); }
+  index_t rows() const { return shape_.rows(); }
+  index_t columns() const { return shape_.columns(); }
+
+  index_t nonzeros() const { return static_cast<index_t>(values_.size()); }
+
+  const std::vector<index_t>& offsets() const { return offsets_; }
+  const std::vector<index_t>& indices() const { return indices_; }
+  std::vector<T>& values() { return values_; }
+  const std::vector<T>& values() const { return values_; }
+
+  /** Get the element at row `i` and column `j`. */
+  T operator()(index_t i, index_t j) const { return cref()(i, j); }
+};
+
+template <class T>
+using csr_matrix = sparse_matrix<T, sparse_format::csr>;
+template <class T>
+using csc_matrix = sparse_matrix<T, sparse_format::csc>;
+
+/** Copy the sparse matrix `src` to the rank 2 array or array_ref `dst`. The
+ * elements of `dst` that are not stored in `src` are set to zero. */
+template <class T, sparse_format Format, class U, class Shape>
+void copy(const sparse_matrix_ref<T, Format>& src, const array_ref<U, Shape>& dst) {
+  static_assert(Shape::rank() == 2, "Sparse matrices can only be copied to rank 2 arrays.");
+  fill(dst, U());
+  src.for_each_nonzero([&](index_t i, index_t j, const T& value) {
+    if (dst.shape().is_in_range(i, j)) { dst(i, j) = value; }
+  });
+}
+template <class T, sparse_format Format, class U, class Shape, class Alloc>
+void copy(const sparse_matrix_ref<T, Format>& src, array<U, Shape, Alloc>& dst) {
+  copy(src, dst.ref());
+}
+template <class T, sparse_format Format, class U, class Shape>
+void copy(const sparse_matrix<T, Format>& src, const array_ref<U, Shape>& dst) {
+  copy(src.cref(), dst);
+}
+template <class T, sparse_format Format, class U, class Shape, class Alloc>
+void copy(const sparse_matrix<T, Format>& src, array<U, Shape, Alloc>& dst) {
+  copy(src.cref(), dst.ref());
+}
+
+/** Make a dense matrix with the same bounds and elements as the sparse
+ * matrix `src`. */
+template <class T, sparse_format Format>
+auto make_dense_copy(const sparse_matrix_ref<T, Format>& src) {
+  matrix<std::remove_const_t<T>> result(
+      {{src.i().min(), src.rows()}, {src.j().min(), src.columns()}});
+  copy(src, result.ref());
+  return result;
+}
+template <class T, sparse_format Format>
+auto make_dense_copy(const sparse_matrix<T, Format>& src) {
+  return make_dense_copy(src.cref());
+}
+
+namespace internal {
+
+// y(j) += a * x(j) for j in [0, n).
+template <class TA, class TX, class TY>
+NDARRAY_INLINE void sparse_axpy_dense(
+    index_t n, TA a, const TX* NDARRAY_RESTRICT x, TY* NDARRAY_RESTRICT y) {
+  // Loops with a constant trip count of one vector are vectorized without
+  // needing a remainder loop.
+  constexpr index_t lanes = std::max<index_t>(1, NDARRAY_GEMM_VECTOR_BYTES / sizeof(TY));
+  index_t j = 0;
+  for (; j + lanes <= n; j += lanes) {
+    for (index_t l = 0; l < lanes; l++) {
+      y[j + l] += a * x[j + l];
+    }
+  }
+  for (; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+template <class TA, class TX, class TY>
+NDARRAY_INLINE void sparse_axpy(
+    index_t n, TA a, const TX* x, index_t x_stride, TY* y, index_t y_stride) {
+  if (x_stride == 1 && y_stride == 1) {
+    sparse_axpy_dense(n, a, x, y);
+  } else {
+    for (index_t j = 0; j < n; j++) {
+      y[j * y_stride] += a * x[j * x_stride];
+    }
+  }
+}
+
+template <class TA, class TX, class ShapeX, class TY, class ShapeY>
+void spmv(const sparse_matrix_ref<TA, sparse_format::csr>& a, const array_ref<TX, ShapeX>& x,
+    const array_ref<TY, ShapeY>& y, thread_pool& pool) {
+  using acc_type = std::common_type_t<decltype(std::declval<TA>() * std::declval<TX>()),
+      std::remove_const_t<TY>>;
+  const index_t* offsets = a.offsets();
+  const index_t* indices = a.indices();
+  const TA* values = a.values();
+  // Each row is a dot product of the nonzeros with x.
+  pool.parallel_for(interval<>(0, a.nonzeros()), sparse_min_work, [&](const interval<>& strip) {
+    for (index_t r : outer_strip(offsets, a.rows(), strip)) {
+      acc_type sum = acc_type();
+      for (index_t p = offsets[r]; p < offsets[r + 1]; p++) {
+        sum += values[p] * x(indices[p]);
+      }
+      y(a.i().min() + r) += sum;
+    }
+  });
+}
+
+template <class TA, class TX, class ShapeX, class TY, class ShapeY>
+void spmv(const sparse_matrix_ref<TA, sparse_format::csc>& a, const array_ref<TX, ShapeX>& x,
+    const array_ref<TY, ShapeY>& y, thread_pool& pool) {
+  using acc_type = std::common_type_t<decltype(std::declval<TA>() * std::declval<TX>()),
+      std::remove_const_t<TY>>;
+  const index_t* offsets = a.offsets();
+  const index_t* indices = a.indices();
+  const TA* values = a.values();
+  std::mutex y_mutex;
+  // Each column scatters its nonzeros times x(j) to y. Strips other than the
+  // whole matrix accumulate to their own buffer, which is added to y at the
+  // end of the strip.
+  pool.parallel_for(interval<>(0, a.nonzeros()), sparse_min_work, [&](const interval<>& strip) {
+    const interval<> cols = outer_strip(offsets, a.columns(), strip);
+    if (strip.extent() == a.nonzeros()) {
+      for (index_t c : cols) {
+        const auto x_c = x(a.j().min() + c);
+        for (index_t p = offsets[c]; p < offsets[c + 1]; p++) {
+          y(indices[p]) += values[p] * x_c;
+        }
+      }
+      return;
+    }
+    const index_t i_min = a.i().min();
+    std::vector<acc_type> partial(a.rows(), acc_type());
+    for (index_t c : cols) {
+      const auto x_c = x(a.j().min() + c);
+      for (index_t p = offsets[c]; p < offsets[c + 1]; p++) {
+        partial[indices[p] - i_min] += values[p] * x_c;
+      }
+    }
+    std::lock_guard<std::mutex> lock(y_mutex);
+    for (index_t r = 0; r < a.rows(); r++) {
+      y(i_min + r) += partial[r];
+    }
+  });
+}
+
+template <class TA, class TB, class ShapeB, class TC, class ShapeC>
+void spmm(const sparse_matrix_ref<TA, sparse_format::csr>& a, const array_ref<TB, ShapeB>& b,
+    const array_ref<TC, ShapeC>& c, thread_pool& pool) {
+  const auto& j_dim = c.j();
+  if (j_dim.extent() <= 0) return;
+  const index_t* offsets = a.offsets();
+  const index_t* indices = a.indices();
+  const TA* values = a.values();
+  // Each row of c is a sum of the rows of b selected by the nonzeros of the
+  // row of a.
+  const index_t min_strip = std::max<index_t>(1, sparse_min_work / j_dim.extent());
+  pool.parallel_for(interval<>(0, a.nonzeros()), min_strip, [&](const interval<>& strip) {
+    for (index_t r : outer_strip(offsets, a.rows(), strip)) {
+      TC* c_r = &c(a.i().min() + r, j_dim.min());
+      for (index_t p = offsets[r]; p < offsets[r + 1]; p++) {
+        sparse_axpy(j_dim.extent(), values[p], &b(indices[p], j_dim.min()), b.j().stride(), c_r,
+            j_dim.stride());
+      }
+    }
+  });
+}
+
+template <class TA, class TB, class ShapeB, class TC, class ShapeC>
+void spmm(const sparse_matrix_ref<TA, sparse_format::csc>& a, const array_ref<TB, ShapeB>& b,
+    const array_ref<TC, ShapeC>& c, thread_pool& pool) {
+  const auto& j_dim = c.j();
+  if (j_dim.extent() <= 0) return;
+  const index_t* offsets = a.offsets();
+  const index_t* indices = a.indices();
+  const TA* values = a.values();
+  // The nonzeros of a column of a scatter the same row of b to many rows of
+  // c, so the strips are strips of the columns of c instead.
+  const index_t min_strip = std::max<index_t>(
+      1, sparse_min_work / std::max<index_t>(1, a.nonzeros()));
+  pool.parallel_for(interval<>(j_dim.min(), j_dim.extent()), min_strip,
+      [&](const interval<>& js) {
+        for (index_t k = 0; k < a.columns(); k++) {
+          const TB* b_k = &b(a.j().min() + k, js.min());
+          for (index_t p = offsets[k]; p < offsets[k + 1]; p++) {
+            sparse_axpy(js.extent(), values[p], b_k, b.j().stride(), &c(indices[p], js.min()),
+                j_dim.stride());
+          }
+        }
+      });
+}
+
+} // namespace internal
+
+/** Compute the matrix-vector product `y += a * x` of the sparse matrix `a`,
+ * using the threads of `pool`. `x` and `y` are rank 1 arrays or array_refs,
+ * and must contain the column and row indices of `a`, respectively. The sums
+ * are accumulated in the type of the products, or the value type of `y` if
+ * that is wider. `y` must not alias `a` or `x`. */
+template <class TA, sparse_format Format, class TX, class ShapeX, class TY, class ShapeY>
+void spmv(const sparse_matrix_ref<TA, Format>& a, const array_ref<TX, ShapeX>& x,
+    const array_ref<TY, ShapeY>& y, thread_pool& pool = thread_pool::global()) {
+  static_assert(ShapeX::rank() == 1 && ShapeY::rank() == 1, "spmv requires rank 1 x and y.");
+  assert(x.shape().template dim<0>().min() <= a.j().min());
+  assert(x.shape().template dim<0>().max() >= a.j().max());
+  assert(y.shape().template dim<0>().min() <= a.i().min());
+  assert(y.shape().template dim<0>().max() >= a.i().max());
+  internal::spmv(a, x, y, pool);
+}
+template <class TA, sparse_format Format, class TX, class ShapeX, class AllocX, class TY,
+    class ShapeY, class AllocY>
+void spmv(const sparse_matrix<TA, Format>& a, const array<TX, ShapeX, AllocX>& x,
+    array<TY, ShapeY, AllocY>& y, thread_pool& pool = thread_pool::global()) {
+  spmv(a.cref(), x.cref(), y.ref(), pool);
+}
+
+/** Compute the matrix product `c += a * b` of the sparse matrix `a` and the
+ * rank 2 array or array_ref `b`, using the threads of `pool`. The columns of
+ * `c` that are computed are the columns of the shape of `c`. `b` must contain
+ * the columns of `c`, and the rows of `b` and `c` must contain the columns and
+ * rows of `a`, respectively. `c` must not alias `a` or `b`.
+ *
+ * This is fastest when the columns of `b` and `c` are dense, i.e. `b` and `c`
+ * are `matrix_ref`s. */
+template <class TA, sparse_format Format, class TB, class ShapeB, class TC, class ShapeC>
+void spmm(const sparse_matrix_ref<TA, Format>& a, const array_ref<TB, ShapeB>& b,
+    const array_ref<TC, ShapeC>& c, thread_pool& pool = thread_pool::global()) {
+  static_assert(ShapeB::rank() == 2 && ShapeC::rank() == 2, "spmm requires rank 2 b and c.");
+  assert(b.i().min() <= a.j().min() && b.i().max() >= a.j().max());
+  assert(c.i().min() <= a.i().min() && c.i().max() >= a.i().max());
+  assert(b.j().min() <= c.j().min() && b.j().max() >= c.j().max());
+  internal::spmm(a, b, c, pool);
+}
+template <class TA, sparse_format Format, class TB, class ShapeB, class AllocB, class TC,
+    class ShapeC, class AllocC>
+void spmm(const sparse_matrix<TA, Format>& a, const array<TB, ShapeB, AllocB>& b,
+    array<TC, ShapeC, AllocC>& c, thread_pool& pool = thread_pool::global()) {
+  spmm(a.cref(), b.cref(), c.ref(), pool);
+}
+
+namespace internal {
+
+// Transpose a matrix operand if Transpose is std::true_type.
+template <class T, sparse_format Format>
+NDARRAY_INLINE auto transpose_if(std::false_type, const sparse_matrix_ref<T, Format>& a) {
+  return a;
+}
+template <class T, sparse_format Format>
+NDARRAY_INLINE auto transpose_if(std::true_type, const sparse_matrix_ref<T, Format>& a) {
+  return transpose(a);
+}
+template <class T, class Shape>
+NDARRAY_INLINE auto transpose_if(std::false_type, const array_ref<T, Shape>& a) {
+  return a;
+}
+template <class T, class Shape>
+NDARRAY_INLINE auto transpose_if(std::true_type, const array_ref<T, Shape>& a) {
+  return transpose<1, 0>(a);
+}
+
+// Matrix-vector products y(i) += A(i, j) * x(j) or y(i) += A(j, i) * x(j),
+// where A is a sparse matrix, are dispatched to spmv if y has the same bounds
+// as the rows of A (or the columns, if A is transposed).
+template <size_t I, size_t J, size_t A0, size_t A1>
+using enable_if_spmv =
+    std::enable_if_t<I != J && ((A0 == I && A1 == J) || (A0 == J && A1 == I))>;
+
+template <size_t I, size_t A0, class Shape, class TY, class ShapeY, class TA,
+    sparse_format Format, class TX, class ShapeX, class Expr>
+NDARRAY_INLINE void evaluate_ein_spmv(const Shape& reduction_shape,
+    const array_ref<TY, ShapeY>& y, const sparse_matrix_ref<TA, Format>& a,
+    const array_ref<TX, ShapeX>& x, const Expr& expr) {
+  const auto a_ij = transpose_if(std::integral_constant<bool, A0 != I>(), a);
+  const auto& i_dim = reduction_shape.template dim<I>();
+  if (i_dim.min() == a_ij.i().min() && i_dim.extent() == a_ij.i().extent()) {
+    spmv(a_ij, x, y);
+  } else {
+    evaluate_ein_loops(reduction_shape, expr);
+  }
+}
+
+template <class Shape, class TY, class ShapeY, size_t I, class TA, sparse_format Format,
+    size_t A0, size_t A1, class TX, class ShapeX, size_t J, class = enable_if_spmv<I, J, A0, A1>>
+NDARRAY_INLINE void evaluate_ein_reduce(const Shape& reduction_shape,
+    const ein_op_add_assign<ein_op<array_ref<TY, ShapeY>, I>,
+        ein_op_mul<ein_op<sparse_matrix_ref<TA, Format>, A0, A1>,
+            ein_op<array_ref<TX, ShapeX>, J>>>& expr) {
+  evaluate_ein_spmv<I, A0>(
+      reduction_shape, expr.op_a.op, expr.op_b.op_a.op, expr.op_b.op_b.op, expr);
+}
+template <class Shape, class TY, class ShapeY, size_t I, class TA, sparse_format Format,
+    size_t A0, size_t A1, class TX, class ShapeX, size_t J, class = enable_if_spmv<I, J, A0, A1>>
+NDARRAY_INLINE void evaluate_ein_reduce(const Shape& reduction_shape,
+    const ein_op_add_assign<ein_op<array_ref<TY, ShapeY>, I>,
+        ein_op_mul<ein_op<array_ref<TX, ShapeX>, J>,
+            ein_op<sparse_matrix_ref<TA, Format>, A0, A1>>>& expr) {
+  evaluate_ein_spmv<I, A0>(
+      reduction_shape, expr.op_a.op, expr.op_b.op_b.op, expr.op_b.op_a.op, expr);
+}
+
+// Returns true if C(C0, C1) += A(A0, A1) * B(B0, B1) is a matrix product,
+// i.e. A and B each have one dimension of C, and share the other one.
+template <size_t C0, size_t C1, size_t A0, size_t A1, size_t B0, size_t B1>
+constexpr bool is_spmm() {
+  constexpr size_t I = A0 == C0 || A0 == C1 ? A0 : A1;
+  constexpr size_t K = A0 == I ? A1 : A0;
+  constexpr size_t J = C0 == I ? C1 : C0;
+  return C0 != C1 && A0 != A1 && (A0 == C0 || A0 == C1) != (A1 == C0 || A1 == C1) &&
+         ((B0 == K && B1 == J) || (B0 == J && B1 == K));
+}
+
+// Matrix products C(i, j) += A(i, k) * B(k, j), where A is a sparse matrix,
+// with any order of the dimensions of the operands, or the operands of the
+// product, are dispatched to spmm if C has the same bounds as the rows of A.
+template <size_t C0, size_t C1, size_t A0, size_t A1, size_t B0, class Shape, class TC,
+    class ShapeC, class TA, sparse_format Format, class TB, class ShapeB, class Expr>
+NDARRAY_INLINE void evaluate_ein_spmm(const Shape& reduction_shape,
+    const array_ref<TC, ShapeC>& c, const sparse_matrix_ref<TA, Format>& a,
+    const array_ref<TB, ShapeB>& b, const Expr& expr) {
+  constexpr size_t I = A0 == C0 || A0 == C1 ? A0 : A1;
+  constexpr size_t K = A0 == I ? A1 : A0;
+  const auto a_ik = transpose_if(std::integral_constant<bool, A0 != I>(), a);
+  const auto b_kj = transpose_if(std::integral_constant<bool, B0 != K>(), b);
+  const auto c_ij = transpose_if(std::integral_constant<bool, C0 != I>(), c);
+  const auto& i_dim = reduction_shape.template dim<I>();
+  if (i_dim.min() == a_ik.i().min() && i_dim.extent() == a_ik.i().extent()) {
+    spmm(a_ik, b_kj, c_ij);
+  } else {
+    evaluate_ein_loops(reduction_shape, expr);
+  }
+}
+
+template <class Shape, class TC, class ShapeC, size_t C0, size_t C1, class TA,
+    sparse_format Format, size_t A0, size_t A1, class TB, class ShapeB, size_t B0, size_t B1,
+    class = std::enable_if_t<is_spmm<C0, C1, A0, A1, B0, B1>()>>
+NDARRAY_INLINE void evaluate_ein_reduce(const Shape& reduction_shape,
+    const ein_op_add_assign<ein_op<array_ref<TC, ShapeC>, C0, C1>,
+        ein_op_mul<ein_op<sparse_matrix_ref<TA, Format>, A0, A1>,
+            ein_op<array_ref<TB, ShapeB>, B0, B1>>>& expr) {
+  evaluate_ein_spmm<C0, C1, A0, A1, B0>(
+      reduction_shape, expr.op_a.op, expr.op_b.op_a.op, expr.op_b.op_b.op, expr);
+}
+template <class Shape, class TC, class ShapeC, size_t C0, size_t C1, class TA,
+    sparse_format Format, size_t A0, size_t A1, class TB, class ShapeB, size_t B0, size_t B1,
+    class = std::enable_if_t<is_spmm<C0, C1, A0, A1, B0, B1>()>>
+NDARRAY_INLINE void evaluate_ein_reduce(const Shape& reduction_shape,
+    const ein_op_add_assign<ein_op<array_ref<TC, ShapeC>, C0, C1>,
+        ein_op_mul<ein_op<array_ref<TB, ShapeB>, B0, B1>,
+            ein_op<sparse_matrix_ref<TA, Format>, A0, A1>>>& expr) {
+  evaluate_ein_spmm<C0, C1, A0, A1, B0>(
+      reduction_shape, expr.op_a.op, expr.op_b.op_b.op, expr.op_b.op_a.op, expr);
+}
+
+} // namespace internal
+
+/** Define an Einstein summation operand for a sparse matrix. See `ein()`
+ * and `ein_reduce()` for more details. */
+template <size_t... Is, class T, sparse_format Format,
+    class = std::enable_if_t<sizeof...(Is) == 2>>
+auto ein(const sparse_matrix<T, Format>& op) {
+  return ein<Is...>(op.cref());
+}
+
+} // namespace nda
+
+#endif // NDARRAY_SPARSE_H
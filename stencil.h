@@ -0,0 +1,359 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/** \file stencil.h
+ * \brief 2D stencils (correlations) with boundary conditions.
+ */
+#ifndef NDARRAY_STENCIL_H
+#define NDARRAY_STENCIL_H
+
+#include "array.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+namespace nda {
+
+/** How a stencil reads indices outside of the bounds of its input. */
+enum class boundary {
+  /** Use the nearest index in bounds. */
+  clamp,
+  /** Reflect the indices about the edge, without repeating the edge, i.e.
+   * `min - 1` reads `min + 1`. */
+  mirror,
+  /** Out of bounds indices read a constant value. */
+  constant,
+  /** Out of bounds indices wrap around to the other edge. */
+  wrap,
+};
+
+namespace internal {
+
+// Map `x` to an index in the interval [`min`, `min` + `extent`) according to the
+// boundary condition `b`. For `boundary::constant`, `x` is returned unmodified.
+inline index_t remap_boundary(index_t x, index_t min, index_t extent, boundary b) {
+  if (min <= x && x < min + extent) return x;
+  switch (b) {
+  case boundary::clamp: return std::min(std::max(x, min), min + extent - 1);
+  case boundary::mirror: {
+    if (extent <= 1) return min;
+    const index_t period = 2 * (extent - 1);
+    index_t r = (x - min) % period;
+    if (r < 0) r += period;
+    return min + (r < extent ? r : period - r);
+  }
+  case boundary::wrap: {
+    index_t r = (x - min) % extent;
+    if (r < 0) r += extent;
+    return min + r;
+  }
+  case boundary::constant: return x;
+  }
+  return x;
+}
+
+// Read `in(x, y)`, applying the boundary condition `b` to the indices.
+template <class T, class Shape>
+T sample_boundary(const array_ref<T, Shape>& in, index_t x, index_t y, boundary b,
+    const std::remove_const_t<T>& constant) {
+  x = remap_boundary(x, in.template dim<0>().min(), in.template dim<0>().extent(), b);
+  y = remap_boundary(y, in.template dim<1>().min(), in.template dim<1>().extent(), b);
+  return in.shape().is_in_range(x, y) ? in(x, y) : constant;
+}
+
+// The number of output values computed at once in the register tiled loops.
+constexpr index_t stencil_tile = 16;
+
+// Compute `out(x, y)` for `x` in [`x0`, `x1`], where all of the taps of the
+// kernel are in bounds of `in`. `InDense` indicates the x stride of `in` is 1.
+template <bool InDense, class TAcc, class TIn, class ShapeIn, class TK, class ShapeK, class TOut,
+    class ShapeOut>
+void stencil_row_interior(const array_ref<TIn, ShapeIn>& in, const array_ref<TK, ShapeK>& kernel,
+    const array_ref<TOut, ShapeOut>& out, index_t y, index_t x0, index_t x1) {
+  const index_t sx = InDense ? 1 : in.template dim<0>().stride();
+  const auto& kx = kernel.template dim<0>();
+  const auto& ky = kernel.template dim<1>();
+  constexpr index_t N = stencil_tile;
+  index_t x = x0;
+  for (; x + N - 1 <= x1; x += N) {
+    TAcc acc[N] = {};
+    for (index_t dy : ky) {
+      for (index_t dx : kx) {
+        const TAcc w = kernel(dx, dy);
+        const TIn* p = &in(x + dx, y + dy);
+        for (index_t i = 0; i < N; i++) {
+          acc[i] += w * p[i * sx];
+        }
+      }
+    }
+    for (index_t i = 0; i < N; i++) {
+      out(x + i, y) = static_cast<TOut>(acc[i]);
+    }
+  }
+  for (; x <= x1; x++) {
+    TAcc acc = 0;
+    for (index_t dy : ky) {
+      for (index_t dx : kx) {
+        acc += static_cast<TAcc>(kernel(dx, dy)) * in(x + dx, y + dy);
+      }
+    }
+    out(x, y) = static_cast<TOut>(acc);
+  }
+}
+
+// Compute `out(x, y)` for `x` in [`x0`, `x1`], applying the boundary condition to
+// each tap.
+template <class TAcc, class TIn, class ShapeIn, class TK, class ShapeK, class TOut, class ShapeOut>
+void stencil_row_boundary(const array_ref<TIn, ShapeIn>& in, const array_ref<TK, ShapeK>& kernel,
+    const array_ref<TOut, ShapeOut>& out, index_t y, index_t x0, index_t x1, boundary b,
+    const std::remove_const_t<TIn>& constant) {
+  for (index_t x = x0; x <= x1; x++) {
+    TAcc acc = 0;
+    for (index_t dy : kernel.template dim<1>()) {
+      for (index_t dx : kernel.template dim<0>()) {
+        acc += static_cast<TAcc>(kernel(dx, dy)) * sample_boundary(in, x + dx, y + dy, b, constant);
+      }
+    }
+    out(x, y) = static_cast<TOut>(acc);
+  }
+}
+
+// The number of rows of output to compute in each parallel task, such that
+// each task does at least a minimum amount of work.
+inline index_t stencil_min_strip(index_t width, index_t taps) {
+  const index_t min_work = 1 << 16;
+  return std::max<index_t>(1, min_work / std::max<index_t>(1, width * taps));
+}
+
+template <class TAcc, class TIn, class ShapeIn, class TK, class ShapeK, class TOut, class ShapeOut>
+void stencil_2d(const array_ref<TIn, ShapeIn>& in, const array_ref<TK, ShapeK>& kernel,
+    const array_ref<TOut, ShapeOut>& out, boundary b, const std::remove_const_t<TIn>& constant) {
+  const auto& in_x = in.template dim<0>();
+  const auto& in_y = in.template dim<1>();
+  const auto& kx = kernel.template dim<0>();
+  const auto& ky = kernel.template dim<1>();
+  const auto& out_x = out.template dim<0>();
+  const auto& out_y = out.template dim<1>();
+  if (out.empty() || kernel.empty()) return;
+
+  // The region of the output where all of the taps are in bounds.
+  const index_t ix0 = std::max(out_x.min(), in_x.min() - kx.min());
+  const index_t ix1 = std::min(out_x.max(), in_x.max() - kx.max());
+  const index_t iy0 = std::max(out_y.min(), in_y.min() - ky.min());
+  const index_t iy1 = std::min(out_y.max(), in_y.max() - ky.max());
+  const bool in_dense = in_x.stride() == 1;
+
+  const index_t min_strip = stencil_min_strip(out_x.extent(), kernel.size());
+  parallel_for(interval<>(out_y.min(), out_y.extent()), min_strip, [&](const interval<>& ys) {
+    for (index_t y : ys) {
+      if (y < iy0 || y > iy1 || ix0 > ix1) {
+        stencil_row_boundary<TAcc>(in, kernel, out, y, out_x.min(), out_x.max(), b, constant);
+        continue;
+      }
+      stencil_row_boundary<TAcc>(in, kernel, out, y, out_x.min(), ix0 - 1, b, constant);
+      if (in_dense) {
+        stencil_row_interior<true, TAcc>(in, kernel, out, y, ix0, ix1);
+      } else {
+        stencil_row_interior<false, TAcc>(in, kernel, out, y, ix0, ix1);
+      }
+      stencil_row_boundary<TAcc>(in, kernel, out, y, ix1 + 1, out_x.max(), b, constant);
+    }
+  });
+}
+
+// Accumulate `w * in(x, y)` into `row[x]` for `x` in [`x0`, `x1`], where `x` is
+// in bounds of `in`.
+template <bool InDense, class TAcc, class TIn, class ShapeIn>
+void accumulate_row_interior(const array_ref<TIn, ShapeIn>& in, index_t y, index_t x0,
+    index_t x1, TAcc w, TAcc* row) {
+  const index_t sx = InDense ? 1 : in.template dim<0>().stride();
+  const TIn* p = &in(x0, y);
+  const index_t n = x1 - x0 + 1;
+  for (index_t i = 0; i < n; i++) {
+    row[i] += w * p[i * sx];
+  }
+}
+
+template <class TAcc, class TIn, class ShapeIn, class TKX, class ShapeKX, class TKY, class ShapeKY,
+    class TOut, class ShapeOut>
+void separable_stencil_2d(const array_ref<TIn, ShapeIn>& in,
+    const array_ref<TKX, ShapeKX>& kernel_x, const array_ref<TKY, ShapeKY>& kernel_y,
+    const array_ref<TOut, ShapeOut>& out, boundary b, const std::remove_const_t<TIn>& constant) {
+  const auto& in_x = in.template dim<0>();
+  const auto& in_y = in.template dim<1>();
+  const auto& kx = kernel_x.template dim<0>();
+  const auto& ky = kernel_y.template dim<0>();
+  const auto& out_x = out.template dim<0>();
+  const auto& out_y = out.template dim<1>();
+  if (out.empty() || kernel_x.empty() || kernel_y.empty()) return;
+
+  // The columns of the intermediate rows needed by the horizontal pass.
+  const interval<> row_x(out_x.min() + kx.min(), out_x.extent() + kx.extent() - 1);
+  // The columns of the intermediate rows that are in bounds of the input.
+  const index_t ix0 = std::max(row_x.min(), in_x.min());
+  const index_t ix1 = std::min(row_x.max(), in_x.max());
+  const bool in_dense = in_x.stride() == 1;
+
+  const index_t taps = kx.extent() + ky.extent();
+  const index_t min_strip = stencil_min_strip(row_x.extent(), taps);
+  parallel_for(interval<>(out_y.min(), out_y.extent()), min_strip, [&](const interval<>& ys) {
+    dense_array<TAcc, 1> row_buffer(dense_shape<1>(dense_dim<>(row_x.min(), row_x.extent())));
+    TAcc* row = &row_buffer(row_x.min());
+    for (index_t y : ys) {
+      // Vertical pass: compute the rows of the input filtered by kernel_y.
+      std::fill(row, row + row_x.extent(), TAcc(0));
+      for (index_t dy : ky) {
+        const TAcc w = kernel_y(dy);
+        const index_t in_y_dy = remap_boundary(y + dy, in_y.min(), in_y.extent(), b);
+        if (!in_y.is_in_range(in_y_dy)) {
+          // This row is entirely the constant.
+          for (index_t x = 0; x < row_x.extent(); x++) {
+            row[x] += w * constant;
+          }
+          continue;
+        }
+        for (index_t x = row_x.min(); x < ix0 && x <= row_x.max(); x++) {
+          row[x - row_x.min()] += w * sample_boundary(in, x, in_y_dy, b, constant);
+        }
+        if (ix0 <= ix1) {
+          if (in_dense) {
+            accumulate_row_interior<true>(in, in_y_dy, ix0, ix1, w, row + (ix0 - row_x.min()));
+          } else {
+            accumulate_row_interior<false>(in, in_y_dy, ix0, ix1, w, row + (ix0 - row_x.min()));
+          }
+        }
+        for (index_t x = std::max(ix1 + 1, row_x.min()); x <= row_x.max(); x++) {
+          row[x - row_x.min()] += w * sample_boundary(in, x, in_y_dy, b, constant);
+        }
+      }
+
+      // Horizontal pass: filter the row by kernel_x, in register tiles.
+      constexpr index_t N = stencil_tile;
+      index_t x = out_x.min();
+      for (; x + N - 1 <= out_x.max(); x += N) {
+        TAcc acc[N] = {};
+        for (index_t dx : kx) {
+          const TAcc w = kernel_x(dx);
+          const TAcc* p = row + (x + dx - row_x.min());
+          for (index_t i = 0; i < N; i++) {
+            acc[i] += w * p[i];
+          }
+        }
+        for (index_t i = 0; i < N; i++) {
+          out(x + i, y) = static_cast<TOut>(acc[i]);
+        }
+      }
+      for (; x <= out_x.max(); x++) {
+        TAcc acc = 0;
+        for (index_t dx : kx) {
+          acc += static_cast<TAcc>(kernel_x(dx)) * row[x + dx - row_x.min()];
+        }
+        out(x, y) = static_cast<TOut>(acc);
+      }
+    }
+  });
+}
+
+// Call `fn` with each 2D slice of the input and output.
+template <class TIn, class ShapeIn, class TOut, class ShapeOut, class Fn,
+    std::enable_if_t<ShapeIn::rank() == 2, int> = 0>
+void for_each_stencil_channel(
+    const array_ref<TIn, ShapeIn>& in, const array_ref<TOut, ShapeOut>& out, Fn&& fn) {
+  fn(in, out);
+}
+template <class TIn, class ShapeIn, class TOut, class ShapeOut, class Fn,
+    std::enable_if_t<ShapeIn::rank() == 3, int> = 0>
+void for_each_stencil_channel(
+    const array_ref<TIn, ShapeIn>& in, const array_ref<TOut, ShapeOut>& out, Fn&& fn) {
+  for (index_t c : out.template dim<2>()) {
+    fn(in(_, _, c), out(_, _, c));
+  }
+}
+
+template <class TIn, class TK>
+using stencil_acc_type = decltype(std::declval<std::remove_const_t<TIn>>() *
+                                  std::declval<std::remove_const_t<TK>>());
+
+} // namespace internal
+
+/** Compute the 2D stencil (correlation) of `input` with `kernel`:
+ *
+ * `output(x, y) = sum(kernel(dx, dy) * input(x + dx, y + dy))`
+ *
+ * for all `dx`, `dy` in the domain of `kernel`, and `x`, `y` in the domain of
+ * `output`. The mins of `kernel` are the offsets of the taps, e.g. a centered
+ * 3x3 kernel should have the domain [-1, 1] x [-1, 1]. Reads of `input` out
+ * of bounds are handled according to the boundary condition `b`, where
+ * `constant` is the value used by `boundary::constant`. `input` does not need
+ * to be padded.
+ *
+ * The sums are accumulated in the type of `input(x, y) * kernel(dx, dy)`.
+ * The interior of the output is computed in register tiles along x, and strips
+ * of rows of the output are computed in parallel.
+ *
+ * If the arrays have rank 3, the third dimension (e.g. the channels of an
+ * image) is computed independently. */
+template <class TIn, class ShapeIn, class TK, class ShapeK, class TOut, class ShapeOut>
+void stencil(const array_ref<TIn, ShapeIn>& input, const array_ref<TK, ShapeK>& kernel,
+    const array_ref<TOut, ShapeOut>& output, boundary b = boundary::clamp,
+    const std::remove_const_t<TIn>& constant = std::remove_const_t<TIn>()) {
+  static_assert(ShapeK::rank() == 2, "stencil kernels must have rank 2.");
+  static_assert(ShapeIn::rank() == ShapeOut::rank(), "input and output must have the same rank.");
+  using acc_type = internal::stencil_acc_type<TIn, TK>;
+  internal::for_each_stencil_channel(input, output, [&](const auto& in_c, const auto& out_c) {
+    internal::stencil_2d<acc_type>(in_c, kernel, out_c, b, constant);
+  });
+}
+template <class TIn, class ShapeIn, class AllocIn, class TK, class ShapeK, class AllocK,
+    class TOut, class ShapeOut, class AllocOut>
+void stencil(const array<TIn, ShapeIn, AllocIn>& input, const array<TK, ShapeK, AllocK>& kernel,
+    array<TOut, ShapeOut, AllocOut>& output, boundary b = boundary::clamp,
+    const TIn& constant = TIn()) {
+  stencil(input.cref(), kernel.cref(), output.ref(), b, constant);
+}
+
+/** Compute the stencil of `input` with the separable kernel
+ * `kernel_x(dx) * kernel_y(dy)`. This is equivalent to `stencil` with the 2D
+ * kernel, but only requires `kernel_x.size() + kernel_y.size()` operations per
+ * output value.
+ *
+ * Each row of output is computed by filtering the rows of the input
+ * vertically into a temporary row, which is then filtered horizontally. */
+template <class TIn, class ShapeIn, class TKX, class ShapeKX, class TKY, class ShapeKY, class TOut,
+    class ShapeOut>
+void separable_stencil(const array_ref<TIn, ShapeIn>& input,
+    const array_ref<TKX, ShapeKX>& kernel_x, const array_ref<TKY, ShapeKY>& kernel_y,
+    const array_ref<TOut, ShapeOut>& output, boundary b = boundary::clamp,
+    const std::remove_const_t<TIn>& constant = std::remove_const_t<TIn>()) {
+  static_assert(ShapeKX::rank() == 1 && ShapeKY::rank() == 1,
+      "separable stencil kernels must have rank 1.");
+  static_assert(ShapeIn::rank() == ShapeOut::rank(), "input and output must have the same rank.");
+  using acc_type = std::common_type_t<internal::stencil_acc_type<TIn, TKX>,
+      internal::stencil_acc_type<TIn, TKY>>;
+  internal::for_each_stencil_channel(input, output, [&](const auto& in_c, const auto& out_c) {
+    internal::separable_stencil_2d<acc_type>(in_c, kernel_x, kernel_y, out_c, b, constant);
+  });
+}
+template <class TIn, class ShapeIn, class AllocIn, class TKX, class ShapeKX, class AllocKX,
+    class TKY, class ShapeKY, class AllocKY, class TOut, class ShapeOut, class AllocOut>
+void separable_stencil(const array<TIn, ShapeIn, AllocIn>& input,
+    const array<TKX, ShapeKX, AllocKX>& kernel_x, const array<TKY, ShapeKY, AllocKY>& kernel_y,
+    array<TOut, ShapeOut, AllocOut>& output, boundary b = boundary::clamp,
+    const TIn& constant = TIn()) {
+  separable_stencil(input.cref(), kernel_x.cref(), kernel_y.cref(), output.ref(), b, constant);
+}
+
+} // namespace nda
+
+#endif // NDARRAY_STENCIL_H
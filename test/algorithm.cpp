@@ -15,6 +15,10 @@
 #include "array.h"
 #include "test.h"
 
+#include <cmath>
+#include <complex>
+#include <string>
+
 namespace nda {
 
 TEST(algorithm_equal) {
@@ -48,6 +52,53 @@ TEST(algorithm_copy) {
   }
 }
 
+TEST(algorithm_copy_overlap) {
+  dense_array<int, 2> a({10, 20});
+  fill_pattern(a);
+  dense_array<int, 2> original = make_copy(a, a.shape());
+
+  // Copying an array to itself aliases completely.
+  copy(a.cref(), a.ref());
+  ASSERT(equal(a, original));
+
+  // Rows of a dense array are disjoint.
+  copy(a(_, 3), a(_, 5));
+  // Columns of a dense array interleave, so they conservatively may alias.
+  copy(a(2, _), a(7, _));
+  for_all_indices(a.shape(), [&](int x, int y) {
+    int expected_y = y == 5 ? 3 : y;
+    int expected_x = x == 7 ? 2 : x;
+    ASSERT_EQ(a(x, y), original(expected_x, expected_y));
+  });
+
+  int buffer[100];
+  auto extent = std::make_tuple(index_t(10));
+  auto dense = std::make_tuple(index_t(1));
+  auto strided = std::make_tuple(index_t(2));
+  ASSERT(!internal::may_overlap<1>(
+      extent, std::make_pair(&buffer[0], dense), std::make_pair(&buffer[10], dense)));
+  ASSERT(internal::may_overlap<1>(
+      extent, std::make_pair(&buffer[0], dense), std::make_pair(&buffer[9], dense)));
+  ASSERT(internal::may_overlap<1>(
+      extent, std::make_pair(&buffer[0], strided), std::make_pair(&buffer[1], strided)));
+  ASSERT(!internal::may_overlap<1>(
+      extent, std::make_pair(&buffer[0], strided), std::make_pair(&buffer[19], strided)));
+}
+
+TEST(algorithm_copy_memmove) {
+  // Overlapping dense copies of trivially copyable types should behave like
+  // memmove.
+  dense_array<int, 1> a({{0, 20}}, 0);
+  fill_pattern(a);
+  dense_array<int, 1> original = make_copy(a, a.shape());
+  auto src = make_array_ref(&a(0), dense_shape<1>(10));
+  auto dst = make_array_ref(&a(5), dense_shape<1>(10));
+  copy(src, dst);
+  for (index_t i = 0; i < 20; i++) {
+    ASSERT_EQ(a(i), original(i >= 5 && i < 15 ? i - 5 : i));
+  }
+}
+
 TEST(algorithm_move) {
   array_of_rank<int, 2> a({10, 20});
   generate(a, rand);
@@ -68,6 +119,35 @@ TEST(algorithm_move) {
   }
 }
 
+TEST(algorithm_fill) {
+  dense_array<float, 3> a({10, 20, 3}, 1.0f);
+  for (float value : {0.0f, -0.0f, 2.0f}) {
+    // Fill a crop of the array, so the rows are not contiguous.
+    auto crop = a(r(2, 7), r(3, 15), 1);
+    fill(crop, value);
+    for_all_indices(a.shape(), [&](int x, int y, int c) {
+      if (crop.shape().is_in_range(x, y) && c == 1) {
+        ASSERT_EQ(a(x, y, c), value);
+        ASSERT_EQ(std::signbit(a(x, y, c)), std::signbit(value));
+      } else {
+        ASSERT_EQ(a(x, y, c), 1.0f);
+      }
+    });
+  }
+}
+
+TEST(algorithm_fill_types) {
+  // Types that are not trivial are filled by assignment, even when the value
+  // is all zeros.
+  dense_array<std::string, 2> strings({4, 3}, "a");
+  fill(strings, std::string());
+  strings.for_each_value([](const std::string& s) { ASSERT(s.empty()); });
+
+  dense_array<std::complex<float>, 2> complex({4, 3}, std::complex<float>(1.0f, 2.0f));
+  fill(complex, std::complex<float>());
+  complex.for_each_value([](std::complex<float> x) { ASSERT_EQ(x, std::complex<float>()); });
+}
+
 TEST(algorithm_copy_scalar) {
   array_of_rank<int, 0> a;
   generate(a, rand);
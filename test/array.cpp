@@ -15,6 +15,10 @@
 #include "array.h"
 #include "test.h"
 
+#include <array>
+#include <string>
+#include <vector>
+
 namespace nda {
 
 TEST(array_default_constructor) {
@@ -326,6 +330,39 @@ TEST(array_dense_move) {
   check_pattern(dense_move);
 }
 
+// A value larger than a vector register, without a default constructor.
+struct wide_value {
+  double x[4];
+  explicit wide_value(double v) : x{v, v + 1, v + 2, v + 3} {}
+  bool operator==(const wide_value& o) const { return std::equal(x, x + 4, o.x); }
+  bool operator!=(const wide_value& o) const { return !(*this == o); }
+};
+
+TEST(array_non_temporal) {
+  // Fills of values that do not evenly divide a vector register.
+  std::vector<wide_value> wide_values(70, wide_value(0));
+  dense_array_ref<wide_value, 2> wide(wide_values.data(), {10, 7});
+  fill(wide, wide_value(5), store_policy::non_temporal);
+  wide.for_each_value([](const wide_value& i) { ASSERT(i == wide_value(5)); });
+  dense_array<std::array<uint8_t, 3>, 1> rgb(dense_shape<1>(37));
+  fill(rgb, {{1, 2, 3}}, store_policy::non_temporal);
+  rgb.for_each_value([](const std::array<uint8_t, 3>& i) { ASSERT(i[2] == 3); });
+
+  // Copies that are not of trivially copyable values of the same type.
+  dense_array<std::string, 1> strings(dense_shape<1>(9));
+  for (index_t i : strings.x()) {
+    strings(i) = std::string(100, 'a' + i);
+  }
+  dense_array<std::string, 1> string_copy(dense_shape<1>(9));
+  copy(strings, string_copy, store_policy::non_temporal);
+  ASSERT(string_copy == strings);
+  dense_array<int, 2> ints({13, 5});
+  fill_pattern(ints);
+  dense_array<double, 2> doubles({13, 5});
+  copy(ints, doubles, store_policy::non_temporal);
+  for_all_indices(ints.shape(), [&](index_t x, index_t y) { ASSERT_EQ(doubles(x, y), ints(x, y)); });
+}
+
 TEST(array_tricky_copy) {
   array_of_rank<int, 2> source({{0, 4, 6}, {0, 6, 1}});
   fill_pattern(source);
@@ -15,6 +15,9 @@
 #include "array.h"
 #include "test.h"
 
+#include <thread>
+#include <vector>
+
 namespace nda {
 
 typedef dense_array<int, 3, auto_allocator<int, 32>> dense3d_int_auto_array;
@@ -63,4 +66,136 @@ TEST(auto_array_bad_alloc) {
   ASSERT(!is_auto_allocation(not_auto_array));
 }
 
+TEST(pool_allocator) {
+  pool_allocator<float> alloc;
+  // A freed block should be reused by the next allocation of the same size
+  // class.
+  float* a = alloc.allocate(20);
+  alloc.deallocate(a, 20);
+  float* b = alloc.allocate(17);
+  ASSERT_EQ(a, b);
+  alloc.deallocate(b, 17);
+
+  // Large allocations are not pooled, but must still work.
+  double* big = pool_allocator<double>().allocate(100000);
+  big[99999] = 1.0;
+  pool_allocator<double>().deallocate(big, 100000);
+
+  // Memory can be freed on a different thread than it was allocated.
+  std::vector<int*> blocks;
+  pool_allocator<int> int_alloc;
+  for (int i = 0; i < 200; i++) {
+    blocks.push_back(int_alloc.allocate(i % 50 + 1));
+    *blocks.back() = i;
+  }
+  std::thread t([&]() {
+    for (int i = 0; i < 200; i++) {
+      ASSERT_EQ(*blocks[i], i);
+      int_alloc.deallocate(blocks[i], i % 50 + 1);
+    }
+  });
+  t.join();
+}
+
+// A thread_local object constructed before the thread's free lists is
+// destroyed after them.
+struct pool_user {
+  std::vector<int, pool_allocator<int>> data;
+};
+
+TEST(pool_allocator_thread_exit) {
+  std::thread t([]() {
+    static thread_local pool_user user;
+    // This allocation constructs the free lists of this thread after user,
+    // so user.data is freed at thread exit after the lists are destroyed.
+    user.data.resize(10, 3);
+  });
+  t.join();
+}
+
+typedef dense_array<int, 3, auto_pool_allocator<int, 32>> dense3d_int_auto_pool_array;
+
+TEST(auto_pool_array) {
+  dense3d_int_auto_pool_array auto_array({4, 3, 2});
+  ASSERT(is_auto_allocation(auto_array));
+
+  // This array spills to the pool.
+  dense3d_int_auto_pool_array pool_array({4, 3, 5});
+  ASSERT(!is_auto_allocation(pool_array));
+  fill_pattern(pool_array.ref());
+  dense3d_int_auto_pool_array copy_array(pool_array);
+  check_pattern(copy_array.cref());
+  const int* data = copy_array.data();
+
+  // After freeing an array, a new array of the same size should reuse its
+  // memory.
+  copy_array.clear();
+  dense3d_int_auto_pool_array reused({4, 3, 5});
+  ASSERT_EQ(reused.data(), data);
+}
+
+struct strip_tag {};
+struct output_tag {};
+
+TEST(tracking_allocator) {
+  using strip_alloc = tracking_allocator<std::allocator<float>, strip_tag>;
+  using output_alloc = tracking_allocator<uninitialized_std_allocator<int>, output_tag>;
+  allocation_stats& strips = get_allocation_stats<strip_tag>();
+  allocation_stats& outputs = output_alloc::stats();
+  strips.reset();
+  outputs.reset();
+
+  {
+    dense_array<int, 2, output_alloc> out({100, 10});
+    for (int i = 0; i < 3; i++) {
+      dense_array<float, 2, strip_alloc> strip({100, 4}, 0.0f);
+      ASSERT_EQ(strips.current_bytes(), 400 * sizeof(float));
+    }
+    dense_array<float, 1, strip_alloc> a({{0, 10}});
+    dense_array<float, 1, strip_alloc> b({{0, 1000}});
+    ASSERT_EQ(strips.current_bytes(), 1010 * sizeof(float));
+    ASSERT_EQ(outputs.current_bytes(), 1000 * sizeof(int));
+  }
+  ASSERT_EQ(strips.allocations(), 5);
+  ASSERT_EQ(strips.deallocations(), 5);
+  ASSERT_EQ(strips.current_bytes(), 0);
+  ASSERT_EQ(strips.peak_bytes(), 1010 * sizeof(float));
+  ASSERT_EQ(strips.total_bytes(), (1200 + 1010) * sizeof(float));
+  ASSERT_EQ(strips.histogram(allocation_stats::histogram_bucket(1600)), 3);
+  ASSERT_EQ(strips.histogram(6), 1);
+  ASSERT_EQ(strips.histogram(12), 1);
+
+  ASSERT_EQ(outputs.allocations(), 1);
+  ASSERT_EQ(outputs.peak_bytes(), 1000 * sizeof(int));
+
+  // Allocators with the same tag share counters, even with different value
+  // types.
+  strips.reset();
+  tracking_allocator<std::allocator<double>, strip_tag> doubles;
+  double* d = doubles.allocate(10);
+  ASSERT_EQ(strips.current_bytes(), 10 * sizeof(double));
+  doubles.deallocate(d, 10);
+  ASSERT_EQ(strips.allocations(), 1);
+  ASSERT_EQ(strips.current_bytes(), 0);
+
+  // Allocations from several threads are counted.
+  strips.reset();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([]() {
+      strip_alloc alloc;
+      for (int i = 0; i < 1000; i++) {
+        alloc.deallocate(alloc.allocate(i + 1), i + 1);
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(strips.allocations(), 4000);
+  ASSERT_EQ(strips.deallocations(), 4000);
+  ASSERT_EQ(strips.current_bytes(), 0);
+  ASSERT(strips.peak_bytes() >= 1000 * sizeof(float));
+}
+
 } // namespace nda
@@ -0,0 +1,276 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "chunk_store.h"
+#include "test.h"
+
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace nda {
+
+namespace {
+
+// A temporary directory, which is removed with its files when destroyed.
+class temp_dir {
+  std::string path_;
+
+public:
+  temp_dir() {
+    const char* tmp = std::getenv("TMPDIR");
+    std::string pattern = std::string(tmp ? tmp : "/tmp") + "/chunk_store_XXXXXX";
+    std::vector<char> buffer(pattern.begin(), pattern.end());
+    buffer.push_back(0);
+    path_ = ::mkdtemp(buffer.data());
+  }
+  ~temp_dir() {
+    if (DIR* dir = ::opendir(path_.c_str())) {
+      while (dirent* entry = ::readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") { ::unlink((path_ + "/" + name).c_str()); }
+      }
+      ::closedir(dir);
+    }
+    ::rmdir(path_.c_str());
+  }
+
+  // A path for a chunk store in this directory. Chunk stores are the only
+  // thing in the directory, so they can be at the path of the directory.
+  const std::string& path() const { return path_; }
+};
+
+bool file_exists(const std::string& path) { return ::access(path.c_str(), F_OK) == 0; }
+
+} // namespace
+
+TEST(chunk_store_copy) {
+  temp_dir dir;
+  dense_shape<3> shape({-10, 100}, {0, 70}, {5, 30});
+  dense_array<int, 3> values(shape);
+  for_all_indices(shape, [&](index_t x, index_t y, index_t z) {
+    values(x, y, z) = x + y * 100 + z * 10000;
+  });
+
+  thread_pool pool(3);
+  {
+    chunk_store<int, 3> store(dir.path(), shape, dense_shape<3>(32, 16, 8), -1, 1 << 20, pool);
+    ASSERT_EQ(store.chunk_grid().width(), 4);
+    ASSERT_EQ(store.chunk_grid().height(), 5);
+    ASSERT_EQ(store.chunk_grid().z().extent(), 4);
+
+    // Untouched chunks have the fill value, and have no file.
+    dense_array<int, 3> crop({{0, 40}, {10, 20}, {8, 10}});
+    copy(store, crop);
+    crop.for_each_value([](int x) { ASSERT_EQ(x, -1); });
+    ASSERT_EQ(store.chunk_reads(), 0);
+
+    // Write part of the store, and read it back through the cache.
+    dense_array<int, 3> written =
+        make_compact_copy(values(interval<>(0, 60), interval<>(5, 40), interval<>(10, 20)));
+    copy(written, store);
+    ASSERT_EQ(store.chunk_writes(), 0);
+    copy(store, crop);
+    for_all_indices(crop.shape(), [&](index_t x, index_t y, index_t z) {
+      ASSERT_EQ(crop(x, y, z), (written.shape().is_in_range(x, y, z) ? values(x, y, z) : -1));
+    });
+
+    // Each modified chunk is written once.
+    store.flush();
+    const size_t written_chunks = 3 * 3 * 4;
+    ASSERT_EQ(store.chunk_writes(), written_chunks);
+    ASSERT(file_exists(dir.path() + "/1.0.0"));
+    ASSERT(!file_exists(dir.path() + "/0.4.0"));
+    store.flush();
+    ASSERT_EQ(store.chunk_writes(), written_chunks);
+  }
+
+  // Reopen the store, and copy the whole thing.
+  chunk_store<int, 3> store(dir.path(), 1 << 20, pool);
+  ASSERT(store.shape().min() == shape.min());
+  ASSERT(store.shape().extent() == shape.extent());
+  ASSERT_EQ(store.fill_value(), -1);
+  dense_array<int, 3> all(shape);
+  copy(store, all);
+  for_all_indices(shape, [&](index_t x, index_t y, index_t z) {
+    bool is_written = x >= 0 && x < 60 && y >= 5 && y < 45 && z >= 10 && z < 30;
+    ASSERT_EQ(all(x, y, z), (is_written ? values(x, y, z) : -1));
+  });
+
+  // Overwriting entire chunks does not read them.
+  const size_t reads = store.chunk_reads();
+  store.clear_cache();
+  copy(values, store);
+  ASSERT_EQ(store.chunk_reads(), reads);
+  store.clear_cache();
+  copy(store, all);
+  ASSERT(all == values);
+}
+
+TEST(chunk_store_cache) {
+  temp_dir dir;
+  dense_shape<2> shape(256, 256);
+  dense_array<float, 2> values(shape);
+  for_all_indices(shape, [&](index_t x, index_t y) { values(x, y) = x * 0.5f + y; });
+
+  // The cache only has room for 4 chunks.
+  const size_t chunk_bytes = 32 * 32 * sizeof(float);
+  chunk_store<float, 2> store(dir.path(), shape, dense_shape<2>(32, 32), 0.0f, 4 * chunk_bytes);
+  copy(values, store);
+  ASSERT(store.cached_bytes() <= store.cache_bytes());
+  // Chunks evicted from the cache were written, the rest are written by flush.
+  ASSERT_EQ(store.chunk_writes(), 64 - 4);
+  store.flush();
+  ASSERT_EQ(store.chunk_writes(), 64);
+
+  // Reading a crop within a cached chunk does not read any files.
+  dense_array<float, 2> crop({{230, 20}, {240, 10}});
+  copy(store, crop);
+  ASSERT_EQ(store.chunk_reads(), 0);
+  for_all_indices(crop.shape(), [&](index_t x, index_t y) { ASSERT_EQ(crop(x, y), values(x, y)); });
+
+  // Copying the whole store reads every chunk, in batches that fit the cache.
+  dense_array<float, 2> all(shape);
+  copy(store, all);
+  ASSERT(all == values);
+  ASSERT(store.cached_bytes() <= store.cache_bytes());
+  ASSERT(store.chunk_reads() >= 60);
+
+  // Reading the most recently used chunks again hits the cache.
+  const size_t reads = store.chunk_reads();
+  dense_array<float, 2> last({{224, 32}, {224, 32}});
+  copy(store, last);
+  ASSERT_EQ(store.chunk_reads(), reads);
+}
+
+TEST(chunk_store_small_cache) {
+  temp_dir dir;
+  dense_shape<2> shape(160, 96);
+  dense_array<int, 2> expected(shape, 0);
+  // The cache only has room for 3 chunks, so most chunks of each batch evict
+  // and write a chunk of the same copy.
+  const size_t chunk_bytes = 16 * 16 * sizeof(int);
+  thread_pool pool(4);
+  chunk_store<int, 2> store(dir.path(), shape, dense_shape<2>(16, 16), 0, 3 * chunk_bytes, pool);
+
+  // Overlapping crops that are not aligned to the chunks, so each copy reads
+  // chunks that were recently evicted and written.
+  for (int n = 0; n < 20; n++) {
+    const index_t x = (n * 37) % 100;
+    const index_t y = (n * 23) % 50;
+    dense_array<int, 2> src({{x, 60}, {y, 46}});
+    for_all_indices(
+        src.shape(), [&](index_t i, index_t j) { src(i, j) = n * 100000 + i * 100 + j; });
+    copy(src, store);
+    copy(src, expected(src.x(), src.y()));
+
+    dense_array<int, 2> dst({{(x + 30) % 100, 60}, {(y + 20) % 50, 46}});
+    copy(store, dst);
+    ASSERT(equal(dst.cref(), expected(dst.x(), dst.y())));
+  }
+  dense_array<int, 2> all(shape);
+  copy(store, all);
+  ASSERT(all == expected);
+}
+
+TEST(chunk_store_pinned_batch) {
+  temp_dir dir;
+  // The cache has room for 3 of the 4 chunks.
+  dense_shape<2> shape(16, 64);
+  const size_t chunk_bytes = 16 * 16 * sizeof(int);
+  thread_pool pool(0);
+  chunk_store<int, 2> store(dir.path(), shape, dense_shape<2>(16, 16), 0, 3 * chunk_bytes, pool);
+
+  // Write the last 3 chunks, which are all in the cache.
+  dense_array<int, 2> src({16, {16, 48}}, 7);
+  copy(src, store);
+  ASSERT_EQ(store.chunk_writes(), 0);
+
+  // Reading the first 2 chunks evicts a chunk when the first one is read.
+  // The second chunk is in the batch being copied, so it is not evicted, and
+  // is not read back from its file.
+  dense_array<int, 2> dst({16, {0, 32}});
+  copy(store, dst);
+  ASSERT_EQ(store.chunk_writes(), 1);
+  ASSERT_EQ(store.chunk_reads(), 0);
+  ASSERT(equal(dst(_, interval<>(16, 16)), src(_, interval<>(16, 16))));
+}
+
+TEST(chunk_store_evict_error) {
+  temp_dir dir;
+  dense_shape<2> shape(64, 64);
+  dense_array<int, 2> values(shape);
+  for_all_indices(shape, [&](index_t x, index_t y) { values(x, y) = x * 64 + y; });
+
+  // The cache only has room for 1 chunk, so copying each chunk after the
+  // first one evicts and writes the previous one.
+  const size_t chunk_bytes = 32 * 32 * sizeof(int);
+  thread_pool pool(0);
+  chunk_store<int, 2> store(dir.path(), shape, dense_shape<2>(32, 32), 0, chunk_bytes, pool);
+
+  // A directory in place of the file of chunk (0, 0) makes writing it fail.
+  const std::string blocked = dir.path() + "/0.0";
+  ASSERT_EQ(::mkdir(blocked.c_str(), 0755), 0);
+  bool threw = false;
+  try {
+    copy(values, store);
+  } catch (const std::runtime_error&) { threw = true; }
+  ASSERT(threw);
+
+  // The chunks that were not written are still in the cache, and flushed
+  // when the file can be written.
+  ::rmdir(blocked.c_str());
+  store.flush();
+  chunk_store<int, 2> reopened(dir.path());
+  dense_array<int, 2> all(shape);
+  copy(reopened, all);
+  for_all_indices(dense_shape<2>({0, 32}, {0, 32}), [&](index_t x, index_t y) {
+    ASSERT_EQ(all(x, y), values(x, y));
+  });
+}
+
+TEST(chunk_store_flush_error) {
+  temp_dir dir;
+  dense_shape<2> shape(64, 64);
+  dense_array<int, 2> values(shape);
+  for_all_indices(shape, [&](index_t x, index_t y) { values(x, y) = x * 64 + y; });
+
+  chunk_store<int, 2> store(dir.path(), shape, dense_shape<2>(32, 32));
+  copy(values, store);
+  ASSERT_EQ(store.chunk_writes(), 0);
+
+  // A directory in place of the file of chunk (0, 0) makes writing it fail.
+  const std::string blocked = dir.path() + "/0.0";
+  ASSERT_EQ(::mkdir(blocked.c_str(), 0755), 0);
+  bool threw = false;
+  try {
+    store.flush();
+  } catch (const std::runtime_error&) { threw = true; }
+  ASSERT(threw);
+  ASSERT_EQ(store.chunk_writes(), 3);
+
+  // The chunk that failed to write is still dirty, so the next flush writes it.
+  ::rmdir(blocked.c_str());
+  store.flush();
+  ASSERT_EQ(store.chunk_writes(), 4);
+  store.flush();
+  ASSERT_EQ(store.chunk_writes(), 4);
+
+  chunk_store<int, 2> reopened(dir.path());
+  dense_array<int, 2> all(shape);
+  copy(reopened, all);
+  ASSERT(all == values);
+}
+
+} // namespace nda
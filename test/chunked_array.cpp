@@ -0,0 +1,128 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "chunked_array.h"
+#include "test.h"
+
+namespace nda {
+
+TEST(chunked_array_lazy) {
+  // A volume that would be far too big to allocate densely.
+  const index_t N = 1 << 14;
+  chunked_array<float, 3> a({N, N, N}, {64, 64, 64}, -1.0f);
+  ASSERT_EQ(a.allocated_chunks(), 0);
+  ASSERT_EQ(a.chunk_grid().width(), N / 64);
+
+  const chunked_array<float, 3>& const_a = a;
+  ASSERT_EQ(const_a(0, 0, 0), -1.0f);
+  ASSERT_EQ(const_a(N - 1, 100, 5000), -1.0f);
+  ASSERT_EQ(a.allocated_chunks(), 0);
+
+  // Writing allocates only the chunk containing the element.
+  a(100, 200, 300) = 3.0f;
+  a(101, 201, 301) = 4.0f;
+  a(N - 1, N - 1, N - 1) = 5.0f;
+  ASSERT_EQ(a.allocated_chunks(), 2);
+  ASSERT_EQ(a.allocated_size(), 2 * 64 * 64 * 64);
+  ASSERT_EQ(const_a(100, 200, 300), 3.0f);
+  ASSERT_EQ(const_a(101, 201, 301), 4.0f);
+  ASSERT_EQ(const_a(102, 202, 302), -1.0f);
+  ASSERT_EQ(const_a(N - 1, N - 1, N - 1), 5.0f);
+  ASSERT_EQ(const_a(N - 1, N - 1, 0), -1.0f);
+
+  // for_each_value visits only the allocated chunks.
+  index_t visited = 0;
+  float sum = 0.0f;
+  const_a.for_each_value([&](float x) {
+    visited++;
+    if (x != -1.0f) { sum += x; }
+  });
+  ASSERT_EQ(visited, 2 * 64 * 64 * 64);
+  ASSERT_EQ(sum, 12.0f);
+  a.for_each_value([](float& x) { x = x == -1.0f ? -1.0f : x * 2.0f; });
+  ASSERT_EQ(const_a(100, 200, 300), 6.0f);
+
+  a.deallocate_chunk(a.chunk_index({100, 200, 300}));
+  ASSERT_EQ(a.allocated_chunks(), 1);
+  ASSERT_EQ(const_a(100, 200, 300), -1.0f);
+  a.clear();
+  ASSERT_EQ(a.allocated_chunks(), 0);
+  ASSERT_EQ(const_a(N - 1, N - 1, N - 1), -1.0f);
+}
+
+TEST(chunked_array_edges) {
+  // The shape has mins, and extents that are not a multiple of the chunks.
+  chunked_array<int, 2> a({{-3, 50}, {10, 21}}, {16, 8});
+  ASSERT_EQ(a.chunk_grid().width(), 4);
+  ASSERT_EQ(a.chunk_grid().height(), 3);
+  dense_shape<2> edge = a.chunk_shape({3, 2});
+  ASSERT_EQ(edge.x().min(), 45);
+  ASSERT_EQ(edge.x().extent(), 2);
+  ASSERT_EQ(edge.y().min(), 26);
+  ASSERT_EQ(edge.y().extent(), 5);
+  for_all_indices(a.shape(), [&](index_t x, index_t y) { a(x, y) = x * 100 + y; });
+  ASSERT_EQ(a.allocated_chunks(), 12);
+  ASSERT_EQ(a.allocated_size(), a.shape().size());
+  const chunked_array<int, 2>& const_a = a;
+  for_all_indices(a.shape(), [&](index_t x, index_t y) { ASSERT_EQ(const_a(x, y), x * 100 + y); });
+}
+
+TEST(chunked_array_copy) {
+  chunked_array<int, 3> a({{-10, 100}, {0, 80}, {5, 30}}, {32, 16, 8}, 7);
+  a(20, 30, 10) = 1;
+  a(80, 70, 30) = 2;
+  const chunked_array<int, 3>& const_a = a;
+
+  // Copy a crop that intersects allocated and unallocated chunks.
+  dense_array<int, 3> crop({{0, 90}, {20, 55}, {8, 25}});
+  copy(a, crop);
+  for_all_indices(crop.shape(), [&](index_t x, index_t y, index_t z) {
+    ASSERT_EQ(crop(x, y, z), const_a(x, y, z));
+  });
+  ASSERT_EQ(crop(20, 30, 10), 1);
+  ASSERT_EQ(crop(80, 70, 30), 2);
+  ASSERT_EQ(crop(0, 20, 8), 7);
+
+  // Copy a crop to a transposed array, which is not dense.
+  dense_array<int, 3> crop_t({{8, 25}, {20, 55}, {0, 90}});
+  copy(a, transpose<2, 1, 0>(crop_t.ref()));
+  for_all_indices(crop.shape(), [&](index_t x, index_t y, index_t z) {
+    ASSERT_EQ(crop_t(z, y, x), crop(x, y, z));
+  });
+
+  // Copying dense arrays into a chunked array only allocates the chunks that
+  // contain values other than the fill value.
+  chunked_array<int, 3> b({{-10, 100}, {0, 80}, {5, 30}}, {32, 16, 8}, 7);
+  copy(crop, b);
+  ASSERT_EQ(b.allocated_chunks(), 2);
+  const chunked_array<int, 3>& const_b = b;
+  for_all_indices(b.shape(), [&](index_t x, index_t y, index_t z) {
+    ASSERT_EQ(const_b(x, y, z), const_a(x, y, z));
+  });
+
+  dense_array<int, 3> ones({{-5, 40}, {10, 20}, {5, 10}}, 1);
+  copy(ones, b);
+  for_all_indices(b.shape(), [&](index_t x, index_t y, index_t z) {
+    ASSERT_EQ(const_b(x, y, z), (ones.shape().is_in_range(x, y, z) ? 1 : const_a(x, y, z)));
+  });
+
+  // Copies convert the value type.
+  dense_array<float, 3> crop_float({{0, 90}, {20, 55}, {8, 25}});
+  copy(a, crop_float);
+  for_all_indices(crop.shape(), [&](index_t x, index_t y, index_t z) {
+    ASSERT_EQ(crop_float(x, y, z), crop(x, y, z));
+  });
+}
+
+} // namespace nda
@@ -0,0 +1,182 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "codec.h"
+#include "test.h"
+
+#include <cmath>
+#include <random>
+
+namespace nda {
+
+namespace {
+
+std::vector<uint8_t> random_bytes(size_t n, std::mt19937& rng) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::vector<uint8_t> result(n);
+  for (uint8_t& i : result) {
+    i = byte(rng);
+  }
+  return result;
+}
+
+const codec all_codecs[] = {
+    {false, shuffle_kind::none, false},
+    {false, shuffle_kind::none, true},
+    {true, shuffle_kind::none, true},
+    {false, shuffle_kind::byte, false},
+    {true, shuffle_kind::byte, true},
+    {false, shuffle_kind::bit, true},
+    {true, shuffle_kind::bit, false},
+    {true, shuffle_kind::bit, true},
+};
+
+} // namespace
+
+TEST(codec_shuffle) {
+  std::mt19937 rng;
+  for (size_t size : {1, 2, 3, 4, 8, 16}) {
+    // Use counts that are not a multiple of the vector size or 8.
+    for (index_t n : {0, 5, 8, 37, 64, 100, 3000, 5003}) {
+      std::vector<uint8_t> values = random_bytes(n * size, rng);
+
+      std::vector<uint8_t> bytes(n * size);
+      internal::shuffle_bytes(values.data(), n, size, bytes.data(), n);
+      for (index_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < size; b++) {
+          ASSERT_EQ(bytes[b * n + i], values[i * size + b]);
+        }
+      }
+      std::vector<uint8_t> unshuffled(n * size);
+      internal::unshuffle_bytes(bytes.data(), n, n, size, unshuffled.data());
+      ASSERT(unshuffled == values);
+
+      std::vector<uint8_t> bits(n * size);
+      internal::shuffle_bits(values.data(), n, size, bits.data());
+      const index_t n8 = n - n % 8;
+      for (index_t i = 0; i < n8; i++) {
+        for (size_t b = 0; b < size; b++) {
+          for (int k = 0; k < 8; k++) {
+            int bit = (values[i * size + b] >> k) & 1;
+            int shuffled = (bits[(b * 8 + k) * (n8 / 8) + i / 8] >> (i % 8)) & 1;
+            ASSERT_EQ(shuffled, bit);
+          }
+        }
+      }
+      for (index_t i = n8 * size; i < n * static_cast<index_t>(size); i++) {
+        ASSERT_EQ(bits[i], values[i]);
+      }
+      internal::unshuffle_bits(bits.data(), n, size, unshuffled.data());
+      ASSERT(unshuffled == values);
+    }
+  }
+}
+
+TEST(codec_zero_runs) {
+  std::mt19937 rng;
+  std::uniform_int_distribution<int> run_length(0, 100);
+  for (int trial = 0; trial < 20; trial++) {
+    // Alternate between runs of random bytes and runs of zeros.
+    std::vector<uint8_t> values;
+    for (int run = 0; run < 50; run++) {
+      std::vector<uint8_t> literal = random_bytes(run_length(rng), rng);
+      values.insert(values.end(), literal.begin(), literal.end());
+      values.insert(values.end(), run_length(rng), 0);
+    }
+    std::vector<uint8_t> encoded;
+    internal::encode_zero_runs(values.data(), values.size(), encoded);
+    ASSERT_LT(encoded.size(), values.size());
+    std::vector<uint8_t> decoded(values.size());
+    internal::decode_zero_runs(encoded.data(), encoded.size(), decoded.data(), decoded.size());
+    ASSERT(decoded == values);
+
+    // Truncated data is detected.
+    bool threw = false;
+    try {
+      internal::decode_zero_runs(
+          encoded.data(), encoded.size() - 1, decoded.data(), decoded.size());
+    } catch (const std::runtime_error&) { threw = true; }
+    ASSERT(threw);
+  }
+}
+
+TEST(codec_compress) {
+  // A smooth volume, which compresses well with delta coding.
+  dense_array<int16_t, 3> smooth({{-3, 100}, {2, 50}, {0, 7}});
+  for_all_indices(smooth.shape(), [&](index_t x, index_t y, index_t z) {
+    smooth(x, y, z) = static_cast<int16_t>(1000 * std::sin(x * 0.05) + y * 3 - z);
+  });
+  // A mostly empty volume.
+  dense_array<float, 3> sparse({100, 50, 7}, 0.0f);
+  sparse(10, 20, 3) = 1.5f;
+  sparse(90, 2, 6) = -3.0f;
+  // Random data, which does not compress.
+  std::mt19937 rng;
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  dense_array<double, 2> noise({37, 29});
+  generate(noise, [&]() { return uniform(rng); });
+
+  for (const codec& c : all_codecs) {
+    std::vector<uint8_t> smooth_data = compress(smooth, c);
+    dense_array<int16_t, 3> smooth_decompressed(smooth.shape());
+    decompress(smooth_data, smooth_decompressed);
+    ASSERT(smooth_decompressed == smooth);
+
+    std::vector<uint8_t> sparse_data = compress(sparse.cref(), c);
+    dense_array<float, 3> sparse_decompressed(sparse.shape());
+    decompress(sparse_data.data(), sparse_data.size(), sparse_decompressed.ref());
+    ASSERT(sparse_decompressed == sparse);
+    if (c.zero_runs) { ASSERT_LT(sparse_data.size(), sparse.size()); }
+
+    std::vector<uint8_t> noise_data = compress(noise, c);
+    dense_array<double, 2> noise_decompressed(noise.shape());
+    decompress(noise_data, noise_decompressed);
+    ASSERT(noise_decompressed == noise);
+  }
+
+  // Delta coding, shuffling, and zero runs make smooth data much smaller.
+  const size_t smooth_bytes = smooth.size() * sizeof(int16_t);
+  ASSERT_LT(compress(smooth).size(), smooth_bytes * 2 / 3);
+  ASSERT_LT(compress(smooth, {true, shuffle_kind::bit, true}).size(), smooth_bytes / 2);
+
+  // Arrays that are not contiguous can be compressed and decompressed.
+  auto smooth_t = transpose<1, 0, 2>(smooth.cref());
+  std::vector<uint8_t> smooth_t_data = compress(smooth_t);
+  dense_array<int16_t, 3> smooth_t_decompressed({{2, 50}, {-3, 100}, {0, 7}});
+  decompress(smooth_t_data, smooth_t_decompressed);
+  for_all_indices(smooth.shape(), [&](index_t x, index_t y, index_t z) {
+    ASSERT_EQ(smooth_t_decompressed(y, x, z), smooth(x, y, z));
+  });
+  dense_array<int16_t, 3> smooth_t_decompressed_t(smooth.shape());
+  decompress(smooth_t_data, transpose<1, 0, 2>(smooth_t_decompressed_t.ref()));
+  ASSERT(smooth_t_decompressed_t == smooth);
+
+  // Data that does not match the array is rejected.
+  std::vector<uint8_t> smooth_data = compress(smooth);
+  bool threw = false;
+  try {
+    dense_array<int16_t, 3> wrong_shape({50, 100, 7});
+    decompress(smooth_data, wrong_shape);
+  } catch (const std::runtime_error&) { threw = true; }
+  ASSERT(threw);
+  threw = false;
+  try {
+    dense_array<int16_t, 3> decompressed(smooth.shape());
+    smooth_data.resize(smooth_data.size() / 2);
+    decompress(smooth_data, decompressed);
+  } catch (const std::runtime_error&) { threw = true; }
+  ASSERT(threw);
+}
+
+} // namespace nda
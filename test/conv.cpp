@@ -0,0 +1,127 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "conv.h"
+#include "test.h"
+
+#include <random>
+
+namespace nda {
+
+template <class Input, class Filter, class Bias, class Output, class Epilogue>
+void conv2d_reference(const Input& input, const Filter& filter, const Bias& bias,
+    const Output& output, const Epilogue& epilogue) {
+  for_all_indices(output.shape(), [&](index_t co, index_t x, index_t y, index_t n) {
+    double sum = bias(co);
+    for (index_t dy : filter.template dim<2>()) {
+      for (index_t dx : filter.template dim<1>()) {
+        for (index_t ci : filter.template dim<3>()) {
+          sum += filter(co, dx, dy, ci) * input(ci, x + dx, y + dy, n);
+        }
+      }
+    }
+    output(co, x, y, n) = epilogue(static_cast<float>(sum));
+  });
+}
+
+template <class Epilogue>
+void test_conv2d(
+    index_t ci, index_t co, index_t w, index_t h, index_t n, const Epilogue& epilogue) {
+  std::mt19937 rng;
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+
+  // The filter is centered, so the input must be padded by 1 on each side.
+  dense_array<float, 4> input({ci, {-1, w + 2}, {-1, h + 2}, n});
+  dense_array<float, 4> filter({co, {-1, 3}, {-1, 3}, ci});
+  dense_array<float, 1> bias({{0, co}}, 0.0f);
+  generate(input, [&]() { return uniform(rng); });
+  generate(filter, [&]() { return uniform(rng); });
+  generate(bias, [&]() { return uniform(rng); });
+
+  dense_array<float, 4> output({co, w, h, n});
+  dense_array<float, 4> reference({co, w, h, n});
+  conv2d(input, filter, bias, output, epilogue);
+  conv2d_reference(input.cref(), filter.cref(), bias.cref(), reference.ref(), epilogue);
+  for_each_index(output.shape(), [&](const index_of_rank<4>& i) {
+    ASSERT_LT(std::abs(output[i] - reference[i]), 1e-4f) << "i=" << i;
+  });
+}
+
+TEST(conv2d) {
+  // Sizes that are and are not multiples of the tile size.
+  test_conv2d(3, 48, 8, 5, 2, no_activation());
+  test_conv2d(5, 13, 7, 3, 1, no_activation());
+  test_conv2d(16, 50, 17, 4, 1, relu());
+  test_conv2d(4, 24, 9, 6, 2, clamp_activation<float>(-0.5f, 0.5f));
+  test_conv2d(2, 7, 3, 3, 1, [](float x) { return x * x; });
+}
+
+TEST(conv2d_relu) {
+  dense_array<float, 4> input({2, 4, 4, 1});
+  dense_array<float, 4> filter({3, 3, 3, 2}, 1.0f);
+  dense_array<float, 1> bias({{0, 3}}, 0.0f);
+  fill(input, 1.0f);
+  bias(0) = -20.0f;
+  bias(1) = 0.0f;
+  bias(2) = 1.0f;
+  dense_array<float, 4> output({3, 2, 2, 1});
+  conv2d(input, filter, bias, output, relu());
+  for_all_indices(output.shape(), [&](index_t co, index_t x, index_t y, index_t n) {
+    ASSERT_EQ(output(co, x, y, n), std::max(0.0f, 18.0f + bias(co)));
+  });
+}
+
+template <index_t M>
+void test_winograd_conv2d(
+    index_t ci, index_t co, index_t w, index_t h, index_t n, float tolerance) {
+  std::mt19937 rng;
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+
+  dense_array<float, 4> input({ci, {-1, w + 2}, {-1, h + 2}, n});
+  dense_array<float, 4> filter({co, {-1, 3}, {-1, 3}, ci});
+  dense_array<float, 1> bias({{0, co}}, 0.0f);
+  generate(input, [&]() { return uniform(rng); });
+  generate(filter, [&]() { return uniform(rng); });
+  generate(bias, [&]() { return uniform(rng); });
+
+  dense_array<float, 4> reference({co, w, h, n});
+  conv2d_reference(input.cref(), filter.cref(), bias.cref(), reference.ref(), relu());
+
+  // The transformed filter can be reused for several convolutions.
+  winograd_filter<M> transformed(filter);
+  for (int i = 0; i < 2; i++) {
+    dense_array<float, 4> output({co, w, h, n});
+    winograd_conv2d(input, transformed, bias, output, relu());
+    for_each_index(output.shape(), [&](const index_of_rank<4>& i) {
+      ASSERT_LT(std::abs(output[i] - reference[i]), tolerance) << "i=" << i;
+    });
+  }
+
+  // Compute a crop of the output, with a non-zero min.
+  dense_array<float, 4> cropped({{1, co - 1}, {1, w - 1}, {2, h - 2}, n});
+  winograd_conv2d(input.cref(), transformed, bias.cref(), cropped.ref(), relu());
+  for_each_index(cropped.shape(), [&](const index_of_rank<4>& i) {
+    ASSERT_LT(std::abs(cropped[i] - reference[i]), tolerance) << "i=" << i;
+  });
+}
+
+TEST(conv2d_winograd) {
+  // Sizes that are and are not multiples of the tile size and batch size.
+  test_winograd_conv2d<2>(3, 8, 8, 6, 2, 1e-4f);
+  test_winograd_conv2d<2>(5, 13, 37, 5, 1, 1e-4f);
+  test_winograd_conv2d<4>(3, 8, 8, 8, 2, 1e-3f);
+  test_winograd_conv2d<4>(7, 50, 70, 7, 1, 1e-3f);
+}
+
+} // namespace nda
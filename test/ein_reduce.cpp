@@ -260,6 +260,123 @@ TEST(make_ein_sum_matrix_vector_integer) {
   }
 }
 
+TEST(ein_reduce_matrix_vector) {
+  // Use sizes that are not multiples of the blocks of the matrix-vector
+  // product kernels.
+  const index_t M = 37;
+  const index_t N = 53;
+  matrix<int> A({M, N});
+  matrix<int> AT({N, M});
+  vector<int> x({{0, N}});
+  vector<int> xt({{0, M}});
+  fill_pattern(A);
+  fill_pattern(x, 3);
+  fill_pattern(xt, 5);
+  for_all_indices(A.shape(), [&](index_t i, index_t j) { AT(j, i) = A(i, j); });
+
+  auto check_Ax = [&](const vector<int>& Ax) {
+    for (index_t i : Ax.i()) {
+      int Ax_i = 1;
+      for (index_t j : x.i()) {
+        Ax_i += A(i, j) * x(j);
+      }
+      ASSERT_EQ(Ax(i), Ax_i);
+    }
+  };
+  auto check_xtA = [&](const vector<int>& xtA) {
+    for (index_t j : xtA.i()) {
+      int xtA_j = 1;
+      for (index_t i : xt.i()) {
+        xtA_j += xt(i) * A(i, j);
+      }
+      ASSERT_EQ(xtA(j), xtA_j);
+    }
+  };
+
+  // Dense rows of A.
+  vector<int> Ax({{0, M}}, 1);
+  ein_reduce(ein<i>(Ax) += ein<i, j>(A) * ein<j>(x));
+  check_Ax(Ax);
+
+  vector<int> xA({{0, M}}, 1);
+  ein_reduce(ein<i>(xA) += ein<j>(x) * ein<i, j>(A));
+  check_Ax(xA);
+
+  // Dense columns of A.
+  vector<int> ATx({{0, M}}, 1);
+  ein_reduce(ein<i>(ATx) += ein<j, i>(AT) * ein<j>(x));
+  check_Ax(ATx);
+
+  vector<int> xtA({{0, N}}, 1);
+  ein_reduce(ein<j>(xtA) += ein<i>(xt) * ein<i, j>(A));
+  check_xtA(xtA);
+
+  vector<int> xtA_transposed({{0, N}}, 1);
+  ein_reduce(ein<j>(xtA_transposed) += ein<j, i>(transpose<1, 0>(A.ref())) * ein<i>(xt));
+  check_xtA(xtA_transposed);
+
+  // Neither dimension of A is dense.
+  dense_array<int, 3> A3({M, 2, N});
+  for_all_indices(A.shape(), [&](index_t i, index_t j) { A3(i, 0, j) = A(i, j); });
+  vector<int> A3x({{0, M}}, 1);
+  ein_reduce(ein<i>(A3x) += ein<i, j>(A3(_, 0, _)) * ein<j>(x));
+  check_Ax(A3x);
+}
+
+TEST(ein_reduce_matrix_vector_offset) {
+  // Compute part of a matrix-vector product, for operands with different
+  // bounds.
+  matrix<double> A({{-3, 20}, {5, 30}});
+  vector<double> x({{5, 30}});
+  vector<double> Ax({{0, 10}}, 0.0);
+  fill_pattern(A);
+  fill_pattern(x);
+
+  ein_reduce(ein<i>(Ax) += ein<i, j>(A) * ein<j>(x));
+  for (index_t i : Ax.i()) {
+    double Ax_i = 0;
+    for (index_t j : x.i()) {
+      Ax_i += A(i, j) * x(j);
+    }
+    ASSERT_EQ(Ax(i), Ax_i);
+  }
+
+  vector<double> y({{-3, 20}});
+  fill_pattern(y);
+  vector<double> ytA({{10, 8}}, 0.0);
+  ein_reduce(ein<j>(ytA) += ein<i>(y) * ein<i, j>(A));
+  for (index_t j : ytA.i()) {
+    double ytA_j = 0;
+    for (index_t i : y.i()) {
+      ytA_j += y(i) * A(i, j);
+    }
+    ASSERT_EQ(ytA(j), ytA_j);
+  }
+}
+
+TEST(ein_reduce_matrix_vector_alias) {
+  // y(i) += A(i, j) * y(j), where x is the result. This must be evaluated in
+  // the order of the loops, with j outermost, rather than by the kernels that
+  // read blocks of x before writing y. Unsigned integers wrap around on
+  // overflow.
+  const index_t N = 13;
+  matrix<unsigned> AT({N, N});
+  vector<unsigned> y({{0, N}});
+  fill_pattern(AT);
+  fill_pattern(y, 3);
+  vector<unsigned> y_ref(y);
+  for (index_t j = 0; j < N; j++) {
+    const unsigned y_j = y_ref(j);
+    for (index_t i = 0; i < N; i++) {
+      y_ref(i) += AT(j, i) * y_j;
+    }
+  }
+
+  // The columns of A are dense.
+  ein_reduce(ein<i>(y) += ein<j, i>(AT) * ein<j>(y));
+  ASSERT(equal(y.cref(), y_ref.cref()));
+}
+
 TEST(ein_sum_sum_3d) {
   array_of_rank<int, 3> T({4, 5, 8});
   fill_pattern(T);
@@ -352,6 +469,111 @@ TEST(ein_reduce_dft) {
   }
 }
 
+TEST(ein_reduce_hoist) {
+  constexpr index_t M = 10;
+  constexpr index_t N = 20;
+  constexpr index_t K = 30;
+  matrix<float, M, K> B;
+  fill_pattern(B);
+
+  // a(j, k) doesn't depend on i, the innermost loop, so it should only be
+  // evaluated once per (j, k).
+  index_t a_calls = 0;
+  auto a = [&](index_t j, index_t k) {
+    a_calls++;
+    return static_cast<float>(j * 3 - k);
+  };
+  matrix<float, M, N> C({}, 0.0f);
+  ein_reduce(ein<i, j>(C) += ein<j, k>(a) * ein<i, k>(B));
+  ASSERT_EQ(a_calls, N * K);
+  for (index_t i = 0; i < M; i++) {
+    for (index_t j = 0; j < N; j++) {
+      float C_ij = 0.0f;
+      for (index_t k = 0; k < K; k++) {
+        C_ij += (j * 3 - k) * B(i, k);
+      }
+      ASSERT_EQ(C(i, j), C_ij);
+    }
+  }
+
+  // Hoisting through unary and binary operations, and of operands that don't
+  // depend on any index.
+  a_calls = 0;
+  index_t scale_calls = 0;
+  auto scale = [&]() {
+    scale_calls++;
+    return 2;
+  };
+  matrix<int, M, N> D({}, 0);
+  ein_reduce(ein<i, j>(D) += cast<int>(-ein<j, k>(a)) * ein<>(std::move(scale)) +
+                             cast<int>(max(ein<j, k>(a), ein<i, k>(B))));
+  ASSERT_EQ(scale_calls, 1);
+  // The max depends on i, but its operand a(j, k) is still hoisted.
+  ASSERT_EQ(a_calls, N * K * 2);
+  for (index_t i = 0; i < M; i++) {
+    for (index_t j = 0; j < N; j++) {
+      int D_ij = 0;
+      for (index_t k = 0; k < K; k++) {
+        D_ij += -(j * 3 - k) * 2 + static_cast<int>(std::max<float>(j * 3 - k, B(i, k)));
+      }
+      ASSERT_EQ(D(i, j), D_ij);
+    }
+  }
+}
+
+TEST(ein_reduce_alias) {
+  constexpr index_t M = 20;
+  constexpr index_t N = 30;
+  matrix<int, M, N> A;
+  fill_pattern(A);
+  matrix<int, M, N> A_ref(A);
+
+  // Elementwise operations may use the result as an operand. Each element is
+  // read before it is written.
+  ein_reduce(ein<i, j>(A) *= ein<i, j>(A));
+  for (index_t i = 0; i < M; i++) {
+    for (index_t j = 0; j < N; j++) {
+      ASSERT_EQ(A(i, j), A_ref(i, j) * A_ref(i, j));
+    }
+  }
+
+  // Sum the other columns of A into its first column. A is row-major, so the
+  // range of addresses of the first column overlaps the other columns, and
+  // this uses the loops for operands that may alias the result.
+  copy(A_ref, A);
+  ein_reduce(ein<i>(A(_, 0)) += ein<i, j>(A(_, interval<>(1, N - 1))));
+  for (index_t i = 0; i < M; i++) {
+    int sum = A_ref(i, 0);
+    for (index_t j = 1; j < N; j++) {
+      sum += A_ref(i, j);
+    }
+    ASSERT_EQ(A(i, 0), sum);
+  }
+  // Sum the rows of A into a row of another matrix.
+  matrix<int, M, N> B({}, 0);
+  ein_reduce(ein<j>(B(0, _)) += ein<i, j>(A_ref));
+  for (index_t j = 0; j < N; j++) {
+    int sum = 0;
+    for (index_t i = 0; i < M; i++) {
+      sum += A_ref(i, j);
+    }
+    ASSERT_EQ(B(0, j), sum);
+  }
+
+  // Sum the other rows of A into its first row. The first row is disjoint
+  // from the range of the other rows, so this uses the loops for operands
+  // that don't alias the result.
+  copy(A_ref, A);
+  ein_reduce(ein<j>(A(0, _)) += ein<i, j>(A(interval<>(1, M - 1), _)));
+  for (index_t j = 0; j < N; j++) {
+    int sum = 0;
+    for (index_t i = 0; i < M; i++) {
+      sum += A_ref(i, j);
+    }
+    ASSERT_EQ(A(0, j), sum);
+  }
+}
+
 #if 0
 // TODO: https://github.com/dsharlet/array/issues/42
 TEST(ein_reduce_no_copy) {
@@ -0,0 +1,110 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "explain.h"
+#include "test.h"
+
+namespace nda {
+
+TEST(explain_dense) {
+  // A dense array is fused into one loop.
+  dense_array<float, 3> a({10, 20, 30});
+  loop_nest_explanation e = explain(a);
+  ASSERT_EQ(e.loops.size(), 1);
+  ASSERT_EQ(e.loops[0].dims.size(), 3);
+  ASSERT_EQ(e.loops[0].extent, 6000);
+  ASSERT_EQ(e.loops[0].stride_bytes[0], 4);
+  ASSERT_EQ(e.operands.size(), 1);
+  ASSERT_EQ(e.operands[0].elem_size, 4);
+  ASSERT_EQ(e.operands[0].static_strides_before, 1);
+  // The compile-time stride of the dense dimension is lost.
+  ASSERT_EQ(e.operands[0].static_strides_after, 0);
+  ASSERT_EQ(e.operands[0].cache_line_utilization, 1.0);
+
+  // Rank 1 shapes are not optimized, so compile-time strides survive.
+  dense_array<float, 1> b({{0, 8}});
+  loop_nest_explanation e_b = explain(b);
+  ASSERT_EQ(e_b.operands[0].static_strides_after, 1);
+  ASSERT_EQ(e_b.operands[0].cache_line_utilization, 0.5);
+}
+
+TEST(explain_reorder) {
+  // A transposed array is traversed in memory order, and the cropped inner
+  // dimension prevents fusing.
+  array_of_rank<int, 3> a({10, 20, 30});
+  auto a_tr = transpose<2, 0, 1>(a.ref());
+  auto cropped = a_tr(r(0, 30), r(0, 5), r(0, 20));
+  loop_nest_explanation e = explain(cropped);
+  ASSERT_EQ(e.loops.size(), 2);
+  ASSERT_EQ(e.loops[0].dims.size(), 1);
+  ASSERT_EQ(e.loops[0].dims[0], 1);
+  ASSERT_EQ(e.loops[0].extent, 5);
+  ASSERT_EQ(e.loops[0].stride_bytes[0], 4);
+  ASSERT_EQ(e.loops[1].dims.size(), 2);
+  ASSERT_EQ(e.loops[1].dims[0], 2);
+  ASSERT_EQ(e.loops[1].dims[1], 0);
+  ASSERT_EQ(e.loops[1].extent, 600);
+  ASSERT_EQ(e.loops[1].stride_bytes[0], 40);
+  ASSERT_LT(e.operands[0].cache_line_utilization, 0.5);
+
+  std::string s = e.to_string();
+  ASSERT(s.find("loop dims {2, 0} extent 600") != std::string::npos);
+  ASSERT(s.find("  loop dims {1} extent 5") != std::string::npos);
+}
+
+TEST(explain_copy) {
+  dense_array<int, 2> src({30, 40});
+  dense_array<int, 2> dst({30, 40});
+  loop_nest_explanation e = explain_copy(src, dst);
+  ASSERT_EQ(e.operands.size(), 2);
+  ASSERT_EQ(e.loops.size(), 1);
+  ASSERT_EQ(e.loops[0].extent, 1200);
+
+  // Copying to a transposed destination can't be fused, and reads the source
+  // with a large stride.
+  auto dst_tr = transpose<1, 0>(dst.ref());
+  array_of_rank<int, 2> src_tr({40, 30});
+  e = explain_copy(src_tr.cref(), dst_tr);
+  ASSERT_EQ(e.loops.size(), 2);
+  ASSERT_EQ(e.loops[0].dims[0], 1);
+  ASSERT_EQ(e.loops[0].stride_bytes[0], 40 * 4);
+  ASSERT_EQ(e.loops[0].stride_bytes[1], 4);
+  ASSERT_EQ(e.operands[0].cache_line_utilization, 4.0 / 64);
+  // The 120 byte rows of dst use 2 cache lines.
+  ASSERT_EQ(e.operands[1].cache_line_utilization, 120.0 / 128);
+}
+
+TEST(explain_ein_reduce) {
+  enum { i = 0, j = 1, k = 2 };
+  dense_array<float, 2> a({10, 20});
+  dense_array<float, 2> b({20, 30});
+  dense_array<float, 2> ab({10, 30});
+  loop_nest_explanation e = explain_ein_reduce(ein<i, j>(ab) += ein<i, k>(a) * ein<k, j>(b));
+  ASSERT_EQ(e.operands.size(), 3);
+  ASSERT_EQ(e.loops.size(), 3);
+  ASSERT_EQ(e.loops[0].extent, 10);
+  ASSERT_EQ(e.loops[1].extent, 30);
+  ASSERT_EQ(e.loops[2].extent, 20);
+  // Loop i is the inner dimension of ab and a, and is not used by b.
+  ASSERT_EQ(e.loops[0].stride_bytes[0], 4);
+  ASSERT_EQ(e.loops[0].stride_bytes[1], 4);
+  ASSERT_EQ(e.loops[0].stride_bytes[2], 0);
+  // The reduction loop k.
+  ASSERT_EQ(e.loops[2].stride_bytes[0], 0);
+  ASSERT_EQ(e.loops[2].stride_bytes[1], 40);
+  ASSERT_EQ(e.loops[2].stride_bytes[2], 4);
+  ASSERT_EQ(e.operands[0].static_strides_before, 1);
+}
+
+} // namespace nda
@@ -0,0 +1,183 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gemm.h"
+#include "ein_reduce.h"
+#include "matrix.h"
+#include "test.h"
+
+#include <random>
+
+namespace nda {
+
+namespace {
+
+enum { i = 0, j = 1, k = 2 };
+
+template <class T, class Shape>
+void fill_random(const array_ref<T, Shape>& a, int min, int max, std::mt19937& rng) {
+  std::uniform_int_distribution<int> dist(min, max);
+  generate(a, [&]() { return static_cast<T>(dist(rng)); });
+}
+
+// Compute c += a * b with the products accumulated in TC, for reference.
+template <class TA, class ShapeA, class TB, class ShapeB, class TC, class ShapeC>
+void multiply_ref(const array_ref<TA, ShapeA>& a, const array_ref<TB, ShapeB>& b,
+    const array_ref<TC, ShapeC>& c) {
+  for (index_t y : c.i()) {
+    for (index_t x : c.j()) {
+      for (index_t z : a.j()) {
+        c(y, x) += static_cast<TC>(a(y, z)) * static_cast<TC>(b(z, x));
+      }
+    }
+  }
+}
+
+} // namespace
+
+TEST(gemm_float) {
+  std::mt19937 rng;
+  // Use sizes that are not multiples of the register tiles or blocks.
+  const index_t M = 103;
+  const index_t K = 301;
+  const index_t N = 71;
+  matrix<float> a({M, K});
+  matrix<float> b({K, N});
+  fill_random(a.ref(), -10, 10, rng);
+  fill_random(b.ref(), -10, 10, rng);
+
+  matrix<float> c({M, N}, 1.0f);
+  matrix<float> c_ref({M, N}, 1.0f);
+  gemm(a, b, c);
+  multiply_ref(a.ref(), b.ref(), c_ref.ref());
+  // The elements are small integers, so the products are exact.
+  ASSERT(c == c_ref);
+
+  // The operands can have any strides.
+  matrix<float> c_t({N, M}, 1.0f);
+  gemm(transpose<1, 0>(b.cref()), transpose<1, 0>(a.cref()), c_t.ref());
+  for_all_indices(c.shape(), [&](index_t y, index_t x) { ASSERT_EQ(c_t(x, y), c(y, x)); });
+}
+
+TEST(gemm_int8) {
+  std::mt19937 rng;
+  const index_t M = 67;
+  const index_t K = 519;
+  const index_t N = 45;
+  matrix<int8_t> a({M, K});
+  matrix<int8_t> b({K, N});
+  matrix<uint8_t> b_u8({K, N});
+  fill_random(a.ref(), -128, 127, rng);
+  fill_random(b.ref(), -128, 127, rng);
+  fill_random(b_u8.ref(), 0, 255, rng);
+
+  // Compare the 8-bit integer products with the float reference path, which
+  // is exact for these sizes.
+  matrix<int32_t> c({M, N}, 3);
+  matrix<float> c_ref({M, N}, 3.0f);
+  gemm(a, b, c);
+  gemm(a, b, c_ref);
+  for_all_indices(c.shape(), [&](index_t y, index_t x) {
+    ASSERT_EQ(c(y, x), static_cast<int32_t>(c_ref(y, x)));
+  });
+
+  matrix<int32_t> c_u8({M, N}, 0);
+  matrix<int32_t> c_u8_ref({M, N}, 0);
+  gemm(a, b_u8, c_u8);
+  multiply_ref(a.ref(), b_u8.ref(), c_u8_ref.ref());
+  ASSERT(c_u8 == c_u8_ref);
+}
+
+TEST(gemm_offset) {
+  // Compute part of a product of operands with different bounds.
+  std::mt19937 rng;
+  matrix<double> a({{-5, 60}, {10, 50}});
+  matrix<double> b({{10, 50}, {3, 80}});
+  fill_random(a.ref(), -3, 3, rng);
+  fill_random(b.ref(), -3, 3, rng);
+
+  matrix<double> c({{0, 40}, {20, 50}}, 0.0);
+  matrix<double> c_ref({{0, 40}, {20, 50}}, 0.0);
+  gemm(a, b, c);
+  multiply_ref(a(c.i(), _), b(_, c.j()), c_ref.ref());
+  ASSERT(c == c_ref);
+}
+
+TEST(ein_reduce_gemm) {
+  std::mt19937 rng;
+  const index_t M = 40;
+  const index_t K = 77;
+  const index_t N = 50;
+  matrix<int8_t> a({M, K});
+  matrix<int8_t> b({K, N});
+  matrix<int8_t> b_t({N, K});
+  fill_random(a.ref(), -128, 127, rng);
+  fill_random(b.ref(), -128, 127, rng);
+  for_all_indices(b.shape(), [&](index_t z, index_t x) { b_t(x, z) = b(z, x); });
+
+  matrix<int> c_ref({M, N}, 0);
+  multiply_ref(a.ref(), b.ref(), c_ref.ref());
+
+  matrix<int> c({M, N}, 0);
+  ein_reduce(ein<i, j>(c) += cast<int>(ein<i, k>(a)) * cast<int>(ein<k, j>(b)));
+  ASSERT(c == c_ref);
+
+  // The operands of the product can be in either order, and the dimensions
+  // of the operands can be in any order.
+  matrix<int> c_ba({M, N}, 0);
+  ein_reduce(ein<i, j>(c_ba) += cast<int>(ein<k, j>(b)) * cast<int>(ein<i, k>(a)));
+  ASSERT(c_ba == c_ref);
+
+  matrix<int> c_bt({M, N}, 0);
+  ein_reduce(ein<i, j>(c_bt) += cast<int>(ein<i, k>(a)) * cast<int>(ein<j, k>(b_t)));
+  ASSERT(c_bt == c_ref);
+
+  matrix<int> c_t({N, M}, 0);
+  ein_reduce(ein<j, i>(c_t) += cast<int>(ein<i, k>(a)) * cast<int>(ein<k, j>(b)));
+  for_all_indices(c.shape(), [&](index_t y, index_t x) { ASSERT_EQ(c_t(x, y), c_ref(y, x)); });
+
+  // Products of the same type do not need a cast.
+  matrix<int> a_int({M, K});
+  matrix<int> b_int({K, N});
+  for_all_indices(a.shape(), [&](index_t y, index_t z) { a_int(y, z) = a(y, z); });
+  for_all_indices(b.shape(), [&](index_t z, index_t x) { b_int(z, x) = b(z, x); });
+  matrix<int> c_int({M, N}, 0);
+  ein_reduce(ein<i, j>(c_int) += ein<i, k>(a_int) * ein<k, j>(b_int));
+  ASSERT(c_int == c_ref);
+}
+
+TEST(ein_reduce_gemm_alias) {
+  // C(i, j) += C(i, k) * B(k, j), where the result is an operand. This must be
+  // evaluated in the order of the loops, with k outermost and i innermost,
+  // rather than by gemm. Unsigned integers wrap around on overflow.
+  std::mt19937 rng;
+  const index_t N = 40;
+  matrix<unsigned> c({N, N});
+  matrix<unsigned> b({N, N});
+  fill_random(c.ref(), 0, 5, rng);
+  fill_random(b.ref(), 0, 5, rng);
+  matrix<unsigned> c_ref(c);
+  for (index_t z = 0; z < N; z++) {
+    for (index_t x = 0; x < N; x++) {
+      for (index_t y = 0; y < N; y++) {
+        c_ref(y, x) += c_ref(y, z) * b(z, x);
+      }
+    }
+  }
+
+  ein_reduce(ein<i, j>(c) += ein<i, k>(c) * ein<k, j>(b));
+  ASSERT(c == c_ref);
+}
+
+} // namespace nda
@@ -0,0 +1,184 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "half.h"
+#include "ein_reduce.h"
+#include "matrix.h"
+#include "test.h"
+
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace nda {
+
+namespace {
+
+enum { i = 0, j = 1, k = 2 };
+
+bool is_nan_half(uint16_t h) { return (h & 0x7c00) == 0x7c00 && (h & 0x3ff) != 0; }
+
+template <class T, class Shape>
+void fill_random(const array_ref<T, Shape>& a, std::mt19937& rng) {
+  std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+  generate(a, [&]() { return static_cast<T>(dist(rng)); });
+}
+
+} // namespace
+
+TEST(half_conversions) {
+  ASSERT_EQ(half(0.0f).bits(), 0x0000);
+  ASSERT_EQ(half(1.0f).bits(), 0x3c00);
+  ASSERT_EQ(half(-2.0f).bits(), 0xc000);
+  ASSERT_EQ(half(65504.0f).bits(), 0x7bff);
+  ASSERT_EQ(half(std::ldexp(1.0f, -24)).bits(), 0x0001);
+  ASSERT_EQ(static_cast<float>(half::from_bits(0x0001)), std::ldexp(1.0f, -24));
+  // Ties round to even.
+  ASSERT_EQ(half(1.0f + std::ldexp(1.0f, -11)).bits(), 0x3c00);
+  ASSERT_EQ(half(1.0f + 3 * std::ldexp(1.0f, -11)).bits(), 0x3c02);
+  // Values that round to more than the largest half are infinity.
+  ASSERT_EQ(half(65520.0f).bits(), 0x7c00);
+  ASSERT_EQ(half(-std::numeric_limits<float>::infinity()).bits(), 0xfc00);
+
+  ASSERT_EQ(bfloat16(1.0f).bits(), 0x3f80);
+  ASSERT_EQ(bfloat16(-3.0f).bits(), 0xc040);
+  ASSERT_EQ(static_cast<float>(bfloat16::from_bits(0x4049)), 3.140625f);
+  ASSERT_EQ(bfloat16(1.0f + std::ldexp(1.0f, -8)).bits(), 0x3f80);
+  ASSERT_EQ(bfloat16(1.0f + 3 * std::ldexp(1.0f, -8)).bits(), 0x3f82);
+
+  // Arithmetic is done in float.
+  half h = 1.5f;
+  h += 2.0f;
+  h *= h;
+  ASSERT_EQ(static_cast<float>(h), 12.25f);
+  ASSERT_EQ(h + h, 24.5f);
+  bfloat16 b = 3.0f;
+  b -= 0.5f;
+  ASSERT_EQ(static_cast<float>(b), 2.5f);
+}
+
+TEST(half_portable_conversions) {
+  // Every half converts to float and back exactly, with the portable
+  // conversions or the conversion instructions.
+  for (uint32_t bits = 0; bits < 0x10000; bits++) {
+    uint16_t h = static_cast<uint16_t>(bits);
+    float x = internal::half_bits_to_float_portable(h);
+    if (is_nan_half(h)) {
+      ASSERT(is_nan_half(internal::float_to_half_bits_portable(x)));
+      continue;
+    }
+    ASSERT_EQ(internal::float_to_bits(x), internal::float_to_bits(half::from_bits(h)));
+    ASSERT_EQ(internal::float_to_half_bits_portable(x), h);
+  }
+
+  // Random floats in the range of half, including the subnormals, round the
+  // same way.
+  std::mt19937 rng;
+  std::uniform_int_distribution<int> exponent(-30, 17);
+  std::uniform_real_distribution<float> mantissa(-2.0f, 2.0f);
+  for (int n = 0; n < 100000; n++) {
+    float x = std::ldexp(mantissa(rng), exponent(rng));
+    ASSERT_EQ(internal::float_to_half_bits_portable(x), half(x).bits());
+  }
+}
+
+TEST(half_copy) {
+  std::mt19937 rng;
+  // Use an extent that is not a multiple of the vector size, so the bulk
+  // conversions have a remainder.
+  dense_array<float, 2> x({37, 5});
+  fill_random(x.ref(), rng);
+
+  dense_array<half, 2> h(x.shape());
+  copy(x, h);
+  for_all_indices(x.shape(), [&](index_t a, index_t b) {
+    ASSERT_EQ(h(a, b).bits(), half(x(a, b)).bits());
+  });
+  dense_array<float, 2> x_h(x.shape());
+  copy(h, x_h);
+  for_all_indices(x.shape(), [&](index_t a, index_t b) {
+    ASSERT_EQ(x_h(a, b), static_cast<float>(h(a, b)));
+    ASSERT(std::abs(x_h(a, b) - x(a, b)) <= std::abs(x(a, b)) * std::ldexp(1.0f, -11));
+  });
+
+  dense_array<bfloat16, 2> bf(x.shape());
+  copy(x, bf);
+  for_all_indices(x.shape(), [&](index_t a, index_t b) {
+    ASSERT_EQ(bf(a, b).bits(), bfloat16(x(a, b)).bits());
+  });
+  dense_array<float, 2> x_bf(x.shape());
+  copy(bf, x_bf, store_policy::non_temporal);
+  for_all_indices(x.shape(), [&](index_t a, index_t b) {
+    ASSERT_EQ(x_bf(a, b), static_cast<float>(bf(a, b)));
+    ASSERT(std::abs(x_bf(a, b) - x(a, b)) <= std::abs(x(a, b)) * std::ldexp(1.0f, -8));
+  });
+
+  // Copies of arrays that are not dense convert one value at a time.
+  dense_array<half, 2> h_t({5, 37});
+  copy(transpose<1, 0>(x.cref()), h_t.ref());
+  for_all_indices(x.shape(), [&](index_t a, index_t b) {
+    ASSERT_EQ(h_t(b, a).bits(), h(a, b).bits());
+  });
+}
+
+TEST(half_ein_reduce) {
+  std::mt19937 rng;
+  const index_t M = 40;
+  const index_t K = 50;
+  const index_t N = 60;
+  matrix<half> a({M, K});
+  matrix<half> b({K, N});
+  vector<bfloat16> x({{0, K}});
+  fill_random(a.ref(), rng);
+  fill_random(b.ref(), rng);
+  fill_random(x.ref(), rng);
+
+  // Products of 16-bit floats accumulate in float.
+  vector<float> y({{0, M}}, 0.0f);
+  ein_reduce(ein<i>(y) += ein<i, j>(a) * ein<j>(x));
+  for (index_t y_i : y.x()) {
+    float y_ref = 0.0f;
+    for (index_t z : x.x()) {
+      y_ref += static_cast<float>(a(y_i, z)) * static_cast<float>(x(z));
+    }
+    ASSERT(std::abs(y(y_i) - y_ref) < 1e-3f * std::abs(y_ref) + 1e-3f);
+  }
+
+  // Matrix products with a cast to float are computed by gemm, which converts
+  // the operands to float when packing them.
+  matrix<float> c({M, N}, 0.0f);
+  ein_reduce(ein<i, j>(c) += cast<float>(ein<i, k>(a)) * cast<float>(ein<k, j>(b)));
+  for_all_indices(c.shape(), [&](index_t y_i, index_t x_j) {
+    float c_ref = 0.0f;
+    for (index_t z : a.j()) {
+      c_ref += static_cast<float>(a(y_i, z)) * static_cast<float>(b(z, x_j));
+    }
+    ASSERT(std::abs(c(y_i, x_j) - c_ref) < 1e-3f * std::abs(c_ref) + 1e-1f);
+  });
+
+  // Reductions can also accumulate in 16-bit floats.
+  vector<half> sums({{0, M}}, half(0.0f));
+  ein_reduce(ein<i>(sums) += ein<i, j>(a));
+  for (index_t y_i : sums.x()) {
+    float sum_ref = 0.0f;
+    float sum_abs = 0.0f;
+    for (index_t z : a.j()) {
+      sum_ref += a(y_i, z);
+      sum_abs += std::abs(a(y_i, z));
+    }
+    ASSERT(std::abs(sums(y_i) - sum_ref) <= K * std::ldexp(1.0f, -11) * sum_abs);
+  }
+}
+
+} // namespace nda
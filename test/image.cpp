@@ -54,6 +54,8 @@ void test_crop() {
 TEST(image_crop) {
   test_crop<planar_image_shape>();
   test_crop<chunky_image_shape<3>>();
+  test_crop<tiled_image_shape<8, 8>>();
+  test_crop<tiled_image_shape<16, 4, 3>>();
 }
 
 template <typename Shape>
@@ -176,6 +178,43 @@ TEST(image_chunky_padded) {
   }
 }
 
+TEST(image_tiled_copy) {
+  test_copy_all_types<tiled_image_shape<8, 8>, chunky_image_shape<3>>(3);
+  test_copy_all_types<chunky_image_shape<3>, tiled_image_shape<8, 8, 3>>(3);
+  test_copy_all_types<tiled_image_shape<16, 4>, planar_image_shape>(2);
+  test_copy_all_types<planar_image_shape, tiled_image_shape<16, 4>>(2);
+  test_copy_all_types<tiled_image_shape<8, 8, 3>, tiled_image_shape<8, 8, 3>>(3);
+  test_copy_all_types<tiled_image_shape<16, 4>, tiled_image_shape<8, 8>>(4);
+}
+
+TEST(image_tiled_layout) {
+  tiled_image<int, 4, 2, 1> im({10, 5, {}});
+  // 3 x 3 tiles of 4 x 2 pixels.
+  ASSERT_EQ(im.shape().flat_extent(), 3 * 3 * 4 * 2);
+  ASSERT_EQ(im.shape()(3, 1, 0), 7);
+  ASSERT_EQ(im.shape()(4, 0, 0), 8);
+  ASSERT_EQ(im.shape()(0, 2, 0), 3 * 8);
+  ASSERT_EQ(im.shape()(9, 4, 0), 8 * 8 + 1);
+
+  // Iterating the values of a tiled image should be in memory order.
+  index_t next = 0;
+  im.for_each_value([&](int& i) { i = next++; });
+  index_t expected = 0;
+  im.shape().for_each_tile([&](const auto& tile, index_t offset) {
+    for_each_image_index(tile, [&](const std::tuple<index_t, index_t, index_t>& i) {
+      ASSERT_EQ(im.base()[offset + tile[i]], expected);
+      expected++;
+    });
+  });
+  ASSERT_EQ(expected, static_cast<index_t>(im.size()));
+
+  // Cropping a tiled image does not move the tiles.
+  auto cropped = crop(im, 3, 1, 7, 4, crop_origin::zero);
+  ASSERT_EQ(cropped.base(), im.base());
+  ASSERT_EQ(&cropped(0, 0, 0), &im(3, 1, 0));
+  ASSERT_EQ(&cropped(3, 2, 0), &im(6, 3, 0));
+}
+
 void general_chunky(const chunky_image_ref<const int>&) {}
 
 void overload_shape(const planar_image_ref<const int>&) {}
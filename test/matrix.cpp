@@ -15,6 +15,9 @@
 #include "matrix.h"
 #include "test.h"
 
+#include <random>
+#include <vector>
+
 namespace nda {
 
 TEST(matrix_slice) {
@@ -60,4 +63,288 @@ TEST(small_matrix) {
   for_all_indices(move_assign.shape(), [&](int x, int y) { ASSERT_EQ(move_assign(x, y), x); });
 }
 
+template <index_t Rows, index_t Cols>
+small_matrix<double, Rows, Cols> batch_element(
+    const batched_matrix<float, Rows, Cols>& a, index_t b) {
+  small_matrix<double, Rows, Cols> result;
+  for_all_indices(result.shape(), [&](index_t i, index_t j) { result(i, j) = a(i, j, b); });
+  return result;
+}
+
+template <index_t N>
+void test_batched_inverse(index_t batch) {
+  std::mt19937 rng;
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  batched_matrix<float, N, N> a(make_batched_matrix_shape<N, N>(batch));
+  // Make diagonally dominant matrices, which are well conditioned.
+  for_all_indices(a.shape(), [&](index_t i, index_t j, index_t b) {
+    a(i, j, b) = uniform(rng) + (i == j ? N + 1 : 0);
+  });
+
+  batched_matrix<float, N, N> inv(a.shape());
+  batched_inverse(a, inv);
+  batched_matrix<float, N, N> identity(a.shape());
+  batched_multiply(a, inv, identity);
+  for_all_indices(identity.shape(), [&](index_t i, index_t j, index_t b) {
+    ASSERT_LT(std::abs(identity(i, j, b) - (i == j ? 1.0f : 0.0f)), 1e-5f);
+  });
+
+  // The determinant of a product is the product of the determinants.
+  batched_matrix<float, N, N> a2(a.shape());
+  batched_multiply(a, a, a2);
+  dense_array<float, 1> det({{0, batch}});
+  dense_array<float, 1> det2({{0, batch}});
+  batched_determinant(a, det);
+  batched_determinant(a2, det2);
+  for (index_t b = 0; b < batch; b++) {
+    ASSERT_LT(std::abs(det2(b) - det(b) * det(b)), 1e-4f * std::abs(det2(b)));
+  }
+}
+
+TEST(batched_matrix_inverse) {
+  test_batched_inverse<1>(5);
+  test_batched_inverse<2>(37);
+  test_batched_inverse<3>(100);
+  test_batched_inverse<4>(16);
+  test_batched_inverse<4>(50);
+}
+
+TEST(batched_matrix_determinant) {
+  batched_matrix<float, 3, 3> a(make_batched_matrix_shape<3, 3>(3), 0.0f);
+  for (index_t i = 0; i < 3; i++) {
+    a(i, i, 0) = i + 1;
+    a(i, 2 - i, 1) = 1;
+    a(i, 0, 2) = 1;
+  }
+  dense_array<float, 1> det({{0, 3}});
+  batched_determinant(a, det);
+  ASSERT_EQ(det(0), 6);
+  ASSERT_EQ(det(1), -1);
+  ASSERT_EQ(det(2), 0);
+}
+
+TEST(batched_matrix_multiply) {
+  std::mt19937 rng;
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  const index_t batch = 21;
+  batched_matrix<float, 2, 3> a(make_batched_matrix_shape<2, 3>(batch));
+  batched_matrix<float, 3, 4> b(make_batched_matrix_shape<3, 4>(batch));
+  generate(a, [&]() { return uniform(rng); });
+  generate(b, [&]() { return uniform(rng); });
+
+  // Compute a crop of the batch, with a non-zero min.
+  batched_matrix<float, 2, 4> c({{}, {}, {3, 15}});
+  batched_multiply(a, b, c);
+  for (index_t n = 3; n < 18; n++) {
+    auto a_n = batch_element(a, n);
+    auto b_n = batch_element(b, n);
+    for_all_indices(c(_, _, n).shape(), [&](index_t i, index_t j) {
+      double c_ij = 0;
+      for (index_t k = 0; k < 3; k++) {
+        c_ij += a_n(i, k) * b_n(k, j);
+      }
+      ASSERT_LT(std::abs(c(i, j, n) - c_ij), 1e-5);
+    });
+  }
+}
+
+TEST(batched_matrix_transform) {
+  const index_t batch = 19;
+  batched_matrix<float, 3, 4> m(make_batched_matrix_shape<3, 4>(batch));
+  batched_vector<float, 3> x(make_batched_vector_shape<3>(batch));
+  batched_vector<float, 4> x_h(make_batched_vector_shape<4>(batch));
+  for_all_indices(m.shape(), [&](index_t i, index_t j, index_t b) { m(i, j, b) = i * 4 + j + b; });
+  for_all_indices(x.shape(), [&](index_t i, index_t b) {
+    x(i, b) = i - b;
+    x_h(i, b) = i - b;
+    x_h(3, b) = 1;
+  });
+
+  // Transforming a point with an implicit homogeneous coordinate should be
+  // the same as transforming the homogeneous point.
+  batched_vector<float, 3> y(make_batched_vector_shape<3>(batch));
+  batched_vector<float, 3> y_h(make_batched_vector_shape<3>(batch));
+  batched_transform(m, x, y);
+  batched_transform(m, x_h, y_h);
+  for_all_indices(y.shape(), [&](index_t i, index_t b) {
+    float y_ib = m(i, 3, b);
+    for (index_t j = 0; j < 3; j++) {
+      y_ib += m(i, j, b) * x(j, b);
+    }
+    ASSERT_EQ(y(i, b), y_ib);
+    ASSERT_EQ(y_h(i, b), y_ib);
+  });
+}
+
+// Naive unblocked LU factorization with partial pivoting, for reference.
+void naive_lu_factor(matrix<double>& a, std::vector<index_t>& pivots) {
+  const index_t k_end = std::min(a.rows(), a.columns());
+  for (index_t k = 0; k < k_end; k++) {
+    index_t pivot = k;
+    for (index_t i = k + 1; i < a.rows(); i++) {
+      if (std::abs(a(i, k)) > std::abs(a(pivot, k))) pivot = i;
+    }
+    pivots.push_back(pivot);
+    for (index_t j = 0; j < a.columns(); j++) {
+      std::swap(a(k, j), a(pivot, j));
+    }
+    for (index_t i = k + 1; i < a.rows(); i++) {
+      a(i, k) /= a(k, k);
+      for (index_t j = k + 1; j < a.columns(); j++) {
+        a(i, j) -= a(i, k) * a(k, j);
+      }
+    }
+  }
+}
+
+// Naive unblocked Cholesky factorization, for reference.
+void naive_cholesky_factor(matrix<double>& a) {
+  for (index_t j = 0; j < a.columns(); j++) {
+    for (index_t i = j; i < a.rows(); i++) {
+      double sum = a(i, j);
+      for (index_t k = 0; k < j; k++) {
+        sum -= a(i, k) * a(j, k);
+      }
+      a(i, j) = i == j ? std::sqrt(sum) : sum / a(j, j);
+    }
+  }
+}
+
+matrix<double> random_matrix(index_t rows, index_t cols, std::mt19937& rng) {
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  matrix<double> a({rows, cols});
+  generate(a, [&]() { return uniform(rng); });
+  return a;
+}
+
+// Make a random symmetric positive definite matrix.
+matrix<double> random_spd_matrix(index_t n, std::mt19937& rng) {
+  matrix<double> b = random_matrix(n, n, rng);
+  matrix<double> a({n, n});
+  for_all_indices(a.shape(), [&](index_t i, index_t j) {
+    a(i, j) = i == j ? n : 0;
+    for (index_t k = 0; k < n; k++) {
+      a(i, j) += b(i, k) * b(j, k);
+    }
+  });
+  return a;
+}
+
+// Compute the residual max |a * x - b|.
+double residual(const matrix<double>& a, const matrix<double>& x, const matrix<double>& b) {
+  double result = 0;
+  for_all_indices(b.shape(), [&](index_t i, index_t j) {
+    double ax_ij = 0;
+    for (index_t k = 0; k < a.columns(); k++) {
+      ax_ij += a(i, k) * x(k, j);
+    }
+    result = std::max(result, std::abs(ax_ij - b(i, j)));
+  });
+  return result;
+}
+
+TEST(matrix_lu_factor) {
+  std::mt19937 rng;
+  const index_t sizes[][2] = {{1, 1}, {7, 7}, {150, 150}, {130, 45}, {45, 130}, {200, 200}};
+  for (auto size : sizes) {
+    const index_t m = size[0];
+    const index_t n = size[1];
+    matrix<double> a = random_matrix(m, n, rng);
+
+    matrix<double> lu_ref = a;
+    std::vector<index_t> pivots_ref;
+    naive_lu_factor(lu_ref, pivots_ref);
+
+    for (index_t block_size : {1, 16, 64}) {
+      matrix<double> lu = a;
+      vector<index_t> pivots({{0, std::min(m, n)}});
+      ASSERT(lu_factor(lu, pivots, block_size));
+      for (index_t k = 0; k < std::min(m, n); k++) {
+        ASSERT_EQ(pivots(k), pivots_ref[k]);
+      }
+      for_all_indices(lu.shape(), [&](index_t i, index_t j) {
+        ASSERT_LT(std::abs(lu(i, j) - lu_ref(i, j)), 1e-9);
+      });
+    }
+  }
+}
+
+TEST(matrix_lu_factor_cropped) {
+  // Factor a matrix that does not have a min of 0, and is not dense.
+  std::mt19937 rng;
+  matrix<double> a = random_matrix(100, 120, rng);
+  matrix<double> lu_ref({80, 80});
+  for_all_indices(lu_ref.shape(), [&](index_t i, index_t j) { lu_ref(i, j) = a(i + 10, j + 30); });
+  std::vector<index_t> pivots_ref;
+  naive_lu_factor(lu_ref, pivots_ref);
+
+  vector<index_t> pivots({{5, 80}});
+  ASSERT(lu_factor(a(r(10, 90), r(30, 110)), pivots.ref(), 32));
+  for (index_t k = 0; k < 80; k++) {
+    ASSERT_EQ(pivots(k + 5), pivots_ref[k]);
+  }
+  for_all_indices(lu_ref.shape(), [&](index_t i, index_t j) {
+    ASSERT_LT(std::abs(a(i + 10, j + 30) - lu_ref(i, j)), 1e-9);
+  });
+}
+
+TEST(matrix_lu_solve) {
+  std::mt19937 rng;
+  const index_t n = 173;
+  matrix<double> a = random_matrix(n, n, rng);
+  matrix<double> b = random_matrix(n, 3, rng);
+
+  matrix<double> lu = a;
+  vector<index_t> pivots({{0, n}});
+  ASSERT(lu_factor(lu, pivots, 48));
+  matrix<double> x = b;
+  lu_solve(lu, pivots, x);
+  ASSERT_LT(residual(a, x, b), 1e-9);
+
+  // A singular matrix should be reported.
+  for (index_t i = 0; i < n; i++) {
+    a(i, 5) = 0;
+  }
+  ASSERT(!lu_factor(a, pivots));
+}
+
+TEST(matrix_cholesky_factor) {
+  std::mt19937 rng;
+  for (index_t n : {1, 9, 100, 161}) {
+    matrix<double> a = random_spd_matrix(n, rng);
+    matrix<double> l_ref = a;
+    naive_cholesky_factor(l_ref);
+
+    for (index_t block_size : {1, 16, 64}) {
+      matrix<double> l = a;
+      ASSERT(cholesky_factor(l, block_size));
+      for_all_indices(l.shape(), [&](index_t i, index_t j) {
+        if (j <= i) {
+          ASSERT_LT(std::abs(l(i, j) - l_ref(i, j)), 1e-9);
+        } else {
+          // The upper triangle should not be modified.
+          ASSERT_EQ(l(i, j), a(i, j));
+        }
+      });
+    }
+  }
+}
+
+TEST(matrix_cholesky_solve) {
+  std::mt19937 rng;
+  const index_t n = 150;
+  matrix<double> a = random_spd_matrix(n, rng);
+  matrix<double> b = random_matrix(n, 4, rng);
+
+  matrix<double> l = a;
+  ASSERT(cholesky_factor(l, 32));
+  matrix<double> x = b;
+  cholesky_solve(l, x);
+  ASSERT_LT(residual(a, x, b), 1e-9);
+
+  // A matrix that is not positive definite should be reported.
+  a(70, 70) = -1e6;
+  ASSERT(!cholesky_factor(a));
+}
+
 } // namespace nda
@@ -0,0 +1,113 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "morton.h"
+#include "test.h"
+
+#include <vector>
+
+namespace nda {
+
+TEST(morton_shape_2d) {
+  // Use small blocks so the shape has partial blocks in both dimensions.
+  morton_shape<2, 2> s({{3, 10}, {-2, 7}});
+  ASSERT_EQ(s.flat_extent(), 3 * 2 * 16);
+  ASSERT(!s.is_compact());
+
+  // Within a block, the offsets are the bits of the indices interleaved.
+  ASSERT_EQ(s(3, -2), 0);
+  ASSERT_EQ(s(4, -2), 1);
+  ASSERT_EQ(s(3, -1), 2);
+  ASSERT_EQ(s(4, -1), 3);
+  ASSERT_EQ(s(5, -2), 4);
+  ASSERT_EQ(s(6, 1), 15);
+  // The next block in dim 0.
+  ASSERT_EQ(s(7, -2), 16);
+  // The next block in dim 1.
+  ASSERT_EQ(s(3, 2), 3 * 16);
+
+  // The mapping is one-to-one.
+  std::vector<int> used(s.flat_extent(), 0);
+  for_all_indices(s, [&](index_t i, index_t j) { used[s(i, j)]++; });
+  index_t total = 0;
+  for (int u : used) {
+    ASSERT(u == 0 || u == 1);
+    total += u;
+  }
+  ASSERT_EQ(total, static_cast<index_t>(s.size()));
+}
+
+TEST(morton_shape_3d) {
+  morton_shape<3, 3> s({{0, 20}, {5, 9}, {-1, 17}});
+  std::vector<int> used(s.flat_extent(), 0);
+  for_all_indices(s, [&](index_t i, index_t j, index_t k) { used[s(i, j, k)]++; });
+  for (int u : used) {
+    ASSERT(u == 0 || u == 1);
+  }
+  ASSERT_EQ(s(1, 5, -1), 1);
+  ASSERT_EQ(s(0, 6, -1), 2);
+  ASSERT_EQ(s(0, 5, 0), 4);
+  ASSERT_EQ(s(7, 12, 6), 511);
+}
+
+TEST(morton_iteration_order) {
+  morton_shape<2, 2> s({6, 5});
+  // The indices should be visited in memory order.
+  index_t prev = -1;
+  index_t count = 0;
+  for_each_index(s, [&](const std::tuple<index_t, index_t>& i) {
+    ASSERT_LT(prev, s[i]);
+    prev = s[i];
+    count++;
+  });
+  ASSERT_EQ(count, static_cast<index_t>(s.size()));
+
+  morton_array<int, 2, 2> a(s, 0);
+  for_each_index(s, [&](const std::tuple<index_t, index_t>& i) { a[i] = s[i]; });
+  index_t next = 0;
+  a.for_each_value([&](int x) {
+    ASSERT_LT(next - 1, x);
+    next = x + 1;
+  });
+}
+
+template <size_t Rank, index_t BlockBits, class DenseShape>
+void test_morton_copy(const DenseShape& dense_shape) {
+  array<int, DenseShape> dense(dense_shape);
+  fill_pattern(dense);
+
+  morton_array<int, Rank, BlockBits> morton(morton_shape<Rank, BlockBits>(dense.shape().dims()));
+  copy(dense, morton);
+  check_pattern(morton);
+
+  array<int, DenseShape> dense2(dense_shape);
+  copy(morton, dense2);
+  check_pattern(dense2);
+
+  morton_array<int, Rank, BlockBits> morton2(morton);
+  check_pattern(morton2);
+
+  morton_array<int, Rank, BlockBits + 1> morton3(
+      morton_shape<Rank, BlockBits + 1>(dense.shape().dims()));
+  copy(morton, morton3);
+  check_pattern(morton3);
+}
+
+TEST(morton_copy) {
+  test_morton_copy<2, 4>(dense_shape<2>({2, 50}, {-3, 40}));
+  test_morton_copy<2, 2>(dense_shape<2>(16, 32));
+  test_morton_copy<3, 2>(dense_shape<3>({1, 13}, 9, {-4, 20}));
+}
+
+} // namespace nda
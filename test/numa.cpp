@@ -0,0 +1,137 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "numa.h"
+#include "test.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nda {
+
+TEST(numa_node_count) { ASSERT(numa_node_count() >= 1); }
+
+TEST(numa_allocator) {
+  for (numa_policy policy : {numa_policy::first_touch, numa_policy::interleave}) {
+    numa_array<int, dense_shape<3>> a({{-2, 30}, 20, {1, 10}}, numa_allocator<int>(policy));
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(a.data()) % 4096, 0);
+    fill_pattern(a.ref());
+    check_pattern(a.cref());
+
+    numa_array<int, dense_shape<3>> b(a);
+    check_pattern(b.cref());
+    ASSERT(b.get_allocator().policy() == policy);
+  }
+
+  // Non-trivial types are still constructed.
+  numa_array<std::string, dense_shape<1>> strings({{0, 10}}, "hello");
+  strings(3) = "world";
+  ASSERT_EQ(strings(2), "hello");
+  ASSERT_EQ(strings(3), "world");
+}
+
+TEST(numa_parallel_fill) {
+  dense_array<int, 3> a({7, 11, {-3, 100}}, 0);
+  parallel_fill(a, 3, 10);
+  a.for_each_value([](int x) { ASSERT_EQ(x, 3); });
+
+  // With a pool of 3 workers, the outermost dimension is divided into 4
+  // strips, one for each thread, that cover it without overlapping.
+  thread_pool pool(3);
+  std::mutex mutex;
+  std::vector<interval<>> strips;
+  auto record_strip = [&](const auto& strip) {
+    // The inner dimensions are not divided.
+    ASSERT_EQ(strip.shape().template dim<0>(), a.shape().template dim<0>());
+    ASSERT_EQ(strip.shape().template dim<1>(), a.shape().template dim<1>());
+    const auto& outer = strip.shape().template dim<2>();
+    std::lock_guard<std::mutex> lock(mutex);
+    strips.emplace_back(outer.min(), outer.extent());
+  };
+  internal::for_each_outer_strip(a.ref(), 10, pool, record_strip);
+  ASSERT_EQ(strips.size(), 4);
+  std::sort(strips.begin(), strips.end(),
+      [](const interval<>& l, const interval<>& r) { return l.min() < r.min(); });
+  ASSERT_EQ(strips.front().min(), -3);
+  ASSERT_EQ(strips.back().max(), 96);
+  for (size_t i = 0; i < strips.size(); i++) {
+    ASSERT(strips[i].extent() >= 10);
+    if (i > 0) { ASSERT_EQ(strips[i].min(), strips[i - 1].max() + 1); }
+  }
+
+  // Each strip runs on the same thread in every call, the first one on the
+  // calling thread.
+  std::map<index_t, std::thread::id> strip_threads;
+  for (int n = 0; n < 3; n++) {
+    internal::for_each_outer_strip(a.ref(), 10, pool, [&](const auto& strip) {
+      const index_t min = strip.shape().template dim<2>().min();
+      std::lock_guard<std::mutex> lock(mutex);
+      auto i = strip_threads.emplace(min, std::this_thread::get_id()).first;
+      ASSERT(i->second == std::this_thread::get_id());
+    });
+  }
+  ASSERT_EQ(strip_threads.size(), 4);
+  ASSERT(strip_threads[-3] == std::this_thread::get_id());
+  std::vector<int> cpus;
+  for (int i = 0; i < static_cast<int>(std::thread::hardware_concurrency()); i++) {
+    cpus.push_back(i);
+  }
+#if defined(__linux__)
+  ASSERT(pool.set_worker_affinity(0, cpus));
+#endif
+
+  // A minimum strip size limits the number of strips.
+  strips.clear();
+  internal::for_each_outer_strip(a.ref(), 40, pool, record_strip);
+  ASSERT_EQ(strips.size(), 3);
+
+  // A minimum strip size of 0 or less is treated as 1.
+  dense_array<int, 3> small({7, 11, 2});
+  int small_strips = 0;
+  for (index_t min_strip : {0, -1}) {
+    small_strips = 0;
+    internal::for_each_outer_strip(small.ref(), min_strip, pool, [&](const auto& strip) {
+      std::lock_guard<std::mutex> lock(mutex);
+      small_strips++;
+    });
+    ASSERT_EQ(small_strips, 2);
+  }
+
+  parallel_fill(a, 5, 10, pool);
+  a.for_each_value([](int x) { ASSERT_EQ(x, 5); });
+  std::atomic<int> calls(0);
+  parallel_generate(a.ref(), [&]() { return calls++; }, 10, pool);
+  ASSERT_EQ(static_cast<size_t>(calls), a.size());
+
+  // Each strip calls its own copy of a stateful generator, and the caller's
+  // generator is not modified.
+  std::function<int()> counter = [n = 0]() mutable { return n++; };
+  dense_array<int, 3> c({2, 3, 8});
+  parallel_generate(c, counter, 2, pool);
+  ASSERT_EQ(counter(), 0);
+  for_all_indices(c.shape(), [&](index_t x, index_t y, index_t z) {
+    ASSERT_EQ(c(x, y, z), (z % 2) * 6 + y * 2 + x);
+  });
+
+  auto b = make_numa_array<float>(dense_shape<2>(1000, 1000), 2.0f);
+  b.for_each_value([](float x) { ASSERT_EQ(x, 2.0f); });
+}
+
+} // namespace nda
@@ -0,0 +1,152 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "prefetch.h"
+#include "chunked_array.h"
+#include "test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+namespace nda {
+
+TEST(prefetch_strips) {
+  dense_array<int, 3> a({{-2, 30}, {3, 50}, {0, 4}});
+  for_all_indices(
+      a.shape(), [&](index_t x, index_t y, index_t c) { a(x, y, c) = x + y * 100 + c; });
+
+  for (index_t depth : {1, 2, 5}) {
+    // The last strip is clamped to the shape.
+    index_t y = a.shape().y().min();
+    for (const auto& strip : prefetch_strips<1>(a, split(a.shape().y(), 8), depth)) {
+      ASSERT_EQ(strip.shape().x().min(), a.shape().x().min());
+      ASSERT_EQ(strip.shape().x().extent(), a.shape().x().extent());
+      ASSERT_EQ(strip.shape().y().min(), y);
+      ASSERT_EQ(strip.shape().y().extent(), std::min<index_t>(8, a.shape().y().max() + 1 - y));
+      for_all_indices(strip.shape(), [&](index_t x, index_t y, index_t c) {
+        ASSERT_EQ(strip(x, y, c), a(x, y, c));
+      });
+      y += strip.shape().y().extent();
+    }
+    ASSERT_EQ(y, a.shape().y().max() + 1);
+  }
+
+  // Strips of a transposed array_ref, along the innermost dim of the strips.
+  auto a_t = transpose<1, 0, 2>(a.cref());
+  index_t strips = 0;
+  for (const auto& strip : prefetch_strips<1>(a_t, split<16>(a_t.shape().y()))) {
+    for_all_indices(strip.shape(), [&](index_t y, index_t x, index_t c) {
+      ASSERT_EQ(strip(y, x, c), a(x, y, c));
+    });
+    strips++;
+  }
+  ASSERT_EQ(strips, 2);
+}
+
+TEST(prefetch_chunked_array) {
+  chunked_array<float, 2> a({{0, 100}, {0, 200}}, {32, 32}, -1.0f);
+  a(10, 20) = 1.0f;
+  a(90, 150) = 2.0f;
+  std::vector<dense_shape<2>> tiles = {
+      {{0, 50}, {0, 50}},
+      {{50, 50}, {100, 100}},
+      {{0, 100}, {140, 20}},
+  };
+  const chunked_array<float, 2>& const_a = a;
+  size_t i = 0;
+  for (const auto& tile : prefetch(const_a, tiles)) {
+    ASSERT_EQ(tile.shape().min(), tiles[i].min());
+    ASSERT_EQ(tile.shape().extent(), tiles[i].extent());
+    for_all_indices(tile.shape(), [&](index_t x, index_t y) {
+      ASSERT_EQ(tile(x, y), const_a(x, y));
+    });
+    i++;
+  }
+  ASSERT_EQ(i, tiles.size());
+}
+
+TEST(prefetch_overlap) {
+  const index_t tile_count = 10;
+  std::vector<dense_shape<1>> tiles;
+  for (index_t i = 0; i < tile_count; i++) {
+    tiles.push_back(dense_shape<1>({i * 10, 10}));
+  }
+  // Count the tiles that have been loaded.
+  std::mutex mutex;
+  std::condition_variable cv;
+  index_t loaded = 0;
+  auto load = [&](const array_ref<int, dense_shape<1>>& tile) {
+    for (index_t x : tile.x()) {
+      tile(x) = x;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      loaded++;
+    }
+    cv.notify_all();
+  };
+
+  index_t x = 0;
+  index_t i = 0;
+  for (const auto& tile : prefetched_tiles<int, 1>(tiles, load)) {
+    for (index_t j : tile.x()) {
+      ASSERT_EQ(tile(j), x);
+      x++;
+    }
+    // While this tile is being used, the next tile is loaded into the other
+    // buffer. The timeout only avoids hanging if it is not.
+    const index_t next = std::min(i + 2, tile_count);
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT(cv.wait_for(lock, std::chrono::seconds(10), [&]() { return loaded >= next; }));
+    // There are only 2 buffers, so the loader can't be further ahead.
+    ASSERT_EQ(loaded, next);
+    i++;
+  }
+  ASSERT_EQ(x, tile_count * 10);
+}
+
+TEST(prefetch_errors) {
+  std::vector<dense_shape<1>> tiles(5, dense_shape<1>(10));
+  index_t loaded = 0;
+  auto load = [&](const array_ref<int, dense_shape<1>>& tile) {
+    if (loaded == 3) { throw std::runtime_error("load failed"); }
+    loaded++;
+    fill(tile, 1);
+  };
+
+  // The error is thrown when the tile that failed to load is used.
+  index_t processed = 0;
+  bool threw = false;
+  try {
+    for (const auto& tile : prefetched_tiles<int, 1>(tiles, load)) {
+      ASSERT_EQ(tile(0), 1);
+      processed++;
+    }
+  } catch (const std::runtime_error&) { threw = true; }
+  ASSERT(threw);
+  ASSERT_EQ(processed, 3);
+
+  // Leaving the loop early stops loading tiles.
+  loaded = 0;
+  for (const auto& tile : prefetched_tiles<int, 1>(tiles, load, 2)) {
+    ASSERT_EQ(tile(0), 1);
+    break;
+  }
+  ASSERT(loaded <= 2);
+}
+
+} // namespace nda
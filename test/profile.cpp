@@ -0,0 +1,180 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#define NDARRAY_PROFILE
+#include "ein_reduce.h"
+#include "test.h"
+
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace nda {
+
+namespace {
+
+// The other tests are compiled without NDARRAY_PROFILE. To avoid sharing
+// instantiations of the algorithms with them, use a value type unique to this
+// file.
+struct value {
+  int x = 0;
+
+  value() = default;
+  value(int x) : x(x) {}
+
+  value& operator+=(const value& r) {
+    x += r.x;
+    return *this;
+  }
+  friend value operator*(const value& a, const value& b) { return value(a.x * b.x); }
+  friend bool operator==(const value& a, const value& b) { return a.x == b.x; }
+  friend bool operator!=(const value& a, const value& b) { return a.x != b.x; }
+};
+
+profile::counters get_counters(const char* name, const std::string& shape) {
+  return profile::profiler::global().get_counters()[profile::counters_key(name, shape)];
+}
+
+} // namespace
+
+TEST(profile_counters) {
+  profile::profiler& p = profile::profiler::global();
+  p.reset();
+
+  dense_array<value, 2> a({10, 20});
+  dense_array<value, 2> b({10, 20});
+  fill(a, value(2));
+  fill(b, value(3));
+  copy(a, b);
+  generate(b, []() { return value(1); });
+  int sum = 0;
+  b.for_each_value([&](const value& i) { sum += i.x; });
+  ASSERT_EQ(sum, 200);
+
+  const std::string dense_2d = profile::type_name(typeid(dense_shape<2>));
+  profile::counters fills = get_counters("fill", dense_2d);
+  ASSERT_EQ(fills.calls, 2);
+  ASSERT_EQ(fills.elements, 400);
+  ASSERT_EQ(fills.bytes, 400 * sizeof(value));
+  ASSERT(fills.seconds >= 0.0);
+
+  profile::counters copies = get_counters("copy", dense_2d);
+  ASSERT_EQ(copies.calls, 1);
+  ASSERT_EQ(copies.elements, 200);
+  ASSERT_EQ(copies.bytes, 200 * 2 * sizeof(value));
+
+  ASSERT_EQ(get_counters("generate", dense_2d).calls, 1);
+  // fill and generate should not also be counted as for_each_value.
+  ASSERT_EQ(get_counters("for_each_value", dense_2d).calls, 1);
+
+  // Different shape types are counted separately.
+  dense_array<value, 1> x({{0, 20}}, value(1));
+  dense_array<value, 1> ax({{0, 10}}, value(0));
+  fill(x.ref(), value(4));
+  ASSERT_EQ(get_counters("fill", profile::type_name(typeid(dense_shape<1>))).calls, 1);
+  ASSERT_EQ(get_counters("fill", dense_2d).calls, 2);
+
+  enum { i = 0, j = 1 };
+  ein_reduce(ein<i>(ax) += ein<i, j>(a) * ein<j>(x));
+  ASSERT_EQ(ax(0).x, 2 * 4 * 20);
+  size_t ein_reduce_calls = 0;
+  for (const auto& c : p.get_counters()) {
+    if (c.first.first == "ein_reduce") {
+      ein_reduce_calls += c.second.calls;
+      ASSERT_EQ(c.second.elements, 200);
+      // The bytes are the size of ax, a and x.
+      ASSERT_EQ(c.second.bytes, (10 + 200 + 20) * sizeof(value));
+    }
+  }
+  ASSERT_EQ(ein_reduce_calls, 1);
+
+  std::stringstream report;
+  p.write_report(report);
+  ASSERT(report.str().find("fill [" + dense_2d + "]: 2 calls") != std::string::npos);
+
+  p.reset();
+  ASSERT(p.get_counters().empty());
+}
+
+TEST(profile_threads) {
+  profile::profiler& p = profile::profiler::global();
+  p.reset();
+  p.set_tracing(true);
+
+  // Calls on each thread are recorded separately, and merged when reported.
+  const int thread_count = 4;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; t++) {
+    threads.emplace_back([]() {
+      dense_array<value, 2> a({8, 8});
+      for (int i = 0; i < 10; i++) {
+        fill(a, value(i));
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  p.set_tracing(false);
+
+  profile::counters fills = get_counters("fill", profile::type_name(typeid(dense_shape<2>)));
+  ASSERT_EQ(fills.calls, thread_count * 10);
+  ASSERT_EQ(fills.elements, thread_count * 10 * 64);
+
+  // The events of all threads are in the timeline, in order of time, with a
+  // different id for each thread.
+  std::vector<profile::trace_event> events = p.get_events();
+  ASSERT_EQ(events.size(), thread_count * 10);
+  std::set<size_t> thread_ids;
+  for (size_t i = 0; i < events.size(); i++) {
+    thread_ids.insert(events[i].thread);
+    if (i > 0) { ASSERT(events[i - 1].begin_us <= events[i].begin_us); }
+  }
+  ASSERT_EQ(thread_ids.size(), thread_count);
+
+  p.reset();
+}
+
+TEST(profile_chrome_trace) {
+  profile::profiler& p = profile::profiler::global();
+  p.reset();
+
+  // Calls are only recorded in the timeline when tracing is enabled.
+  dense_array<value, 3> a({4, 5, 6});
+  fill(a, value(1));
+  p.set_tracing(true);
+  fill(a, value(2));
+  copy(a, a);
+  p.set_tracing(false);
+  fill(a, value(3));
+
+  std::stringstream trace;
+  p.write_chrome_trace(trace);
+  const std::string json = trace.str();
+  ASSERT_EQ(json.find("{\"traceEvents\":["), 0);
+  ASSERT(json.find("\"name\":\"fill\"") != std::string::npos);
+  ASSERT(json.find("\"name\":\"copy\"") != std::string::npos);
+  ASSERT(json.find("\"ph\":\"X\"") != std::string::npos);
+  ASSERT(json.find("\"elements\":120") != std::string::npos);
+  size_t events = 0;
+  for (size_t at = json.find("\"ph\""); at != std::string::npos; at = json.find("\"ph\"", at + 1)) {
+    events++;
+  }
+  ASSERT_EQ(events, 2);
+
+  p.reset();
+}
+
+} // namespace nda
@@ -0,0 +1,218 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sparse.h"
+#include "ein_reduce.h"
+#include "test.h"
+
+#include <random>
+
+namespace nda {
+
+namespace {
+
+enum { i = 0, j = 1, k = 2 };
+
+// Make a matrix with about `density` of its elements set to small nonzero
+// integers, so the products below are exact.
+matrix<double> random_sparse(const matrix_shape<>& shape, double density, std::mt19937& rng) {
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::uniform_int_distribution<int> value(1, 9);
+  matrix<double> result(shape, 0.0);
+  for_all_indices(shape, [&](index_t y, index_t x) {
+    if (uniform(rng) < density) { result(y, x) = value(rng); }
+  });
+  // Make one row and one column entirely empty, and one row dense.
+  for (index_t x : shape.j()) {
+    result(shape.i().min() + 1, x) = 0.0;
+    result(shape.i().max(), x) = value(rng);
+  }
+  for (index_t y : shape.i()) {
+    result(y, shape.j().min() + 2) = 0.0;
+  }
+  return result;
+}
+
+template <class T, class Shape>
+void fill_random(const array_ref<T, Shape>& a, std::mt19937& rng) {
+  std::uniform_int_distribution<int> value(-5, 5);
+  generate(a, [&]() { return static_cast<T>(value(rng)); });
+}
+
+} // namespace
+
+TEST(sparse_from_dense) {
+  std::mt19937 rng;
+  matrix<double> dense = random_sparse({{-3, 40}, {5, 30}}, 0.05, rng);
+  index_t nonzeros = 0;
+  dense.for_each_value([&](double x) { nonzeros += x != 0.0 ? 1 : 0; });
+
+  csr_matrix<double> csr(dense);
+  csc_matrix<double> csc(dense);
+  ASSERT_EQ(csr.nonzeros(), nonzeros);
+  ASSERT_EQ(csc.nonzeros(), nonzeros);
+  ASSERT(csr.shape() == csc.shape());
+  ASSERT_EQ(csr.i().min(), -3);
+  ASSERT_EQ(csr.columns(), 30);
+  for_all_indices(dense.shape(), [&](index_t y, index_t x) {
+    ASSERT_EQ(csr(y, x), dense(y, x));
+    ASSERT_EQ(csc(y, x), dense(y, x));
+  });
+
+  // Converting back to a dense matrix makes the same matrix.
+  ASSERT(make_dense_copy(csr) == dense);
+  ASSERT(make_dense_copy(csc) == dense);
+  matrix<double> copied({{-5, 50}, {0, 40}}, 1.0);
+  copy(csc, copied);
+  for_all_indices(copied.shape(), [&](index_t y, index_t x) {
+    ASSERT_EQ(copied(y, x), (dense.shape().is_in_range(y, x) ? dense(y, x) : 0.0));
+  });
+
+  // Converting between formats.
+  csc_matrix<double> csc_from_csr(csr);
+  ASSERT(csc_from_csr.offsets() == csc.offsets());
+  ASSERT(csc_from_csr.indices() == csc.indices());
+  ASSERT(csc_from_csr.values() == csc.values());
+  csr_matrix<double> csr_from_csc(csc);
+  ASSERT(csr_from_csc.indices() == csr.indices());
+  ASSERT(csr_from_csc.values() == csr.values());
+
+  // A transposed matrix refers to the same storage, in the other format.
+  csc_matrix_ref<const double> csr_t = transpose(csr.cref());
+  ASSERT_EQ(csr_t.rows(), csr.columns());
+  for_all_indices(dense.shape(), [&](index_t y, index_t x) { ASSERT_EQ(csr_t(x, y), dense(y, x)); });
+}
+
+TEST(sparse_spmv) {
+  std::mt19937 rng;
+  // Use enough nonzeros for the products to be split into several strips.
+  for (double density : {0.0, 0.01, 0.2}) {
+    matrix<double> dense = random_sparse({{2, 1000}, {-4, 500}}, density, rng);
+    csr_matrix<double> csr(dense);
+    csc_matrix<double> csc(dense);
+    vector<double> x({{-4, 500}});
+    fill_random(x.ref(), rng);
+
+    vector<double> y_ref({{2, 1000}}, 1.0);
+    for_all_indices(dense.shape(), [&](index_t y, index_t z) { y_ref(y) += dense(y, z) * x(z); });
+
+    vector<double> y_csr({{2, 1000}}, 1.0);
+    spmv(csr, x, y_csr);
+    ASSERT(y_csr == y_ref);
+    vector<double> y_csc({{2, 1000}}, 1.0);
+    spmv(csc, x, y_csc);
+    ASSERT(y_csc == y_ref);
+
+    // Use a pool with several threads, regardless of the number of cores.
+    thread_pool pool(3);
+    vector<double> y_csr_mt({{2, 1000}}, 1.0);
+    spmv(csr.cref(), x.cref(), y_csr_mt.ref(), pool);
+    ASSERT(y_csr_mt == y_ref);
+    vector<double> y_csc_mt({{2, 1000}}, 1.0);
+    spmv(csc.cref(), x.cref(), y_csc_mt.ref(), pool);
+    ASSERT(y_csc_mt == y_ref);
+  }
+}
+
+TEST(sparse_spmm) {
+  std::mt19937 rng;
+  matrix<double> dense = random_sparse({{0, 200}, {0, 150}}, 0.05, rng);
+  csr_matrix<double> csr(dense);
+  csc_matrix<double> csc(dense);
+  matrix<double> b({{0, 150}, {-2, 70}});
+  fill_random(b.ref(), rng);
+
+  // Compute some of the columns of b.
+  matrix<double> c_ref({{0, 200}, {0, 60}}, 0.0);
+  for_all_indices(c_ref.shape(), [&](index_t y, index_t x) {
+    for (index_t z : dense.j()) {
+      c_ref(y, x) += dense(y, z) * b(z, x);
+    }
+  });
+
+  thread_pool pool(3);
+  for (thread_pool* p : {&thread_pool::global(), &pool}) {
+    matrix<double> c_csr({{0, 200}, {0, 60}}, 0.0);
+    spmm(csr.cref(), b.cref(), c_csr.ref(), *p);
+    ASSERT(c_csr == c_ref);
+    matrix<double> c_csc({{0, 200}, {0, 60}}, 0.0);
+    spmm(csc.cref(), b.cref(), c_csc.ref(), *p);
+    ASSERT(c_csc == c_ref);
+
+    // The operands can have any strides.
+    matrix<double> c_t({{0, 60}, {0, 200}}, 0.0);
+    spmm(csr.cref(), b.cref(), transpose<1, 0>(c_t.ref()), *p);
+    for_all_indices(c_ref.shape(), [&](index_t y, index_t x) { ASSERT_EQ(c_t(x, y), c_ref(y, x)); });
+  }
+}
+
+TEST(sparse_ein_reduce) {
+  std::mt19937 rng;
+  matrix<double> dense = random_sparse({{0, 50}, {0, 40}}, 0.1, rng);
+  csr_matrix<double> a(dense);
+  csc_matrix<double> a_csc(dense);
+  vector<double> x({{0, 40}});
+  fill_random(x.ref(), rng);
+  vector<double> x_t({{0, 50}});
+  fill_random(x_t.ref(), rng);
+  matrix<double> b({{0, 40}, {0, 30}});
+  fill_random(b.ref(), rng);
+
+  // Compare sparse products to the same products with the dense matrix.
+  vector<double> y_ref({{0, 50}}, 0.0);
+  ein_reduce(ein<i>(y_ref) += ein<i, j>(dense) * ein<j>(x));
+  vector<double> y({{0, 50}}, 0.0);
+  ein_reduce(ein<i>(y) += ein<i, j>(a) * ein<j>(x));
+  ASSERT(y == y_ref);
+  vector<double> y_swapped({{0, 50}}, 0.0);
+  ein_reduce(ein<i>(y_swapped) += ein<j>(x) * ein<i, j>(a_csc));
+  ASSERT(y_swapped == y_ref);
+
+  vector<double> y_t_ref({{0, 40}}, 0.0);
+  ein_reduce(ein<i>(y_t_ref) += ein<j, i>(dense) * ein<j>(x_t));
+  vector<double> y_t({{0, 40}}, 0.0);
+  ein_reduce(ein<i>(y_t) += ein<j, i>(a) * ein<j>(x_t));
+  ASSERT(y_t == y_t_ref);
+
+  // Results that are a subset of the rows of the sparse matrix are computed
+  // by visiting every element.
+  vector<double> y_crop({{10, 20}}, 0.0);
+  ein_reduce(ein<i>(y_crop) += ein<i, j>(a) * ein<j>(x));
+  for (index_t y_i : y_crop.x()) {
+    ASSERT_EQ(y_crop(y_i), y_ref(y_i));
+  }
+
+  matrix<double> c_ref({{0, 50}, {0, 30}}, 0.0);
+  ein_reduce(ein<i, j>(c_ref) += ein<i, k>(dense) * ein<k, j>(b));
+  matrix<double> c({{0, 50}, {0, 30}}, 0.0);
+  ein_reduce(ein<i, j>(c) += ein<i, k>(a) * ein<k, j>(b));
+  ASSERT(c == c_ref);
+  matrix<double> c_csc({{0, 50}, {0, 30}}, 0.0);
+  ein_reduce(ein<i, j>(c_csc) += ein<k, j>(b) * ein<i, k>(a_csc));
+  ASSERT(c_csc == c_ref);
+  matrix<double> c_t({{0, 30}, {0, 50}}, 0.0);
+  ein_reduce(ein<j, i>(c_t) += ein<i, k>(a) * ein<k, j>(b));
+  for_all_indices(c.shape(), [&](index_t y_i, index_t x_j) {
+    ASSERT_EQ(c_t(x_j, y_i), c_ref(y_i, x_j));
+  });
+
+  // Other expressions work too, by visiting every element.
+  vector<double> row_sums_ref({{0, 50}}, 0.0);
+  ein_reduce(ein<i>(row_sums_ref) += ein<i, j>(dense));
+  vector<double> row_sums({{0, 50}}, 0.0);
+  ein_reduce(ein<i>(row_sums) += ein<i, j>(a));
+  ASSERT(row_sums == row_sums_ref);
+}
+
+} // namespace nda
@@ -0,0 +1,177 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stencil.h"
+#include "image.h"
+#include "test.h"
+
+#include <atomic>
+
+namespace nda {
+
+TEST(remap_boundary) {
+  // The interval [2, 6).
+  ASSERT_EQ(internal::remap_boundary(1, 2, 4, boundary::clamp), 2);
+  ASSERT_EQ(internal::remap_boundary(8, 2, 4, boundary::clamp), 5);
+  ASSERT_EQ(internal::remap_boundary(1, 2, 4, boundary::mirror), 3);
+  ASSERT_EQ(internal::remap_boundary(-1, 2, 4, boundary::mirror), 5);
+  ASSERT_EQ(internal::remap_boundary(6, 2, 4, boundary::mirror), 4);
+  ASSERT_EQ(internal::remap_boundary(9, 2, 4, boundary::mirror), 3);
+  ASSERT_EQ(internal::remap_boundary(1, 2, 4, boundary::wrap), 5);
+  ASSERT_EQ(internal::remap_boundary(-3, 2, 4, boundary::wrap), 5);
+  ASSERT_EQ(internal::remap_boundary(7, 2, 4, boundary::wrap), 3);
+  ASSERT_EQ(internal::remap_boundary(1, 2, 4, boundary::constant), 1);
+  ASSERT_EQ(internal::remap_boundary(4, 2, 4, boundary::constant), 4);
+}
+
+TEST(parallel_for) {
+  dense_array<int, 1> visited({{-3, 1000}}, 0);
+  std::atomic<int> calls(0);
+  parallel_for(interval<>(-3, 1000), 10, [&](const interval<>& strip) {
+    ASSERT(strip.extent() >= 10);
+    for (index_t i : strip) {
+      visited(i)++;
+    }
+    calls++;
+  });
+  for (index_t i : visited.x()) {
+    ASSERT_EQ(visited(i), 1);
+  }
+  ASSERT(calls >= 1);
+
+  // Nested parallel loops should not deadlock.
+  std::atomic<int> total(0);
+  parallel_for(interval<>(0, 8), [&](const interval<>& outer) {
+    for (index_t i = 0; i < outer.extent(); i++) {
+      parallel_for(interval<>(0, 10), [&](const interval<>& inner) { total += inner.extent(); });
+    }
+  });
+  ASSERT_EQ(total, 80);
+}
+
+template <class TIn, class ShapeIn, class TK, class ShapeK, class TOut, class ShapeOut>
+void stencil_reference(const array_ref<TIn, ShapeIn>& input, const array_ref<TK, ShapeK>& kernel,
+    const array_ref<TOut, ShapeOut>& output, boundary b, std::remove_const_t<TIn> constant) {
+  for_all_indices(output.shape(), [&](index_t x, index_t y) {
+    double sum = 0;
+    for_all_indices(kernel.shape(), [&](index_t dx, index_t dy) {
+      sum += kernel(dx, dy) * internal::sample_boundary(input, x + dx, y + dy, b, constant);
+    });
+    output(x, y) = sum;
+  });
+}
+
+template <class Input, class Output>
+void check_close(const Input& a, const Output& b) {
+  for_each_index(a.shape(), [&](const typename Input::index_type& i) {
+    ASSERT_LT(std::abs(a[i] - b[i]), 1e-3f) << "i=" << i;
+  });
+}
+
+const boundary all_boundaries[] = {
+    boundary::clamp, boundary::mirror, boundary::constant, boundary::wrap};
+
+TEST(stencil) {
+  dense_array<float, 2> input({{-2, 37}, {3, 29}});
+  for_all_indices(input.shape(), [&](index_t x, index_t y) {
+    input(x, y) = static_cast<float>((x * 7919 + y * 31) % 101) - 50.0f;
+  });
+
+  // An asymmetric kernel, with some taps that are out of bounds for any output.
+  dense_array<float, 2> kernel({{-2, 4}, {-1, 3}});
+  fill_pattern(kernel);
+
+  for (boundary b : all_boundaries) {
+    // Compute outputs that are larger than the input, so all of the boundary
+    // handling is exercised.
+    dense_array<float, 2> output({{-5, 45}, {0, 36}});
+    dense_array<float, 2> reference(output.shape());
+    stencil(input, kernel, output, b, 3.0f);
+    stencil_reference(input.cref(), kernel.cref(), reference.ref(), b, 3.0f);
+    check_close(output, reference);
+
+    // The input is not dense in x.
+    auto input_t = transpose<1, 0>(input);
+    auto output_t = transpose<1, 0>(output);
+    stencil(input_t.cref(), transpose<1, 0>(kernel).cref(), output_t, b, 3.0f);
+    check_close(output, reference);
+  }
+}
+
+TEST(separable_stencil) {
+  dense_array<float, 2> input({{1, 75}, {-4, 20}});
+  for_all_indices(input.shape(), [&](index_t x, index_t y) {
+    input(x, y) = static_cast<float>((x * 104729 + y * 7) % 89) - 40.0f;
+  });
+
+  dense_array<float, 1> kernel_x({{-3, 7}});
+  dense_array<float, 1> kernel_y({{-1, 2}});
+  fill_pattern(kernel_x);
+  fill_pattern(kernel_y, 2);
+  dense_array<float, 2> kernel({{-3, 7}, {-1, 2}});
+  for_all_indices(
+      kernel.shape(), [&](index_t x, index_t y) { kernel(x, y) = kernel_x(x) * kernel_y(y); });
+
+  for (boundary b : all_boundaries) {
+    dense_array<float, 2> output({{0, 80}, {-6, 26}});
+    dense_array<float, 2> reference(output.shape());
+    separable_stencil(input, kernel_x, kernel_y, output, b, -1.0f);
+    stencil_reference(input.cref(), kernel.cref(), reference.ref(), b, -1.0f);
+    check_close(output, reference);
+  }
+}
+
+TEST(stencil_image) {
+  chunky_image<float, 3> input({30, 20, 3});
+  fill_pattern(input);
+  planar_image<float> output({30, 20, 3});
+
+  // A 3x3 box filter.
+  dense_array<float, 2> box({{-1, 3}, {-1, 3}}, 1.0f / 9.0f);
+  stencil(input.cref(), box.cref(), output.ref(), boundary::clamp);
+
+  dense_array<float, 1> box_1d({{-1, 3}}, 1.0f / 3.0f);
+  planar_image<float> output_separable({30, 20, 3});
+  separable_stencil(input.cref(), box_1d.cref(), box_1d.cref(), output_separable.ref());
+
+  for (index_t c = 0; c < 3; c++) {
+    dense_array<float, 2> reference({30, 20});
+    stencil_reference(input(_, _, c), box.cref(), reference.ref(), boundary::clamp, 0.0f);
+    check_close(reference, output(_, _, c));
+    check_close(reference, output_separable(_, _, c));
+  }
+}
+
+TEST(stencil_integer) {
+  dense_array<uint8_t, 2> input({64, 48});
+  fill_pattern(input);
+  // Sobel operator.
+  dense_array<int, 2> sobel({{-1, 3}, {-1, 3}});
+  const int sobel_x[] = {-1, 0, 1, -2, 0, 2, -1, 0, 1};
+  for_all_indices(sobel.shape(),
+      [&](index_t x, index_t y) { sobel(x, y) = sobel_x[(y + 1) * 3 + x + 1]; });
+  dense_array<int, 2> output({64, 48});
+  stencil(input, sobel, output, boundary::mirror);
+
+  for_all_indices(output.shape(), [&](index_t x, index_t y) {
+    int expected = 0;
+    for_all_indices(sobel.shape(), [&](index_t dx, index_t dy) {
+      expected += sobel(dx, dy) *
+                  internal::sample_boundary(input.cref(), x + dx, y + dy, boundary::mirror, 0);
+    });
+    ASSERT_EQ(output(x, y), expected);
+  });
+}
+
+} // namespace nda